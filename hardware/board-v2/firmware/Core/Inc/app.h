@@ -23,10 +23,40 @@
 
 #define ERROR_SHORT_ANSWER 1
 #define ERROR_WRONG_ANSWER 2
+#define ERROR_QUEUE_FULL 3
 
 #include "stm32f070xb.h"
 
 #define MOTOR_RX_SIZE 32
+
+// Modbus transactions with the motor controller.
+// motor_loop never waits: it sends a request, returns, and checks the answer
+// collected by the UART interrupt on the next calls.
+#define MOTOR_QUEUE_SIZE 4
+#define MOTOR_ANSWER_TIMEOUT_MS 50
+#define MOTOR_MAX_RETRIES 2
+// Modbus RTU needs 3.5 characters of silence between frames, 4ms at 9600
+#define MOTOR_FRAME_GAP_MS 5
+// The desired state is sent again after this time without requests
+#define MOTOR_REFRESH_MS 2000
+
+#define MOTOR_FRAME_SIZE 8
+#define MOTOR_READ_ANSWER_SIZE 7
+#define MOTOR_EXCEPTION_ANSWER_SIZE 5
+
+#define MOTOR_REQ_STOP 1
+#define MOTOR_REQ_START 2
+#define MOTOR_REQ_SPEED 3
+#define MOTOR_REQ_INFO 4
+
+#define MOTOR_TRANSACTION_IDLE 0
+#define MOTOR_TRANSACTION_WAITING 1
+
+typedef struct motor_request_s {
+	uint8_t kind;
+	uint8_t speed;
+} motor_request;
+
 typedef struct motor_full_status_s {
 	uint8_t is_in_use; // indicates whether motor is in use;
 	uint8_t current_status; // running or stopped
@@ -34,9 +64,24 @@ typedef struct motor_full_status_s {
 	uint8_t desired_status; // running or stopped
 	uint8_t desired_speed; //0 to 100
 	char rx_buffer[MOTOR_RX_SIZE + 1];
-	uint8_t rx_buffer_cursor;
-	uint16_t inactive_loops;
+	volatile uint8_t rx_buffer_cursor; // moved by the UART interrupt
 	uint8_t communication_status;
+
+	// requests waiting to be sent, the first one is in flight when WAITING
+	motor_request queue[MOTOR_QUEUE_SIZE];
+	uint8_t queue_head;
+	uint8_t queue_len;
+	uint8_t transaction_state;
+	uint8_t attempt;
+	char tx_frame[MOTOR_FRAME_SIZE];
+	uint32_t sent_at;
+	uint32_t idle_since;
+	uint32_t last_request_at;
+
+	// counters for diagnostics
+	uint16_t timeouts;
+	uint16_t retries;
+	uint16_t failures;
 } motor_full_status;
 
 typedef struct hw_settings_s {
@@ -95,13 +140,13 @@ void app_decode_set(const char * cmd);
 void app_decode_ping(const char * cmd);
 void app_decode_run(const char *cmd);
 
-// returns error
+// queue a request, returns error
 uint8_t app_stop_motor();
-// returns error
+// queue a request, returns error
 uint8_t app_start_motor();
-// returns error
+// queue a request, returns error
 uint8_t app_set_motor_speed(uint8_t desired_speed);
-// returns error
+// queue a request, returns error
 uint8_t app_get_motor_info();
 
 void app_push_motor_byte(uint8_t key);
@@ -93,59 +93,27 @@ uint8_t status_by_error(uint8_t err) {
 uint8_t get_motor_communication_status() {
 	return motor_status.communication_status;
 }
-// motor_loop returns an error
-uint8_t motor_loop() {
-	// Let it start once per 1 ms
-	motor_status.inactive_loops++;
 
-	if (motor_status.desired_status == MOTOR_STATUS_STOPPED) {
-		if(motor_status.current_status == MOTOR_STATUS_RUNNING) {
-			motor_status.inactive_loops = 0;
-			uint8_t err = app_stop_motor();
-			if (!err) {
-				motor_status.current_status = MOTOR_STATUS_STOPPED;
-			}
-			motor_status.communication_status = status_by_error(err);
-		}
-	} else {
-		uint8_t desired_speed = motor_status.desired_speed;
-		if (motor_status.current_speed != desired_speed) {
-			motor_status.inactive_loops = 0;
-			uint8_t err = app_set_motor_speed(desired_speed);
-			motor_status.communication_status = status_by_error(err);
-			if (err) return err;
-			motor_status.current_speed = desired_speed;
-		}
-		if (motor_status.current_status == MOTOR_STATUS_STOPPED) {
-			motor_status.inactive_loops = 0;
-			uint8_t err = app_start_motor();
-			motor_status.communication_status = status_by_error(err);
-			if (err) {
-				return err;
-			}
-		}
-	}
-	if (motor_status.inactive_loops > 2000) {
-		motor_status.inactive_loops = 0;
-		if (motor_status.is_in_use) {
-			if(motor_status.desired_status == MOTOR_STATUS_STOPPED) {
-				uint8_t err = app_stop_motor();
-				motor_status.communication_status = status_by_error(err);
-			} else {
-				uint8_t err = app_set_motor_speed(motor_status.desired_speed);
-				motor_status.communication_status = status_by_error(err);
-				if (err) return err;
-				err = app_start_motor();
-				motor_status.communication_status = status_by_error(err);
-			}
-		} else {
-			uint8_t err = app_get_motor_info();
-			motor_status.communication_status = status_by_error(err);
-		}
+motor_full_status * get_motor_status() {
+	return &motor_status;
+}
+
+uint8_t motor_queue_push(uint8_t kind, uint8_t speed) {
+	if (motor_status.queue_len >= MOTOR_QUEUE_SIZE) {
+		return ERROR_QUEUE_FULL;
 	}
+	uint8_t pos = (motor_status.queue_head + motor_status.queue_len) % MOTOR_QUEUE_SIZE;
+	motor_status.queue[pos].kind = kind;
+	motor_status.queue[pos].speed = speed;
+	motor_status.queue_len++;
 	return 0;
 }
 
+void motor_queue_pop() {
+	motor_status.queue_head = (motor_status.queue_head + 1) % MOTOR_QUEUE_SIZE;
+	motor_status.queue_len--;
+}
+
 void send_rs_485_command(const char *cmd, uint8_t size) {
 	motor_status.rx_buffer_cursor = 0;
 	rs485_write_data(cmd, size);
@@ -160,60 +128,153 @@ uint8_t are_equal(const char * src1, const char * src2, uint8_t size) {
 	return 1;
 }
 
-uint8_t send_generic_cmd(const char *cur_cmd) {
-	send_rs_485_command(cur_cmd, 8);
-	uint8_t max_delay = 50;
-	for (;max_delay > 0 && motor_status.rx_buffer_cursor<8;) {
-		max_delay--;
-		just_sleep_for_ms(1);
-	}
-	if(motor_status.rx_buffer_cursor < 8) {
-		return ERROR_SHORT_ANSWER;
+// sends the first queued request, its frame is kept for retries
+void motor_send_request(uint32_t now) {
+	motor_request * req = &motor_status.queue[motor_status.queue_head];
+	if (motor_status.attempt == 0) {
+		char * cmd;
+		if (req->kind == MOTOR_REQ_STOP) {
+			cmd = stop_motor_cmd();
+		} else if (req->kind == MOTOR_REQ_START) {
+			cmd = start_motor_cmd();
+		} else if (req->kind == MOTOR_REQ_SPEED) {
+			cmd = set_motor_speed_cmd(req->speed);
+		} else {
+			cmd = read_motor_info_cmd();
+		}
+		cp(cmd, motor_status.tx_frame, MOTOR_FRAME_SIZE);
 	}
-	if(!are_equal(cur_cmd, motor_status.rx_buffer, 8)) {
+	motor_status.transaction_state = MOTOR_TRANSACTION_WAITING;
+	motor_status.sent_at = now;
+	motor_status.last_request_at = now;
+	send_rs_485_command(motor_status.tx_frame, MOTOR_FRAME_SIZE);
+}
+
+#define MOTOR_ANSWER_PENDING 0xff
+// returns MOTOR_ANSWER_PENDING until the whole answer is received, then error
+uint8_t motor_check_answer() {
+	uint8_t cursor = motor_status.rx_buffer_cursor;
+	if (cursor >= 2 && (motor_status.rx_buffer[1] & 0x80)) {
+		// modbus exception
+		if (cursor < MOTOR_EXCEPTION_ANSWER_SIZE) return MOTOR_ANSWER_PENDING;
 		return ERROR_WRONG_ANSWER;
 	}
+	if (motor_status.queue[motor_status.queue_head].kind == MOTOR_REQ_INFO) {
+		if (cursor < MOTOR_READ_ANSWER_SIZE) return MOTOR_ANSWER_PENDING;
+		// We need to parse read info, right now we can just compare first two bytes
+		if (!are_equal(motor_status.tx_frame, motor_status.rx_buffer, 2)) return ERROR_WRONG_ANSWER;
+		return 0;
+	}
+	// write commands are echoed back
+	if (cursor < MOTOR_FRAME_SIZE) return MOTOR_ANSWER_PENDING;
+	if (!are_equal(motor_status.tx_frame, motor_status.rx_buffer, MOTOR_FRAME_SIZE)) return ERROR_WRONG_ANSWER;
 	return 0;
 }
 
-uint8_t send_read_cmd(const char *cur_cmd) {
-	send_rs_485_command(cur_cmd, 8);
-	uint8_t max_delay = 50;
-	for (;max_delay > 0 && motor_status.rx_buffer_cursor<6;) {
-		max_delay--;
-		just_sleep_for_ms(1);
+void motor_apply_answer(motor_request * req) {
+	if (req->kind == MOTOR_REQ_STOP) {
+		motor_status.current_status = MOTOR_STATUS_STOPPED;
+	} else if (req->kind == MOTOR_REQ_START) {
+		motor_status.current_status = MOTOR_STATUS_RUNNING;
+	} else if (req->kind == MOTOR_REQ_SPEED) {
+		motor_status.current_speed = req->speed;
 	}
-	if(motor_status.rx_buffer_cursor < 6) {
-		return ERROR_SHORT_ANSWER;
+}
+
+// queues the requests needed to bring the motor to the desired state
+void motor_plan_requests(uint32_t now) {
+	if (motor_status.desired_status == MOTOR_STATUS_STOPPED) {
+		if (motor_status.current_status == MOTOR_STATUS_RUNNING) {
+			app_stop_motor();
+		}
+	} else {
+		if (motor_status.current_speed != motor_status.desired_speed) {
+			app_set_motor_speed(motor_status.desired_speed);
+		}
+		if (motor_status.current_status == MOTOR_STATUS_STOPPED) {
+			app_start_motor();
+		}
 	}
-	// We need to parse read info, right now we can just compare first two bytes
-	if(!are_equal(cur_cmd, motor_status.rx_buffer, 2)) {
-		return ERROR_WRONG_ANSWER;
+	if (motor_status.queue_len || now - motor_status.last_request_at <= MOTOR_REFRESH_MS) {
+		return;
+	}
+	// nothing to do for a while, so repeat the state in case the inverter was reset
+	if (motor_status.is_in_use) {
+		if (motor_status.desired_status == MOTOR_STATUS_STOPPED) {
+			app_stop_motor();
+		} else {
+			app_set_motor_speed(motor_status.desired_speed);
+			app_start_motor();
+		}
+	} else {
+		app_get_motor_info();
+	}
+}
+
+// motor_loop returns an error of a request given up during this call.
+// It is called every 1 ms and never waits for the motor.
+uint8_t motor_loop() {
+	uint32_t now = get_tick();
+
+	if (motor_status.transaction_state == MOTOR_TRANSACTION_WAITING) {
+		uint8_t err = motor_check_answer();
+		if (err == MOTOR_ANSWER_PENDING) {
+			if (now - motor_status.sent_at < MOTOR_ANSWER_TIMEOUT_MS) {
+				return 0;
+			}
+			motor_status.timeouts++;
+			err = ERROR_SHORT_ANSWER;
+		}
+		motor_status.transaction_state = MOTOR_TRANSACTION_IDLE;
+		motor_status.idle_since = now;
+		if (!err) {
+			motor_status.communication_status = MOTOR_OK;
+			motor_apply_answer(&motor_status.queue[motor_status.queue_head]);
+			motor_queue_pop();
+			motor_status.attempt = 0;
+		} else if (motor_status.attempt < MOTOR_MAX_RETRIES) {
+			// the same frame goes out again after the gap
+			motor_status.attempt++;
+			motor_status.retries++;
+		} else {
+			// following requests depend on this one, e.g. start after speed
+			motor_status.failures++;
+			motor_status.communication_status = status_by_error(err);
+			motor_status.queue_len = 0;
+			motor_status.attempt = 0;
+			return err;
+		}
+	}
+
+	if (now - motor_status.idle_since < MOTOR_FRAME_GAP_MS) {
+		return 0;
+	}
+	if (!motor_status.queue_len) {
+		motor_plan_requests(now);
+	}
+	if (motor_status.queue_len) {
+		motor_send_request(now);
 	}
 	return 0;
 }
 
 // returns error
 uint8_t app_stop_motor(){
-	char * cur_cmd = stop_motor_cmd();
-	return send_generic_cmd(cur_cmd);
+	return motor_queue_push(MOTOR_REQ_STOP, 0);
 }
 
 // returns error
 uint8_t app_set_motor_speed(uint8_t desired_speed) {
-	char * cur_cmd = set_motor_speed_cmd(desired_speed);
-	return send_generic_cmd(cur_cmd);
+	return motor_queue_push(MOTOR_REQ_SPEED, desired_speed);
 }
 
 // returns error
 uint8_t app_start_motor() {
-	char * cur_cmd = start_motor_cmd();
-	return send_generic_cmd(cur_cmd);
+	return motor_queue_push(MOTOR_REQ_START, 0);
 }
 
 uint8_t app_get_motor_info() {
-	char * cur_cmd = read_motor_info_cmd();
-	return send_read_cmd(cur_cmd);
+	return motor_queue_push(MOTOR_REQ_INFO, 0);
 }
 
 void app_push_motor_byte(uint8_t key) {
@@ -235,8 +296,17 @@ void zero_motor_settings() {
 	motor_status.current_status = MOTOR_STATUS_STOPPED;
 	motor_status.desired_status = MOTOR_STATUS_STOPPED;
 	motor_status.rx_buffer_cursor = 0;
-	motor_status.inactive_loops = 0;
 	motor_status.communication_status = MOTOR_NOT_ANSWERING;
+	motor_status.queue_head = 0;
+	motor_status.queue_len = 0;
+	motor_status.transaction_state = MOTOR_TRANSACTION_IDLE;
+	motor_status.attempt = 0;
+	motor_status.sent_at = 0;
+	motor_status.idle_since = 0;
+	motor_status.last_request_at = 0;
+	motor_status.timeouts = 0;
+	motor_status.retries = 0;
+	motor_status.failures = 0;
 }
 
 void app_init() {
@@ -0,0 +1,155 @@
+/*
+ * motor_loop_test.c
+ *
+ *  Host test of the motor Modbus transactions in app.c.
+ *  Build and run with `make` in this directory.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "app.h"
+#include "shared.h"
+
+uint32_t fake_tick = 3000;
+char sent[16][MOTOR_FRAME_SIZE];
+int sent_count = 0;
+int failed = 0;
+
+uint32_t flash_read() {
+	return 0x00000100;
+}
+
+void flash_write(uint32_t data) {
+}
+
+uint32_t get_fake_tick() {
+	return fake_tick;
+}
+
+void fake_rs485_write(const char * cmd, int size) {
+	if (sent_count < 16) {
+		memcpy(sent[sent_count], cmd, MOTOR_FRAME_SIZE);
+	}
+	sent_count++;
+}
+
+void fail_on_sleep(uint32_t ms) {
+	printf("motor_loop must not sleep\n");
+	failed = 1;
+}
+
+void fake_send_data(const char * data, int size) {
+}
+
+void fake_relay(uint8_t key) {
+}
+
+void check(int condition, const char * message) {
+	if (!condition) {
+		printf("failed: %s\n", message);
+		failed = 1;
+	}
+}
+
+void answer(const char * frame, int size) {
+	for (int i = 0; i < size; i++) {
+		app_push_motor_byte((uint8_t)frame[i]);
+	}
+}
+
+void run_ms(int ms) {
+	for (int i = 0; i < ms; i++) {
+		motor_loop();
+		fake_tick++;
+	}
+}
+
+void reset() {
+	app_init();
+	sent_count = 0;
+}
+
+void test_speed_then_start() {
+	reset();
+	app_set_desired_motor_speed(50);
+	run_ms(1);
+	check(sent_count == 1, "speed request is sent at once");
+	check(sent[0][1] == 0x06 && sent[0][3] == 0x01, "first request sets speed");
+	run_ms(10);
+	check(sent_count == 1, "next request waits for the answer");
+
+	answer(sent[0], MOTOR_FRAME_SIZE);
+	run_ms(1);
+	check(get_motor_status()->current_speed == 50, "speed is applied on answer");
+	run_ms(MOTOR_FRAME_GAP_MS);
+	check(sent_count == 2, "queued start follows after the frame gap");
+	check(sent[1][3] == 0x00 && sent[1][5] == 0x05, "second request starts the motor");
+
+	answer(sent[1], MOTOR_FRAME_SIZE);
+	run_ms(MOTOR_FRAME_GAP_MS + 10);
+	check(get_motor_status()->current_status == MOTOR_STATUS_RUNNING, "motor is running");
+	check(get_motor_communication_status() == MOTOR_OK, "communication is ok");
+	check(sent_count == 2, "nothing is sent once the state is reached");
+}
+
+void test_timeout_and_retries() {
+	reset();
+	app_set_desired_motor_speed(30);
+	run_ms(1 + (MOTOR_MAX_RETRIES + 1) * (MOTOR_ANSWER_TIMEOUT_MS + MOTOR_FRAME_GAP_MS));
+	motor_full_status * st = get_motor_status();
+	check(st->retries == MOTOR_MAX_RETRIES, "request is retried");
+	check(st->failures == 1, "request is given up after retries");
+	check(st->timeouts == MOTOR_MAX_RETRIES + 1, "every attempt timed out");
+	check(get_motor_communication_status() == MOTOR_NOT_ANSWERING, "motor is not answering");
+	check(memcmp(sent[0], sent[1], MOTOR_FRAME_SIZE) == 0, "retry repeats the frame");
+}
+
+void test_wrong_answer() {
+	reset();
+	app_set_desired_motor_speed(40);
+	run_ms(1);
+	char bad[MOTOR_FRAME_SIZE];
+	memcpy(bad, sent[0], MOTOR_FRAME_SIZE);
+	bad[5] ^= 0x01;
+	for (int i = 0; i <= MOTOR_MAX_RETRIES; i++) {
+		answer(bad, MOTOR_FRAME_SIZE);
+		run_ms(MOTOR_FRAME_GAP_MS + 1);
+	}
+	check(get_motor_status()->failures == 1, "wrong answers are given up");
+	check(get_motor_communication_status() == MOTOR_WRONG_ANSWERS, "wrong answers are reported");
+	check(get_motor_status()->current_status == MOTOR_STATUS_STOPPED, "start is not sent after failed speed");
+}
+
+void test_refresh_reads_info() {
+	reset();
+	run_ms(1);
+	check(sent_count == 1 && sent[0][1] == 0x03, "idle motor is polled with a read");
+	char info[MOTOR_READ_ANSWER_SIZE] = {0x01, 0x03, 0x02, 0x00, 0x01, 0x00, 0x00};
+	answer(info, MOTOR_READ_ANSWER_SIZE);
+	run_ms(MOTOR_REFRESH_MS);
+	check(sent_count == 1, "no polling before the refresh time");
+	run_ms(MOTOR_FRAME_GAP_MS + 1);
+	check(sent_count == 2, "idle motor is polled again");
+}
+
+int main() {
+	set_rs485_write(fake_rs485_write);
+	set_tick_func(get_fake_tick);
+	set_sleep_func(fail_on_sleep);
+	set_app_send_data(fake_send_data);
+	set_turn_on_func(fake_relay);
+	set_turn_off_func(fake_relay);
+
+	test_speed_then_start();
+	test_timeout_and_retries();
+	test_wrong_answer();
+	test_refresh_reads_info();
+
+	if (failed) {
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
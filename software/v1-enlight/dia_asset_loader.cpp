@@ -0,0 +1,219 @@
+#include "dia_asset_loader.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <SDL_image.h>
+
+#include "dia_functions.h"
+
+static double DiaAssetLoader_NowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// What SDL_DisplayFormat or SDL_DisplayFormatAlpha and then
+// DiaScreenItemImage::Rescale do, but without touching the screen.
+static void DiaAssetLoader_Run(DiaAssetLoader *loader, DiaAssetJob *job) {
+    double start = DiaAssetLoader_NowMs();
+    SDL_Surface *tmpImg = IMG_Load(job->Path.c_str());
+    double decoded = DiaAssetLoader_NowMs();
+    if (tmpImg) {
+        Uint32 flags;
+        SDL_Surface *probe;
+        if (tmpImg->format->Amask == 0) {
+            probe = loader->OpaqueProbe;
+            flags = tmpImg->flags & (SDL_SRCCOLORKEY | SDL_SRCALPHA | SDL_RLEACCELOK);
+        } else {
+            probe = loader->AlphaProbe;
+            flags = tmpImg->flags & (SDL_SRCALPHA | SDL_RLEACCELOK);
+        }
+        job->Picture = SDL_ConvertSurface(tmpImg, probe->format, flags | SDL_SWSURFACE);
+        SDL_FreeSurface(tmpImg);
+    }
+    double converted = DiaAssetLoader_NowMs();
+    if (job->Picture && job->Width && job->Height &&
+        (job->Picture->w != job->Width || job->Picture->h != job->Height)) {
+        job->Scaled = dia_ScaleSurface(job->Picture, job->Width, job->Height);
+    }
+    double scaled = DiaAssetLoader_NowMs();
+
+    pthread_mutex_lock(&loader->StatLock);
+    loader->Stat.pictures++;
+    if (!job->Picture) {
+        loader->Stat.failed++;
+    }
+    loader->Stat.decode_ms += decoded - start;
+    loader->Stat.convert_ms += converted - decoded;
+    loader->Stat.scale_ms += scaled - converted;
+    pthread_mutex_unlock(&loader->StatLock);
+}
+
+static void *DiaAssetLoader_Worker(void *arg) {
+    DiaAssetLoader *loader = (DiaAssetLoader *)arg;
+    DiaAssetJob *job;
+    while (loader->Jobs.Pop(&job, CHANNEL_WAIT_FOREVER) == CHANNEL_NOERROR) {
+        DiaAssetLoader_Run(loader, job);
+        loader->Done.Push(job);
+    }
+    return NULL;
+}
+
+int DiaAssetLoader_Start(DiaAssetLoader *loader) {
+    if (!loader) {
+        return ASSET_LOADER_NULL_PARAMETER;
+    }
+    // SDL_DisplayFormat(Alpha) of a tiny picture, the only calls which need
+    // the screen.
+    SDL_Surface *probe = SDL_CreateRGBSurface(SDL_SWSURFACE, 1, 1, 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000);
+    if (!probe || !SDL_GetVideoSurface()) {
+        if (probe) {
+            SDL_FreeSurface(probe);
+        }
+        return ASSET_LOADER_NO_VIDEO;
+    }
+    loader->OpaqueProbe = SDL_DisplayFormat(probe);
+    loader->AlphaProbe = SDL_DisplayFormatAlpha(probe);
+    SDL_FreeSurface(probe);
+    if (!loader->OpaqueProbe || !loader->AlphaProbe) {
+        return ASSET_LOADER_NO_VIDEO;
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cores > 1 ? cores - 1 : 0;
+    if (workers > ASSET_LOADER_MAX_WORKERS) {
+        workers = ASSET_LOADER_MAX_WORKERS;
+    }
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&loader->Workers[loader->WorkersCount], NULL, DiaAssetLoader_Worker, loader) != 0) {
+            break;
+        }
+        loader->WorkersCount++;
+    }
+    loader->Stat.workers = loader->WorkersCount;
+    loader->Started = 1;
+    return ASSET_LOADER_NO_ERROR;
+}
+
+int DiaAssetLoader_Submit(DiaAssetLoader *loader, DiaAssetJob *job) {
+    if (!loader || !job) {
+        return ASSET_LOADER_NULL_PARAMETER;
+    }
+    if (!loader->Started || loader->Finished) {
+        return ASSET_LOADER_NOT_STARTED;
+    }
+    loader->Submitted.push_back(job);
+    loader->Jobs.Push(job);
+    return ASSET_LOADER_NO_ERROR;
+}
+
+static void DiaAssetLoader_ToDisplay(SDL_Surface **surface) {
+    if (!*surface) {
+        return;
+    }
+    SDL_Surface *converted = (*surface)->format->Amask ? SDL_DisplayFormatAlpha(*surface) : SDL_DisplayFormat(*surface);
+    if (converted) {
+        SDL_FreeSurface(*surface);
+        *surface = converted;
+    }
+}
+
+// Video memory surfaces can only be made on the main thread.
+static int DiaAssetLoader_Hardware() {
+    const SDL_VideoInfo *info = SDL_GetVideoInfo();
+    return info && info->blit_hw;
+}
+
+static void DiaAssetLoader_Apply(DiaAssetJob *job, int hardware) {
+    if (hardware) {
+        DiaAssetLoader_ToDisplay(&job->Picture);
+        DiaAssetLoader_ToDisplay(&job->Scaled);
+    }
+    job->Apply(job);
+    delete job;
+}
+
+int DiaAssetLoader_Finish(DiaAssetLoader *loader) {
+    if (!loader) {
+        return ASSET_LOADER_NULL_PARAMETER;
+    }
+    if (!loader->Started || loader->Finished) {
+        return ASSET_LOADER_NOT_STARTED;
+    }
+    loader->Finished = 1;
+
+    double start = DiaAssetLoader_NowMs();
+    loader->Jobs.Close();
+    DiaAssetJob *job;
+    while (loader->Jobs.Pop(&job) == CHANNEL_NOERROR) {
+        DiaAssetLoader_Run(loader, job);
+    }
+    for (int i = 0; i < loader->WorkersCount; i++) {
+        pthread_join(loader->Workers[i], NULL);
+    }
+    loader->WorkersCount = 0;
+    // All of them are in Submitted as well
+    while (loader->Done.Pop(&job) == CHANNEL_NOERROR) {
+    }
+    double waited = DiaAssetLoader_NowMs();
+
+    int hardware = DiaAssetLoader_Hardware();
+    for (size_t i = 0; i < loader->Submitted.size(); i++) {
+        DiaAssetLoader_Apply(loader->Submitted[i], hardware);
+    }
+    loader->Submitted.clear();
+
+    pthread_mutex_lock(&loader->StatLock);
+    loader->Stat.wait_ms = waited - start;
+    loader->Stat.finish_ms = DiaAssetLoader_NowMs() - waited;
+    pthread_mutex_unlock(&loader->StatLock);
+    return ASSET_LOADER_NO_ERROR;
+}
+
+int DiaAssetLoader_Poll(DiaAssetLoader *loader) {
+    if (!loader || !loader->Started || loader->Finished) {
+        return 0;
+    }
+    DiaAssetJob *job;
+    if (loader->WorkersCount == 0 && loader->Jobs.Pop(&job) == CHANNEL_NOERROR) {
+        DiaAssetLoader_Run(loader, job);
+        loader->Done.Push(job);
+    }
+    int hardware = DiaAssetLoader_Hardware();
+    while (loader->Done.Pop(&job) == CHANNEL_NOERROR) {
+        std::vector<DiaAssetJob *>::iterator it = std::find(loader->Submitted.begin(), loader->Submitted.end(), job);
+        if (it != loader->Submitted.end()) {
+            loader->Submitted.erase(it);
+        }
+        DiaAssetLoader_Apply(job, hardware);
+    }
+    return loader->Submitted.size();
+}
+
+void DiaAssetLoader_GetStat(DiaAssetLoader *loader, asset_loader_stat_t *stat) {
+    pthread_mutex_lock(&loader->StatLock);
+    *stat = loader->Stat;
+    pthread_mutex_unlock(&loader->StatLock);
+}
+
+DiaAssetLoader::~DiaAssetLoader() {
+    if (Started && !Finished) {
+        Jobs.Close();
+        for (int i = 0; i < WorkersCount; i++) {
+            pthread_join(Workers[i], NULL);
+        }
+        for (size_t i = 0; i < Submitted.size(); i++) {
+            delete Submitted[i];
+        }
+    }
+    if (OpaqueProbe) {
+        SDL_FreeSurface(OpaqueProbe);
+    }
+    if (AlphaProbe) {
+        SDL_FreeSurface(AlphaProbe);
+    }
+}
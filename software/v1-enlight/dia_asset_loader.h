@@ -0,0 +1,125 @@
+#ifndef DIA_ASSET_LOADER_H
+#define DIA_ASSET_LOADER_H
+
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+
+#include <SDL.h>
+
+#include "dia_channel.h"
+
+#define ASSET_LOADER_NO_ERROR 0
+#define ASSET_LOADER_NULL_PARAMETER 1
+#define ASSET_LOADER_NOT_STARTED 2
+#define ASSET_LOADER_NO_VIDEO 3
+
+#define ASSET_LOADER_MAX_WORKERS 8
+
+class DiaAssetJob;
+typedef void (*asset_job_apply_t)(DiaAssetJob *job);
+
+// One picture to decode. Picture is what IMG_Load and SDL_DisplayFormat(Alpha)
+// give, Scaled is Picture scaled to Width x Height if its size is other.
+class DiaAssetJob {
+   public:
+    std::string Path;
+    int Width;
+    int Height;
+
+    SDL_Surface *Picture;
+    SDL_Surface *Scaled;
+
+    // Called on the main thread by DiaAssetLoader_Finish, takes the surfaces.
+    asset_job_apply_t Apply;
+    void *Target;
+    int Slot;
+
+    DiaAssetJob(std::string path, int width, int height, asset_job_apply_t apply, void *target, int slot) {
+        Path = path;
+        Width = width;
+        Height = height;
+        Picture = 0;
+        Scaled = 0;
+        Apply = apply;
+        Target = target;
+        Slot = slot;
+    }
+
+    ~DiaAssetJob() {
+        if (Picture) {
+            SDL_FreeSurface(Picture);
+        }
+        if (Scaled) {
+            SDL_FreeSurface(Scaled);
+        }
+    }
+};
+
+typedef struct asset_loader_stat {
+    int pictures;
+    int failed;
+    int workers;
+    // Summed over the workers.
+    double decode_ms;
+    double convert_ms;
+    double scale_ms;
+    // Main thread in DiaAssetLoader_Finish.
+    double wait_ms;
+    double finish_ms;
+} asset_loader_stat_t;
+
+// DiaAssetLoader decodes, converts and scales pictures on all cores while
+// the configuration is parsed. The workers convert to the formats
+// SDL_DisplayFormat and SDL_DisplayFormatAlpha use, so the pictures are the
+// same as decoded on the main thread. The results are handed to the items
+// in the order they were submitted by DiaAssetLoader_Finish, or as they come
+// by DiaAssetLoader_Poll if the loader keeps running.
+class DiaAssetLoader {
+   public:
+    DiaChannel<DiaAssetJob> Jobs;
+    // Decoded jobs, taken by DiaAssetLoader_Poll.
+    DiaChannel<DiaAssetJob> Done;
+    // Main thread only, not applied yet.
+    std::vector<DiaAssetJob *> Submitted;
+    int Started;
+    int Finished;
+    pthread_t Workers[ASSET_LOADER_MAX_WORKERS];
+    int WorkersCount;
+    // Their formats are what the workers convert to.
+    SDL_Surface *OpaqueProbe;
+    SDL_Surface *AlphaProbe;
+
+    pthread_mutex_t StatLock = PTHREAD_MUTEX_INITIALIZER;
+    asset_loader_stat_t Stat;
+
+    DiaAssetLoader() {
+        Started = 0;
+        Finished = 0;
+        WorkersCount = 0;
+        OpaqueProbe = 0;
+        AlphaProbe = 0;
+        Stat = asset_loader_stat_t();
+    }
+
+    ~DiaAssetLoader();
+};
+
+// Starts a worker per core but one, the main thread helps in Finish.
+// The video mode must be set before.
+int DiaAssetLoader_Start(DiaAssetLoader *loader);
+
+// Takes the job. Fails if the loader is not started, then decode in place.
+int DiaAssetLoader_Submit(DiaAssetLoader *loader, DiaAssetJob *job);
+
+// Waits for all jobs and applies them. The loader takes no more jobs.
+int DiaAssetLoader_Finish(DiaAssetLoader *loader);
+
+// Applies the jobs decoded by now, in the order they are done, and returns
+// how many are left. Without workers one job is decoded in place per call.
+int DiaAssetLoader_Poll(DiaAssetLoader *loader);
+
+void DiaAssetLoader_GetStat(DiaAssetLoader *loader, asset_loader_stat_t *stat);
+
+#endif
@@ -0,0 +1,278 @@
+#include "dia_asset_pack.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <jansson.h>
+
+#include "dia_crc.h"
+
+static int DiaAssetPack_ReadFile(std::string path, std::string *content) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        return 1;
+    }
+    char buf[16 * 1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        content->append(buf, n);
+    }
+    fclose(f);
+    return 0;
+}
+
+static void DiaAssetPack_Unmap(DiaAssetPack *pack) {
+    if (pack->Data) {
+        munmap(pack->Data, pack->Size);
+    }
+    pack->Data = 0;
+    pack->Size = 0;
+    pack->Header = 0;
+    pack->Entries = 0;
+    pack->Index.clear();
+    pack->SourceState.clear();
+}
+
+DiaAssetPack::~DiaAssetPack() {
+    DiaAssetPack_Unmap(this);
+}
+
+std::string DiaAssetPack_Key(const char *src, int itemW, int itemH) {
+    char size[32];
+    snprintf(size, sizeof(size), "@%dx%d", itemW, itemH);
+    return std::string(src) + size;
+}
+
+uint32_t DiaAssetPack_ConfigHash(const char *folder) {
+    std::string content;
+    if (DiaAssetPack_ReadFile(std::string(folder) + "/" + ASSET_PACK_CONFIG_FILENAME, &content)) {
+        return 0;
+    }
+    uint32_t crc = dia_crc32(0, content.data(), content.size());
+
+    json_error_t error;
+    json_t *root = json_loads(content.c_str(), 0, &error);
+    if (!root) {
+        return crc;
+    }
+    json_t *screens = json_object_get(root, "screens");
+    for (size_t i = 0; i < json_array_size(screens); i++) {
+        json_t *src = json_object_get(json_array_get(screens, i), "src");
+        if (!json_is_string(src)) {
+            continue;
+        }
+        std::string screen;
+        DiaAssetPack_ReadFile(std::string(folder) + "/" + json_string_value(src), &screen);
+        crc = dia_crc32(crc, json_string_value(src), strlen(json_string_value(src)));
+        crc = dia_crc32(crc, screen.data(), screen.size());
+    }
+    json_decref(root);
+    return crc;
+}
+
+int DiaAssetPack_SourceInfo(const char *path, uint64_t *size, int64_t *mtime, uint32_t *crc) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return 1;
+    }
+    *size = st.st_size;
+    *mtime = st.st_mtime;
+    if (crc) {
+        std::string content;
+        if (DiaAssetPack_ReadFile(path, &content)) {
+            return 1;
+        }
+        *crc = dia_crc32(0, content.data(), content.size());
+    }
+    return 0;
+}
+
+static void DiaAssetPack_GetFormat(SDL_Surface *surface, asset_pack_format_t *format) {
+    format->bits_per_pixel = surface->format->BitsPerPixel;
+    format->rmask = surface->format->Rmask;
+    format->gmask = surface->format->Gmask;
+    format->bmask = surface->format->Bmask;
+    format->amask = surface->format->Amask;
+}
+
+int DiaAssetPack_DisplayFormats(asset_pack_format_t *opaque, asset_pack_format_t *alpha) {
+    if (!SDL_GetVideoSurface()) {
+        return 1;
+    }
+    SDL_Surface *probe = SDL_CreateRGBSurface(SDL_SWSURFACE, 1, 1, 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000);
+    if (!probe) {
+        return 1;
+    }
+    SDL_Surface *opaqueSurface = SDL_DisplayFormat(probe);
+    SDL_Surface *alphaSurface = SDL_DisplayFormatAlpha(probe);
+    SDL_FreeSurface(probe);
+    int err = 1;
+    if (opaqueSurface && alphaSurface) {
+        DiaAssetPack_GetFormat(opaqueSurface, opaque);
+        DiaAssetPack_GetFormat(alphaSurface, alpha);
+        err = 0;
+    }
+    if (opaqueSurface) {
+        SDL_FreeSurface(opaqueSurface);
+    }
+    if (alphaSurface) {
+        SDL_FreeSurface(alphaSurface);
+    }
+    return err;
+}
+
+static int DiaAssetPack_Check(DiaAssetPack *pack) {
+    if (pack->Size < sizeof(asset_pack_header_t)) {
+        return ASSET_PACK_WRONG_FORMAT;
+    }
+    asset_pack_header_t *header = (asset_pack_header_t *)pack->Data;
+    if (header->magic != ASSET_PACK_MAGIC || header->version != ASSET_PACK_VERSION) {
+        return ASSET_PACK_WRONG_FORMAT;
+    }
+    if (header->count > (pack->Size - sizeof(asset_pack_header_t)) / sizeof(asset_pack_entry_t)) {
+        return ASSET_PACK_WRONG_FORMAT;
+    }
+    asset_pack_entry_t *entries = (asset_pack_entry_t *)(header + 1);
+    for (uint32_t i = 0; i < header->count; i++) {
+        asset_pack_entry_t *entry = &entries[i];
+        if (memchr(entry->src, 0, sizeof(entry->src)) == 0 || entry->offset > pack->Size ||
+            (uint64_t)entry->pitch * entry->h > pack->Size - entry->offset) {
+            return ASSET_PACK_WRONG_FORMAT;
+        }
+    }
+
+    if (header->config_hash != DiaAssetPack_ConfigHash(pack->Folder.c_str())) {
+        return ASSET_PACK_OUTDATED;
+    }
+    asset_pack_format_t opaque, alpha;
+    if (DiaAssetPack_DisplayFormats(&opaque, &alpha) ||
+        memcmp(&opaque, &header->opaque, sizeof(opaque)) != 0 ||
+        memcmp(&alpha, &header->alpha, sizeof(alpha)) != 0) {
+        return ASSET_PACK_WRONG_PIXEL_FORMAT;
+    }
+
+    pack->Header = header;
+    pack->Entries = entries;
+    for (uint32_t i = 0; i < header->count; i++) {
+        pack->Index[DiaAssetPack_Key(entries[i].src, entries[i].item_w, entries[i].item_h)] = i;
+    }
+    pack->SourceState.assign(header->count, 0);
+    return ASSET_PACK_NO_ERROR;
+}
+
+int DiaAssetPack_Open(DiaAssetPack *pack) {
+    if (!pack) {
+        return ASSET_PACK_NULL_PARAMETER;
+    }
+    DiaAssetPack_Unmap(pack);
+
+    std::string path = pack->Folder + "/" + ASSET_PACK_FILENAME;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        printf("Asset pack %s is not found, pictures are decoded at start\n", path.c_str());
+        return ASSET_PACK_OPEN_ERROR;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return ASSET_PACK_OPEN_ERROR;
+    }
+    // Private writable mapping: SDL may write into a surface while
+    // converting it, then only that page is copied.
+    void *data = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        printf("Asset pack %s is not mapped\n", path.c_str());
+        return ASSET_PACK_OPEN_ERROR;
+    }
+    pack->Data = data;
+    pack->Size = st.st_size;
+
+    int err = DiaAssetPack_Check(pack);
+    if (err == ASSET_PACK_OUTDATED) {
+        printf("Asset pack %s is made for another configuration, run asset_pack.exe again\n", path.c_str());
+    } else if (err == ASSET_PACK_WRONG_PIXEL_FORMAT) {
+        printf("Asset pack %s is made for another screen pixel format\n", path.c_str());
+    } else if (err != ASSET_PACK_NO_ERROR) {
+        printf("Asset pack %s is broken\n", path.c_str());
+    }
+    if (err != ASSET_PACK_NO_ERROR) {
+        DiaAssetPack_Unmap(pack);
+        return err;
+    }
+    // Start reading the pictures in while the configuration is parsed.
+    madvise(pack->Data, pack->Size, MADV_WILLNEED);
+    printf("Asset pack %s: %u pictures, %lu bytes\n", path.c_str(), pack->Header->count, (unsigned long)pack->Size);
+    return ASSET_PACK_NO_ERROR;
+}
+
+// Size and mtime are enough if they are the same, otherwise the content
+// decides: copying the folder changes mtime but not the pictures.
+static int DiaAssetPack_SourceUnchanged(DiaAssetPack *pack, asset_pack_entry_t *entry) {
+    std::string path = pack->Folder + "/" + entry->src;
+    uint64_t size;
+    int64_t mtime;
+    if (DiaAssetPack_SourceInfo(path.c_str(), &size, &mtime, 0)) {
+        return 0;
+    }
+    if (size != entry->source_size) {
+        return 0;
+    }
+    if (mtime == entry->source_mtime) {
+        return 1;
+    }
+    uint32_t crc;
+    if (DiaAssetPack_SourceInfo(path.c_str(), &size, &mtime, &crc)) {
+        return 0;
+    }
+    return crc == entry->source_crc;
+}
+
+SDL_Surface *DiaAssetPack_GetSurface(DiaAssetPack *pack, const char *src, int itemW, int itemH) {
+    if (!pack || !pack->Header || !src) {
+        return 0;
+    }
+    std::map<std::string, uint32_t>::iterator it = pack->Index.find(DiaAssetPack_Key(src, itemW, itemH));
+    if (it == pack->Index.end()) {
+        pack->Stat.misses++;
+        return 0;
+    }
+    uint32_t i = it->second;
+    asset_pack_entry_t *entry = &pack->Entries[i];
+    if (pack->SourceState[i] == 0) {
+        pack->SourceState[i] = DiaAssetPack_SourceUnchanged(pack, entry) ? 1 : -1;
+    }
+    if (pack->SourceState[i] < 0) {
+        printf("Asset pack: %s has changed, it is decoded\n", entry->src);
+        pack->Stat.stale++;
+        return 0;
+    }
+
+    asset_pack_format_t *format = (entry->flags & ASSET_PACK_FLAG_ALPHA) ? &pack->Header->alpha : &pack->Header->opaque;
+    SDL_Surface *surface = SDL_CreateRGBSurfaceFrom((char *)pack->Data + entry->offset, entry->w, entry->h,
+        format->bits_per_pixel, entry->pitch, format->rmask, format->gmask, format->bmask, format->amask);
+    if (!surface) {
+        pack->Stat.misses++;
+        return 0;
+    }
+    if (entry->flags & ASSET_PACK_FLAG_ALPHA) {
+        SDL_SetAlpha(surface, SDL_SRCALPHA, SDL_ALPHA_OPAQUE);
+    }
+    if (entry->flags & ASSET_PACK_FLAG_COLORKEY) {
+        SDL_SetColorKey(surface, SDL_SRCCOLORKEY, entry->colorkey);
+    }
+    pack->Stat.hits++;
+    return surface;
+}
+
+void DiaAssetPack_PrintStat(DiaAssetPack *pack) {
+    if (!pack || !pack->Header) {
+        return;
+    }
+    printf("Asset pack: %d pictures mapped, %d not packed, %d changed since packing\n",
+        pack->Stat.hits, pack->Stat.misses, pack->Stat.stale);
+}
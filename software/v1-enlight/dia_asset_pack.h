@@ -0,0 +1,133 @@
+#ifndef DIA_ASSET_PACK_H
+#define DIA_ASSET_PACK_H
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <SDL.h>
+
+// Made by asset_pack.exe, lives next to main.json.
+#define ASSET_PACK_FILENAME "assets.pack"
+// Same as DIA_DEFAULT_FIRMWARE_FILENAME.
+#define ASSET_PACK_CONFIG_FILENAME "main.json"
+
+#define ASSET_PACK_MAGIC 0x50414944
+#define ASSET_PACK_VERSION 1
+#define ASSET_PACK_SRC_LENGTH 200
+// Pixels of every picture start at this offset alignment.
+#define ASSET_PACK_ALIGN 64
+
+#define ASSET_PACK_NO_ERROR 0
+#define ASSET_PACK_NULL_PARAMETER 1
+#define ASSET_PACK_OPEN_ERROR 2
+#define ASSET_PACK_WRONG_FORMAT 3
+#define ASSET_PACK_OUTDATED 4
+#define ASSET_PACK_WRONG_PIXEL_FORMAT 5
+
+#define ASSET_PACK_FLAG_ALPHA 1
+#define ASSET_PACK_FLAG_COLORKEY 2
+
+typedef struct asset_pack_format {
+    uint32_t bits_per_pixel;
+    uint32_t rmask;
+    uint32_t gmask;
+    uint32_t bmask;
+    uint32_t amask;
+} asset_pack_format_t;
+
+// File layout: header, count entries, pixels.
+typedef struct asset_pack_header {
+    uint32_t magic;
+    uint32_t version;
+    // DiaAssetPack_ConfigHash of the configuration the pack is made for.
+    uint32_t config_hash;
+    uint32_t count;
+    // What SDL_DisplayFormat and SDL_DisplayFormatAlpha make on the screen.
+    asset_pack_format_t opaque;
+    asset_pack_format_t alpha;
+} asset_pack_header_t;
+
+typedef struct asset_pack_entry {
+    // Picture name as written in the screen, 0 terminated.
+    char src[ASSET_PACK_SRC_LENGTH];
+    // Item size the picture is scaled to, 0x0 if it is kept as is.
+    uint32_t item_w;
+    uint32_t item_h;
+    // Source file the pixels are made of.
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint32_t source_crc;
+    uint32_t flags;
+    uint32_t colorkey;
+    uint32_t w;
+    uint32_t h;
+    uint32_t pitch;
+    uint64_t offset;
+} asset_pack_entry_t;
+
+typedef struct asset_pack_stat {
+    int hits;
+    int misses;
+    // Pictures whose source has changed since the pack was made.
+    int stale;
+} asset_pack_stat_t;
+
+// DiaAssetPack maps the pack of a configuration folder. Its pictures are
+// already decoded, scaled to the item size and in the screen pixel format,
+// so an image costs one SDL_CreateRGBSurfaceFrom on top of the mapping.
+// Surfaces made by DiaAssetPack_GetSurface point into the mapping and must
+// be freed before the pack is deleted.
+class DiaAssetPack {
+   public:
+    std::string Folder;
+    void *Data;
+    size_t Size;
+    asset_pack_header_t *Header;
+    asset_pack_entry_t *Entries;
+    // Entry numbers by DiaAssetPack_Key.
+    std::map<std::string, uint32_t> Index;
+    // Per entry: 0 if its source is not checked yet, 1 if it is unchanged,
+    // -1 if it has changed.
+    std::vector<int> SourceState;
+    asset_pack_stat_t Stat;
+
+    DiaAssetPack(std::string folder) {
+        Folder = folder;
+        Data = 0;
+        Size = 0;
+        Header = 0;
+        Entries = 0;
+        Stat = asset_pack_stat_t();
+    }
+
+    ~DiaAssetPack();
+};
+
+// Maps Folder/ASSET_PACK_FILENAME. The pack is not used if it is made for
+// another configuration or another screen pixel format; the video mode must
+// be set before.
+int DiaAssetPack_Open(DiaAssetPack *pack);
+
+// Returns the picture scaled to itemW x itemH (0x0 for the picture as is),
+// 0 if the pack is not open, has not got it or its source has changed.
+SDL_Surface *DiaAssetPack_GetSurface(DiaAssetPack *pack, const char *src, int itemW, int itemH);
+
+void DiaAssetPack_PrintStat(DiaAssetPack *pack);
+
+// Below is shared with the packer.
+std::string DiaAssetPack_Key(const char *src, int itemW, int itemH);
+
+// Checksum of main.json and the screens it includes, they define which
+// pictures are needed and their sizes.
+uint32_t DiaAssetPack_ConfigHash(const char *folder);
+
+// crc is not calculated if it is 0. Returns 1 if there is no such file.
+int DiaAssetPack_SourceInfo(const char *path, uint64_t *size, int64_t *mtime, uint32_t *crc);
+
+// Formats of the current video mode, returns 1 if it is not set.
+int DiaAssetPack_DisplayFormats(asset_pack_format_t *opaque, asset_pack_format_t *alpha);
+
+#endif
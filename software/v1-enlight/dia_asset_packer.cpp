@@ -0,0 +1,247 @@
+// Asset pack builder.
+// Usage: ./asset_pack.exe [-b bits per pixel] <configuration folder>
+// Decodes the pictures of every image and image_array item of the
+// configuration, converts them to the screen pixel format, scales images to
+// their item size the way DiaScreenItemImage::Rescale does and writes all of
+// them to <folder>/assets.pack, which the firmware maps instead of decoding.
+// Run it again after changing the configuration: an outdated pack is ignored
+// and pictures changed since packing are decoded.
+// The screen format is taken from SDL_VIDEODRIVER (dummy by default) at the
+// given depth, the firmware tells if it does not match its screen.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "dia_asset_pack.h"
+#include "dia_functions.h"
+
+// Same as DEPTH in dia_screen.cpp.
+#define PACKER_DEFAULT_DEPTH 32
+
+typedef struct packer_request {
+    std::string src;
+    int itemW;
+    int itemH;
+} packer_request_t;
+
+static double NowSec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void AddRequest(std::map<std::string, packer_request_t> *requests, const char *src, int itemW, int itemH) {
+    if (!src || strlen(src) >= ASSET_PACK_SRC_LENGTH) {
+        printf("skipped picture with a too long name: %s\n", src ? src : "(nil)");
+        return;
+    }
+    packer_request_t request;
+    request.src = src;
+    request.itemW = itemW;
+    request.itemH = itemH;
+    (*requests)[DiaAssetPack_Key(src, itemW, itemH)] = request;
+}
+
+// Same items as DiaScreenItemImage and DiaScreenItemImageArray load.
+static void CollectScreen(std::map<std::string, packer_request_t> *requests, json_t *screen) {
+    json_t *items = json_object_get(screen, "items");
+    for (size_t i = 0; i < json_array_size(items); i++) {
+        json_t *item = json_array_get(items, i);
+        const char *type = json_string_value(json_object_get(item, "type"));
+        if (!type) {
+            continue;
+        }
+        if (strcmp(type, "image") == 0) {
+            const char *src = json_string_value(json_object_get(item, "src"));
+            const char *size = json_string_value(json_object_get(item, "size"));
+            int w = 0, h = 0;
+            if (!src || !size || sscanf(size, "%d;%d", &w, &h) != 2) {
+                continue;
+            }
+            AddRequest(requests, src, w, h);
+        } else if (strcmp(type, "image_array") == 0) {
+            json_t *sources = json_object_get(item, "sources");
+            for (size_t k = 0; k < json_array_size(sources); k++) {
+                AddRequest(requests, json_string_value(json_object_get(json_array_get(sources, k), "src")), 0, 0);
+            }
+        }
+    }
+}
+
+static int CollectConfiguration(std::map<std::string, packer_request_t> *requests, const char *folder) {
+    json_t *root = dia_get_resource_json(folder, ASSET_PACK_CONFIG_FILENAME);
+    if (!root) {
+        return 1;
+    }
+    json_t *screens = json_object_get(root, "screens");
+    for (size_t i = 0; i < json_array_size(screens); i++) {
+        json_t *screen = json_array_get(screens, i);
+        const char *src = json_string_value(json_object_get(screen, "src"));
+        if (!src) {
+            CollectScreen(requests, screen);
+            continue;
+        }
+        json_t *implementation = dia_get_resource_json(folder, src);
+        if (implementation) {
+            CollectScreen(requests, implementation);
+            json_decref(implementation);
+        }
+    }
+    json_decref(root);
+    return 0;
+}
+
+// What the firmware gets from IMG_Load, SDL_DisplayFormat(Alpha) and Rescale.
+static SDL_Surface *MakeSurface(std::string path, int itemW, int itemH) {
+    SDL_Surface *tmpImg = IMG_Load(path.c_str());
+    if (!tmpImg) {
+        printf("error: IMG_Load: %s\n", IMG_GetError());
+        return 0;
+    }
+    SDL_Surface *img;
+    if (tmpImg->format->Amask == 0) {
+        img = SDL_DisplayFormat(tmpImg);
+    } else {
+        img = SDL_DisplayFormatAlpha(tmpImg);
+    }
+    SDL_FreeSurface(tmpImg);
+    if (img && itemW && itemH && (img->w != itemW || img->h != itemH)) {
+        SDL_Surface *scaled = dia_ScaleSurface(img, itemW, itemH);
+        SDL_FreeSurface(img);
+        img = scaled;
+    }
+    return img;
+}
+
+static int WritePack(std::string path, asset_pack_header_t *header, std::vector<asset_pack_entry_t> *entries,
+                     std::string *pixels) {
+    size_t tableBytes = sizeof(asset_pack_header_t) + entries->size() * sizeof(asset_pack_entry_t);
+    size_t dataStart = (tableBytes + ASSET_PACK_ALIGN - 1) / ASSET_PACK_ALIGN * ASSET_PACK_ALIGN;
+    for (size_t i = 0; i < entries->size(); i++) {
+        (*entries)[i].offset += dataStart;
+    }
+
+    std::string tmpPath = path + ".tmp";
+    FILE *f = fopen(tmpPath.c_str(), "wb");
+    if (!f) {
+        printf("can't create %s\n", tmpPath.c_str());
+        return 1;
+    }
+    std::string padding(dataStart - tableBytes, 0);
+    int ok = fwrite(header, sizeof(*header), 1, f) == 1;
+    if (ok && !entries->empty()) {
+        ok = fwrite(&(*entries)[0], sizeof(asset_pack_entry_t), entries->size(), f) == entries->size();
+    }
+    ok = ok && fwrite(padding.data(), 1, padding.size(), f) == padding.size();
+    ok = ok && fwrite(pixels->data(), 1, pixels->size(), f) == pixels->size();
+    ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    fclose(f);
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        printf("can't write %s\n", path.c_str());
+        unlink(tmpPath.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int depth = PACKER_DEFAULT_DEPTH;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:")) != -1) {
+        switch (opt) {
+            case 'b': depth = atoi(optarg); break;
+            default:
+                printf("usage: %s [-b bits per pixel] <configuration folder>\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        printf("usage: %s [-b bits per pixel] <configuration folder>\n", argv[0]);
+        return 1;
+    }
+    std::string folder = argv[optind];
+
+    setenv("SDL_VIDEODRIVER", "dummy", 0);
+    if (SDL_Init(SDL_INIT_VIDEO) < 0 || !SDL_SetVideoMode(16, 16, depth, SDL_SWSURFACE)) {
+        printf("can't set the video mode: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    asset_pack_header_t header = asset_pack_header_t();
+    header.magic = ASSET_PACK_MAGIC;
+    header.version = ASSET_PACK_VERSION;
+    header.config_hash = DiaAssetPack_ConfigHash(folder.c_str());
+    if (DiaAssetPack_DisplayFormats(&header.opaque, &header.alpha)) {
+        printf("can't get the display formats\n");
+        return 1;
+    }
+
+    std::map<std::string, packer_request_t> requests;
+    if (CollectConfiguration(&requests, folder.c_str())) {
+        printf("can't read %s/%s\n", folder.c_str(), ASSET_PACK_CONFIG_FILENAME);
+        return 1;
+    }
+
+    double start = NowSec();
+    std::vector<asset_pack_entry_t> entries;
+    std::string pixels;
+    for (std::map<std::string, packer_request_t>::iterator it = requests.begin(); it != requests.end(); ++it) {
+        packer_request_t *request = &it->second;
+        std::string path = folder + "/" + request->src;
+        asset_pack_entry_t entry = asset_pack_entry_t();
+        if (DiaAssetPack_SourceInfo(path.c_str(), &entry.source_size, &entry.source_mtime, &entry.source_crc)) {
+            printf("skipped %s: no such file\n", path.c_str());
+            continue;
+        }
+        SDL_Surface *img = MakeSurface(path, request->itemW, request->itemH);
+        if (!img) {
+            printf("skipped %s: can't decode\n", path.c_str());
+            continue;
+        }
+        asset_pack_format_t *format = img->format->Amask ? &header.alpha : &header.opaque;
+        if (img->format->BitsPerPixel != format->bits_per_pixel || img->format->Rmask != format->rmask ||
+            img->format->Gmask != format->gmask || img->format->Bmask != format->bmask) {
+            printf("skipped %s: not in the display format\n", path.c_str());
+            SDL_FreeSurface(img);
+            continue;
+        }
+
+        strcpy(entry.src, request->src.c_str());
+        entry.item_w = request->itemW;
+        entry.item_h = request->itemH;
+        if (img->format->Amask) {
+            entry.flags |= ASSET_PACK_FLAG_ALPHA;
+        }
+        if (img->flags & SDL_SRCCOLORKEY) {
+            entry.flags |= ASSET_PACK_FLAG_COLORKEY;
+            entry.colorkey = img->format->colorkey;
+        }
+        entry.w = img->w;
+        entry.h = img->h;
+        entry.pitch = img->pitch;
+        entry.offset = pixels.size();
+        SDL_LockSurface(img);
+        pixels.append((const char *)img->pixels, (size_t)img->pitch * img->h);
+        SDL_UnlockSurface(img);
+        pixels.resize((pixels.size() + ASSET_PACK_ALIGN - 1) / ASSET_PACK_ALIGN * ASSET_PACK_ALIGN, 0);
+        SDL_FreeSurface(img);
+        entries.push_back(entry);
+    }
+    header.count = entries.size();
+
+    std::string path = folder + "/" + ASSET_PACK_FILENAME;
+    if (WritePack(path, &header, &entries, &pixels)) {
+        return 1;
+    }
+    printf("%s: %u of %u pictures, %lu bytes of pixels, %d bits per pixel, made in %.1f sec\n", path.c_str(),
+           header.count, (unsigned)requests.size(), (unsigned long)pixels.size(), depth, NowSec() - start);
+    SDL_Quit();
+    return 0;
+}
@@ -5,19 +5,53 @@
 #define CHANNEL_BUFFER_OVERFLOW 1
 #define CHANNEL_BUFFER_EMPTY 2
 #define CHANNEL_BUFFER_DESTINATION_IS_NULL 3
+// The channel was closed, nothing is pushed and waiting stops.
+#define CHANNEL_CLOSED 4
 
 #define CHANNEL_WAIT_FOR_DATA 1
 #define CHANNEL_DO_NOT_WAIT_FOR_DATA 0
 
+// Capacity of a channel which grows without limit.
+#define CHANNEL_UNBOUNDED 0
+// What Push does when a bounded channel is full.
+#define CHANNEL_REJECT_NEW 0
+#define CHANNEL_DROP_OLDEST 1
+#define CHANNEL_BLOCK 2
+// Timeout to wait forever.
+#define CHANNEL_WAIT_FOREVER -1
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <pthread.h>
 #include <stdint.h>
-#include <string.h>
+#include <time.h>
 #include <string>
 #include <list>
+#include <atomic>
+
+// Deadline timeoutMs from now on the monotonic clock.
+static inline void DiaChannel_Deadline(struct timespec *deadline, int timeoutMs) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeoutMs / 1000;
+    deadline->tv_nsec += (long)(timeoutMs % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+static inline void DiaChannel_InitCond(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
 
+// Queue of pointers for any number of producers and consumers.
+// Peek, PeekSome, Pop and PopSome wait up to timeoutMs for data,
+// the default 0 returns at once like before.
 template <class T>
 class DiaChannel {
 private:
@@ -25,12 +59,32 @@ private:
 public:
 
     int Push(T * newElement) {
+        int err = CHANNEL_NOERROR;
         pthread_mutex_lock(&listLock);
-        container.push_back(newElement);
+        while (!closed && capacity != CHANNEL_UNBOUNDED && (int)container.size() >= capacity && policy == CHANNEL_BLOCK) {
+            pthread_cond_wait(&notFull, &listLock);
+        }
+        if (closed) {
+            err = CHANNEL_CLOSED;
+        } else if (capacity != CHANNEL_UNBOUNDED && (int)container.size() >= capacity) {
+            if (policy == CHANNEL_DROP_OLDEST) {
+                delete container.front();
+                container.pop_front();
+                dropped++;
+                container.push_back(newElement);
+            } else {
+                err = CHANNEL_BUFFER_OVERFLOW;
+            }
+        } else {
+            container.push_back(newElement);
+        }
         pthread_mutex_unlock(&listLock);
-        return 0;
+        if (err == CHANNEL_NOERROR) {
+            pthread_cond_broadcast(&notEmpty);
+        }
+        return err;
     }
-    
+
     int DropOne() {
         int err = 0;
         pthread_mutex_lock(&listLock);
@@ -38,49 +92,280 @@ public:
             T *result = container.front();
             container.pop_front();
             delete result;
+            pthread_cond_signal(&notFull);
         } else {
             err = 1;
         }
         pthread_mutex_unlock(&listLock);
         return err;
     }
-    
-    int Peek(T ** result) {
+
+    int Peek(T ** result, int timeoutMs = 0) {
         int err = 0;
         pthread_mutex_lock(&listLock);
-        if (container.empty()) {
-            err = CHANNEL_BUFFER_EMPTY;
+        err = WaitForData(timeoutMs);
+        if (err) {
             *result = NULL;
         } else {
             *result = container.front();
         }
         pthread_mutex_unlock(&listLock);
-        return err;        
+        return err;
     }
-    
-    int Pop(T ** result) {
+
+    // Copies up to max elements from the front without removing them.
+    // Returns the number of copied elements.
+    int PeekSome(T ** result, int max, int timeoutMs = 0) {
+        int count = 0;
+        pthread_mutex_lock(&listLock);
+        WaitForData(timeoutMs);
+        for (typename std::list<T*>::iterator it = container.begin(); it != container.end() && count < max; ++it) {
+            result[count++] = *it;
+        }
+        pthread_mutex_unlock(&listLock);
+        return count;
+    }
+
+    int Pop(T ** result, int timeoutMs = 0) {
         int err = 0;
         pthread_mutex_lock(&listLock);
-        if (container.empty()) {
-            err = CHANNEL_BUFFER_EMPTY;
+        err = WaitForData(timeoutMs);
+        if (err) {
             *result = NULL;
         } else {
             *result = container.front();
             container.pop_front();
+            pthread_cond_signal(&notFull);
         }
         pthread_mutex_unlock(&listLock);
-        return err;        
+        return err;
     }
-    
-    DiaChannel() {
+
+    // Removes up to max elements from the front under one lock.
+    // Returns the number of removed elements.
+    int PopSome(T ** result, int max, int timeoutMs = 0) {
+        int count = 0;
+        pthread_mutex_lock(&listLock);
+        WaitForData(timeoutMs);
+        while (!container.empty() && count < max) {
+            result[count++] = container.front();
+            container.pop_front();
+        }
+        if (count > 0) {
+            pthread_cond_broadcast(&notFull);
+        }
+        pthread_mutex_unlock(&listLock);
+        return count;
+    }
+
+    int Size() {
+        pthread_mutex_lock(&listLock);
+        int size = container.size();
+        pthread_mutex_unlock(&listLock);
+        return size;
+    }
+
+    // Elements deleted by CHANNEL_DROP_OLDEST.
+    uint64_t Dropped() {
+        pthread_mutex_lock(&listLock);
+        uint64_t res = dropped;
+        pthread_mutex_unlock(&listLock);
+        return res;
+    }
+
+    // Wakes up everybody waiting on the channel. Elements already in the
+    // channel can still be taken, new ones are not accepted.
+    void Close() {
+        pthread_mutex_lock(&listLock);
+        closed = 1;
+        pthread_cond_broadcast(&notEmpty);
+        pthread_cond_broadcast(&notFull);
+        pthread_mutex_unlock(&listLock);
+    }
+
+    DiaChannel(int capacity = CHANNEL_UNBOUNDED, int policy = CHANNEL_REJECT_NEW) {
+        this->capacity = capacity;
+        this->policy = policy;
+        closed = 0;
+        dropped = 0;
         pthread_mutex_init(&listLock, 0);
+        DiaChannel_InitCond(&notEmpty);
+        DiaChannel_InitCond(&notFull);
     }
-    
+
     ~DiaChannel() {
+        pthread_cond_destroy(&notFull);
+        pthread_cond_destroy(&notEmpty);
         pthread_mutex_destroy(&listLock);
     }
-    
-private:    
+
+private:
     pthread_mutex_t listLock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    int capacity;
+    int policy;
+    int closed;
+    uint64_t dropped;
+
+    // Called with listLock held.
+    int WaitForData(int timeoutMs) {
+        if (container.empty() && !closed && timeoutMs != 0) {
+            struct timespec deadline;
+            DiaChannel_Deadline(&deadline, timeoutMs);
+            while (container.empty() && !closed) {
+                if (timeoutMs < 0) {
+                    pthread_cond_wait(&notEmpty, &listLock);
+                } else if (pthread_cond_timedwait(&notEmpty, &listLock, &deadline) != 0) {
+                    break;
+                }
+            }
+        }
+        if (!container.empty()) {
+            return CHANNEL_NOERROR;
+        }
+        return closed ? CHANNEL_CLOSED : CHANNEL_BUFFER_EMPTY;
+    }
+};
+
+// Bounded ring for exactly one producer thread and one consumer thread.
+// Push, Peek, DropOne and Pop take no lock; the mutex is only touched when
+// the consumer waits on an empty ring. A full ring rejects new elements.
+template <class T>
+class DiaSpscChannel {
+public:
+    // Producer only.
+    int Push(T * newElement) {
+        if (closed.load(std::memory_order_acquire)) {
+            return CHANNEL_CLOSED;
+        }
+        size_t head = this->head.load(std::memory_order_relaxed);
+        if (head - tail.load(std::memory_order_acquire) > mask) {
+            return CHANNEL_BUFFER_OVERFLOW;
+        }
+        ring[head & mask] = newElement;
+        this->head.store(head + 1, std::memory_order_release);
+        // Pairs with the fence in WaitForData, so either the consumer sees
+        // the element or we see it waiting.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed)) {
+            pthread_mutex_lock(&waitLock);
+            pthread_cond_signal(&notEmpty);
+            pthread_mutex_unlock(&waitLock);
+        }
+        return CHANNEL_NOERROR;
+    }
+
+    // Consumer only.
+    int Peek(T ** result, int timeoutMs = 0) {
+        int err = WaitForData(timeoutMs);
+        *result = err ? NULL : ring[tail.load(std::memory_order_relaxed) & mask];
+        return err;
+    }
+
+    // Consumer only.
+    int DropOne() {
+        T *result;
+        if (Pop(&result)) {
+            return 1;
+        }
+        delete result;
+        return 0;
+    }
+
+    // Consumer only.
+    int Pop(T ** result, int timeoutMs = 0) {
+        int err = Peek(result, timeoutMs);
+        if (!err) {
+            tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+        return err;
+    }
+
+    // Consumer only. Returns the number of removed elements.
+    int PopSome(T ** result, int max, int timeoutMs = 0) {
+        WaitForData(timeoutMs);
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        size_t head = this->head.load(std::memory_order_acquire);
+        int count = 0;
+        while (tail != head && count < max) {
+            result[count++] = ring[tail & mask];
+            tail++;
+        }
+        this->tail.store(tail, std::memory_order_release);
+        return count;
+    }
+
+    int Size() {
+        return (int)(head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire));
+    }
+
+    void Close() {
+        closed.store(1, std::memory_order_release);
+        pthread_mutex_lock(&waitLock);
+        pthread_cond_broadcast(&notEmpty);
+        pthread_mutex_unlock(&waitLock);
+    }
+
+    // Capacity is rounded up to a power of two.
+    DiaSpscChannel(int capacity) {
+        size_t size = 1;
+        while ((int)size < capacity) {
+            size <<= 1;
+        }
+        ring = new T*[size];
+        mask = size - 1;
+        head.store(0);
+        tail.store(0);
+        waiting.store(0);
+        closed.store(0);
+        pthread_mutex_init(&waitLock, 0);
+        DiaChannel_InitCond(&notEmpty);
+    }
+
+    // Elements left in the ring belong to the caller, like with DiaChannel.
+    ~DiaSpscChannel() {
+        pthread_cond_destroy(&notEmpty);
+        pthread_mutex_destroy(&waitLock);
+        delete[] ring;
+    }
+
+private:
+    T **ring;
+    size_t mask;
+    // Written by the producer and the consumer only, on separate cache lines.
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    alignas(64) std::atomic<int> waiting;
+    std::atomic<int> closed;
+    pthread_mutex_t waitLock;
+    pthread_cond_t notEmpty;
+
+    int Empty() {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_relaxed);
+    }
+
+    int WaitForData(int timeoutMs) {
+        if (Empty() && timeoutMs != 0 && !closed.load(std::memory_order_acquire)) {
+            struct timespec deadline;
+            DiaChannel_Deadline(&deadline, timeoutMs);
+            pthread_mutex_lock(&waitLock);
+            waiting.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while (Empty() && !closed.load(std::memory_order_acquire)) {
+                if (timeoutMs < 0) {
+                    pthread_cond_wait(&notEmpty, &waitLock);
+                } else if (pthread_cond_timedwait(&notEmpty, &waitLock, &deadline) != 0) {
+                    break;
+                }
+            }
+            waiting.store(0, std::memory_order_relaxed);
+            pthread_mutex_unlock(&waitLock);
+        }
+        if (!Empty()) {
+            return CHANNEL_NOERROR;
+        }
+        return closed.load(std::memory_order_acquire) ? CHANNEL_CLOSED : CHANNEL_BUFFER_EMPTY;
+    }
 };
 #endif
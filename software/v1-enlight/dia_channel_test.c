@@ -1,6 +1,164 @@
+#include <sched.h>
+#include <unistd.h>
+
 #include "dia_channel.h"
 
-int main() {
+// Usage: ./channel_test.exe [items]
+// Single thread checks first, then a stress test with several producers and
+// consumers and a throughput comparison of DiaChannel and DiaSpscChannel.
+
+#define TEST_PRODUCERS 4
+#define TEST_CONSUMERS 2
+#define TEST_BATCH 64
+
+static int Failed = 0;
+
+static void Check(int ok, const char *what) {
+    if (!ok) {
+        printf("failed %s\n", what);
+        Failed = 1;
+    }
+}
+
+static double NowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+typedef struct test_item {
+    int producer;
+    int seq;
+} test_item_t;
+
+typedef struct test_thread {
+    DiaChannel<test_item_t> *channel;
+    DiaSpscChannel<test_item_t> *spsc;
+    test_item_t *items;
+    int producer;
+    int count;
+    volatile int done;
+    int received;
+    int outOfOrder;
+    int lastSeq[TEST_PRODUCERS];
+} test_thread_t;
+
+static void *Produce(void *arg) {
+    test_thread_t *t = (test_thread_t *)arg;
+    for (int i = 0; i < t->count; i++) {
+        test_item_t *item = &t->items[i];
+        item->producer = t->producer;
+        item->seq = i;
+        if (t->channel) {
+            t->channel->Push(item);
+        } else {
+            while (t->spsc->Push(item) == CHANNEL_BUFFER_OVERFLOW) {
+                sched_yield();
+            }
+        }
+    }
+    return NULL;
+}
+
+// Takes batches until the channel is closed and drained.
+static void *Consume(void *arg) {
+    test_thread_t *t = (test_thread_t *)arg;
+    for (int i = 0; i < TEST_PRODUCERS; i++) {
+        t->lastSeq[i] = -1;
+    }
+    test_item_t *batch[TEST_BATCH];
+    for (;;) {
+        int count;
+        if (t->channel) {
+            count = t->channel->PopSome(batch, TEST_BATCH, 100);
+        } else {
+            count = t->spsc->PopSome(batch, TEST_BATCH, 100);
+        }
+        if (count == 0) {
+            int size = t->channel ? t->channel->Size() : t->spsc->Size();
+            if (size == 0 && t->done) {
+                break;
+            }
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            // Elements of one producer come in order to every consumer.
+            if (batch[i]->seq <= t->lastSeq[batch[i]->producer]) {
+                t->outOfOrder++;
+            }
+            t->lastSeq[batch[i]->producer] = batch[i]->seq;
+        }
+        t->received += count;
+    }
+    return NULL;
+}
+
+// Runs producers and consumers over the channel, returns items per second.
+static double RunStress(DiaChannel<test_item_t> *channel, DiaSpscChannel<test_item_t> *spsc, int producers,
+                        int consumers, int items, const char *what) {
+    pthread_t producerThreads[TEST_PRODUCERS], consumerThreads[TEST_CONSUMERS];
+    test_thread_t producer[TEST_PRODUCERS], consumer[TEST_CONSUMERS];
+    test_item_t *storage = new test_item_t[(size_t)items * producers];
+
+    double start = NowMs();
+    for (int i = 0; i < consumers; i++) {
+        consumer[i] = test_thread_t();
+        consumer[i].channel = channel;
+        consumer[i].spsc = spsc;
+        pthread_create(&consumerThreads[i], NULL, Consume, &consumer[i]);
+    }
+    for (int i = 0; i < producers; i++) {
+        producer[i] = test_thread_t();
+        producer[i].channel = channel;
+        producer[i].spsc = spsc;
+        producer[i].items = storage + (size_t)i * items;
+        producer[i].producer = i;
+        producer[i].count = items;
+        pthread_create(&producerThreads[i], NULL, Produce, &producer[i]);
+    }
+    for (int i = 0; i < producers; i++) {
+        pthread_join(producerThreads[i], NULL);
+    }
+    // Consumers stop once they see the channel empty after this.
+    for (int i = 0; i < consumers; i++) {
+        consumer[i].done = 1;
+    }
+    int received = 0, outOfOrder = 0;
+    for (int i = 0; i < consumers; i++) {
+        pthread_join(consumerThreads[i], NULL);
+        received += consumer[i].received;
+        outOfOrder += consumer[i].outOfOrder;
+    }
+    double elapsed = NowMs() - start;
+    delete[] storage;
+
+    Check(received == items * producers, what);
+    Check(outOfOrder == 0, what);
+    double rate = items * producers / (elapsed / 1000.0);
+    printf("%-32s %d items in %7.1f ms, %6.2f M items/s\n", what, items * producers, elapsed, rate / 1e6);
+    return rate;
+}
+
+typedef struct test_waiter {
+    DiaChannel<int> *channel;
+    int err;
+    double wokenAt;
+} test_waiter_t;
+
+static void *WaitForever(void *arg) {
+    test_waiter_t *w = (test_waiter_t *)arg;
+    int *res;
+    w->err = w->channel->Pop(&res, CHANNEL_WAIT_FOREVER);
+    w->wokenAt = NowMs();
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    int items = argc > 1 ? atoi(argv[1]) : 500000;
+    if (items < 1) {
+        items = 1;
+    }
+
     DiaChannel<int> ch;
     int err =0;
     int *res= &err;
@@ -17,6 +175,13 @@ int main() {
     ch.Push(&a1);
     ch.Push(&a2);
     ch.Push(&a3);
+    if (ch.Size() != 3) {
+        printf("failed size\n");
+    }
+    int *some[4];
+    if (ch.PeekSome(some, 2) != 2 || *some[0] != 1 || *some[1] != 2 || ch.PeekSome(some, 4) != 3 || ch.Size() != 3) {
+        printf("failed peek some\n");
+    }
     err = ch.Pop(&res);
     if(*res!=1) {
         printf("failed 1\n");
@@ -29,5 +194,65 @@ int main() {
     if(*res!=3) {
         printf("failed 3\n");
     }
+
+    // Timed wait on an empty channel.
+    double start = NowMs();
+    err = ch.Pop(&res, 50);
+    double waited = NowMs() - start;
+    Check(err == CHANNEL_BUFFER_EMPTY && res == NULL && waited >= 49 && waited < 500, "timed wait");
+
+    // Bounded channels.
+    DiaChannel<int> bounded(2, CHANNEL_REJECT_NEW);
+    Check(bounded.Push(&a1) == CHANNEL_NOERROR && bounded.Push(&a2) == CHANNEL_NOERROR, "bounded push");
+    Check(bounded.Push(&a3) == CHANNEL_BUFFER_OVERFLOW && bounded.Size() == 2, "reject new");
+
+    DiaChannel<int> dropping(2, CHANNEL_DROP_OLDEST);
+    dropping.Push(new int(1));
+    dropping.Push(new int(2));
+    dropping.Push(new int(3));
+    Check(dropping.Size() == 2 && dropping.Dropped() == 1, "drop oldest");
+    Check(dropping.Pop(&res) == CHANNEL_NOERROR && *res == 2, "drop oldest order");
+    delete res;
+    dropping.DropOne();
+
+    // A push wakes a waiting consumer at once, Close wakes it too.
+    DiaChannel<int> wake;
+    test_waiter_t waiter = {&wake, -1, 0};
+    pthread_t thread;
+    pthread_create(&thread, NULL, WaitForever, &waiter);
+    usleep(20000);
+    double pushedAt = NowMs();
+    wake.Push(&a1);
+    pthread_join(thread, NULL);
+    Check(waiter.err == CHANNEL_NOERROR, "wake up on push");
+    printf("wake up latency: %.3f ms\n", waiter.wokenAt - pushedAt);
+
+    pthread_create(&thread, NULL, WaitForever, &waiter);
+    usleep(20000);
+    wake.Close();
+    pthread_join(thread, NULL);
+    Check(waiter.err == CHANNEL_CLOSED && wake.Push(&a1) == CHANNEL_CLOSED, "close");
+
+    DiaSpscChannel<int> ring(3);
+    Check(ring.Push(&a1) == CHANNEL_NOERROR && ring.Push(&a2) == CHANNEL_NOERROR && ring.Push(&a3) == CHANNEL_NOERROR,
+          "ring push");
+    Check(ring.Push(&a1) == CHANNEL_NOERROR && ring.Push(&a1) == CHANNEL_BUFFER_OVERFLOW, "ring capacity");
+    Check(ring.Peek(&res) == CHANNEL_NOERROR && *res == 1 && ring.Pop(&res) == CHANNEL_NOERROR && *res == 1, "ring pop");
+    Check(ring.PopSome(some, 4) == 3 && *some[0] == 2 && *some[2] == 1 && ring.Size() == 0, "ring pop some");
+    Check(ring.Pop(&res, 20) == CHANNEL_BUFFER_EMPTY, "ring timed wait");
+
+    // Stress and throughput.
+    DiaChannel<test_item_t> blocking(1024, CHANNEL_BLOCK);
+    RunStress(&blocking, NULL, TEST_PRODUCERS, TEST_CONSUMERS, items, "DiaChannel 4x2, blocking 1024");
+    DiaChannel<test_item_t> unbounded;
+    double locked = RunStress(&unbounded, NULL, 1, 1, items * 2, "DiaChannel 1x1");
+    DiaSpscChannel<test_item_t> spsc(1024);
+    double lockFree = RunStress(NULL, &spsc, 1, 1, items * 2, "DiaSpscChannel 1x1, 1024");
+    printf("lock-free speedup: %.1fx\n", lockFree / locked);
+
+    if (Failed) {
+        return 1;
+    }
     printf("OK\n");
+    return 0;
 }
@@ -1,12 +1,57 @@
 #include "dia_configuration.h"
 #include "dia_functions.h"
 #include "dia_storage_interface.h"
+#include "dia_storage_file.h"
 #include <string.h>
 #include <stdlib.h>
+#include <chrono>
 
 int DiaConfiguration::InitFromFile() {
+    if (!_AssetPack) {
+        _AssetPack = new DiaAssetPack(_Folder);
+        DiaAssetPack_Open(_AssetPack);
+    }
+    if (!_ImageCache) {
+        _ImageCache = new DiaImageCache(_Folder, _AssetPack);
+    }
+    if (!_Prerender) {
+        _Prerender = new DiaPrerender(_ImageCache);
+    }
+    DiaAssetLoader * loader = new DiaAssetLoader();
+    if (DiaAssetLoader_Start(loader) != ASSET_LOADER_NO_ERROR) {
+        printf("Pictures are decoded one by one, the video mode is not set\n");
+    }
+
+    auto start = std::chrono::steady_clock::now();
     std::string resource = dia_get_resource(_Folder.c_str(), DIA_DEFAULT_FIRMWARE_FILENAME);
-    return InitFromString(resource.c_str());
+    int err = InitFromString(resource.c_str());
+    auto parsed = std::chrono::steady_clock::now();
+
+    // Screens are loaded in the order of main.json while they fit the
+    // budget, the rest are loaded when shown.
+    size_t queued = 0;
+    for (size_t i = 0; i < _ScreenOrder.size(); i++) {
+        size_t used = _ImageCache->Resident + queued;
+        size_t limit = used < _ImageCache->Budget ? _ImageCache->Budget - used : 0;
+        long bytes = DiaImageCache_Prefetch(_ImageCache, _ScreenOrder[i], loader, limit);
+        if (bytes > 0) {
+            queued += bytes;
+        }
+    }
+    DiaAssetLoader_Finish(loader);
+    asset_loader_stat_t stat;
+    DiaAssetLoader_GetStat(loader, &stat);
+    delete loader;
+
+    auto finished = std::chrono::steady_clock::now();
+    printf("Configuration loaded in %.1f ms: parse %.1f ms, wait for pictures %.1f ms, finalise %.1f ms\n",
+        std::chrono::duration<double, std::milli>(finished - start).count(),
+        std::chrono::duration<double, std::milli>(parsed - start).count(), stat.wait_ms, stat.finish_ms);
+    printf("%d pictures (%d failed) on %d workers and the main thread: decode %.1f ms, convert %.1f ms, scale %.1f ms\n",
+        stat.pictures, stat.failed, stat.workers, stat.decode_ms, stat.convert_ms, stat.scale_ms);
+    DiaAssetPack_PrintStat(_AssetPack);
+    DiaImageCache_PrintStat(_ImageCache, 1);
+    return err;
 }
 
 int DiaConfiguration::RunCommand(std::string command) {
@@ -65,6 +110,7 @@ int DiaConfiguration::Init() {
             printf("ERROR: GPIO INIT");
             return CONFIGURATION_STATUS::ERROR_GPIO;
         }
+        DiaGpio_SetPulseCapture(_Gpio, _PulseCapture, _PulseMinWidthUs, _PulseDebounceUs);
         #endif
     }
     return err;
@@ -88,7 +134,15 @@ DiaConfiguration::DiaConfiguration(std::string folder, DiaNetwork *newNet) {
     _Screen = 0; // use Init();
     _svcWeather = new DiaRuntimeSvcWeather(newNet);
 
-    _Storage = CreateEmptyInterface();
+    _AssetPack = 0;
+    _ImageCache = 0;
+    _Prerender = 0;
+
+    _Storage = CreateFileInterface(STORAGE_FILE_PATH);
+    if (!_Storage) {
+        printf("Storage is not available, relay stats won't survive a restart\n");
+        _Storage = CreateEmptyInterface();
+    }
     _Net = newNet;
 }
 
@@ -178,6 +232,29 @@ int DiaConfiguration::InitFromJson(json_t * configuration_json) {
         }
     }
 
+    // Coin and banknote pulses are captured on edges unless "polling" is set
+    _PulseCapture = PULSE_CAPTURE_EDGE;
+    json_t *pulse_capture_json = json_object_get(configuration_json, "pulse_capture");
+    if (json_is_string(pulse_capture_json)) {
+        if (!strcmp(json_string_value(pulse_capture_json), "polling")) {
+            _PulseCapture = PULSE_CAPTURE_POLLING;
+        } else if (strcmp(json_string_value(pulse_capture_json), "edge")) {
+            fprintf(stderr, "error: unknown pulse_capture, using edge\n");
+        }
+    }
+
+    _PulseMinWidthUs = PULSE_MIN_WIDTH_US;
+    json_t *pulse_min_width_json = json_object_get(configuration_json, "pulse_min_width_us");
+    if (json_is_integer(pulse_min_width_json)) {
+        _PulseMinWidthUs = json_integer_value(pulse_min_width_json);
+    }
+
+    _PulseDebounceUs = PULSE_DEBOUNCE_US;
+    json_t *pulse_debounce_json = json_object_get(configuration_json, "pulse_debounce_us");
+    if (json_is_integer(pulse_debounce_json)) {
+        _PulseDebounceUs = json_integer_value(pulse_debounce_json);
+    }
+
     // Let's unpack relays #
     json_t *relays_json = json_object_get(configuration_json, "relays");
     if(!json_is_integer(relays_json)) {
@@ -186,6 +263,11 @@ int DiaConfiguration::InitFromJson(json_t * configuration_json) {
     }
     _RelaysNumber = json_integer_value(relays_json);
 
+    json_t *image_cache_json = json_object_get(configuration_json, "image_cache_mb");
+    if (json_is_integer(image_cache_json) && _ImageCache) {
+        _ImageCache->Budget = (size_t)json_integer_value(image_cache_json) * 1024 * 1024;
+    }
+
     for(unsigned int i = 0; i < json_array_size(screens_json); i++) {
         json_t * screen_json = json_array_get(screens_json, i);
         if(!json_is_object(screen_json)) {
@@ -194,6 +276,8 @@ int DiaConfiguration::InitFromJson(json_t * configuration_json) {
         }
 
         DiaScreenConfig * screen_parsed = new DiaScreenConfig();
+        screen_parsed->ImageCache = _ImageCache;
+        screen_parsed->Prerender = _Prerender;
         json_t * id_json = json_object_get(screen_json, "id");
         if(!json_is_string(id_json)) {
             fprintf(stderr, "error: screen id is not a string\n");
@@ -202,6 +286,7 @@ int DiaConfiguration::InitFromJson(json_t * configuration_json) {
 
         std::string id = json_string_value(id_json);
         ScreenConfigs.insert(std::pair<std::string, DiaScreenConfig *>(id, screen_parsed));
+        _ScreenOrder.push_back(id);
         ScreenConfigs[id]->Init(_Folder, screen_json);
     }
 
@@ -315,6 +400,7 @@ int DiaConfiguration::LoadConfig() {
             }
         }
     }
+    DiaGpio_RelaysChanged(_Gpio);
     #endif
 
     json_t *last_update = json_object_get(configuration_json, "lastUpdate");
@@ -394,6 +480,16 @@ DiaConfiguration::~DiaConfiguration() {
             delete curConfig;
         }
     }
+    // Items release their pictures, and packed pictures point into the pack.
+    if (_Prerender) {
+        delete _Prerender;
+    }
+    if (_ImageCache) {
+        delete _ImageCache;
+    }
+    if (_AssetPack) {
+        delete _AssetPack;
+    }
     delete _Runtime;
     if (_Screen) {
         delete _Screen;
@@ -2,6 +2,7 @@
 #define DIA_CONFIGURATION_H
 #include <map>
 #include <string>
+#include <vector>
 #include <jansson.h>
 #include "dia_screen_config.h"
 #include "dia_screen.h"
@@ -41,6 +42,10 @@ public:
         assert(_Screen);
         return _Screen;
     }
+
+    DiaPrerender * GetPrerender() {
+        return _Prerender;
+    }
     
     storage_interface_t *GetStorage() {
         assert(_Storage);
@@ -166,6 +171,11 @@ public:
     DiaGpio * _Gpio;
     DiaRuntimeSvcWeather * _svcWeather;
     storage_interface_t * _Storage;
+    DiaAssetPack * _AssetPack;
+    DiaImageCache * _ImageCache;
+    DiaPrerender * _Prerender;
+    // Screen ids in the order of main.json.
+    std::vector<std::string> _ScreenOrder;
     DiaNetwork * _Net;
     
     
@@ -177,6 +187,9 @@ public:
     int _NeedToRotateTouchScreen;
     
     int _LastButtonPulse;
+    int _PulseCapture;
+    int _PulseMinWidthUs;
+    int _PulseDebounceUs;
 
     int _LastUpdate = -1;
     int _DiscountLastUpdate = -1;
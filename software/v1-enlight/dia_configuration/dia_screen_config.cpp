@@ -8,20 +8,90 @@
 int DiaScreenConfig::Display(DiaScreen * screen) {
     Changed = 0;
     printf("Displaying screen '%s' ..........,,, \n", this->id.c_str());
-    clickAreas.clear();
     auto t1 = std::chrono::high_resolution_clock::now();
-    for (auto it = items_list.begin(); it != items_list.end(); ++it) {
+
+    SDL_Rect canvasRect = {0, 0, (Uint16)screen->Canvas->w, (Uint16)screen->Canvas->h};
+    int canvasArea = dia_rect_area(canvasRect);
+
+    SDL_Rect rects[MAX_DAMAGED_RECTS];
+    int rectsCount = 0;
+    int damagedArea = 0;
+    if (!FullRedraw) {
+        for (auto it = DamagedRects.begin(); it != DamagedRects.end(); ++it) {
+            SDL_Rect visible;
+            if (dia_intersect_rect(*it, canvasRect, &visible)) {
+                rects[rectsCount++] = visible;
+                damagedArea += dia_rect_area(visible);
+            }
+        }
+    }
+    DamagedRects.clear();
+
+    int err = 0;
+    if (FullRedraw || damagedArea * 100 > canvasArea * FULL_REDRAW_DAMAGE_PERCENT) {
+        FullRedraw = 0;
+        err = DisplayItems(screen, NULL);
+        if (err == 0) {
+            screen->FlipFrame();
+        }
+        LastRedrawnPixels = canvasArea;
+    } else {
+        for (int i = 0; i < rectsCount && err == 0; i++) {
+            err = DisplayItems(screen, &rects[i]);
+        }
+        if (err == 0 && FramePrepared) {
+            screen->FlipFrame();
+        } else if (err == 0 && rectsCount > 0) {
+            screen->UpdateRects(rectsCount, rects);
+        }
+        LastRedrawnPixels = damagedArea;
+    }
+
+    auto t2 = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>( t2 - t1 ).count();
+    printf("create screen time '%.3f' ms, redrawn %d pixels (%d%%), %d static items\n", duration/1000.0,
+        LastRedrawnPixels, canvasArea ? (int)((int64_t)LastRedrawnPixels * 100 / canvasArea) : 0,
+        screen->StaticLayerScreen == id ? StaticCount : 0);
+
+    return err;
+}
+
+// Draws items overlapping the area, or all items if area is NULL.
+int DiaScreenConfig::DisplayItems(DiaScreen * screen, SDL_Rect * area) {
+    if (area) {
+        SDL_SetClipRect(screen->Canvas, area);
+    } else {
+        clickAreas.clear();
+    }
+
+    // Static items at the bottom come from the layer
+    int first = 0;
+    if (!FramePrepared && UpdateStaticLayer(screen) == 0) {
+        if (area) {
+            SDL_Rect dst = *area;
+            SDL_BlitSurface(screen->StaticLayer, area, screen->Canvas, &dst);
+        } else {
+            SDL_BlitSurface(screen->StaticLayer, NULL, screen->Canvas, NULL);
+        }
+        first = StaticCount;
+    }
+
+    int err = 0;
+    int index = 0;
+    for (auto it = items_list.begin(); it != items_list.end(); ++it, ++index) {
         DiaScreenItem * currentItem = *it;
         if (currentItem->display_ptr == 0) {
             printf("error: can't display object with empty display\n");
-            return 1;
+            err = 1;
+            break;
         }
         if (currentItem->specific_object_ptr == 0) {
             printf("error: can't display empty object\n");
-            return 1;
+            err = 1;
+            break;
         }
 
-        if (currentItem->type == "image") {
+        if (area == NULL && currentItem->type == "image") {
             DiaScreenItemImage * currentItemImage = (DiaScreenItemImage *)(currentItem->specific_object_ptr);
 
             // Image is a clickable button
@@ -36,24 +106,132 @@ int DiaScreenConfig::Display(DiaScreen * screen) {
             }
         }
 
+        if (index < first) {
+            continue;
+        }
+        if (!currentItem->visible.value) {
+            continue;
+        }
+        if (area && !dia_intersect_rect(*area, currentItem->specific_object_ptr->getRect(), NULL)) {
+            continue;
+        }
+
         printf("--item '%s' of type '%s' --- \n", currentItem->id.c_str(), currentItem->type.c_str());
-        if (currentItem->visible.value) {
-            int err = currentItem->display_ptr(currentItem, currentItem->specific_object_ptr, screen);
-            if (err!=0) {
-                return err;
-            }
-        } else {
-            printf("not visible!\n");
+        err = currentItem->display_ptr(currentItem, currentItem->specific_object_ptr, screen);
+        if (err!=0) {
+            break;
         }
     }
 
-    screen->FlipFrame();
+    if (area) {
+        SDL_SetClipRect(screen->Canvas, NULL);
+    }
+    return err;
+}
+
+int DiaScreenConfig::IsShown() {
+    return LastScreen != 0 && LastScreen->LastDisplayed == id;
+}
+
+// Number of items at the bottom of the z-order the script has not set
+// since the screen was shown.
+int DiaScreenConfig::StaticRun() {
+    int count = 0;
+    for (auto it = items_list.begin(); it != items_list.end(); ++it) {
+        if ((*it)->SetSerial == ShownSerial) {
+            break;
+        }
+        count++;
+    }
+    return count;
+}
+
+// Flattens the static items at the bottom into the static layer of the
+// screen, unless the layer has them already. A static item the script sets
+// becomes dynamic, so the layer is rebuilt without it.
+// Returns 0 if the layer is to be used.
+int DiaScreenConfig::UpdateStaticLayer(DiaScreen * screen) {
+    if (screen->LastDisplayed != id) {
+        return 1;
+    }
+    int count = StaticRun();
+    if (count < STATIC_LAYER_MIN_ITEMS) {
+        if (screen->StaticLayerScreen == id) {
+            screen->StaticLayerScreen = "";
+        }
+        return 1;
+    }
+    if (screen->StaticLayerScreen == id && StaticCount == count) {
+        return 0;
+    }
+
+    SDL_Surface * canvas = screen->Canvas;
+    if (screen->StaticLayer && (screen->StaticLayer->w != canvas->w || screen->StaticLayer->h != canvas->h)) {
+        SDL_FreeSurface(screen->StaticLayer);
+        screen->StaticLayer = 0;
+    }
+    if (!screen->StaticLayer) {
+        screen->StaticLayer = SDL_CreateRGBSurface(SDL_SWSURFACE, canvas->w, canvas->h, canvas->format->BitsPerPixel,
+            canvas->format->Rmask, canvas->format->Gmask, canvas->format->Bmask, 0);
+        if (!screen->StaticLayer) {
+            printf("error: can't create the static layer\n");
+            return 1;
+        }
+    }
+    screen->StaticLayerScreen = "";
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    SDL_FillRect(screen->StaticLayer, NULL, 0);
+    // Items draw on the canvas of the screen
+    screen->Canvas = screen->StaticLayer;
+    int err = 0;
+    int index = 0;
+    for (auto it = items_list.begin(); it != items_list.end() && index < count; ++it, ++index) {
+        DiaScreenItem * currentItem = *it;
+        if (!currentItem->visible.value || currentItem->display_ptr == 0 || currentItem->specific_object_ptr == 0) {
+            continue;
+        }
+        err = currentItem->display_ptr(currentItem, currentItem->specific_object_ptr, screen);
+        if (err) {
+            break;
+        }
+    }
+    screen->Canvas = canvas;
+    if (err) {
+        return 1;
+    }
+    screen->StaticLayerScreen = id;
+    StaticCount = count;
+
     auto t2 = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::microseconds>( t2 - t1 ).count();
-    printf("create screen time '%.3f' ms\n", duration/1000.0);
-
+    printf("static layer of '%s' made of %d items in '%.3f' ms\n", id.c_str(), count, duration/1000.0);
     return 0;
 }
+
+// Remembers the area to be composed again on the next Display call.
+// Overlapping rectangles are merged to avoid drawing the same pixels twice.
+void DiaScreenConfig::AddDamage(SDL_Rect rect) {
+    if (FullRedraw || rect.w == 0 || rect.h == 0) {
+        return;
+    }
+
+    for (auto it = DamagedRects.begin(); it != DamagedRects.end(); ) {
+        if (dia_intersect_rect(*it, rect, NULL)) {
+            rect = dia_union_rect(rect, *it);
+            it = DamagedRects.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    DamagedRects.push_back(rect);
+
+    if (DamagedRects.size() > MAX_DAMAGED_RECTS) {
+        DamagedRects.clear();
+        FullRedraw = 1;
+    }
+}
+
 int DiaScreenConfig::Init(std::string folder, json_t * screen_json) {
     Folder = folder;
     if(screen_json == 0) {
@@ -132,6 +310,14 @@ DiaScreenConfig::~DiaScreenConfig() {
 
 DiaScreenConfig::DiaScreenConfig() {
     Changed = 1;
+    FullRedraw = 1;
+    LastRedrawnPixels = 0;
+    FramePrepared = 0;
+    ShownSerial = 0;
+    LastScreen = 0;
+    StaticCount = 0;
+    ImageCache = 0;
+    Prerender = 0;
 }
 
 int DiaScreenConfig::InitDetails(json_t *screen_json) {
@@ -169,6 +355,8 @@ int dia_screen_config_set_value_function (void * object, const char *element,
         printf("item is not found :( \n");
         return 1;
     }
+    // Values set just before the screen is switched to count for that showing
+    foundItem->SetSerial = screen->ShownSerial + (screen->IsShown() ? 0 : 1);
     return foundItem->SetValue(key, value);
 }
 
@@ -176,6 +364,7 @@ int dia_screen_config_set_value_function (void * object, const char *element,
 int dia_screen_display_screen (void * screen_object, void * screen_config) {
     DiaScreenConfig * screenConfig = (DiaScreenConfig *)screen_config;
     DiaScreen * screen = (DiaScreen *)screen_object;
+    screenConfig->LastScreen = screen;
     if (screenConfig->id == screen->LastDisplayed) {
         if (screenConfig->Changed) {
             screenConfig->Changed = 0;
@@ -185,8 +374,23 @@ int dia_screen_display_screen (void * screen_object, void * screen_config) {
         // if everything is the same we do not need to do anything
         return 1;
     }
+    std::string from = screen->LastDisplayed;
     screen->LastDisplayed = screenConfig->id;
+    screenConfig->ShownSerial++;
+    DiaImageCache_SetScreen(screenConfig->ImageCache, screenConfig->id);
     screenConfig->Changed = 0;
-    printf("real2:[%s]\n",screenConfig->id.c_str() );
-    return screenConfig->Display(screen);
+    screenConfig->FramePrepared = DiaPrerender_Take(screenConfig->Prerender, screenConfig, screen);
+    screenConfig->FullRedraw = !screenConfig->FramePrepared;
+    printf("real2:[%s]%s\n",screenConfig->id.c_str(), screenConfig->FramePrepared ? " prerendered" : "");
+    int err = screenConfig->Display(screen);
+    screenConfig->FramePrepared = 0;
+    DiaPrerender_Learn(screenConfig->Prerender, from, screenConfig);
+    DiaPrerender_PrintStat(screenConfig->Prerender);
+    return err;
+}
+
+// Prepares the screen which is going to be shown soon.
+int dia_screen_prefetch_screen (void * screen_config) {
+    DiaScreenConfig * screenConfig = (DiaScreenConfig *)screen_config;
+    return DiaPrerender_Request(screenConfig->Prerender, screenConfig);
 }
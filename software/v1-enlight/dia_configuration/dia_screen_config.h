@@ -10,8 +10,17 @@
 #include "dia_screen_item.h"
 #include "dia_screen.h"
 #include "dia_all_items.h"
+#include "dia_image_cache.h"
+#include "dia_prerender.h"
 #include <SDL.h>
 
+// More damaged rectangles than this are not worth tracking separately.
+#define MAX_DAMAGED_RECTS 16
+// Full frame is flipped when damage covers more than this part of the screen.
+#define FULL_REDRAW_DAMAGE_PERCENT 60
+// Fewer static items at the bottom are drawn directly, not from the layer.
+#define STATIC_LAYER_MIN_ITEMS 2
+
 class AreaItem
 {
     public:
@@ -29,6 +38,25 @@ public:
     std::string Folder;
     std::string background;
     int Changed;
+    // Pictures of image and image_array items.
+    DiaImageCache * ImageCache;
+    // Prepares the screen before it is shown.
+    DiaPrerender * Prerender;
+
+    // Set when the whole screen must be composed again, e.g. after switching to it.
+    int FullRedraw;
+    std::list<SDL_Rect> DamagedRects;
+    // Pixels composed by the last Display call.
+    int LastRedrawnPixels;
+    // The prerendered frame is on the canvas, the whole of it is flipped.
+    int FramePrepared;
+
+    // Incremented every time the screen is switched to.
+    int ShownSerial;
+    // Screen the config was displayed on last, 0 before.
+    DiaScreen * LastScreen;
+    // Items at the bottom of the z-order drawn from the static layer.
+    int StaticCount;
 
     std::list<DiaScreenItem *> items_list;
     std::map<std::string, DiaScreenItem *> items_map;
@@ -38,11 +66,17 @@ public:
     int InitDetails(json_t *screen_json);
     int AddItem(DiaScreenItem * item);
     int Display(DiaScreen * screen);
+    int DisplayItems(DiaScreen * screen, SDL_Rect * area);
+    void AddDamage(SDL_Rect rect);
+    int IsShown();
+    int StaticRun();
+    int UpdateStaticLayer(DiaScreen * screen);
     ~DiaScreenConfig();
     DiaScreenConfig();
 };
 
 int dia_screen_config_set_value_function (void * object, const char *element, const char * key, const char * value);
 int dia_screen_display_screen (void * screen_object, void * screen_config);
+int dia_screen_prefetch_screen (void * screen_config);
 
 #endif
@@ -10,6 +10,7 @@ DiaScreenItem::DiaScreenItem(DiaScreenConfig * newParent) {
     notify_ptr = 0;
     specific_object_ptr = 0;
     Parent = newParent;
+    SetSerial = -1;
 }
 
 int DiaScreenItem::Init(json_t * screen_item_json) {
@@ -116,6 +117,7 @@ int DiaScreenItem::SetValue(std::string key, std::string value) {
         if (err) return err;
         if (oldVisible != visible.value) {
             Parent->Changed = 1;
+            MarkDamaged();
         }
         return 0;
     }
@@ -125,7 +127,12 @@ int DiaScreenItem::SetValue(std::string key, std::string value) {
 
         items[key] = value;
         if(notify_ptr!=0) {
-            return notify_ptr(this, specific_object_ptr, key);
+            // The old area must be repainted as well, since a position or
+            // size change moves the item away from it.
+            MarkDamaged();
+            int err = notify_ptr(this, specific_object_ptr, key);
+            MarkDamaged();
+            return err;
         }
     } else {
         
@@ -134,7 +141,10 @@ int DiaScreenItem::SetValue(std::string key, std::string value) {
         if (oldValue.compare(value)!=0) {
             Parent->Changed = 1;
             if(notify_ptr!=0) {
-                return notify_ptr(this, specific_object_ptr, key);
+                MarkDamaged();
+                int err = notify_ptr(this, specific_object_ptr, key);
+                MarkDamaged();
+                return err;
             } else {
                 printf("can't notify element, warning\n");
             }
@@ -144,6 +154,13 @@ int DiaScreenItem::SetValue(std::string key, std::string value) {
     return 0;
 }
 
+void DiaScreenItem::MarkDamaged() {
+    if (specific_object_ptr == 0 || Parent == 0) {
+        return;
+    }
+    Parent->AddDamage(specific_object_ptr->getRect());
+}
+
 DiaScreenItem::~DiaScreenItem() {
     printf("~DiaScreenItem();\n");
     if(type.compare("digits")==0 ) {
@@ -176,6 +193,16 @@ DiaScreenItem::~DiaScreenItem() {
         } else {
             printf("qr can't be deleted \n");
         }
+    } else if(type.compare("image_array")==0 ){
+        printf("image_array object to be destroyed...\n");
+        if(specific_object_ptr!=0) {
+            DiaScreenItemImageArray * image_array = (DiaScreenItemImageArray *) this->specific_object_ptr;
+            delete image_array;
+            specific_object_ptr = 0;
+            printf("image_array deleted \n");
+        } else {
+            printf("image_array can't be deleted \n");
+        }
     } else {
         printf("error, can't destroy type '%s'\n", type.c_str() );
     }
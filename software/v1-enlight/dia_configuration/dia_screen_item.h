@@ -10,6 +10,8 @@
 class SpecificObjectPtr {
     public:
         virtual DiaIntPair getSize() = 0;
+        // Area of the screen the object covers when displayed.
+        virtual SDL_Rect getRect() = 0;
         virtual void SetPicture(SDL_Surface * newPicture) = 0;
         virtual void SetScaledPicture(SDL_Surface * newPicture) = 0;
 };
@@ -22,6 +24,9 @@ public:
     std::string type;
     DiaBoolean visible;
     DiaScreenConfig *Parent;
+    // ShownSerial of the parent the script set a value for, -1 if never.
+    // Items set since the screen was shown are drawn over its static layer.
+    int SetSerial;
 
     // virtual function to display an element
 
@@ -42,6 +47,8 @@ public:
     std::string GetValue(std::string key, int * error);
     int SetValue(std::string key, std::string value);
     int SetValue(std::string key, json_t * value);
+    // Reports the area covered by the item as damaged to the parent screen.
+    void MarkDamaged();
 };
 
 
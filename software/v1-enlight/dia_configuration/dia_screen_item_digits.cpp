@@ -1,4 +1,5 @@
 #include "dia_screen_item_digits.h"
+#include "dia_functions.h"
 
 int DiaScreenItemDigits::Init(DiaScreenItem *base_item, json_t * item_json) {
     if (item_json == 0) {
@@ -85,6 +86,24 @@ DiaIntPair DiaScreenItemDigits::getSize(){
     return this->size;
 }
 
+// Covers all possible digit places, so shorter numbers erase longer ones.
+SDL_Rect DiaScreenItemDigits::getRect() {
+    SDL_Rect rect = {0, 0, 0, 0};
+    int first = 1;
+    for (int i = 0; i < length.value && i < MAX_DIGITS; i++) {
+        if (OutputRectangles[i] == 0) {
+            continue;
+        }
+        if (first) {
+            rect = *OutputRectangles[i];
+            first = 0;
+        } else {
+            rect = dia_union_rect(rect, *OutputRectangles[i]);
+        }
+    }
+    return rect;
+}
+
 void DiaScreenItemDigits::SetPicture(SDL_Surface * newPicture){
 
 }
@@ -145,10 +164,12 @@ int dia_screen_item_digits_display(DiaScreenItem * base_item, void * digits_ptr,
     }
 
     for(int i = 0; i<nums_to_output; i++) {
+        // SDL_BlitSurface clips the destination rectangle in place
+        SDL_Rect dst = *digits->OutputRectangles[i];
         SDL_BlitSurface(fontImage,
             digits->font.SymbolRect[(int)output[i]],
             screen->Canvas,
-            digits->OutputRectangles[i]);
+            &dst);
     }
 
     return 0;
@@ -24,6 +24,7 @@ public:
     SDL_Rect * OutputRectangles[MAX_DIGITS];
 
     virtual DiaIntPair getSize();
+    virtual SDL_Rect getRect();
     virtual void SetPicture(SDL_Surface * newPicture);
     virtual void SetScaledPicture(SDL_Surface * newPicture);
 
@@ -41,6 +41,7 @@ void DiaScreenItemImage::Rescale() {
 DiaScreenItemImage::DiaScreenItemImage() {
     Picture = 0;
     ScaledPicture = 0;
+    Entry = 0;
     OutputRectangle = (SDL_Rect *)malloc(sizeof(SDL_Rect));
 }
 
@@ -48,6 +49,29 @@ DiaIntPair DiaScreenItemImage::getSize(){
     return this->size;
 }
 
+SDL_Rect DiaScreenItemImage::getRect() {
+    SDL_Rect rect;
+    rect.x = position.x;
+    rect.y = position.y;
+    rect.w = size.x;
+    rect.h = size.y;
+
+    if (Entry) {
+        int w, h;
+        DiaImageCache_GetSize(Entry, &w, &h);
+        rect.w = w;
+        rect.h = h;
+        return rect;
+    }
+
+    SDL_Surface * curPict = ScaledPicture ? ScaledPicture : Picture;
+    if (curPict) {
+        rect.w = curPict->w;
+        rect.h = curPict->h;
+    }
+    return rect;
+}
+
 void DiaScreenItemImage::SetPicture(SDL_Surface * newPicture) {
     if (Picture!=0) {
         SDL_FreeSurface(Picture);
@@ -72,10 +96,12 @@ DiaScreenItemImage::~DiaScreenItemImage() {
         Picture = 0;
     }
     if (ScaledPicture!=0) {
-        printf("\nSDL_FreeSurface(Picture);\n");
-        SDL_FreeSurface(Picture);
-        Picture = 0;
+        printf("\nSDL_FreeSurface(ScaledPicture);\n");
+        SDL_FreeSurface(ScaledPicture);
+        ScaledPicture = 0;
     }
+    DiaImageCache_Release(Entry, EntryScreen);
+    Entry = 0;
     if(OutputRectangle!=0) {
         printf("\nfree(OutputRectangle);\n");
         free(OutputRectangle);
@@ -96,19 +122,18 @@ int dia_screen_item_image_display(DiaScreenItem * base_item, void * image_ptr, D
 
     DiaScreenItemImage * myImg = (DiaScreenItemImage *)image_ptr;
 
-    SDL_Surface * curPict = myImg->Picture;
-
-    if (myImg->ScaledPicture) {
-        curPict = myImg->ScaledPicture;
-        printf("scaled picture used\n");
-    } else {
-        printf("original img used \n");
+    SDL_Surface * curPict = DiaImageCache_Get(myImg->Entry);
+    if (!curPict) {
+        printf("error: img '%s' is not loaded\n", myImg->src.value.c_str());
+        return 0;
     }
 
+    // SDL_BlitSurface clips the destination rectangle in place
+    SDL_Rect dst = *myImg->OutputRectangle;
     SDL_BlitSurface(curPict,
                 NULL,
                 screen->Canvas,
-                myImg->OutputRectangle);
+                &dst);
 
     printf("img '%s' displayed at (%d, %d) size (%d, %d) \n", myImg->src.value.c_str(),
     myImg->OutputRectangle->x,
@@ -119,6 +144,22 @@ int dia_screen_item_image_display(DiaScreenItem * base_item, void * image_ptr, D
     return 0;
 }
 
+// Points the item to the picture of its src at its size in the image cache,
+// the picture is loaded when it is displayed.
+static int dia_screen_item_image_acquire(DiaScreenItem * base_item, DiaScreenItemImage * obj) {
+    DiaImageCacheEntry * entry = DiaImageCache_Acquire(base_item->Parent->ImageCache, base_item->Parent->id,
+        obj->src.value.c_str(), obj->size.x, obj->size.y);
+    // Released after acquiring to keep the picture if src and size are the same
+    DiaImageCache_Release(obj->Entry, obj->EntryScreen);
+    obj->Entry = entry;
+    obj->EntryScreen = base_item->Parent->id;
+    if (!entry) {
+        printf("error: no image cache for '%s'\n", obj->src.value.c_str());
+        return 1;
+    }
+    return 0;
+}
+
 int dia_screen_item_image_notify(DiaScreenItem * base_item, void * image_ptr, std::string key) {
     int error = 0;
     std::string value = base_item->GetValue(key, &error);
@@ -137,32 +178,16 @@ int dia_screen_item_image_notify(DiaScreenItem * base_item, void * image_ptr, st
         obj->size.Init(value);
         obj->OutputRectangle->w = obj->size.x;
         obj->OutputRectangle->h = obj->size.y;
-        obj->Rescale();
+        if (obj->Entry) {
+            return dia_screen_item_image_acquire(base_item, obj);
+        }
     } else
     if (key.compare("click_id") == 0) {
         obj->click_id.Init(value);
     } else 
     if (key.compare("src") == 0) {
         obj->src.Init(value);
-        std::string full_name = base_item->Parent->Folder;
-        full_name+="/";
-        full_name+=obj->src.value;
-        SDL_Surface *tmpImg = IMG_Load(full_name.c_str());
-
-        if(!tmpImg) {
-            printf("error: IMG_Load: %s\n", IMG_GetError());
-            printf("%s error\n", full_name.c_str());
-            return 1;
-        }
-        SDL_Surface *newImg;
-        if (tmpImg->format->Amask==0) {
-            newImg = SDL_DisplayFormat(tmpImg);
-        } else {
-            newImg = SDL_DisplayFormatAlpha(tmpImg);
-        }
-        obj->SetPicture(newImg);
-        obj->Rescale();
-        SDL_FreeSurface(tmpImg);
+        return dia_screen_item_image_acquire(base_item, obj);
 	} else {
         printf("unknown key for image object: '%s' \n", key.c_str());
         return 1;
@@ -17,9 +17,13 @@ public:
     SDL_Rect * OutputRectangle;
     SDL_Surface * Picture;
     SDL_Surface * ScaledPicture;
+    // Picture of src at size, Picture and ScaledPicture are used by qr items.
+    DiaImageCacheEntry * Entry;
+    std::string EntryScreen;
     int Init(DiaScreenItem * base_item,json_t * item_json);
 
     virtual DiaIntPair getSize();
+    virtual SDL_Rect getRect();
     virtual void SetPicture(SDL_Surface * newPicture);
     virtual void SetScaledPicture(SDL_Surface * newPicture);
 
@@ -42,31 +42,56 @@ int DiaScreenItemImageArray::Init(DiaScreenItem *base_item, json_t * item_json)
 
 DiaScreenItemImageArray::DiaScreenItemImageArray() {
     for (int i = 0; i < MAX_PICTURES; i++) {
-        Pictures[i] = 0;
-        ScaledPictures[i] = 0;
+        Frames[i] = 0;
     }
     OutputRectangle = (SDL_Rect *)malloc(sizeof(SDL_Rect));
     appendPos = 0;
 }
 
-void DiaScreenItemImageArray::AppendPicture(SDL_Surface * newPicture) {
+void DiaScreenItemImageArray::AppendFrame(DiaImageCacheEntry * frame) {
     if (this->appendPos == MAX_PICTURES - 1) {
         printf("Image array OVERFLOW: can't append new image\n");
+        DiaImageCache_Release(frame, FramesScreen);
         return;
     }
 
-    if (Pictures[this->appendPos] != 0) {
-        SDL_FreeSurface(Pictures[this->appendPos]);
-        Pictures[this->appendPos] = 0;
+    if (Frames[this->appendPos] != 0) {
+        DiaImageCache_Release(Frames[this->appendPos], FramesScreen);
+        Frames[this->appendPos] = 0;
     }
 
-    Pictures[this->appendPos] = newPicture;
+    Frames[this->appendPos] = frame;
     appendPos++;
 }
 
 DiaIntPair DiaScreenItemImageArray::getSize(){
     return this->size;
 }
+SDL_Rect DiaScreenItemImageArray::getRect() {
+    SDL_Rect rect;
+    rect.x = position.x;
+    rect.y = position.y;
+    rect.w = size.x;
+    rect.h = size.y;
+
+    int picture_to_show = index.value;
+    if (picture_to_show > length.value - 1) {
+        picture_to_show = length.value - 1;
+    }
+    if (picture_to_show < 0) {
+        picture_to_show = 0;
+    }
+    if (Frames[picture_to_show]) {
+        int w, h;
+        DiaImageCache_GetSize(Frames[picture_to_show], &w, &h);
+        if (w > 0 && h > 0) {
+            rect.w = w;
+            rect.h = h;
+        }
+    }
+    return rect;
+}
+
 void DiaScreenItemImageArray::SetPicture(SDL_Surface * newPicture){
 
 }
@@ -76,10 +101,8 @@ void DiaScreenItemImageArray::SetScaledPicture(SDL_Surface * newPicture){
 
 DiaScreenItemImageArray::~DiaScreenItemImageArray() {
     for (int i = 0; i < MAX_PICTURES; i++) {
-        if (Pictures[i] != 0) {
-            SDL_FreeSurface(Pictures[i]);
-            Pictures[i] = 0;
-        }
+        DiaImageCache_Release(Frames[i], FramesScreen);
+        Frames[i] = 0;
     }
     if (OutputRectangle != 0) {
         free(OutputRectangle);
@@ -112,12 +135,18 @@ int dia_screen_item_image_array_display(DiaScreenItem * base_item, void * image_
         picture_to_show = high_boundary;
     }
    
-    SDL_Surface * currentPicture = image_array->Pictures[picture_to_show];
+    SDL_Surface * currentPicture = DiaImageCache_Get(image_array->Frames[picture_to_show]);
+    if (!currentPicture) {
+        printf("error: frame %d is not loaded\n", picture_to_show);
+        return 0;
+    }
 
+    // SDL_BlitSurface clips the destination rectangle in place
+    SDL_Rect dst = *image_array->OutputRectangle;
     SDL_BlitSurface(currentPicture,
                 NULL,
                 screen->Canvas,
-                image_array->OutputRectangle);
+                &dst);
 
     printf("img displayed at (%d, %d) size (%d, %d) \n",
     image_array->OutputRectangle->x,
@@ -157,26 +186,14 @@ int dia_screen_item_image_array_notify(DiaScreenItem * base_item, void * image_a
         obj->index.Init(value);
     } else
     if (key.compare("src") == 0) {
-        std::string full_name = base_item->Parent->Folder;
-
-        full_name += "/";
-        full_name += value;
-
-        SDL_Surface *tmpImg = IMG_Load(full_name.c_str());
-
-        if (!tmpImg) {
-            printf("error: IMG_Load: %s\n", IMG_GetError());
-            printf("%s error\n", full_name.c_str());
+        DiaImageCacheEntry * frame = DiaImageCache_Acquire(base_item->Parent->ImageCache, base_item->Parent->id,
+            value.c_str(), 0, 0);
+        if (!frame) {
+            printf("error: no image cache for '%s'\n", value.c_str());
             return 1;
         }
-        SDL_Surface *newImg;
-        if (tmpImg->format->Amask==0) {
-            newImg = SDL_DisplayFormat(tmpImg);
-        } else {
-            newImg = SDL_DisplayFormatAlpha(tmpImg);
-        }
-        SDL_FreeSurface(tmpImg);
-        obj->AppendPicture(newImg);
+        obj->FramesScreen = base_item->Parent->id;
+        obj->AppendFrame(frame);
 	} else {
         printf("unknown key for image object: '%s' \n", key.c_str());
         return 1;
@@ -17,18 +17,20 @@ public:
     DiaNumber index;
 
     SDL_Rect * OutputRectangle;
-    SDL_Surface * Pictures[MAX_PICTURES];
-    SDL_Surface * ScaledPictures[MAX_PICTURES];
+    // Frames in the image cache, loaded when displayed.
+    DiaImageCacheEntry * Frames[MAX_PICTURES];
+    std::string FramesScreen;
 
     int appendPos;
 
     int Init(DiaScreenItem * base_item, json_t * item_json);
     
     virtual DiaIntPair getSize();
+    virtual SDL_Rect getRect();
     virtual void SetPicture(SDL_Surface * newPicture);
     virtual void SetScaledPicture(SDL_Surface * newPicture);
 
-    void AppendPicture(SDL_Surface * newPicture);
+    void AppendFrame(DiaImageCacheEntry * frame);
     //void Rescale();
 
     ~DiaScreenItemImageArray();
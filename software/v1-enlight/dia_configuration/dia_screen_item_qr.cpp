@@ -2,7 +2,43 @@
 #include "dia_screen_item_qr.h"
 #include "dia_functions.h"
 
+#include <pthread.h>
+#include <list>
+#include <utility>
+
+// Recently rendered codes, the most recently used first. The cache holds
+// one reference to every surface, items showing a code hold another one.
+static std::list<std::pair<std::string, SDL_Surface *> > qr_cache;
+static pthread_mutex_t qr_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static SDL_Surface * dia_qr_cache_get(const std::string & key) {
+    SDL_Surface * res = 0;
+    pthread_mutex_lock(&qr_cache_lock);
+    for (auto it = qr_cache.begin(); it != qr_cache.end(); ++it) {
+        if (it->first == key) {
+            res = it->second;
+            res->refcount++;
+            qr_cache.splice(qr_cache.begin(), qr_cache, it);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&qr_cache_lock);
+    return res;
+}
+
+static void dia_qr_cache_put(const std::string & key, SDL_Surface * surface) {
+    pthread_mutex_lock(&qr_cache_lock);
+    surface->refcount++;
+    qr_cache.push_front(std::make_pair(key, surface));
+    while (qr_cache.size() > QR_CACHE_SIZE) {
+        SDL_FreeSurface(qr_cache.back().second);
+        qr_cache.pop_back();
+    }
+    pthread_mutex_unlock(&qr_cache_lock);
+}
+
 DiaScreenItemQr::DiaScreenItemQr() {
+    QrPicture = 0;
 }
 
 DiaScreenItemQr::~DiaScreenItemQr() {
@@ -35,18 +71,32 @@ int DiaScreenItemQr::Init(DiaScreenItem *base_item, json_t * item_json) {
 
 int DiaScreenItemQr::SetQr(std::string url) {
     const QrCode::Ecc errCorLvl = QrCode::Ecc::HIGHERR;  // Error correction level
-    const QrCode qr = QrCode::encodeText(url.c_str(), errCorLvl);
-    SDL_Surface *qrSurface = dia_QRToSurface(qr);
+    int width = this->getSize().x;
+    int height = this->getSize().y;
 
-    SDL_Surface * scaledSurface = dia_ScaleSurface(qrSurface, this->getSize().x, this->getSize().y);
-    SDL_Surface * scaledQR = SDL_DisplayFormat(scaledSurface);
-    this->SetScaledPicture(scaledQR);
-    SDL_FreeSurface(scaledSurface);
+    std::string key = std::to_string((int)errCorLvl) + ":" + std::to_string(width) + "x" + std::to_string(height) + ":" + url;
+    if (key == QrKey && ScaledPicture != 0 && ScaledPicture == QrPicture) {
+        return 1;
+    }
 
-    if (qrSurface!=0) {
+    SDL_Surface * scaledQR = dia_qr_cache_get(key);
+    if (scaledQR == 0) {
+        const QrCode qr = QrCode::encodeText(url.c_str(), errCorLvl);
+        SDL_Surface * qrSurface = dia_QRToScaledSurface(qr, width, height);
+        if (qrSurface == 0) {
+            return 1;
+        }
+        scaledQR = SDL_DisplayFormat(qrSurface);
         SDL_FreeSurface(qrSurface);
+        if (scaledQR == 0) {
+            return 1;
+        }
+        dia_qr_cache_put(key, scaledQR);
     }
 
+    this->SetScaledPicture(scaledQR);
+    QrPicture = scaledQR;
+    QrKey = key;
     return 1;
 }
 
@@ -77,10 +127,12 @@ int dia_screen_item_qr_display(DiaScreenItem * base_item, void * image_ptr, DiaS
         printf("original qr used \n");
     }
 
+    // SDL_BlitSurface clips the destination rectangle in place
+    SDL_Rect dst = *myQr->OutputRectangle;
     SDL_BlitSurface(curPict,
                 NULL,
                 screen->Canvas,
-                myQr->OutputRectangle);
+                &dst);
 
     printf("qr '%s' displayed at (%d, %d) size (%d, %d) \n", myQr->src.value.c_str(),
     myQr->OutputRectangle->x,
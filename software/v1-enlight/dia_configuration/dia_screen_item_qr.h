@@ -7,9 +7,16 @@
 #include <dia_functions.h>
 #include "dia_screen_item_image.h"
 
+// Amount of recently rendered codes kept ready for display.
+#define QR_CACHE_SIZE 8
+
 class DiaScreenItemQr : public DiaScreenItemImage {
 public:
     DiaString url;
+    // (text, size, ECC) of the code in QrPicture.
+    std::string QrKey;
+    // Rendered code; Rescale can replace ScaledPicture with the src picture.
+    SDL_Surface * QrPicture;
 
     int Init(DiaScreenItem * base_item, json_t * item_json);
     int SetQr(std::string url);
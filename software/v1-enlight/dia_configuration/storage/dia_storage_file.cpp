@@ -0,0 +1,257 @@
+#include "dia_storage_file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dia_crc.h"
+
+static void DiaStorageFile_EncodeRecord(std::string *out, const std::string &key, const std::string &value) {
+    storage_file_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.magic = STORAGE_FILE_MAGIC;
+    record.key_length = key.size();
+    record.length = value.size();
+
+    uint32_t crc = dia_crc32(0, &record, sizeof(record));
+    crc = dia_crc32(crc, key.data(), key.size());
+    record.crc = dia_crc32(crc, value.data(), value.size());
+
+    out->append((const char *)&record, sizeof(record));
+    out->append(key);
+    out->append(value);
+}
+
+// Calls handler for every valid record up to the first broken one,
+// returns the size of the valid ones.
+static size_t DiaStorageFile_ForEachRecord(const std::string &data, void *arg,
+    void (*handler)(void *arg, const char *key, size_t keyLength, const char *value, size_t length)) {
+    size_t offset = 0;
+    while (offset + sizeof(storage_file_record_t) <= data.size()) {
+        storage_file_record_t record;
+        memcpy(&record, data.data() + offset, sizeof(record));
+        if (record.magic != STORAGE_FILE_MAGIC) {
+            break;
+        }
+        // Each length is compared with what is left, so corrupt lengths
+        // can't wrap around on 32-bit size_t.
+        size_t left = data.size() - offset - sizeof(record);
+        if (record.key_length > left || record.length > left - record.key_length) {
+            break;
+        }
+        size_t size = sizeof(record) + (size_t)record.key_length + record.length;
+        uint32_t expected = record.crc;
+        record.crc = 0;
+        uint32_t crc = dia_crc32(0, &record, sizeof(record));
+        crc = dia_crc32(crc, data.data() + offset + sizeof(record), size - sizeof(record));
+        if (crc != expected) {
+            break;
+        }
+
+        const char *key = data.data() + offset + sizeof(record);
+        handler(arg, key, record.key_length, key + record.key_length, record.length);
+        offset += size;
+    }
+    return offset;
+}
+
+static void DiaStorageFile_LoadRecord(void *arg, const char *key, size_t keyLength, const char *value, size_t length) {
+    DiaStorageFile *storage = (DiaStorageFile *)arg;
+    storage->Values[std::string(key, keyLength)] = std::string(value, length);
+}
+
+static void DiaStorageFile_FailRecord(void *arg, const char *key, size_t keyLength, const char *value, size_t length) {
+    DiaStorageFile *storage = (DiaStorageFile *)arg;
+    storage->Unsynced.insert(std::string(key, keyLength));
+}
+
+static void DiaStorageFile_SyncRecord(void *arg, const char *key, size_t keyLength, const char *value, size_t length) {
+    DiaStorageFile *storage = (DiaStorageFile *)arg;
+    storage->Unsynced.erase(std::string(key, keyLength));
+}
+
+static size_t DiaStorageFile_ReadFile(void *arg, const std::string &data) {
+    DiaStorageFile *storage = (DiaStorageFile *)arg;
+    size_t valid = DiaStorageFile_ForEachRecord(data, storage, DiaStorageFile_LoadRecord);
+
+    storage->LiveBytes = 0;
+    for (std::map<std::string, std::string>::iterator it = storage->Values.begin(); it != storage->Values.end(); ++it) {
+        storage->LiveBytes += sizeof(storage_file_record_t) + it->first.size() + it->second.size();
+    }
+    return valid;
+}
+
+// Keys of a failed batch are saved again even if unchanged. The file is
+// rewritten with the latest values only once it is bigger than
+// STORAGE_FILE_COMPACT_BYTES and twice as big as they are.
+static int DiaStorageFile_Committed(void *arg, const std::string &batch, int err) {
+    DiaStorageFile *storage = (DiaStorageFile *)arg;
+    if (err != DIA_LOG_FILE_NO_ERROR) {
+        DiaStorageFile_ForEachRecord(batch, storage, DiaStorageFile_FailRecord);
+    } else if (!storage->Unsynced.empty()) {
+        DiaStorageFile_ForEachRecord(batch, storage, DiaStorageFile_SyncRecord);
+    }
+    return storage->Log.FileBytes > STORAGE_FILE_COMPACT_BYTES && storage->Log.FileBytes > storage->LiveBytes * 2;
+}
+
+// Encodes the latest values for the rewritten file, unsynced ones included.
+static void DiaStorageFile_Snapshot(void *arg, std::string *data) {
+    DiaStorageFile *storage = (DiaStorageFile *)arg;
+    for (std::map<std::string, std::string>::iterator it = storage->Values.begin(); it != storage->Values.end(); ++it) {
+        DiaStorageFile_EncodeRecord(data, it->first, it->second);
+    }
+    storage->Unsynced.clear();
+}
+
+int DiaStorageFile_Open(DiaStorageFile *storage) {
+    if (!storage) {
+        return STORAGE_FILE_NULL_PARAMETER;
+    }
+
+    storage->Log.Load = DiaStorageFile_ReadFile;
+    storage->Log.Committed = DiaStorageFile_Committed;
+    storage->Log.Snapshot = DiaStorageFile_Snapshot;
+    storage->Log.Owner = storage;
+    if (DiaLogFile_Open(&storage->Log) != DIA_LOG_FILE_NO_ERROR) {
+        return STORAGE_FILE_OPEN_ERROR;
+    }
+    printf("Storage: %s opened, %d keys\n", storage->Log.Path.c_str(), (int)storage->Values.size());
+    return STORAGE_FILE_NO_ERROR;
+}
+
+// Updates the value and queues its record. Returns the number of the
+// record, 0 if the value was already stored.
+static uint64_t DiaStorageFile_Queue(DiaStorageFile *storage, const char *key, const void *data, size_t length) {
+    std::string keyString(key);
+    std::string value((const char *)data, length);
+    uint64_t record = 0;
+
+    pthread_mutex_lock(&storage->Log.Lock);
+    storage->Stat.saves++;
+    storage->Stat.bytes_saved += length;
+    std::map<std::string, std::string>::iterator it = storage->Values.find(keyString);
+    if (it != storage->Values.end() && it->second == value && !storage->Unsynced.count(keyString)) {
+        storage->Stat.unchanged++;
+    } else {
+        size_t pending = storage->Log.Pending.size();
+        DiaStorageFile_EncodeRecord(&storage->Log.Pending, keyString, value);
+        storage->Unsynced.erase(keyString);
+        if (it != storage->Values.end()) {
+            storage->LiveBytes -= sizeof(storage_file_record_t) + it->first.size() + it->second.size();
+        }
+        storage->LiveBytes += storage->Log.Pending.size() - pending;
+        storage->Values[keyString].swap(value);
+        record = DiaLogFile_Queue(&storage->Log);
+    }
+    pthread_mutex_unlock(&storage->Log.Lock);
+    return record;
+}
+
+int DiaStorageFile_Save(DiaStorageFile *storage, const char *key, const void *data, size_t length) {
+    if (!storage || !key || (!data && length) || !storage->Log.WriterThread) {
+        return STORAGE_FILE_NULL_PARAMETER;
+    }
+    uint64_t record = DiaStorageFile_Queue(storage, key, data, length);
+    if (!record) {
+        return STORAGE_FILE_NO_ERROR;
+    }
+    pthread_mutex_lock(&storage->Log.Lock);
+    int err = DiaLogFile_WaitSynced(&storage->Log, record - 1, record);
+    pthread_mutex_unlock(&storage->Log.Lock);
+    if (err != DIA_LOG_FILE_NO_ERROR) {
+        printf("Storage: can't save [%s]\n", key);
+        return STORAGE_FILE_WRITE_ERROR;
+    }
+    return STORAGE_FILE_NO_ERROR;
+}
+
+int DiaStorageFile_SaveAsync(DiaStorageFile *storage, const char *key, const void *data, size_t length) {
+    if (!storage || !key || (!data && length) || !storage->Log.WriterThread) {
+        return STORAGE_FILE_NULL_PARAMETER;
+    }
+    DiaStorageFile_Queue(storage, key, data, length);
+    return STORAGE_FILE_NO_ERROR;
+}
+
+int DiaStorageFile_Flush(DiaStorageFile *storage) {
+    if (!storage || !storage->Log.WriterThread) {
+        return STORAGE_FILE_NULL_PARAMETER;
+    }
+    pthread_mutex_lock(&storage->Log.Lock);
+    int err = DiaLogFile_WaitSynced(&storage->Log, storage->Log.SyncedRecords, storage->Log.QueuedRecords);
+    pthread_mutex_unlock(&storage->Log.Lock);
+    return err == DIA_LOG_FILE_NO_ERROR ? STORAGE_FILE_NO_ERROR : STORAGE_FILE_WRITE_ERROR;
+}
+
+int DiaStorageFile_Load(DiaStorageFile *storage, const char *key, void *data, size_t length) {
+    if (!storage || !key || (!data && length)) {
+        return STORAGE_FILE_NULL_PARAMETER;
+    }
+    int err = STORAGE_FILE_NO_ERROR;
+    pthread_mutex_lock(&storage->Log.Lock);
+    storage->Stat.loads++;
+    std::map<std::string, std::string>::iterator it = storage->Values.find(key);
+    if (it == storage->Values.end()) {
+        err = STORAGE_FILE_NOT_FOUND;
+    } else if (it->second.size() != length) {
+        printf("Storage: [%s] has %d bytes, %d expected\n", key, (int)it->second.size(), (int)length);
+        err = STORAGE_FILE_WRONG_LENGTH;
+    } else {
+        memcpy(data, it->second.data(), length);
+    }
+    pthread_mutex_unlock(&storage->Log.Lock);
+    return err;
+}
+
+int DiaStorageFile_Get(DiaStorageFile *storage, const char *key, std::string *value) {
+    if (!storage || !key || !value) {
+        return STORAGE_FILE_NULL_PARAMETER;
+    }
+    int err = STORAGE_FILE_NO_ERROR;
+    pthread_mutex_lock(&storage->Log.Lock);
+    storage->Stat.loads++;
+    std::map<std::string, std::string>::iterator it = storage->Values.find(key);
+    if (it == storage->Values.end()) {
+        err = STORAGE_FILE_NOT_FOUND;
+    } else {
+        *value = it->second;
+    }
+    pthread_mutex_unlock(&storage->Log.Lock);
+    return err;
+}
+
+void DiaStorageFile_GetStat(DiaStorageFile *storage, storage_file_stat_t *stat) {
+    pthread_mutex_lock(&storage->Log.Lock);
+    *stat = storage->Stat;
+    stat->syncs = storage->Log.Stat.syncs;
+    stat->bytes_written = storage->Log.Stat.bytes_written;
+    stat->compactions = storage->Log.Stat.rewrites;
+    pthread_mutex_unlock(&storage->Log.Lock);
+}
+
+DiaStorageFile::~DiaStorageFile() {
+    DiaLogFile_Stop(&Log);
+}
+
+storage_interface_t * CreateFileInterface(const char *path) {
+    DiaStorageFile * storage = new DiaStorageFile(path);
+    if (DiaStorageFile_Open(storage) != STORAGE_FILE_NO_ERROR) {
+        delete storage;
+        return 0;
+    }
+    storage_interface_t * res = (storage_interface_t *)calloc(1, sizeof(storage_interface_t));
+    res->next_object = 0;
+    res->object = storage;
+    res->save = storage_interface_file_save;
+    res->load = storage_interface_file_load;
+    res->is_real = 1;
+    return res;
+}
+
+int storage_interface_file_save(void * object, const char *key, const void *data, size_t length) {
+    return DiaStorageFile_Save((DiaStorageFile *)object, key, data, length);
+}
+
+int storage_interface_file_load(void * object, const char *key, void *data, size_t length) {
+    return DiaStorageFile_Load((DiaStorageFile *)object, key, data, length);
+}
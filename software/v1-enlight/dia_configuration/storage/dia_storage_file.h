@@ -0,0 +1,110 @@
+#ifndef dia_storage_file_h
+#define dia_storage_file_h
+
+#include <stdint.h>
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "dia_log_file.h"
+#include "dia_storage_interface.h"
+
+#define STORAGE_FILE_PATH "firmware.storage"
+
+#define STORAGE_FILE_NO_ERROR 0
+#define STORAGE_FILE_NULL_PARAMETER 1
+#define STORAGE_FILE_OPEN_ERROR 2
+#define STORAGE_FILE_WRITE_ERROR 3
+#define STORAGE_FILE_NOT_FOUND 4
+#define STORAGE_FILE_WRONG_LENGTH 5
+
+#define STORAGE_FILE_MAGIC 0x5253564b
+// The writer thread does not fsync more often than this, so saves made
+// meanwhile share one write and one fsync.
+#define STORAGE_FILE_SYNC_INTERVAL_MS 50
+// The file is rewritten with the latest values only once it is bigger than
+// this and twice as big as they are.
+#define STORAGE_FILE_COMPACT_BYTES (64 * 1024)
+
+// On-disk record header, followed by key_length bytes of key and length
+// bytes of value. crc covers the header (with crc set to 0), key and value.
+typedef struct storage_file_record {
+    uint32_t magic;
+    uint32_t key_length;
+    uint32_t length;
+    uint32_t crc;
+} storage_file_record_t;
+
+typedef struct storage_file_stat {
+    uint64_t saves;
+    // Saves of the value already stored, nothing is written for them.
+    uint64_t unchanged;
+    uint64_t loads;
+    uint64_t syncs;
+    // Value bytes asked to be saved vs bytes actually written to the file,
+    // compactions included.
+    uint64_t bytes_saved;
+    uint64_t bytes_written;
+    uint64_t compactions;
+} storage_file_stat_t;
+
+// DiaStorageFile is a log-structured key/value file. A save appends one
+// checksummed record, so a snapshot of a few counters costs one small write
+// instead of rewriting the file. The last valid record of a key wins on
+// load; a torn record at the end is cut off, so after a power cut every key
+// has either its old or its new value.
+// Saves only update the in-memory values and queue the record; the writer
+// thread of the log file commits everything queued with one write and one
+// fdatasync.
+class DiaStorageFile {
+   public:
+    DiaLogFile Log;
+
+    // Everything below is protected by Log.Lock.
+    // Latest value of every key, loads are served from here.
+    std::map<std::string, std::string> Values;
+    // Keys whose last record failed to write. Saving the same value again
+    // queues it again instead of being skipped as unchanged.
+    std::set<std::string> Unsynced;
+    uint64_t LiveBytes;
+    storage_file_stat_t Stat;
+
+    DiaStorageFile(std::string path) : Log("Storage", path, STORAGE_FILE_SYNC_INTERVAL_MS) {
+        LiveBytes = 0;
+        Stat = storage_file_stat_t();
+    }
+
+    ~DiaStorageFile();
+};
+
+// Opens (or creates) the file, reads all valid records and starts the
+// writer thread.
+int DiaStorageFile_Open(DiaStorageFile *storage);
+
+// Returns after the value is on disk, which takes up to
+// STORAGE_FILE_SYNC_INTERVAL_MS plus one fdatasync. Use SaveAsync in loops.
+int DiaStorageFile_Save(DiaStorageFile *storage, const char *key, const void *data, size_t length);
+
+// Returns at once, the value is on disk within STORAGE_FILE_SYNC_INTERVAL_MS.
+// Loads see it immediately.
+int DiaStorageFile_SaveAsync(DiaStorageFile *storage, const char *key, const void *data, size_t length);
+
+// Blocks until everything saved so far is on disk.
+int DiaStorageFile_Flush(DiaStorageFile *storage);
+
+// Fails with STORAGE_FILE_WRONG_LENGTH and leaves data untouched if the
+// stored value has another length, e.g. after the structure changed.
+int DiaStorageFile_Load(DiaStorageFile *storage, const char *key, void *data, size_t length);
+
+// Returns STORAGE_FILE_NOT_FOUND if there is no such key.
+int DiaStorageFile_Get(DiaStorageFile *storage, const char *key, std::string *value);
+
+void DiaStorageFile_GetStat(DiaStorageFile *storage, storage_file_stat_t *stat);
+
+// storage_interface_t on top of DiaStorageFile, 0 if the file can't be opened.
+storage_interface_t * CreateFileInterface(const char *path);
+int storage_interface_file_save(void * object, const char *key, const void *data, size_t length);
+int storage_interface_file_load(void * object, const char *key, void *data, size_t length);
+
+#endif
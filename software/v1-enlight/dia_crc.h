@@ -0,0 +1,34 @@
+#ifndef DIA_CRC_H
+#define DIA_CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3, the one zlib uses) for on-disk records.
+// Pass the previous result as crc to checksum data in several chunks,
+// start with 0.
+inline uint32_t dia_crc32(uint32_t crc, const void *data, size_t size) {
+    static uint32_t table[256];
+    static int initialized = 0;
+
+    if (!initialized) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+            }
+            table[i] = c;
+        }
+        __sync_synchronize();
+        initialized = 1;
+    }
+
+    const uint8_t *buf = (const uint8_t *)data;
+    crc = crc ^ 0xffffffffu;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffffu;
+}
+
+#endif
@@ -0,0 +1,220 @@
+#ifndef DIA_CURL_POOL_H
+#define DIA_CURL_POOL_H
+
+#include <curl/curl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+// Keep-alive probes for idle pooled connections, seconds.
+#define CURL_POOL_KEEPIDLE 30
+#define CURL_POOL_KEEPINTVL 15
+// Connections older than this are not reused, seconds.
+#define CURL_POOL_MAXAGE_CONN 118
+// Maximum amount of idle easy handles kept in the pool.
+#define CURL_POOL_MAX_IDLE 8
+
+// Request counters collected from CURLINFO after every request.
+// All times are in microseconds.
+typedef struct curl_pool_stat {
+    uint64_t requests;
+    uint64_t failures;
+    uint64_t new_connections;
+    uint64_t reused_connections;
+    uint64_t connect_time_total;
+    uint64_t request_time_total;
+    uint64_t last_connect_time;
+    uint64_t last_request_time;
+    uint64_t max_request_time;
+} curl_pool_stat_t;
+
+// DiaCurlPool keeps easy handles alive between requests and makes them
+// share one DNS, connection and TLS session cache, so every route talking
+// to the same Central Server reuses already established TCP connections
+// instead of doing connect + handshake for each request.
+class DiaCurlPool {
+   public:
+    DiaCurlPool() {
+        pthread_mutex_init(&_HandlesLock, 0);
+        pthread_mutex_init(&_StatLock, 0);
+        for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+            pthread_mutex_init(&_ShareLocks[i], 0);
+        }
+        memset(&_Stat, 0, sizeof(_Stat));
+
+        _Share = curl_share_init();
+        if (_Share) {
+            curl_share_setopt(_Share, CURLSHOPT_LOCKFUNC, DiaCurlPool::_Lock);
+            curl_share_setopt(_Share, CURLSHOPT_UNLOCKFUNC, DiaCurlPool::_Unlock);
+            curl_share_setopt(_Share, CURLSHOPT_USERDATA, this);
+            curl_share_setopt(_Share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+            curl_share_setopt(_Share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+            if (curl_share_setopt(_Share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT) != CURLSHE_OK) {
+                // Old libcurl: connections stay per handle, which is still
+                // fine since handles are reused as well.
+                printf("CURL pool: connection cache sharing is not supported\n");
+            }
+        } else {
+            printf("CURL pool: can't create share object\n");
+        }
+    }
+
+    ~DiaCurlPool() {
+        pthread_mutex_lock(&_HandlesLock);
+        for (size_t i = 0; i < _Handles.size(); i++) {
+            curl_easy_cleanup(_Handles[i]);
+        }
+        _Handles.clear();
+        pthread_mutex_unlock(&_HandlesLock);
+
+        if (_Share) {
+            curl_share_cleanup(_Share);
+            _Share = 0;
+        }
+
+        for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+            pthread_mutex_destroy(&_ShareLocks[i]);
+        }
+        pthread_mutex_destroy(&_StatLock);
+        pthread_mutex_destroy(&_HandlesLock);
+    }
+
+    // Returns a handle ready for setting request specific options.
+    // The handle must be given back with Release.
+    CURL *Acquire() {
+        CURL *curl = 0;
+        pthread_mutex_lock(&_HandlesLock);
+        if (!_Handles.empty()) {
+            curl = _Handles.back();
+            _Handles.pop_back();
+        }
+        pthread_mutex_unlock(&_HandlesLock);
+
+        if (!curl) {
+            curl = curl_easy_init();
+            if (!curl) {
+                return 0;
+            }
+        }
+        SetDefaults(curl);
+        return curl;
+    }
+
+    // Gives the handle back to the pool. curl_easy_reset drops request
+    // options but keeps alive connections, DNS and session caches.
+    void Release(CURL *curl) {
+        if (!curl) {
+            return;
+        }
+        curl_easy_reset(curl);
+
+        pthread_mutex_lock(&_HandlesLock);
+        if (_Handles.size() < CURL_POOL_MAX_IDLE) {
+            _Handles.push_back(curl);
+            curl = 0;
+        }
+        pthread_mutex_unlock(&_HandlesLock);
+
+        if (curl) {
+            curl_easy_cleanup(curl);
+        }
+    }
+
+    // Performs the request and updates the latency counters.
+    CURLcode Perform(CURL *curl) {
+        CURLcode res = curl_easy_perform(curl);
+        UpdateStat(curl, res);
+        return res;
+    }
+
+    // Updates the latency counters with a finished request.
+    void UpdateStat(CURL *curl, CURLcode res) {
+        double connect_time = 0;
+        double total_time = 0;
+        long num_connects = 0;
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect_time);
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &total_time);
+        curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &num_connects);
+
+        uint64_t connect_us = (uint64_t)(connect_time * 1000000.0);
+        uint64_t total_us = (uint64_t)(total_time * 1000000.0);
+
+        pthread_mutex_lock(&_StatLock);
+        _Stat.requests++;
+        if (res != CURLE_OK) {
+            _Stat.failures++;
+        }
+        if (num_connects > 0) {
+            _Stat.new_connections++;
+        } else if (res == CURLE_OK) {
+            _Stat.reused_connections++;
+        }
+        _Stat.connect_time_total += connect_us;
+        _Stat.request_time_total += total_us;
+        _Stat.last_connect_time = connect_us;
+        _Stat.last_request_time = total_us;
+        if (total_us > _Stat.max_request_time) {
+            _Stat.max_request_time = total_us;
+        }
+        pthread_mutex_unlock(&_StatLock);
+    }
+
+    void GetStat(curl_pool_stat_t *stat) {
+        pthread_mutex_lock(&_StatLock);
+        *stat = _Stat;
+        pthread_mutex_unlock(&_StatLock);
+    }
+
+    void PrintStat() {
+        curl_pool_stat_t stat;
+        GetStat(&stat);
+        uint64_t requests = stat.requests ? stat.requests : 1;
+        printf("CURL pool: %llu requests, %llu failed, %llu new / %llu reused connections, avg connect %llu us, avg total %llu us, max total %llu us\n",
+               (unsigned long long)stat.requests,
+               (unsigned long long)stat.failures,
+               (unsigned long long)stat.new_connections,
+               (unsigned long long)stat.reused_connections,
+               (unsigned long long)(stat.connect_time_total / requests),
+               (unsigned long long)(stat.request_time_total / requests),
+               (unsigned long long)stat.max_request_time);
+    }
+
+   private:
+    CURLSH *_Share;
+    std::vector<CURL *> _Handles;
+    pthread_mutex_t _HandlesLock;
+    pthread_mutex_t _ShareLocks[CURL_LOCK_DATA_LAST];
+
+    curl_pool_stat_t _Stat;
+    pthread_mutex_t _StatLock;
+
+    void SetDefaults(CURL *curl) {
+        if (_Share) {
+            curl_easy_setopt(curl, CURLOPT_SHARE, _Share);
+        }
+        curl_easy_setopt(curl, CURLOPT_USERAGENT, "diae/0.1");
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, (long)CURL_POOL_KEEPIDLE);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, (long)CURL_POOL_KEEPINTVL);
+        curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1L);
+#if LIBCURL_VERSION_NUM >= 0x074100
+        curl_easy_setopt(curl, CURLOPT_MAXAGE_CONN, (long)CURL_POOL_MAXAGE_CONN);
+#endif
+    }
+
+    static void _Lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+        DiaCurlPool *pool = (DiaCurlPool *)userptr;
+        pthread_mutex_lock(&pool->_ShareLocks[data]);
+    }
+
+    static void _Unlock(CURL *handle, curl_lock_data data, void *userptr) {
+        DiaCurlPool *pool = (DiaCurlPool *)userptr;
+        pthread_mutex_unlock(&pool->_ShareLocks[data]);
+    }
+};
+
+#endif
@@ -12,7 +12,11 @@
 DiaDevice::DiaDevice(const char *portName) {
     _Buf[0] = 0;
     NeedWorking = 1;
+    _handler = -1;
     _PortName = strdup(portName);
+    Driver = 0;
+    HasDriverThread = 0;
+    DeleteDriver = 0;
 }
 
 DiaDevice::~DiaDevice()
@@ -41,6 +41,13 @@ public:
     int _CheckStatus;
     int DeviceType;
     void * Manager;
+    // Driver started on the device. Its thread runs while NeedWorking is
+    // set; the device manager joins it before closing the port and deleting
+    // the driver with DeleteDriver.
+    void * Driver;
+    pthread_t DriverThread;
+    int HasDriverThread;
+    void (*DeleteDriver)(void * driver);
 
     int Open();
     DiaDevice(const char *portName);
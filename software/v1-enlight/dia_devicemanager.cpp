@@ -1,10 +1,17 @@
 #include "dia_devicemanager.h"
 
 #include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <linux/netlink.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <unistd.h>
 #include <wiringPi.h>
 
 #include <stdexcept>
@@ -12,11 +19,15 @@
 
 #include "dia_cardreader.h"
 #include "dia_ccnet.h"
+#include "dia_event.h"
 #include "dia_microcoinsp.h"
 #include "dia_nv9usb.h"
 #include "dia_vendotek.h"
 #include "money_types.h"
 
+#define DIA_UEVENT_GROUP_KERNEL 1
+#define DIA_UEVENT_GROUP_UDEV 2
+
 void DiaDeviceManager_AddCardReader(DiaDeviceManager *manager) {
     printf("Abstract card reader added to the Device Manager\n");
     manager->_CardReader = new DiaCardReader(manager, DiaDeviceManager_ReportMoney);
@@ -34,182 +45,344 @@ void DiaDeviceManager_StartDeviceScan(DiaDeviceManager *manager) {
     }
 }
 
-std::string DiaDeviceManager_ExecBashCommand(const char *cmd, int *error) {
-    char buffer[128];
-    std::string result = "";
-    *error = 0;
-
-    FILE *pipe = popen(cmd, "r");
-    if (!pipe) {
-        *error = 1;
-        return result;
+// Drops devices whose port was not seen by the scan, so a replugged device
+// gets probed and its driver started again.
+void DiaDeviceManager_FinishDeviceScan(DiaDeviceManager *manager) {
+    std::list<DiaDevice *> retired;
+    for (auto it = manager->_Devices.begin(); it != manager->_Devices.end();) {
+        if ((*it)->_CheckStatus == DIAE_DEVICE_STATUS_INITIAL) {
+            printf("\nPort %s disappeared\n", (*it)->_PortName);
+            (*it)->NeedWorking = 0;
+            retired.push_back(*it);
+            it = manager->_Devices.erase(it);
+        } else {
+            ++it;
+        }
     }
 
-    while (fgets(buffer, sizeof buffer, pipe) != NULL) {
-        result += buffer;
+    // All driver threads are told to stop first, so they exit in parallel.
+    // The port is closed only after its driver thread is joined, otherwise
+    // the thread could read from another file opened with the same fd.
+    for (auto it = retired.begin(); it != retired.end(); ++it) {
+        DiaDevice *dev = *it;
+        if (dev->HasDriverThread) {
+            pthread_join(dev->DriverThread, NULL);
+        }
+        if (dev->Driver && dev->DeleteDriver) {
+            dev->DeleteDriver(dev->Driver);
+        }
+        if (dev->_handler >= 0) {
+            close(dev->_handler);
+        }
+        delete dev;
     }
-    pclose(pipe);
-    return result;
 }
 
-int DiaDeviceManager_CheckNV9(char *PortName) {
-    printf("\nChecking port %s for NV9 device...\n", PortName);
-
-    int error = 0;
-    std::string bashOutput = DiaDeviceManager_ExecBashCommand("ls -l /dev/serial/by-id", &error);
-    if (error) {
-        printf("Error while reading info about serial devices, NV9 check failed\n");
-        return 0;
+// Returns the name of the /dev/serial/by-id link pointing to the port,
+// or an empty string if udev has not created one.
+std::string DiaDeviceManager_GetSerialId(const char *PortName) {
+    std::string result = "";
+    char portPath[PATH_MAX];
+    if (realpath(PortName, portPath) == NULL) {
+        return result;
     }
 
-    std::string portName = std::string(PortName);
-    size_t maxDiff = 50;
-
-    // Get short name of port, for instance:
-    //   /dev/ttyACM0 ==> /ttyACM0
-    std::string toCut = portName.substr(0, 4);
-
-    if (toCut != std::string("/dev")) {
-        printf("Invlaid port name in NV9 device check: %s\n", PortName);
-        return 0;
+    DIR *dir = opendir(DIA_SERIAL_BY_ID_DIR);
+    if (dir == NULL) {
+        return result;
     }
 
-    std::string shortPortName = portName.substr(4, 8);
-    size_t devicePortPosition = bashOutput.find(shortPortName);
-
-    // Check existance of port in list
-    if (devicePortPosition != std::string::npos) {
-        size_t deviceNamePosition = bashOutput.find("NV9USB");
-
-        // Compare distance between positions with maxDiff const
-        if (deviceNamePosition != std::string::npos &&
-            devicePortPosition - deviceNamePosition < maxDiff) {
-            return 1;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char linkPath[PATH_MAX];
+        char targetPath[PATH_MAX];
+        snprintf(linkPath, sizeof(linkPath), "%s/%s", DIA_SERIAL_BY_ID_DIR, entry->d_name);
+        if (realpath(linkPath, targetPath) != NULL && strcmp(targetPath, portPath) == 0) {
+            result = entry->d_name;
+            break;
         }
     }
+    closedir(dir);
+    return result;
+}
 
-    return 0;
+int DiaDeviceManager_CheckNV9(char *PortName) {
+    printf("\nChecking port %s for NV9 device...\n", PortName);
+    return DiaDeviceManager_GetSerialId(PortName).find("NV9USB") != std::string::npos;
 }
 
 int DiaDeviceManager_CheckUIC(char *PortName) {
     printf("\nChecking port %s for UIC device...\n", PortName);
-
-    int error = 0;
-    std::string bashOutput = DiaDeviceManager_ExecBashCommand("ls -l /dev/serial/by-id", &error);
-    if (error) {
-        printf("Error while reading info about serial devices, NV9 check failed\n");
-        return 0;
-    }
-
-    std::string portName = std::string(PortName);
-    size_t maxDiff = 50;
-
-    // Get short name of port, for instance:
-    //   /dev/ttyACM0 ==> /ttyACM0
-    std::string toCut = portName.substr(0, 4);
-
-    if (toCut != std::string("/dev")) {
-        printf("Invlaid port name in UIC device check: %s\n", PortName);
-        return 0;
-    }
-
-    std::string shortPortName = portName.substr(4, 8);
-    size_t devicePortPosition = bashOutput.find(shortPortName);
-
-    // Check existance of port in list
-    if (devicePortPosition != std::string::npos) {
-        size_t deviceNamePosition = bashOutput.find("UIC");
-
-        // Compare distance between positions with maxDiff const
-        if (deviceNamePosition != std::string::npos &&
-            devicePortPosition - deviceNamePosition < maxDiff) {
-            return 1;
-        }
-    }
-
-    return 0;
+    return DiaDeviceManager_GetSerialId(PortName).find("UIC") != std::string::npos;
 }
 
-void DiaDeviceManager_CheckOrAddDevice(DiaDeviceManager *manager, char *PortName, int isACM) {
-    int devInList = 0;
+void DiaDeviceManager_AddDevice(DiaDeviceManager *manager, DiaDevice *dev) {
+    pthread_mutex_lock(&manager->DevicesLock);
+    manager->_Devices.push_back(dev);
+    pthread_mutex_unlock(&manager->DevicesLock);
+}
 
+// Marks the port as seen by the current scan.
+// Returns 1 if the port needs no probing.
+int DiaDeviceManager_MarkKnownPort(DiaDeviceManager *manager, const char *PortName) {
+    int known = 0;
     for (auto it = manager->_Devices.begin(); it != manager->_Devices.end(); ++it) {
         if (strcmp(PortName, (*it)->_PortName) == 0) {
-            devInList = 1;
+            known = 1;
             (*it)->_CheckStatus = DIAE_DEVICE_STATUS_IN_LIST;
         }
     }
-    if (!devInList) {
-        if (isACM) {
-            if (DiaDeviceManager_CheckUIC(PortName)) {
-                printf("\nFound UIC on port %s\n\n", PortName);
-                printf("Ignoring this port...\n");
-                DiaDevice *dev = new DiaDevice(PortName);
-                manager->_Devices.push_back(dev);
-
-            } else if (DiaDeviceManager_CheckNV9(PortName)) {
-                printf("\nFound NV9 on port %s\n\n", PortName);
-                DiaDevice *dev = new DiaDevice(PortName);
-
-                dev->Manager = manager;
-                dev->_CheckStatus = DIAE_DEVICE_STATUS_JUST_ADDED;
-                dev->Open();
-                DiaNv9Usb *newNv9 = new DiaNv9Usb(dev, DiaDeviceManager_ReportMoney);
-                DiaNv9Usb_StartDriver(newNv9);
-                manager->_Devices.push_back(dev);
-            }
+    for (auto it = manager->_UnknownPorts.begin(); it != manager->_UnknownPorts.end(); ++it) {
+        if (*it == PortName) {
+            known = 1;
         }
-        if (!isACM) {
-            printf("\nChecking port %s for MicroCoinSp...\n", PortName);
+    }
+    return known;
+}
+
+void DiaDeviceManager_DeleteNv9(void *driver) {
+    delete (DiaNv9Usb *)driver;
+}
+
+void DiaDeviceManager_DeleteMicroCoinSp(void *driver) {
+    delete (DiaMicroCoinSp *)driver;
+}
+
+void DiaDeviceManager_DeleteCcnet(void *driver) {
+    delete (DiaCcnet *)driver;
+}
+
+void DiaDeviceManager_ProbePort(DiaDeviceManager *manager, char *PortName, int isACM) {
+    if (isACM) {
+        if (DiaDeviceManager_CheckUIC(PortName)) {
+            printf("\nFound UIC on port %s\n\n", PortName);
+            printf("Ignoring this port...\n");
+            DiaDevice *dev = new DiaDevice(PortName);
+            DiaDeviceManager_AddDevice(manager, dev);
+
+        } else if (DiaDeviceManager_CheckNV9(PortName)) {
+            printf("\nFound NV9 on port %s\n\n", PortName);
             DiaDevice *dev = new DiaDevice(PortName);
 
             dev->Manager = manager;
             dev->_CheckStatus = DIAE_DEVICE_STATUS_JUST_ADDED;
             dev->Open();
-
-            int res = DiaMicroCoinSp_Detect(dev);
+            DiaNv9Usb *newNv9 = new DiaNv9Usb(dev, DiaDeviceManager_ReportMoney);
+            dev->Driver = newNv9;
+            dev->DeleteDriver = DiaDeviceManager_DeleteNv9;
+            if (DiaNv9Usb_StartDriver(newNv9) == DIA_NV9_NO_ERROR) {
+                dev->DriverThread = newNv9->CommandReadingThread;
+                dev->HasDriverThread = 1;
+            }
+            DiaDeviceManager_AddDevice(manager, dev);
+        }
+    }
+    if (!isACM) {
+        printf("\nChecking port %s for MicroCoinSp...\n", PortName);
+        DiaDevice *dev = new DiaDevice(PortName);
+
+        dev->Manager = manager;
+        dev->_CheckStatus = DIAE_DEVICE_STATUS_JUST_ADDED;
+        dev->Open();
+
+        int res = DiaMicroCoinSp_Detect(dev);
+        if (res) {
+            printf("\nFound MicroCoinSp on port %s\n\n", PortName);
+            DiaMicroCoinSp *newMicroCoinSp = new DiaMicroCoinSp(dev, DiaDeviceManager_ReportMoney);
+            dev->Driver = newMicroCoinSp;
+            dev->DeleteDriver = DiaDeviceManager_DeleteMicroCoinSp;
+            if (DiaMicroCoinSp_StartDriver(newMicroCoinSp) == DIA_MCSP_NO_ERROR) {
+                dev->DriverThread = newMicroCoinSp->WorkingThread;
+                dev->HasDriverThread = 1;
+            }
+            DiaDeviceManager_AddDevice(manager, dev);
+        } else {
+            res = DiaCcnet_Detect(dev);
             if (res) {
-                printf("\nFound MicroCoinSp on port %s\n\n", PortName);
-                DiaMicroCoinSp *newMicroCoinSp = new DiaMicroCoinSp(dev, DiaDeviceManager_ReportMoney);
-                DiaMicroCoinSp_StartDriver(newMicroCoinSp);
-                manager->_Devices.push_back(dev);
-            } else {
-                res = DiaCcnet_Detect(dev);
-                if (res) {
-                    printf("\nFound CCNET device on port %s\n\n", PortName);
-                    DiaCcnet *newCcnet = new DiaCcnet(dev, DiaDeviceManager_ReportMoney);
-                    DiaCcnet_StartDriver(newCcnet);
-                    manager->_Devices.push_back(dev);
-                } else {
-                    printf("\nNo devices found on port %s\n", PortName);
-                    DiaDevice_CloseDevice(dev);
+                printf("\nFound CCNET device on port %s\n\n", PortName);
+                DiaCcnet *newCcnet = new DiaCcnet(dev, DiaDeviceManager_ReportMoney);
+                dev->Driver = newCcnet;
+                dev->DeleteDriver = DiaDeviceManager_DeleteCcnet;
+                if (DiaCcnet_StartDriver(newCcnet) == 0) {
+                    dev->DriverThread = newCcnet->MainThread;
+                    dev->HasDriverThread = 1;
                 }
+                DiaDeviceManager_AddDevice(manager, dev);
+            } else {
+                printf("\nNo devices found on port %s\n", PortName);
+                DiaDevice_CloseDevice(dev);
+                pthread_mutex_lock(&manager->DevicesLock);
+                manager->_UnknownPorts.push_back(PortName);
+                pthread_mutex_unlock(&manager->DevicesLock);
             }
         }
     }
 }
 
+void DiaDeviceManager_CheckOrAddDevice(DiaDeviceManager *manager, char *PortName, int isACM) {
+    if (!DiaDeviceManager_MarkKnownPort(manager, PortName)) {
+        DiaDeviceManager_ProbePort(manager, PortName, isACM);
+    }
+}
+
+struct DiaDeviceManager_Probe {
+    DiaDeviceManager *Manager;
+    char PortName[1024];
+    int IsACM;
+    pthread_t Thread;
+    int Started;
+};
+
+void *DiaDeviceManager_ProbeThread(void *probe) {
+    DiaDeviceManager_Probe *Probe = (DiaDeviceManager_Probe *)probe;
+    DiaDeviceManager_ProbePort(Probe->Manager, Probe->PortName, Probe->IsACM);
+    return 0;
+}
+
 void DiaDeviceManager_ScanDevices(DiaDeviceManager *manager) {
     if (manager == NULL) {
         return;
     }
     struct dirent *entry;
     DIR *dir;
+    std::list<DiaDeviceManager_Probe *> probes;
     DiaDeviceManager_StartDeviceScan(manager);
     if ((dir = opendir("/dev")) != NULL) {
         while ((entry = readdir(dir)) != NULL) {
+            int isACM;
             if (strstr(entry->d_name, "ttyACM")) {
-                char buf[1024];
-                snprintf(buf, 1023, "/dev/%s", entry->d_name);
-                DiaDeviceManager_CheckOrAddDevice(manager, buf, 1);
+                isACM = 1;
             } else if (strstr(entry->d_name, "ttyUSB")) {
-                char buf[1024];
-                snprintf(buf, 1023, "/dev/%s", entry->d_name);
-                DiaDeviceManager_CheckOrAddDevice(manager, buf, 0);
+                isACM = 0;
+            } else {
+                continue;
+            }
+            char buf[1024];
+            snprintf(buf, 1023, "/dev/%s", entry->d_name);
+            if (DiaDeviceManager_MarkKnownPort(manager, buf)) {
+                continue;
             }
+            DiaDeviceManager_Probe *probe = new DiaDeviceManager_Probe();
+            probe->Manager = manager;
+            probe->IsACM = isACM;
+            strcpy(probe->PortName, buf);
+            probes.push_back(probe);
         }
         closedir(dir);
     }
+
+    // Forget silent ports that are gone, so they are probed again when replugged.
+    for (auto it = manager->_UnknownPorts.begin(); it != manager->_UnknownPorts.end();) {
+        if (access(it->c_str(), F_OK) != 0) {
+            it = manager->_UnknownPorts.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    DiaDeviceManager_FinishDeviceScan(manager);
+
+    // Every port is opened and probed in its own thread, so the settle delay
+    // and detection timeouts of several new ports overlap.
+    for (auto it = probes.begin(); it != probes.end(); ++it) {
+        (*it)->Started = pthread_create(&(*it)->Thread, NULL, DiaDeviceManager_ProbeThread, *it) == 0;
+        if (!(*it)->Started) {
+            DiaDeviceManager_ProbeThread(*it);
+        }
+    }
+    for (auto it = probes.begin(); it != probes.end(); ++it) {
+        if ((*it)->Started) {
+            pthread_join((*it)->Thread, NULL);
+        }
+        delete *it;
+    }
+}
+
+// Subscribes to kernel and udev uevents. udev events arrive after
+// /dev/serial/by-id links are created, so ACM ports can be identified then.
+int DiaDeviceManager_OpenUevents() {
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = DIA_UEVENT_GROUP_KERNEL | DIA_UEVENT_GROUP_UDEV;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int DiaDeviceManager_OpenInotify(int *devWatch) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    *devWatch = inotify_add_watch(fd, "/dev", IN_CREATE | IN_DELETE);
+    if (*devWatch < 0) {
+        close(fd);
+        return -1;
+    }
+    // Optional: the directory appears only with the first serial device.
+    inotify_add_watch(fd, DIA_SERIAL_BY_ID_DIR, IN_CREATE | IN_DELETE);
+    return fd;
+}
+
+int DiaDeviceManager_IsSerialPortName(const char *name) {
+    return strstr(name, "ttyACM") != NULL || strstr(name, "ttyUSB") != NULL;
+}
+
+// Reads all pending uevents, returns 1 if any of them concerns a serial port.
+int DiaDeviceManager_ReadUevents(int fd) {
+    int relevant = 0;
+    char buf[8192];
+    while (1) {
+        int n = recv(fd, buf, sizeof(buf) - 1, 0);
+        if (n < 0) {
+            // ENOBUFS means events were lost, so rescan to be safe
+            if (errno == ENOBUFS) {
+                relevant = 1;
+                continue;
+            }
+            break;
+        }
+        buf[n] = 0;
+        // Both kernel and udev messages carry NUL separated KEY=VALUE pairs
+        for (int i = 0; i < n; i += strlen(buf + i) + 1) {
+            if (strncmp(buf + i, "DEVNAME=", 8) == 0 && DiaDeviceManager_IsSerialPortName(buf + i + 8)) {
+                relevant = 1;
+            }
+        }
+    }
+    return relevant;
+}
+
+// Reads all pending inotify events, returns 1 if any of them concerns a serial port.
+int DiaDeviceManager_ReadInotify(int fd, int devWatch) {
+    int relevant = 0;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (1) {
+        int n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        for (int i = 0; i < n;) {
+            struct inotify_event *event = (struct inotify_event *)(buf + i);
+            if (event->len > 0 && event->name[0] != '.') {
+                // Names in the by-id directory don't contain the port name
+                if (event->wd != devWatch || DiaDeviceManager_IsSerialPortName(event->name)) {
+                    relevant = 1;
+                }
+            }
+            i += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return relevant;
 }
 
 DiaDeviceManager::DiaDeviceManager() {
@@ -240,16 +413,65 @@ void DiaDeviceManager_ReportMoney(void *manager, int moneyType, int money) {
     } else {
         printf("ERROR: Unknown money type %d\n", money);
     }
+    DiaEvent_Notify(DIA_EVENT_MONEY);
     printf("Money: %d\n", money);
 }
 
 void *DiaDeviceManager_WorkingThread(void *manager) {
     DiaDeviceManager *Manager = (DiaDeviceManager *)manager;
 
+    int isUevent = 1;
+    int devWatch = -1;
+    int fd = DiaDeviceManager_OpenUevents();
+    if (fd < 0) {
+        printf("Can't listen to uevents, watching /dev instead\n");
+        isUevent = 0;
+        fd = DiaDeviceManager_OpenInotify(&devWatch);
+    }
+    if (fd < 0) {
+        printf("Can't watch /dev, polling for serial devices\n");
+        while (Manager->NeedWorking) {
+            DiaDeviceManager_ScanDevices(Manager);
+            delay(100);
+        }
+        return 0;
+    }
+
+    DiaDeviceManager_ScanDevices(Manager);
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
     while (Manager->NeedWorking) {
-        DiaDeviceManager_ScanDevices(Manager);
-        delay(100);
+        int res = poll(&pfd, 1, DIA_DEVICE_MANAGER_REPROBE_MS);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Device manager poll failed: %s\n", strerror(errno));
+            delay(DIA_DEVICE_MANAGER_REPROBE_MS);
+            continue;
+        }
+        if (res == 0) {
+            // A validator may have been powered on behind an already present adapter
+            Manager->_UnknownPorts.clear();
+            DiaDeviceManager_ScanDevices(Manager);
+            continue;
+        }
+
+        int relevant = 0;
+        do {
+            if (isUevent) {
+                relevant |= DiaDeviceManager_ReadUevents(fd);
+            } else {
+                relevant |= DiaDeviceManager_ReadInotify(fd, devWatch);
+            }
+        } while (poll(&pfd, 1, DIA_DEVICE_MANAGER_SETTLE_MS) > 0);
+
+        if (relevant) {
+            DiaDeviceManager_ScanDevices(Manager);
+        }
     }
+    close(fd);
     return 0;
 }
 
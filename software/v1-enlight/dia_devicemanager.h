@@ -2,6 +2,7 @@
 #define DIA_DEVICE_MANAGER
 
 #include <list>
+#include <string>
 #include "dia_device.h"
 #include "dia_cardreader.h"
 #include "dia_vendotek.h"
@@ -10,6 +11,13 @@
 
 #define DIAE_DEVICE_MANAGER_NOERROR 0
 
+// Ports are rescanned on hotplug events; without any event the working thread
+// wakes up this rarely to retry ports where nothing answered.
+#define DIA_DEVICE_MANAGER_REPROBE_MS 30000
+// Quiet time collecting the burst of events a single plug produces.
+#define DIA_DEVICE_MANAGER_SETTLE_MS 200
+#define DIA_SERIAL_BY_ID_DIR "/dev/serial/by-id"
+
 enum CARD_READER_STATUS {PAYMENT_WORLD_SUCCCES, VENDOTEK_SUCCES,NOT_USED, VENDOTEK_NO_HOST, VENDOTEK_NULL_DRIVER, VENDOTEK_THREAD_ERROR, VENDOTEK_NOT_FOUND};
 
 class DiaDeviceManager {
@@ -26,6 +34,9 @@ public:
     DiaVendotek* _Vendotek = NULL;
     
     std::list<DiaDevice*> _Devices;
+    // Ports probed without an answer, skipped until replugged or reprobe timeout.
+    std::list<std::string> _UnknownPorts;
+    pthread_mutex_t DevicesLock = PTHREAD_MUTEX_INITIALIZER;
 
     pthread_t WorkingThread;
     DiaDeviceManager();
@@ -36,6 +47,7 @@ void DiaDeviceManager_ScanDevices(DiaDeviceManager * manager);
 void DiaDeviceManager_StartDeviceScan(DiaDeviceManager * manager);
 void DiaDeviceManager_FinishDeviceScan(DiaDeviceManager * manager);
 void DiaDeviceManager_CheckOrAddDevice(DiaDeviceManager *manager, char * PortName, int isACM);
+std::string DiaDeviceManager_GetSerialId(const char * PortName);
 void DiaDeviceManager_ReportMoney(void *manager, int moneyType, int Money);
 void DiaDeviceManager_PerformTransaction(void *manager, int money);
 void DiaDeviceManager_AbortTransaction(void *manager);
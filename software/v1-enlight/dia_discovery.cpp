@@ -0,0 +1,267 @@
+#include "dia_discovery.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define DIA_DISCOVERY_HOSTS 254
+
+static uint64_t DiaDiscovery_NowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int DiaDiscovery_LoadCache(const char *path, std::string *ip) {
+    if (!path || !ip) {
+        return DIA_DISCOVERY_NULL_PARAMETER;
+    }
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return DIA_DISCOVERY_NOT_FOUND;
+    }
+    char buf[256];
+    int err = DIA_DISCOVERY_NOT_FOUND;
+    if (fgets(buf, sizeof(buf), file)) {
+        buf[strcspn(buf, "\r\n \t")] = 0;
+        if (buf[0]) {
+            *ip = buf;
+            err = DIA_DISCOVERY_NO_ERROR;
+        }
+    }
+    fclose(file);
+    return err;
+}
+
+int DiaDiscovery_SaveCache(const char *path, std::string ip) {
+    if (!path) {
+        return DIA_DISCOVERY_NULL_PARAMETER;
+    }
+    std::string tmpPath = std::string(path) + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "w");
+    if (!file) {
+        printf("Discovery: can't create %s: %s\n", tmpPath.c_str(), strerror(errno));
+        return DIA_DISCOVERY_IO_ERROR;
+    }
+    int ok = fprintf(file, "%s\n", ip.c_str()) > 0 && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    fclose(file);
+    if (!ok || rename(tmpPath.c_str(), path) != 0) {
+        printf("Discovery: can't write %s: %s\n", path, strerror(errno));
+        unlink(tmpPath.c_str());
+        return DIA_DISCOVERY_IO_ERROR;
+    }
+    return DIA_DISCOVERY_NO_ERROR;
+}
+
+// Connecting a UDP socket sends nothing, but makes the kernel pick the
+// outgoing interface and address.
+int DiaDiscovery_LocalAddress(std::string *ip) {
+    if (!ip) {
+        return DIA_DISCOVERY_NULL_PARAMETER;
+    }
+    int sock = socket(PF_INET, SOCK_DGRAM, 0);
+    if (sock == -1) {
+        printf("Could not socket\n");
+        return DIA_DISCOVERY_IO_ERROR;
+    }
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_LOOPBACK;
+    addr.sin_port = htons(9);
+
+    if (connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1) {
+        close(sock);
+        printf("Could not connect\n");
+        return DIA_DISCOVERY_IO_ERROR;
+    }
+
+    socklen_t addrlen = sizeof(addr);
+    if (getsockname(sock, reinterpret_cast<sockaddr *>(&addr), &addrlen) == -1) {
+        close(sock);
+        printf("Could not getsockname\n");
+        return DIA_DISCOVERY_IO_ERROR;
+    }
+    close(sock);
+
+    char buf[INET_ADDRSTRLEN];
+    if (inet_ntop(AF_INET, &addr.sin_addr, buf, INET_ADDRSTRLEN) == 0x0) {
+        printf("Could not inet_ntop\n");
+        return DIA_DISCOVERY_IO_ERROR;
+    }
+    *ip = buf;
+    return DIA_DISCOVERY_NO_ERROR;
+}
+
+// Announcements are optional, the scan goes on without them if the port
+// is busy.
+static int DiaDiscovery_OpenAnnounceSocket() {
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(DIA_DISCOVERY_ANNOUNCE_PORT);
+    if (bind(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Returns 1 and the sender address if the datagram is an announcement.
+static int DiaDiscovery_ReadAnnounce(int sock, std::string *ip) {
+    char buf[512];
+    sockaddr_in from;
+    socklen_t fromlen = sizeof(from);
+    ssize_t length = recvfrom(sock, buf, sizeof(buf) - 1, 0, reinterpret_cast<sockaddr *>(&from), &fromlen);
+    if (length <= 0) {
+        return 0;
+    }
+    buf[length] = 0;
+    if (strncmp(buf, DIA_DISCOVERY_ANNOUNCE_PREFIX, strlen(DIA_DISCOVERY_ANNOUNCE_PREFIX)) != 0) {
+        return 0;
+    }
+    char addr[INET_ADDRSTRLEN];
+    if (!inet_ntop(AF_INET, &from.sin_addr, addr, sizeof(addr))) {
+        return 0;
+    }
+    *ip = addr;
+    return 1;
+}
+
+static void DiaDiscovery_AddCandidate(std::vector<std::string> *candidates, std::string ip) {
+    if (std::find(candidates->begin(), candidates->end(), ip) == candidates->end()) {
+        candidates->push_back(ip);
+    }
+}
+
+int DiaDiscovery_Scan(std::string localIP, int port, int timeoutMs, std::vector<std::string> *candidates) {
+    if (!candidates) {
+        return DIA_DISCOVERY_NULL_PARAMETER;
+    }
+
+    struct in_addr local;
+    if (inet_pton(AF_INET, localIP.c_str(), &local) != 1) {
+        printf("Discovery: wrong local address %s\n", localIP.c_str());
+        return DIA_DISCOVERY_NULL_PARAMETER;
+    }
+    uint32_t base = ntohl(local.s_addr) & 0xffffff00;
+
+    // pollfd index -> host number, 0 for the announcement socket.
+    std::vector<struct pollfd> fds;
+    std::vector<int> hosts;
+    std::vector<std::string> announced;
+    std::vector<std::string> connected;
+
+    int announce = DiaDiscovery_OpenAnnounceSocket();
+    if (announce >= 0) {
+        struct pollfd pfd = {announce, POLLIN, 0};
+        fds.push_back(pfd);
+        hosts.push_back(0);
+    }
+
+    for (int i = 1; i <= DIA_DISCOVERY_HOSTS; i++) {
+        uint32_t host = base | i;
+        if (host == ntohl(local.s_addr)) {
+            continue;
+        }
+        int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (sock < 0) {
+            printf("Discovery: can't create socket: %s\n", strerror(errno));
+            break;
+        }
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(host);
+        addr.sin_port = htons(port);
+
+        if (connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
+            close(sock);
+            char buf[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &addr.sin_addr, buf, sizeof(buf));
+            connected.push_back(buf);
+        } else if (errno == EINPROGRESS) {
+            struct pollfd pfd = {sock, POLLOUT, 0};
+            fds.push_back(pfd);
+            hosts.push_back(i);
+        } else {
+            close(sock);
+        }
+    }
+
+    uint64_t deadline = DiaDiscovery_NowMs() + timeoutMs;
+    size_t pending = fds.size() - (announce >= 0 ? 1 : 0);
+    while (pending > 0 && announced.empty()) {
+        uint64_t now = DiaDiscovery_NowMs();
+        if (now >= deadline) {
+            break;
+        }
+        int ready = poll(&fds[0], fds.size(), (int)(deadline - now));
+        if (ready < 0 && errno != EINTR) {
+            printf("Discovery: poll failed: %s\n", strerror(errno));
+            break;
+        }
+        for (size_t j = 0; ready > 0 && j < fds.size(); j++) {
+            if (fds[j].fd < 0 || !fds[j].revents) {
+                continue;
+            }
+            if (hosts[j] == 0) {
+                std::string ip;
+                if (DiaDiscovery_ReadAnnounce(fds[j].fd, &ip)) {
+                    printf("Discovery: %s announced itself\n", ip.c_str());
+                    announced.push_back(ip);
+                }
+                continue;
+            }
+            int error = 0;
+            socklen_t len = sizeof(error);
+            getsockopt(fds[j].fd, SOL_SOCKET, SO_ERROR, &error, &len);
+            if (error == 0) {
+                struct in_addr addr;
+                addr.s_addr = htonl(base | hosts[j]);
+                char buf[INET_ADDRSTRLEN];
+                inet_ntop(AF_INET, &addr, buf, sizeof(buf));
+                connected.push_back(buf);
+            }
+            close(fds[j].fd);
+            // poll skips negative descriptors.
+            fds[j].fd = -1;
+            pending--;
+        }
+    }
+
+    for (size_t j = 0; j < fds.size(); j++) {
+        if (fds[j].fd >= 0) {
+            close(fds[j].fd);
+        }
+    }
+
+    for (size_t j = 0; j < announced.size(); j++) {
+        DiaDiscovery_AddCandidate(candidates, announced[j]);
+    }
+    for (size_t j = 0; j < connected.size(); j++) {
+        DiaDiscovery_AddCandidate(candidates, connected[j]);
+    }
+    return candidates->empty() ? DIA_DISCOVERY_NOT_FOUND : DIA_DISCOVERY_NO_ERROR;
+}
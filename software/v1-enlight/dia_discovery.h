@@ -0,0 +1,35 @@
+#ifndef DIA_DISCOVERY_H
+#define DIA_DISCOVERY_H
+
+#include <string>
+#include <vector>
+
+#define DIA_DISCOVERY_NO_ERROR 0
+#define DIA_DISCOVERY_NULL_PARAMETER 1
+#define DIA_DISCOVERY_NOT_FOUND 2
+#define DIA_DISCOVERY_IO_ERROR 3
+
+// Connect probes are given this long, the whole /24 is probed at once.
+#define DIA_DISCOVERY_SCAN_MS 1500
+// The Central Server may announce itself with a UDP broadcast to this port,
+// the datagram starts with DIA_DISCOVERY_ANNOUNCE_PREFIX.
+#define DIA_DISCOVERY_ANNOUNCE_PORT 8021
+#define DIA_DISCOVERY_ANNOUNCE_PREFIX "DIA-CENTRAL"
+
+// Reads the last server address that answered.
+int DiaDiscovery_LoadCache(const char *path, std::string *ip);
+
+// Stores the server address, so the next boot tries it first.
+// The file is replaced atomically.
+int DiaDiscovery_SaveCache(const char *path, std::string ip);
+
+// Returns the local IPv4 address used for outgoing traffic.
+int DiaDiscovery_LocalAddress(std::string *ip);
+
+// Starts non-blocking connects to port on every address of the /24 of
+// localIP and listens for announcements meanwhile. Fills candidates with
+// announced servers first, then addresses which accepted the connection,
+// fastest first. Waits at most timeoutMs.
+int DiaDiscovery_Scan(std::string localIP, int port, int timeoutMs, std::vector<std::string> *candidates);
+
+#endif
@@ -0,0 +1,56 @@
+#include "dia_event.h"
+
+#include <errno.h>
+#include <pthread.h>
+
+static pthread_once_t dia_event_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t dia_event_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dia_event_cond;
+static int dia_event_pending = 0;
+static uint64_t dia_event_raised_us = 0;
+
+// Deadlines are monotonic, so the condition must not follow wall clock jumps
+static void DiaEvent_Init() {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&dia_event_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+uint64_t DiaEvent_NowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void DiaEvent_Notify(int events) {
+    pthread_once(&dia_event_once, DiaEvent_Init);
+    uint64_t nowUs = DiaEvent_NowUs();
+
+    pthread_mutex_lock(&dia_event_lock);
+    if (!dia_event_pending) {
+        dia_event_raised_us = nowUs;
+    }
+    dia_event_pending |= events;
+    pthread_cond_signal(&dia_event_cond);
+    pthread_mutex_unlock(&dia_event_lock);
+}
+
+int DiaEvent_WaitUntil(const struct timespec * deadline, uint64_t * raisedUs) {
+    pthread_once(&dia_event_once, DiaEvent_Init);
+
+    pthread_mutex_lock(&dia_event_lock);
+    while (!dia_event_pending) {
+        if (pthread_cond_timedwait(&dia_event_cond, &dia_event_lock, deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    int events = dia_event_pending;
+    if (raisedUs) {
+        *raisedUs = dia_event_raised_us;
+    }
+    dia_event_pending = 0;
+    pthread_mutex_unlock(&dia_event_lock);
+    return events;
+}
@@ -0,0 +1,22 @@
+#ifndef DIA_EVENT_H
+#define DIA_EVENT_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Events which wake the Lua loop up from smart_delay
+#define DIA_EVENT_BUTTON 1
+#define DIA_EVENT_MONEY 2
+#define DIA_EVENT_NETWORK 4
+
+// Raises events from any thread. Cheap enough for the GPIO interrupt thread.
+void DiaEvent_Notify(int events);
+
+// Blocks until deadline (CLOCK_MONOTONIC) or until an event is raised.
+// Returns raised events and clears them, 0 on timeout.
+// raisedUs gets the CLOCK_MONOTONIC time of the first of them.
+int DiaEvent_WaitUntil(const struct timespec * deadline, uint64_t * raisedUs);
+
+uint64_t DiaEvent_NowUs();
+
+#endif
@@ -13,6 +13,7 @@
 #  endif
 #endif
 
+#include <dirent.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -33,9 +34,11 @@
 
 #include "dia_configuration.h"
 #include "dia_devicemanager.h"
+#include "dia_event.h"
 #include "dia_functions.h"
 #include "dia_gpio.h"
 #include "dia_firmware.h"
+#include "dia_loop.h"
 #include "dia_runtime.h"
 #include "dia_runtime_registry.h"
 #include "dia_screen.h"
@@ -44,6 +47,7 @@
 #include "dia_screen_item_qr.h"
 #include "dia_security.h"
 #include "dia_startscreen.h"
+#include "dia_storage_file.h"
 
 #define DIA_VERSION "v1.8-enlight"
 
@@ -57,6 +61,21 @@
 
 #define BILLION 1000000000
 #define MAX_ACCEPTABLE_FRAME_DRAW_TIME_MICROSEC 1000000
+// How often smart_delay looks for touch and keyboard input while waiting
+#define SDL_INPUT_POLL_MICROSEC 20000
+// Network request counters are printed every NETWORK_STAT_INTERVAL seconds.
+#define NETWORK_STAT_INTERVAL 600
+// Relay counters are saved every RELAY_STAT_SAVE_INTERVAL seconds. A save
+// of unchanged counters writes nothing.
+#define RELAY_STAT_SAVE_INTERVAL 60
+// Local registry, it used to be a registry_<key>.reg file per key.
+#define LOCAL_REGISTRY_PATH "registry.storage"
+#define LOCAL_REGISTRY_FILE_PREFIX "registry_"
+#define LOCAL_REGISTRY_FILE_SUFFIX ".reg"
+// Period of the relay and dispenser jobs of the firmware loop.
+#define FIRMWARE_JOB_PERIOD_MS 100
+// Dispenser requests are tried this many times before giving up.
+#define VOLUME_REQUEST_ATTEMPTS 4
 
 DiaConfiguration *config;
 
@@ -70,6 +89,9 @@ std::string centralKey;
 
 int _DebugKey = 0;
 
+// CLOCK_MONOTONIC time of the event which woke smart_delay up, 0 if none.
+uint64_t _EventRaisedUs = 0;
+
 // Variable for storing an additional money.
 // For instance, service money from Central Server can be transfered inside.
 int _Balance = 0;
@@ -117,8 +139,17 @@ std::string _Qr = "";
 std::string _VisibleSessionID = "";
 
 
-pthread_t run_program_thread;
-pthread_t get_volume_thread;
+// Periodic jobs which do not need a thread of their own.
+DiaLoop *firmwareLoop = 0;
+
+DiaStorageFile *localRegistry = 0;
+
+// Each loop job has at most one server request in flight; the request
+// callback clears the flag on the network thread.
+volatile int _RunProgramInFlight = 0;
+volatile int _VolumeInFlight = 0;
+int _VolumeAttempts = 0;
+
 pthread_t active_session_thread;
 pthread_t play_video_thread;
 
@@ -417,8 +448,7 @@ int get_coins(void *object) {
     if (ALLOW_PULSE && config) {
         DiaGpio *g = config->GetGpio();
         if (g) {
-            gpioCoin = COIN_MULTIPLICATOR * g->CoinsHandler->Money;
-            g->CoinsHandler->Money = 0;
+            gpioCoin = COIN_MULTIPLICATOR * g->CoinsHandler->TakeMoney();
         }
     }
 
@@ -427,8 +457,7 @@ int get_coins(void *object) {
     if (ALLOW_PULSE && config) {
         DiaGpio *g = config->GetGpio();
         if (g && g->AdditionalHandler) {
-            gpioCoinAdditional = COIN_MULTIPLICATOR * g->AdditionalHandler->Money;
-            g->AdditionalHandler->Money = 0;
+            gpioCoinAdditional = COIN_MULTIPLICATOR * g->AdditionalHandler->TakeMoney();
         }
     }
 
@@ -458,8 +487,7 @@ int get_banknotes(void *object) {
     if (ALLOW_PULSE && config) {
         DiaGpio *g = config->GetGpio();
         if (g) {
-            gpioBanknote = BANKNOTE_MULTIPLICATOR * g->BanknotesHandler->Money;
-            g->BanknotesHandler->Money = 0;
+            gpioBanknote = BANKNOTE_MULTIPLICATOR * g->BanknotesHandler->TakeMoney();
         }
     }
 
@@ -527,19 +555,58 @@ inline void set_current_time(struct timespec *stored_time) {
     clock_gettime(CLOCK_MONOTONIC_RAW, stored_time);
 }
 
+// Returns true if the touch screen or keyboard has input for the main loop.
+bool has_pending_sdl_input() {
+    SDL_Event events[1];
+    SDL_PumpEvents();
+    int mask = SDL_EVENTMASK(SDL_MOUSEBUTTONDOWN) | SDL_EVENTMASK(SDL_KEYDOWN) | SDL_QUITMASK;
+    return SDL_PeepEvents(events, 1, SDL_PEEKEVENT, mask) > 0;
+}
+
 int smart_delay_function(void *arg, int ms) {
     struct timespec *stored_time = (struct timespec *)arg;
 
+    // The frame is done, the next likely screen is prepared in the spare time
+    DiaPrerender_Poll(config->GetPrerender(), config->GetScreen());
+
+    // The loop which ran since the wake up has handled the event
+    if (_EventRaisedUs) {
+        printf("Event to frame latency: %d ms\n", (int)((DiaEvent_NowUs() - _EventRaisedUs) / 1000));
+        _EventRaisedUs = 0;
+    }
+
     int64_t delay_wanted = 1000 * ms;
     // us (usecond, microsecond) = 10^-6 seconds
     // tv_sec (second) is one million microseconds
     // tv_nsec (nanosecond) contains 1000 microseconds or 10^9 seconds
     int64_t micro_secs_passed = micro_seconds_since(stored_time);
     if (delay_wanted < MAX_ACCEPTABLE_FRAME_DRAW_TIME_MICROSEC) {
-        if (micro_secs_passed < delay_wanted) {
-            while ((delay_wanted > micro_seconds_since(stored_time)) && (_DebugKey == 0)) {
-                usleep(1000);
+        // Frame delay: sleep until buttons, money or server replies arrive.
+        // SDL 1.2 input can't wake us up, so it is checked between waits.
+        while (micro_secs_passed < delay_wanted && _DebugKey == 0) {
+            int64_t wait_us = delay_wanted - micro_secs_passed;
+            if (wait_us > SDL_INPUT_POLL_MICROSEC) {
+                wait_us = SDL_INPUT_POLL_MICROSEC;
             }
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += wait_us / 1000000;
+            deadline.tv_nsec += (wait_us % 1000000) * 1000;
+            if (deadline.tv_nsec >= BILLION) {
+                deadline.tv_nsec -= BILLION;
+                deadline.tv_sec += 1;
+            }
+
+            uint64_t raised_us = 0;
+            if (DiaEvent_WaitUntil(&deadline, &raised_us)) {
+                _EventRaisedUs = raised_us;
+                break;
+            }
+            if (has_pending_sdl_input()) {
+                _EventRaisedUs = DiaEvent_NowUs();
+                break;
+            }
+            micro_secs_passed = micro_seconds_since(stored_time);
         }
     } else {
         delay_wanted -= micro_secs_passed;
@@ -592,11 +659,16 @@ bool RunProgramOnServerWithRetry(int programID, bool isPreflight) {
     return err == 0;
 }
 
-bool RunProgramOnServer(int programID, bool isPreflight) {
-    int err = 1;
-    printf("relay control server board: run program%s programID=%d\n", isPreflight ? " preflight" : "", programID);
-    err = network->RunProgramOnServer(programID, isPreflight);
-    return err == 0;
+// Network thread, when /run-program sent by RunProgram is answered.
+void RunProgramDone(void *arg, DiaNetRequest *request) {
+    int programID = (int)(intptr_t)arg;
+    if (DiaNetwork::StationCommandFailed(request)) {
+        if (IsRemoteOrAllRelayBoardMode())
+            _IntervalsCountProgram = 1000;
+    } else if (programID == 0 && _CurrentProgramID == 0) {
+        _CurrentProgramID = -1;
+    }
+    _RunProgramInFlight = 0;
 }
 
 int RunProgram() {
@@ -631,57 +703,80 @@ int RunProgram() {
                 return 1;
             }
             if (gpio != nullptr) {
-                gpio->CurrentProgram = _CurrentProgram;
-                gpio->CurrentProgramIsPreflight = _IsPreflight;
+                DiaGpio_SetCurrentProgram(gpio, _CurrentProgram, _IsPreflight);
             } else {
                 printf("ERROR: trying to run program with null gpio object\n");
             }
         #endif
     }
    
-    if (_IntervalsCountProgram > 20 && _CurrentProgramID >= 0) {
-        bool success = RunProgramOnServer(_CurrentProgramID, _IsPreflight);
-        if (success && _CurrentProgramID == 0)
-            _CurrentProgramID = -1;
+    if (_IntervalsCountProgram > 20 && _CurrentProgramID >= 0 && !_RunProgramInFlight) {
+        int programID = _CurrentProgramID;
+        printf("relay control server board: run program%s programID=%d\n", _IsPreflight ? " preflight" : "", programID);
         _IntervalsCountProgram = 0;
-        if (!success && IsRemoteOrAllRelayBoardMode())
-            _IntervalsCountProgram = 1000;
+        _RunProgramInFlight = 1;
+        if (network->RunProgramOnServerAsync(programID, _IsPreflight, (void *)(intptr_t)programID, RunProgramDone) != DIA_NET_NO_ERROR) {
+            _RunProgramInFlight = 0;
+        }
     }
     
     return 0;
 }
 
-int GetVolume() {
-    /**/
-    if (_SensorActivate) {
-        _SensorActivate = false;
-        for (int i = 0; i < 4; i++) {
-            int err = network->StartFluidFlowSensor(_SensorVolume, 1, 0);
-            if (err == 0) {
-                _SensorActive = true;
-                break;
-            }
-            if (i == 3) {
-                _SensorActiveUI = false;
-            }
+// Network thread, when /run-dispenser is answered. Failed requests are
+// sent again right away.
+void StartFluidFlowSensorDone(void *arg, DiaNetRequest *request) {
+    if (!DiaNetwork::StationCommandFailed(request)) {
+        _SensorActive = true;
+    } else {
+        fprintf(stderr, "StartFluidFlowSensor answer %s\n", request->Answer.c_str());
+        if (++_VolumeAttempts < VOLUME_REQUEST_ATTEMPTS &&
+            network->StartFluidFlowSensorAsync(_SensorVolume, 1, 0, NULL, StartFluidFlowSensorDone) == DIA_NET_NO_ERROR) {
+            return;
         }
+        _SensorActiveUI = false;
     }
-    if (_SensorActive) {
-        std::string status;
-        for (int i = 0; i < 4; i++) {
-            int v = network->GetVolume(&status);
-            if (v >= 0) {
-                _Volume = v;
-                break;
-            }
-            if (i == 3) {
-                status = "Server connection error";
-            }
+    _VolumeInFlight = 0;
+}
+
+// Network thread, when /volume-dispenser is answered.
+void GetVolumeDone(void *arg, DiaNetRequest *request) {
+    std::string status;
+    int v = network->ParseVolumeAnswer(request->Failed(), request->Answer, &status);
+    if (v < 0) {
+        if (++_VolumeAttempts < VOLUME_REQUEST_ATTEMPTS &&
+            network->GetVolumeAsync(NULL, GetVolumeDone) == DIA_NET_NO_ERROR) {
+            return;
         }
-        if (_SensorVolume <= _Volume || status != "") {
-            _SensorActive = false;
+        status = "Server connection error";
+    } else {
+        _Volume = v;
+    }
+    if (_SensorVolume <= _Volume || status != "") {
+        _SensorActive = false;
+        _SensorActiveUI = false;
+        printf("Completion of fluid flow. Status: %s\n", status.c_str());
+    }
+    _VolumeInFlight = 0;
+}
+
+int GetVolume() {
+    if (_VolumeInFlight) {
+        return 0;
+    }
+    if (_SensorActivate) {
+        _SensorActivate = false;
+        _VolumeAttempts = 0;
+        _VolumeInFlight = 1;
+        if (network->StartFluidFlowSensorAsync(_SensorVolume, 1, 0, NULL, StartFluidFlowSensorDone) != DIA_NET_NO_ERROR) {
             _SensorActiveUI = false;
-            printf("Completion of fluid flow. Status: %s\n", status.c_str());
+            _VolumeInFlight = 0;
+        }
+    } else if (_SensorActive) {
+        _VolumeAttempts = 0;
+        _VolumeInFlight = 1;
+        if (network->GetVolumeAsync(NULL, GetVolumeDone) != DIA_NET_NO_ERROR) {
+            _VolumeInFlight = 0;
         }
     }
     return 0;
@@ -689,32 +784,18 @@ int GetVolume() {
 
 /////// Central server communication functions //////
 
-// Sends PING request to Central Server every 2 seconds.
-// May get service money from server.
-int CentralServerDialog() {
-    printf("PING CENTRAL SERVER\n");
+// Applies the station state returned by PING or pushed by the server.
+void ApplyServerUpdate(server_update_t *update) {
+    int serviceMoney = update->service_money;
+    int bonusAmount = update->bonus_amount;
+    bool openStation = update->open_station;
+    std::string authorizedSessionID = update->authorized_session_id;
+    std::string visibleSessionID = update->session_id;
+    bool bonusSystemActive = update->bonus_system_active;
+    int buttonID = update->button_id;
+    int lastUpdate = update->last_update;
+    int discountLastUpdate = update->last_discount_update;
 
-    _IntervalsCount++;
-    if (_IntervalsCount < 0) {
-        printf("Memory corruption on _IntervalsCount\n");
-        _IntervalsCount = 0;
-    }
-
-    printf("Sending another PING request to server...\n");
-
-    int serviceMoney = 0;
-    int bonusAmount = 0;
-    bool openStation = false;
-    std::string authorizedSessionID = "";
-    std::string visibleSessionID = "";
-    bool bonusSystemActive = false;
-    int buttonID = 0;
-    int lastUpdate = 0;
-    int discountLastUpdate = 0;
-    std::string qrData = "";
-
-    network->SendPingRequest(serviceMoney, openStation, buttonID, _CurrentBalance, _CurrentProgramID, lastUpdate, discountLastUpdate, bonusSystemActive, qrData, authorizedSessionID, visibleSessionID, bonusAmount);
-    network->GetServerInfo(_ServerUrl);
     if (config) {
         if (lastUpdate != config->GetLastUpdate() && config->GetLastUpdate() != -1) {
             config->LoadConfig();
@@ -727,13 +808,16 @@ int CentralServerDialog() {
     if (serviceMoney > 0) {
         // TODO protect with mutex
         _Balance += serviceMoney;
+        DiaEvent_Notify(DIA_EVENT_MONEY);
     }
     if (bonusAmount > 0) {
         // TODO protect with mutex
         _BalanceBonuses += bonusAmount;
+        DiaEvent_Notify(DIA_EVENT_MONEY);
     }
     if (openStation) {
         _OpenLid = _OpenLid + 1;
+        DiaEvent_Notify(DIA_EVENT_NETWORK);
         printf("Door is going to be opened... \n");
         // TODO: add the function of turning on the relay, which will open the lock.
     }
@@ -754,6 +838,7 @@ int CentralServerDialog() {
         }
         if (_AuthorizedSessionID != authorizedSessionID) {
             EndSession();
+            DiaEvent_Notify(DIA_EVENT_NETWORK);
         }
         _VisibleSessionID = visibleSessionID;
         _AuthorizedSessionID = authorizedSessionID;
@@ -776,45 +861,90 @@ int CentralServerDialog() {
 #ifdef USE_KEYBOARD
     _DebugKey = buttonID;
 #endif
+    if (buttonID != 0) {
+        DiaEvent_Notify(DIA_EVENT_BUTTON);
+    }
+}
+
+// Sends PING request to Central Server every 2 seconds.
+// May get service money from server.
+int CentralServerDialog() {
+    printf("PING CENTRAL SERVER\n");
+
+    _IntervalsCount++;
+    if (_IntervalsCount < 0) {
+        printf("Memory corruption on _IntervalsCount\n");
+        _IntervalsCount = 0;
+    }
+
+    printf("Sending another PING request to server...\n");
+
+    server_update_t update;
+    network->SendPingRequest(&update, _CurrentBalance, _CurrentProgramID);
+    network->GetServerInfo(_ServerUrl);
+    ApplyServerUpdate(&update);
 
     if (config) {
         // Every 30 min (1800 sec) we go inside this
-        static const int maxIntervalsCountWeather = 1800;
-        static int intervalsCountWeather = maxIntervalsCountWeather;
-        if (intervalsCountWeather >= maxIntervalsCountWeather) {
-            intervalsCountWeather = 0;
+        static const int maxIntervalWeather = 1800;
+        static time_t lastWeather = 0;
+        time_t now = time(NULL);
+        if (lastWeather == 0 || now - lastWeather >= maxIntervalWeather) {
+            lastWeather = now;
             config->GetSvcWeather()->SetCurrentTemperature();
         }
-        ++intervalsCountWeather;
     }
     return 0;
 }
 
+// Pings the server every second. While the server pushes updates, PING is
+// only a heartbeat and the updates are applied as soon as they come.
 void *pinging_func(void *ptr) {
+    int iteration = 0;
+    time_t lastDialog = 0;
     while (!_to_be_destroyed) {
-        CentralServerDialog();
-        sleep(1);
+        network->PushTick(_CurrentBalance, _CurrentProgramID);
+        int pushActive = network->PushIsActive();
+        time_t now = time(NULL);
+        if (!pushActive || now - lastDialog >= PUSH_HEARTBEAT_SEC) {
+            CentralServerDialog();
+            lastDialog = now;
+        }
+        if (++iteration % NETWORK_STAT_INTERVAL == 0) {
+            network->PrintRequestStat();
+            DiaLoop_PrintStat(firmwareLoop);
+            DiaGpio *g = config ? config->GetGpio() : 0;
+            if (g) {
+                printf("pulse glitches rejected: coins %d, banknotes %d, additional %d\n",
+                    g->CoinsHandler->Rejected, g->BanknotesHandler->Rejected,
+                    g->AdditionalHandler ? g->AdditionalHandler->Rejected : 0);
+                DiaGpio_PrintRelayLateness(g);
+            }
+        }
+        if (iteration % RELAY_STAT_SAVE_INTERVAL == 0) {
+            DiaGpio *g = config ? config->GetGpio() : 0;
+            if (g) {
+                DiaGpio_SaveStat(g);
+            }
+        }
+        server_update_t update;
+        if (pushActive && network->WaitServerUpdate(&update, 1000) == 0) {
+            ApplyServerUpdate(&update);
+        } else if (!pushActive) {
+            sleep(1);
+        }
     }
     pthread_exit(0);
     return 0;
 }
 
-void *run_program_func(void *ptr) {
-    while (!_to_be_destroyed) {
-        RunProgram();
-        delay(100);
-    }
-    pthread_exit(0);
-    return 0;
+// Both jobs have the same period, so they share every loop wakeup.
+void run_program_job(void *arg) {
+    RunProgram();
 }
 
-void *get_volume_func(void *ptr) {
-    while (!_to_be_destroyed) {
-        GetVolume();
-        delay(100);
-    }
-    pthread_exit(0);
-    return 0;
+void get_volume_job(void *arg) {
+    GetVolume();
 }
 
 void KeyPress(){
@@ -862,22 +992,60 @@ int RecoverRelay() {
 //////// End of Central server communication functions /////////
 
 //////// Local registry Save/Load functions /////////
+// Values are read from memory. Writes are committed in batches, so a value
+// set less than STORAGE_FILE_SYNC_INTERVAL_MS before a power cut is lost,
+// but never half-written.
 std::string GetLocalData(std::string key) {
-    std::string filename = "registry_" + key + ".reg";
-    if (file_exists(filename.c_str())) {
-        char value[6];
-        dia_security_read_file(filename.c_str(), value, 5);
-
-        return std::string(value, 6);
-    } else {
+    std::string value;
+    if (DiaStorageFile_Get(localRegistry, key.c_str(), &value) != STORAGE_FILE_NO_ERROR) {
         return "0";
     }
+    return value;
 }
 
 void SetLocalData(std::string key, std::string value) {
-    std::string filename = "registry_" + key + ".reg";
     fprintf(stderr, "Key: %s, Value: %s \n", key.c_str(), value.c_str());
-    dia_security_write_file(filename.c_str(), value.c_str());
+    DiaStorageFile_SaveAsync(localRegistry, key.c_str(), value.data(), value.size());
+}
+
+// Moves registry_<key>.reg files of older versions into the local registry.
+// Files are removed only after their values are on disk; a key which is
+// already in the registry keeps its value.
+int MigrateLocalRegistry(DiaStorageFile *registry) {
+    DIR *dir = opendir(".");
+    if (!dir) {
+        return 1;
+    }
+    std::list<std::string> migrated;
+    size_t prefixLength = strlen(LOCAL_REGISTRY_FILE_PREFIX);
+    size_t suffixLength = strlen(LOCAL_REGISTRY_FILE_SUFFIX);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        std::string filename = entry->d_name;
+        if (filename.size() <= prefixLength + suffixLength ||
+            filename.compare(0, prefixLength, LOCAL_REGISTRY_FILE_PREFIX) != 0 ||
+            filename.compare(filename.size() - suffixLength, suffixLength, LOCAL_REGISTRY_FILE_SUFFIX) != 0) {
+            continue;
+        }
+        std::string key = filename.substr(prefixLength, filename.size() - prefixLength - suffixLength);
+        std::string value;
+        if (DiaStorageFile_Get(registry, key.c_str(), &value) == STORAGE_FILE_NOT_FOUND) {
+            char buf[256] = "";
+            dia_security_read_file(filename.c_str(), buf, sizeof(buf));
+            DiaStorageFile_SaveAsync(registry, key.c_str(), buf, strlen(buf));
+            printf("Local registry: %s migrated from %s\n", key.c_str(), filename.c_str());
+        }
+        migrated.push_back(filename);
+    }
+    closedir(dir);
+
+    if (DiaStorageFile_Flush(registry) != STORAGE_FILE_NO_ERROR) {
+        return 1;
+    }
+    for (std::list<std::string>::iterator it = migrated.begin(); it != migrated.end(); ++it) {
+        unlink(it->c_str());
+    }
+    return 0;
 }
 /////////////////////////////////////////////////////
 
@@ -1010,6 +1178,13 @@ int main(int argc, char **argv) {
         return 0;
     }
 
+    localRegistry = new DiaStorageFile(LOCAL_REGISTRY_PATH);
+    if (DiaStorageFile_Open(localRegistry) == STORAGE_FILE_NO_ERROR) {
+        MigrateLocalRegistry(localRegistry);
+    } else {
+        printf("Local registry is not available, local values won't be kept\n");
+    }
+
     // Timer initialization
     struct timespec stored_time;
     clock_gettime(CLOCK_MONOTONIC_RAW, &stored_time);
@@ -1272,6 +1447,7 @@ int main(int argc, char **argv) {
         screen->set_value_function = dia_screen_config_set_value_function;
         screen->screen_object = config->GetScreen();
         screen->display_screen = dia_screen_display_screen;
+        screen->prefetch_screen = dia_screen_prefetch_screen;
         config->GetRuntime()->AddScreen(screen);
     }
     
@@ -1381,9 +1557,13 @@ int main(int argc, char **argv) {
         printf("no additional coin handler\n");
     }
 
-    pthread_create(&run_program_thread, NULL, run_program_func, NULL);
-    printf("get_volume_func start...\n");
-    pthread_create(&get_volume_thread, NULL, get_volume_func, NULL);
+    printf("Firmware loop start...\n");
+    firmwareLoop = new DiaLoop();
+    if (DiaLoop_Start(firmwareLoop) != DIA_LOOP_NO_ERROR) {
+        printf("Firmware loop is not started, programs won't be switched\n");
+    }
+    DiaLoop_AddTimer(firmwareLoop, FIRMWARE_JOB_PERIOD_MS, NULL, run_program_job, NULL);
+    DiaLoop_AddTimer(firmwareLoop, FIRMWARE_JOB_PERIOD_MS, NULL, get_volume_job, NULL);
 
 /*
     std::list<std::string> directories;
@@ -1412,27 +1592,8 @@ int main(int argc, char **argv) {
         // Call Lua loop function
         config->GetRuntime()->Loop();
 
-        int x = 0;
-        int y = 0;
-        SDL_GetMouseState(&x, &y);
-        if (config->NeedRotateTouch()) {
-            x = config->GetResX() - x;
-            y = config->GetResY() - y;
-        }
-
-        // Process pressed button
-        DiaScreen *screen = config->GetScreen();
-        std::string last = screen->LastDisplayed;
-
-        for (auto it = config->ScreenConfigs[last]->clickAreas.begin(); it != config->ScreenConfigs[last]->clickAreas.end(); ++it) {
-            if (x >= (*it).X && x <= (*it).X + (*it).Width && y >= (*it).Y && y <= (*it).Y + (*it).Height && mousepress == 1) {
-                printf("CLICK!!!\n");
-                mousepress = 0;
-                _DebugKey = std::stoi((*it).ID);
-                printf("DEBUG KEY = %d\n", _DebugKey);
-            }
-        }
-
+        // Drain input before the click check: a touch wakes smart_delay
+        // and is handled in the same pass
         while (SDL_PollEvent(&_event)) {
             switch (_event.type) {
                 case SDL_QUIT:
@@ -1509,8 +1670,34 @@ int main(int argc, char **argv) {
                     break;
             }
         }
+
+        int x = 0;
+        int y = 0;
+        SDL_GetMouseState(&x, &y);
+        if (config->NeedRotateTouch()) {
+            x = config->GetResX() - x;
+            y = config->GetResY() - y;
+        }
+
+        // Process pressed button
+        DiaScreen *screen = config->GetScreen();
+        std::string last = screen->LastDisplayed;
+
+        for (auto it = config->ScreenConfigs[last]->clickAreas.begin(); it != config->ScreenConfigs[last]->clickAreas.end(); ++it) {
+            if (x >= (*it).X && x <= (*it).X + (*it).Width && y >= (*it).Y && y <= (*it).Y + (*it).Height && mousepress == 1) {
+                printf("CLICK!!!\n");
+                mousepress = 0;
+                _DebugKey = std::stoi((*it).ID);
+                printf("DEBUG KEY = %d\n", _DebugKey);
+            }
+        }
     }
     _to_be_destroyed = 1;
+    DiaLoop_Stop(firmwareLoop);
+    if (config->GetGpio()) {
+        DiaGpio_SaveStat(config->GetGpio());
+    }
+    DiaStorageFile_Flush(localRegistry);
 
     delay(2000);
     return 0;
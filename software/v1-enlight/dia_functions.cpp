@@ -3,9 +3,11 @@
 #include <iostream>
 
 #include "dia_functions.h"
+#include "dia_scaler.h"
 #include "string.h"
 #include <unistd.h>
 #include <cmath>
+#include <vector>
 #include "./QR/qrcodegen.hpp"
 
 using qrcodegen::QrCode;
@@ -193,10 +195,8 @@ class ScalerCoefs {
 };
 
 
-SDL_Surface *dia_ScaleSurface(SDL_Surface *Surface, Uint16 Width, Uint16 Height) {
-    if(!Surface || !Width || !Height)
-        return 0;
-
+// Generic scaler for surfaces which are not 32 bits per pixel.
+static SDL_Surface *dia_ScaleSurfaceGeneric(SDL_Surface *Surface, Uint16 Width, Uint16 Height) {
     SDL_Surface *_ret = SDL_CreateRGBSurface(Surface->flags, Width, Height, Surface->format->BitsPerPixel,
         Surface->format->Rmask, Surface->format->Gmask, Surface->format->Bmask, Surface->format->Amask);
 
@@ -290,6 +290,30 @@ SDL_Surface *dia_ScaleSurface(SDL_Surface *Surface, Uint16 Width, Uint16 Height)
     return _ret;
 }
 
+SDL_Surface *dia_ScaleSurface(SDL_Surface *Surface, Uint16 Width, Uint16 Height) {
+    if(!Surface || !Width || !Height)
+        return 0;
+
+    if (Surface->format->BytesPerPixel != 4) {
+        return dia_ScaleSurfaceGeneric(Surface, Width, Height);
+    }
+
+    SDL_Surface *_ret = SDL_CreateRGBSurface(Surface->flags, Width, Height, Surface->format->BitsPerPixel,
+        Surface->format->Rmask, Surface->format->Gmask, Surface->format->Bmask, Surface->format->Amask);
+    if (!_ret) {
+        return 0;
+    }
+
+    SDL_LockSurface(Surface);
+    SDL_LockSurface(_ret);
+    dia_scale_rgba32((const uint32_t *)Surface->pixels, Surface->w, Surface->h, Surface->pitch,
+        (uint32_t *)_ret->pixels, Width, Height, _ret->pitch);
+    SDL_UnlockSurface(_ret);
+    SDL_UnlockSurface(Surface);
+
+    return _ret;
+}
+
 char * dia_int_to_str(int n, char * result) {
      int i, sign;
 
@@ -398,4 +422,73 @@ SDL_Surface* dia_QRToSurface(QrCode code){
         }
     }
     return qr;
-}
\ No newline at end of file
+}
+
+// Draws the code directly at the requested size. Every pixel takes the color
+// of the nearest module, so edges stay sharp and no scaling is needed.
+SDL_Surface* dia_QRToScaledSurface(QrCode code, int width, int height) {
+    if (width <= 0 || height <= 0) {
+        return 0;
+    }
+    SDL_Surface * qr = SDL_CreateRGBSurface(0, width, height, 32, 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000);
+    if (!qr) {
+        return 0;
+    }
+
+    int modules = code.getSize();
+    std::vector<int> columnModule(width);
+    for (int x = 0; x < width; x++) {
+        columnModule[x] = x * modules / width;
+    }
+
+    SDL_LockSurface(qr);
+    for (int y = 0; y < height; y++) {
+        int moduleY = y * modules / height;
+        Uint32 * row = (Uint32 *)((Uint8 *)qr->pixels + y * qr->pitch);
+        for (int x = 0; x < width; x++) {
+            row[x] = code.getModule(columnModule[x], moduleY) ? 0 : 0xffffffff;
+        }
+    }
+    SDL_UnlockSurface(qr);
+    return qr;
+}
+
+SDL_Rect dia_union_rect(SDL_Rect a, SDL_Rect b) {
+    if (a.w == 0 || a.h == 0) return b;
+    if (b.w == 0 || b.h == 0) return a;
+
+    int x1 = a.x < b.x ? a.x : b.x;
+    int y1 = a.y < b.y ? a.y : b.y;
+    int x2 = (a.x + a.w) > (b.x + b.w) ? (a.x + a.w) : (b.x + b.w);
+    int y2 = (a.y + a.h) > (b.y + b.h) ? (a.y + a.h) : (b.y + b.h);
+
+    SDL_Rect res;
+    res.x = x1;
+    res.y = y1;
+    res.w = x2 - x1;
+    res.h = y2 - y1;
+    return res;
+}
+
+// Returns 1 and the common part of two rectangles if they intersect.
+int dia_intersect_rect(SDL_Rect a, SDL_Rect b, SDL_Rect * result) {
+    int x1 = a.x > b.x ? a.x : b.x;
+    int y1 = a.y > b.y ? a.y : b.y;
+    int x2 = (a.x + a.w) < (b.x + b.w) ? (a.x + a.w) : (b.x + b.w);
+    int y2 = (a.y + a.h) < (b.y + b.h) ? (a.y + a.h) : (b.y + b.h);
+
+    if (x2 <= x1 || y2 <= y1) {
+        return 0;
+    }
+    if (result) {
+        result->x = x1;
+        result->y = y1;
+        result->w = x2 - x1;
+        result->h = y2 - y1;
+    }
+    return 1;
+}
+
+int dia_rect_area(SDL_Rect rect) {
+    return (int)rect.w * (int)rect.h;
+}
@@ -26,5 +26,11 @@ Uint32 ReadPixel(SDL_Surface* surface, int x, int y);
 SDL_Surface* dia_SurfaceFromBase64(std::string img);
 
 SDL_Surface* dia_QRToSurface(QrCode code);
+SDL_Surface* dia_QRToScaledSurface(QrCode code, int width, int height);
+
+// Rectangle helpers for partial screen updates.
+SDL_Rect dia_union_rect(SDL_Rect a, SDL_Rect b);
+int dia_intersect_rect(SDL_Rect a, SDL_Rect b, SDL_Rect * result);
+int dia_rect_area(SDL_Rect rect);
 
 #endif
@@ -1,13 +1,89 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 #include <wiringPi.h>
 
 #include "dia_gpio.h"
 #include "pthread.h"
 #include <assert.h>
 
+// wiringPiISR takes a plain function without arguments, so every handler
+// with an interrupt gets its own slot and trampoline.
+static PulseHandler * volatile pulse_isr_handlers[PULSE_ISR_SLOTS];
+
+static uint64_t DiaGpio_NowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+template <int slot> static void DiaGpio_PulseInterrupt() {
+    // Timestamp first: the level is read after it and may be a bit late
+    uint64_t nowUs = DiaGpio_NowUs();
+    PulseHandler * handler = pulse_isr_handlers[slot];
+    if (handler) {
+        handler->Edge(digitalRead(handler->PinNumber), nowUs);
+    }
+}
+
+static void (* const pulse_isr_functions[PULSE_ISR_SLOTS])(void) = {
+    DiaGpio_PulseInterrupt<0>,
+    DiaGpio_PulseInterrupt<1>,
+    DiaGpio_PulseInterrupt<2>,
+    DiaGpio_PulseInterrupt<3>,
+};
+
+// Switches the handler to edge capture. Returns 0 on success; on failure
+// the handler stays in polling mode. There is no way back to polling
+// once the interrupt is set.
+static int DiaGpio_AttachPulseInterrupt(PulseHandler * handler, int minWidthUs, int debounceUs) {
+    handler->MinPulseWidthUs = minWidthUs;
+    handler->DebounceUs = debounceUs;
+    if (handler->Mode == PULSE_CAPTURE_EDGE) {
+        return 0;
+    }
+
+    int slot = -1;
+    for (int i = 0; i < PULSE_ISR_SLOTS; i++) {
+        if (!pulse_isr_handlers[i]) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        printf("no free interrupt slot for pin %d, polling it\n", handler->PinNumber);
+        return 1;
+    }
+
+    handler->Level = digitalRead(handler->PinNumber);
+    handler->Counted = handler->Level;
+    pulse_isr_handlers[slot] = handler;
+    handler->Mode = PULSE_CAPTURE_EDGE;
+    if (wiringPiISR(handler->PinNumber, INT_EDGE_BOTH, pulse_isr_functions[slot]) < 0) {
+        pulse_isr_handlers[slot] = 0;
+        handler->Mode = PULSE_CAPTURE_POLLING;
+        printf("can't set interrupt on pin %d, polling it\n", handler->PinNumber);
+        return 1;
+    }
+    printf("pin %d: edge capture, min width %dus, debounce %dus\n", handler->PinNumber, minWidthUs, debounceUs);
+    return 0;
+}
+
+// wiringPi can't detach an interrupt, so the slot is just emptied
+static void DiaGpio_DeletePulseHandler(PulseHandler * handler) {
+    if (!handler) return;
+    for (int i = 0; i < PULSE_ISR_SLOTS; i++) {
+        if (pulse_isr_handlers[i] == handler) {
+            pulse_isr_handlers[i] = 0;
+        }
+    }
+    delete handler;
+}
+
 DiaGpio::~DiaGpio() {
-  delete CoinsHandler;
-  delete BanknotesHandler;
+  DiaGpio_DeletePulseHandler(CoinsHandler);
+  DiaGpio_DeletePulseHandler(BanknotesHandler);
+  DiaGpio_DeletePulseHandler(AdditionalHandler);
 }
 
 int DiaGpio_GetLastKey(DiaGpio * gpio) {
@@ -48,11 +124,14 @@ void DiaGpio_WriteRelay(DiaGpio * gpio, int relayNumber, int value) {
     }
     if(gpio->InitializedOk) {
         if(relayNumber>=0 && relayNumber<=gpio->MaxRelays && gpio->RelayPin[relayNumber]>=0) {
+            long nowMs = (long)(DiaGpio_NowUs() / 1000);
             if (value == 1) {
-                gpio->RelayOnTime[relayNumber] = gpio->curTime;
+                if (!gpio->RelayOnTime[relayNumber]) {
+                    gpio->RelayOnTime[relayNumber] = nowMs;
+                }
             } else {
                 if (gpio->RelayOnTime[relayNumber]>0) {
-                    long time_elapsed = gpio->curTime - gpio->RelayOnTime[relayNumber];
+                    long time_elapsed = nowMs - gpio->RelayOnTime[relayNumber];
                     gpio->Stat.relay_time[relayNumber] = gpio->Stat.relay_time[relayNumber] + time_elapsed;
                     gpio->Stat.relay_switch[relayNumber] = gpio->Stat.relay_switch[relayNumber] + 1;
                     gpio->RelayOnTime[relayNumber] = 0;
@@ -80,6 +159,14 @@ DiaGpio::DiaGpio(int maxButtons, int maxRelays, storage_interface_t * storage) {
     CurrentProgram = -1;
     CurrentProgramIsPreflight = 0;
     AllTurnedOff = 0;
+    RelaysChanged = 1;
+    RelayLateness = relay_lateness_t();
+    PrintedRelayLateness = relay_lateness_t();
+    pthread_condattr_t condAttr;
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&RelayCond, &condAttr);
+    pthread_condattr_destroy(&condAttr);
     if(maxButtons>=PIN_COUNT) {
         printf("ERROR: buttons # is too big\n");
         InitializedOk = 0;
@@ -95,12 +182,20 @@ DiaGpio::DiaGpio(int maxButtons, int maxRelays, storage_interface_t * storage) {
     LastPressedKey = -1;
     InitializedOk = 0;
     NeedWorking = 1;
+    CoinsHandler = 0;
+    BanknotesHandler = 0;
+    AdditionalHandler = 0;
+    PulseCapture = PULSE_CAPTURE_POLLING;
+    PulseMinWidthUs = PULSE_MIN_WIDTH_US;
+    PulseDebounceUs = PULSE_DEBOUNCE_US;
 
+    // Without it wiringPiISR exits the process on failure instead of
+    // letting us fall back to polling
+    setenv("WIRINGPI_CODES", "1", 0);
     if (wiringPiSetup () == -1) return;
 
     CoinsHandler = new PulseHandler(COIN_PIN);
     BanknotesHandler = new PulseHandler(BANKNOTE_PIN);
-    AdditionalHandler = 0;
 
     cleanPins(ButtonPin, PIN_COUNT);
     ButtonPin[1] = 13;
@@ -168,7 +263,9 @@ DiaGpio::DiaGpio(int maxButtons, int maxRelays, storage_interface_t * storage) {
 
     pthread_create(&WorkingThread, NULL, DiaGpio_WorkingThread, this);
     pthread_create(&LedSwitchingThread, NULL, DiaGpio_LedSwitcher, this);
+    pthread_create(&RelayThread, NULL, DiaGpio_RelayThread, this);
     pthread_setschedprio(WorkingThread, SCHED_FIFO);
+    pthread_setschedprio(RelayThread, SCHED_FIFO);
     InitializedOk = 1;
 }
 
@@ -180,7 +277,30 @@ void DiaGpio_StartAdditionalHandler(DiaGpio *gpio, int preferredIndex) {
     printf("starting additional handler on [%d] pin of index [%d]\n", foundPin, preferredIndex);
   }
   if(foundPin >=0 ) {
-    gpio->AdditionalHandler = new PulseHandler(foundPin);
+    PulseHandler * handler = new PulseHandler(foundPin);
+    if (gpio->PulseCapture == PULSE_CAPTURE_EDGE) {
+      DiaGpio_AttachPulseInterrupt(handler, gpio->PulseMinWidthUs, gpio->PulseDebounceUs);
+    }
+    gpio->AdditionalHandler = handler;
+  }
+}
+
+void DiaGpio_SetPulseCapture(DiaGpio *gpio, int mode, int minWidthUs, int debounceUs) {
+  assert(gpio);
+  if (minWidthUs < 0) minWidthUs = PULSE_MIN_WIDTH_US;
+  if (debounceUs < 0) debounceUs = PULSE_DEBOUNCE_US;
+  gpio->PulseCapture = mode;
+  gpio->PulseMinWidthUs = minWidthUs;
+  gpio->PulseDebounceUs = debounceUs;
+  if (!gpio->InitializedOk || mode != PULSE_CAPTURE_EDGE) {
+    return;
+  }
+
+  PulseHandler * handlers[] = {gpio->CoinsHandler, gpio->BanknotesHandler, gpio->AdditionalHandler};
+  for (unsigned int i = 0; i < sizeof(handlers) / sizeof(handlers[0]); i++) {
+    if (handlers[i]) {
+      DiaGpio_AttachPulseInterrupt(handlers[i], minWidthUs, debounceUs);
+    }
   }
 }
 
@@ -195,11 +315,81 @@ void DiaGpio_SetProgram(DiaGpio * gpio, int programNumber, int relayNumber,  int
     gpio->Programs[programNumber].RelayNum[relayNumber] = relayNumber;
     gpio->Programs[programNumber].OnTime[relayNumber] = onTime;
     gpio->Programs[programNumber].OffTime[relayNumber] = offTime;
+    DiaGpio_RelaysChanged(gpio);
+}
+
+void DiaGpio_SetCurrentProgram(DiaGpio * gpio, int program, int isPreflight) {
+    assert(gpio);
+    pthread_mutex_lock(&gpio->RelayLock);
+    if (gpio->CurrentProgram != program || gpio->CurrentProgramIsPreflight != isPreflight) {
+        gpio->CurrentProgram = program;
+        gpio->CurrentProgramIsPreflight = isPreflight;
+        gpio->RelaysChanged = 1;
+        pthread_cond_signal(&gpio->RelayCond);
+    }
+    pthread_mutex_unlock(&gpio->RelayLock);
+}
+
+void DiaGpio_RelaysChanged(DiaGpio * gpio) {
+    assert(gpio);
+    pthread_mutex_lock(&gpio->RelayLock);
+    gpio->RelaysChanged = 1;
+    pthread_cond_signal(&gpio->RelayCond);
+    pthread_mutex_unlock(&gpio->RelayLock);
 }
 
-void DiaGpio_CheckRelays(DiaGpio * gpio, long curTime) {
+void DiaGpio_GetRelayLateness(DiaGpio * gpio, relay_lateness_t * lateness) {
     assert(gpio);
-    if(gpio->CurrentProgram>(int)sizeof(gpio->Programs)) {
+    pthread_mutex_lock(&gpio->RelayLock);
+    *lateness = gpio->RelayLateness;
+    pthread_mutex_unlock(&gpio->RelayLock);
+}
+
+void DiaGpio_PrintRelayLateness(DiaGpio * gpio) {
+    relay_lateness_t cur;
+    DiaGpio_GetRelayLateness(gpio, &cur);
+    relay_lateness_t *prev = &gpio->PrintedRelayLateness;
+    uint64_t switches = cur.switches - prev->switches;
+    printf("relay switches: %llu, lateness avg %llu us, max ever %llu us;",
+        (unsigned long long)switches,
+        (unsigned long long)(switches ? (cur.total_us - prev->total_us) / switches : 0),
+        (unsigned long long)cur.max_us);
+    for (int i = 0; i < RELAY_LATENESS_BUCKETS; i++) {
+        uint64_t count = cur.buckets[i] - prev->buckets[i];
+        if (!count) continue;
+        if (i == RELAY_LATENESS_BUCKETS - 1) {
+            printf(" >=%lluus:%llu", 1ULL << (i - 1), (unsigned long long)count);
+        } else {
+            printf(" <%lluus:%llu", 1ULL << i, (unsigned long long)count);
+        }
+    }
+    printf("\n");
+    *prev = cur;
+}
+
+int DiaGpio_SaveStat(DiaGpio * gpio) {
+    assert(gpio);
+    // The relay thread updates the counters under the lock
+    pthread_mutex_lock(&gpio->RelayLock);
+    relay_stat stat = gpio->Stat;
+    pthread_mutex_unlock(&gpio->RelayLock);
+    return gpio->_Storage->save(gpio->_Storage->object, "relays", &stat, sizeof(stat));
+}
+
+static DiaRelayConfig * DiaGpio_CurrentRelayConfig(DiaGpio * gpio) {
+    if (gpio->CurrentProgramIsPreflight) {
+        return &gpio->PreflightPrograms[gpio->CurrentProgram];
+    }
+    return &gpio->Programs[gpio->CurrentProgram];
+}
+
+// Applies the current program: steady relays are set at once, pulsing ones
+// get a deadline now. Called with RelayLock held.
+static void DiaGpio_ScheduleRelays(DiaGpio * gpio, uint64_t nowUs) {
+    while (!gpio->RelayQueue.empty()) {
+        gpio->RelayQueue.pop();
+    }
+    if(gpio->CurrentProgram>=MAX_PROGRAMS_COUNT) {
         printf("Disabling programs as current program is out of range %d...\n", gpio->CurrentProgram);
         gpio->CurrentProgram = -1;
     }
@@ -210,43 +400,65 @@ void DiaGpio_CheckRelays(DiaGpio * gpio, long curTime) {
             printf("turning all off\n");
             DiaGpio_StopRelays(gpio);
         }
-    } else {
-        gpio->AllTurnedOff = 0;
-        DiaRelayConfig * config;
-        if (gpio->CurrentProgramIsPreflight) {
-            config = &gpio->PreflightPrograms[gpio->CurrentProgram];
-        } else {
-            config = &gpio->Programs[gpio->CurrentProgram];
+        return;
+    }
+    gpio->AllTurnedOff = 0;
+    DiaRelayConfig * config = DiaGpio_CurrentRelayConfig(gpio);
+    for(int i=0;i<PIN_COUNT;i++) {
+        if(gpio->RelayPin[i]<0) {
+            continue;
         }
-        for(int i=0;i<PIN_COUNT;i++) {
-            if(gpio->RelayPin[i]<0) {
-                continue;
+        if(config->OnTime[i]<=0) {
+            if(gpio->RelayPinStatus[i]) {
+                printf("-%d; ontime:%ld status:%d\n", i, config->OnTime[i], gpio->RelayPinStatus[i]);
+                DiaGpio_WriteRelay(gpio, i, 0);
             }
-
-            if(config->OnTime[i]<=0) {
-                if(gpio->RelayPinStatus[i]) {
-                    printf("-%d; ontime:%ld status:%d\n", i, config->OnTime[i], gpio->RelayPinStatus[i]);
-                    DiaGpio_WriteRelay(gpio, i, 0);
-                }
-            } else if(config->OffTime[i]<=0) {
-                if(!gpio->RelayPinStatus[i]) {
-                    DiaGpio_WriteRelay(gpio, i, 1);
-                }
-            } else {
-                if(curTime>=config->NextSwitchTime[i]) {
-                    if(gpio->RelayPinStatus[i]) {
-                        DiaGpio_WriteRelay(gpio, i, 0);
-                        config->NextSwitchTime[i] = curTime + config->OffTime[i];
-                    } else  {
-                        DiaGpio_WriteRelay(gpio, i,1);
-                        config->NextSwitchTime[i] = curTime + config->OnTime[i];
-                    }
-                }
+        } else if(config->OffTime[i]<=0) {
+            if(!gpio->RelayPinStatus[i]) {
+                DiaGpio_WriteRelay(gpio, i, 1);
             }
+        } else {
+            relay_deadline_t deadline = {nowUs, i};
+            gpio->RelayQueue.push(deadline);
         }
     }
 }
 
+static void DiaGpio_RecordLateness(relay_lateness_t * lateness, uint64_t lateUs) {
+    int bucket = 0;
+    while (bucket < RELAY_LATENESS_BUCKETS - 1 && lateUs >= (1ULL << bucket)) {
+        bucket++;
+    }
+    lateness->buckets[bucket]++;
+    lateness->switches++;
+    lateness->total_us += lateUs;
+    if (lateUs > lateness->max_us) {
+        lateness->max_us = lateUs;
+    }
+}
+
+// Toggles a pulsing relay which is due. The next deadline counts from this
+// one, not from now, so the duty cycle does not stretch when we are late;
+// after a stall longer than the period it starts over from now instead of
+// catching up with a burst of switches. Called with RelayLock held.
+static void DiaGpio_SwitchRelay(DiaGpio * gpio, relay_deadline_t deadline, uint64_t nowUs) {
+    DiaRelayConfig * config = DiaGpio_CurrentRelayConfig(gpio);
+    int i = deadline.relay;
+    if(config->OnTime[i]<=0 || config->OffTime[i]<=0) {
+        return;
+    }
+    DiaGpio_RecordLateness(&gpio->RelayLateness, nowUs - deadline.due_us);
+
+    int value = !gpio->RelayPinStatus[i];
+    DiaGpio_WriteRelay(gpio, i, value);
+    uint64_t periodUs = (uint64_t)(value ? config->OnTime[i] : config->OffTime[i]) * 1000;
+    deadline.due_us += periodUs;
+    if (deadline.due_us <= nowUs) {
+        deadline.due_us = nowUs + periodUs;
+    }
+    gpio->RelayQueue.push(deadline);
+}
+
 int DiaGpio_ReadButton(DiaGpio * gpio, int ButtonNumber) {
   if(ButtonNumber>=0 && ButtonNumber<=gpio->MaxButtons) {
     if(gpio->ButtonPin[ButtonNumber]>=0) {
@@ -362,6 +574,43 @@ void * DiaGpio_LedSwitcher(void * gpio)
 }
 
 
+// Sleeps until the nearest relay deadline on the monotonic clock or until
+// the program changes, whichever comes first.
+void * DiaGpio_RelayThread(void * gpio) {
+    DiaGpio *Gpio = (DiaGpio *)gpio;
+
+    pthread_mutex_lock(&Gpio->RelayLock);
+    while(Gpio->NeedWorking) {
+      uint64_t nowUs = DiaGpio_NowUs();
+      if(Gpio->RelaysChanged) {
+        Gpio->RelaysChanged = 0;
+        DiaGpio_ScheduleRelays(Gpio, nowUs);
+      }
+      while(!Gpio->RelayQueue.empty() && Gpio->RelayQueue.top().due_us <= nowUs) {
+        relay_deadline_t deadline = Gpio->RelayQueue.top();
+        Gpio->RelayQueue.pop();
+        DiaGpio_SwitchRelay(Gpio, deadline, nowUs);
+      }
+
+      if(Gpio->RelaysChanged) {
+        continue;
+      }
+      if(Gpio->RelayQueue.empty()) {
+        pthread_cond_wait(&Gpio->RelayCond, &Gpio->RelayLock);
+      } else {
+        uint64_t dueUs = Gpio->RelayQueue.top().due_us;
+        struct timespec due;
+        due.tv_sec = dueUs / 1000000;
+        due.tv_nsec = (dueUs % 1000000) * 1000;
+        pthread_cond_timedwait(&Gpio->RelayCond, &Gpio->RelayLock, &due);
+      }
+    }
+    pthread_mutex_unlock(&Gpio->RelayLock);
+    pthread_exit(NULL);
+    return NULL;
+}
+
+
 void * DiaGpio_WorkingThread(void * gpio) {
     DiaGpio *Gpio = (DiaGpio *)gpio;
 
@@ -370,7 +619,6 @@ void * DiaGpio_WorkingThread(void * gpio) {
     while(Gpio->NeedWorking) {
       delay(1);//This code will run once per ms
       curTime+=1;
-      DiaGpio_CheckRelays(Gpio, curTime);
 
       Gpio->CoinsHandler->Tick();
       Gpio->BanknotesHandler->Tick();
@@ -389,6 +637,7 @@ void * DiaGpio_WorkingThread(void * gpio) {
                   Gpio->ButtonStatus[i] = 1;
                   Gpio->ButtonLastStatusChangeTime[i] = curTime + 100;
                   Gpio->LastPressedKey = i;
+                  DiaEvent_Notify(DIA_EVENT_BUTTON);
               }
           } else {
             if(Gpio->ButtonStatus[i] && curTime > Gpio->ButtonLastStatusChangeTime[i]) {
@@ -9,6 +9,18 @@
 #define COIN_PIN 29
 #define BANKNOTE_PIN 28
 
+// Pulse capture modes
+#define PULSE_CAPTURE_POLLING 0
+#define PULSE_CAPTURE_EDGE 1
+
+// Edge capture filter defaults. The polling filter needs 5 of 6 samples
+// taken 1ms apart, so pulses shorter than ~5ms never counted there either.
+#define PULSE_MIN_WIDTH_US 5000
+#define PULSE_DEBOUNCE_US 2000
+
+// Max handlers with interrupts attached at the same time
+#define PULSE_ISR_SLOTS 4
+
 #define NO_ANIMATION 0
 #define ONE_BUTTON_ANIMATION 1
 #define IDLE_ANIMATION 2
@@ -18,9 +30,17 @@
 #define DEFAULT_LIGHTING_TIME_MS 500
 #define MAX_PROGRAMS_COUNT 100
 
+// Relay switch lateness histogram. Bucket 0 counts switches made on time,
+// bucket i switches late by [2^(i-1), 2^i) us, the last one everything later.
+#define RELAY_LATENESS_BUCKETS 20
+
 #include <pthread.h>
+#include <stdint.h>
 #include <map>
+#include <queue>
+#include <vector>
 
+#include "dia_event.h"
 #include "dia_relayconfig.h"
 #include "dia_storage_interface.h"
 
@@ -29,13 +49,44 @@ struct relay_stat {
     int relay_switch[PIN_COUNT];
 };
 
+typedef struct relay_lateness {
+    uint64_t switches;
+    uint64_t total_us;
+    uint64_t max_us;
+    uint64_t buckets[RELAY_LATENESS_BUCKETS];
+} relay_lateness_t;
+
+// Next switch of a pulsing relay, CLOCK_MONOTONIC.
+typedef struct relay_deadline {
+    uint64_t due_us;
+    int relay;
+} relay_deadline_t;
+
+struct relay_deadline_later {
+    bool operator()(const relay_deadline_t &a, const relay_deadline_t &b) const {
+        return a.due_us > b.due_us;
+    }
+};
+
 class PulseHandler {
 public:
   int PinNumber;
-  int Money;
+  volatile int Money;
+  // Pulses thrown away by the filter: too short or bouncing
+  volatile int Rejected;
   int Status[COIN_TOTAL];
   int Status_;
   int Loop;
+
+  // PULSE_CAPTURE_POLLING: Tick() is called every 1ms by the working thread.
+  // PULSE_CAPTURE_EDGE: Edge() is called from the interrupt thread.
+  int Mode;
+  int MinPulseWidthUs;
+  int DebounceUs;
+  int Level;
+  int Counted;
+  uint64_t RiseUs;
+  uint64_t FallUs;
 private:
   int calcONPins() {
     int res = 0;
@@ -48,6 +99,7 @@ private:
 public:
   PulseHandler(int pinNumber) {
     Money = 0;
+    Rejected = 0;
     PinNumber=pinNumber;
     pinMode(PinNumber, INPUT);
     for(int i=0;i<COIN_TOTAL;i++) {
@@ -55,9 +107,24 @@ public:
       Status_ = digitalRead(PinNumber);
     }
     Loop = 0;
+
+    Mode = PULSE_CAPTURE_POLLING;
+    MinPulseWidthUs = PULSE_MIN_WIDTH_US;
+    DebounceUs = PULSE_DEBOUNCE_US;
+    Level = Status_;
+    Counted = Status_;
+    RiseUs = 0;
+    FallUs = 0;
+  }
+
+  // Returns the money counted since the last call and resets it.
+  int TakeMoney() {
+    return __sync_lock_test_and_set(&Money, 0);
   }
 
   void Tick() {
+    if (Mode != PULSE_CAPTURE_POLLING) return;
+
     int curState = digitalRead(PinNumber);
     Status[Loop] = curState;
 
@@ -70,11 +137,45 @@ public:
       if(curSwitchedOnPins<(COIN_TOTAL-COIN_SWITCH)) Status_ = 0;
     } else {
       if(curSwitchedOnPins>COIN_SWITCH) {
-        Money++;
+        __sync_fetch_and_add(&Money, 1);
+        DiaEvent_Notify(DIA_EVENT_MONEY);
         Status_ = 1;
       }
     }
   }
+
+  // Handles a level change seen at nowUs (CLOCK_MONOTONIC).
+  // A pulse is counted on its falling edge if it was at least MinPulseWidthUs
+  // wide. A rise sooner than DebounceUs after a fall is contact bounce, so the
+  // previous pulse goes on and is not counted twice.
+  void Edge(int level, uint64_t nowUs) {
+    if (level == Level) {
+      // Both edges were missed: the pulse was shorter than our latency
+      if (!level) __sync_fetch_and_add(&Rejected, 1);
+      return;
+    }
+    Level = level;
+
+    if (level) {
+      if (FallUs && nowUs - FallUs < (uint64_t)DebounceUs) {
+        __sync_fetch_and_add(&Rejected, 1);
+        return;
+      }
+      RiseUs = nowUs;
+      Counted = 0;
+      return;
+    }
+
+    FallUs = nowUs;
+    if (Counted) return;
+    if (nowUs - RiseUs >= (uint64_t)MinPulseWidthUs) {
+      __sync_fetch_and_add(&Money, 1);
+      DiaEvent_Notify(DIA_EVENT_MONEY);
+      Counted = 1;
+    } else {
+      __sync_fetch_and_add(&Rejected, 1);
+    }
+  }
 };
 
 class DiaGpio {
@@ -88,7 +189,6 @@ public:
  
 	relay_stat Stat;
 
-	long curTime;
     int LastPressedKey;
     int InitializedOk;
     int ButtonPin[PIN_COUNT];
@@ -112,12 +212,28 @@ public:
     PulseHandler * BanknotesHandler;
     PulseHandler * AdditionalHandler;
 
+    // Pulse capture settings, see DiaGpio_SetPulseCapture
+    int PulseCapture;
+    int PulseMinWidthUs;
+    int PulseDebounceUs;
+
+    // Set with DiaGpio_SetCurrentProgram. The program, the queue and the
+    // lateness below are protected by RelayLock.
     int CurrentProgram;
     int CurrentProgramIsPreflight;
     int AllTurnedOff;
 
+    pthread_mutex_t RelayLock = PTHREAD_MUTEX_INITIALIZER;
+    // Monotonic, signalled when the program or the relay config changes.
+    pthread_cond_t RelayCond;
+    int RelaysChanged;
+    std::priority_queue<relay_deadline_t, std::vector<relay_deadline_t>, relay_deadline_later> RelayQueue;
+    relay_lateness_t RelayLateness;
+    relay_lateness_t PrintedRelayLateness;
+
     pthread_t WorkingThread;
     pthread_t LedSwitchingThread;
+    pthread_t RelayThread;
 
 
     DiaRelayConfig Programs[MAX_PROGRAMS_COUNT];
@@ -126,6 +242,7 @@ public:
     ~DiaGpio();
 private:
     storage_interface_t * _Storage;
+    friend int DiaGpio_SaveStat(DiaGpio * gpio);
 };
 
 void DiaGpio_ButtonAnimation(DiaGpio * gpio, long curTime);
@@ -138,11 +255,23 @@ void DiaGpio_WriteLight(DiaGpio * gpio, int relayNumber, int value);
 
 void DiaGpio_SetProgram(DiaGpio * gpio, int programNumber, int relayNumber,  int onTime, int offTime);
 void DiaGpio_StopRelays(DiaGpio * gpio);
+
+// Makes the relay thread run the program, -1 turns all relays off.
+void DiaGpio_SetCurrentProgram(DiaGpio * gpio, int program, int isPreflight);
+// Must be called after Programs or PreflightPrograms were changed.
+void DiaGpio_RelaysChanged(DiaGpio * gpio);
+void DiaGpio_GetRelayLateness(DiaGpio * gpio, relay_lateness_t * lateness);
+// Prints how late relays were switched since the previous call.
+void DiaGpio_PrintRelayLateness(DiaGpio * gpio);
+// Saves relay counters to the storage, they are loaded back on start.
+int DiaGpio_SaveStat(DiaGpio * gpio);
 int DiaGpio_ReadButton(DiaGpio * gpio, int ButtonNumber);
 
 void DiaGpio_StartAdditionalHandler(DiaGpio *gpio, int preferredIndex);
+void DiaGpio_SetPulseCapture(DiaGpio *gpio, int mode, int minWidthUs, int debounceUs);
 
 void DiaGpio_Test(DiaGpio * gpio);
 void * DiaGpio_WorkingThread(void * gpio);
+void * DiaGpio_RelayThread(void * gpio);
 inline int DiaGpio_Abs(int from, int to);
 #endif
@@ -0,0 +1,324 @@
+#include "dia_image_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <set>
+
+#include <SDL_image.h>
+
+#include "dia_functions.h"
+
+static void DiaImageCache_SetPicture(DiaImageCacheEntry *entry, SDL_Surface *picture, int packed) {
+    DiaImageCache *cache = entry->Cache;
+    entry->Picture = picture;
+    entry->PictureW = picture->w;
+    entry->PictureH = picture->h;
+    entry->Bytes = packed ? 0 : (size_t)picture->pitch * picture->h;
+    if (entry->Bytes) {
+        cache->Resident += entry->Bytes;
+        cache->Lru.push_front(entry);
+        entry->LruPos = cache->Lru.begin();
+        entry->InLru = 1;
+    }
+}
+
+static void DiaImageCache_Unload(DiaImageCacheEntry *entry) {
+    DiaImageCache *cache = entry->Cache;
+    if (entry->InLru) {
+        cache->Lru.erase(entry->LruPos);
+        entry->InLru = 0;
+    }
+    cache->Resident -= entry->Bytes;
+    entry->Bytes = 0;
+    if (entry->Picture) {
+        SDL_FreeSurface(entry->Picture);
+        entry->Picture = 0;
+    }
+}
+
+static void DiaImageCache_Delete(DiaImageCacheEntry *entry) {
+    DiaImageCache_Unload(entry);
+    entry->Cache->Entries.erase(DiaAssetPack_Key(entry->Src.c_str(), entry->Width, entry->Height));
+    delete entry;
+}
+
+// Takes the picture from the asset pack.
+static int DiaImageCache_LoadPacked(DiaImageCacheEntry *entry) {
+    SDL_Surface *picture = DiaAssetPack_GetSurface(entry->Cache->Pack, entry->Src.c_str(), entry->Width, entry->Height);
+    if (!picture) {
+        return 1;
+    }
+    DiaImageCache_SetPicture(entry, picture, 1);
+    return 0;
+}
+
+static std::string DiaImageCache_Path(DiaImageCacheEntry *entry) {
+    return entry->Cache->Folder + "/" + entry->Src;
+}
+
+// What image items did on every src change before.
+static int DiaImageCache_Load(DiaImageCacheEntry *entry) {
+    if (DiaImageCache_LoadPacked(entry) == 0) {
+        return 0;
+    }
+    std::string full_name = DiaImageCache_Path(entry);
+    SDL_Surface *tmpImg = IMG_Load(full_name.c_str());
+    if (!tmpImg) {
+        printf("error: IMG_Load: %s\n", IMG_GetError());
+        printf("%s error\n", full_name.c_str());
+        entry->Failed = 1;
+        return 1;
+    }
+    SDL_Surface *newImg;
+    if (tmpImg->format->Amask == 0) {
+        newImg = SDL_DisplayFormat(tmpImg);
+    } else {
+        newImg = SDL_DisplayFormatAlpha(tmpImg);
+    }
+    SDL_FreeSurface(tmpImg);
+    if (newImg && entry->Width && entry->Height && (newImg->w != entry->Width || newImg->h != entry->Height)) {
+        SDL_Surface *scaled = dia_ScaleSurface(newImg, entry->Width, entry->Height);
+        SDL_FreeSurface(newImg);
+        newImg = scaled;
+    }
+    if (!newImg) {
+        entry->Failed = 1;
+        return 1;
+    }
+    DiaImageCache_SetPicture(entry, newImg, 0);
+    return 0;
+}
+
+// Takes the picture decoded by DiaAssetLoader.
+static void DiaImageCache_Apply(DiaAssetJob *job) {
+    DiaImageCacheEntry *entry = (DiaImageCacheEntry *)job->Target;
+    entry->Loading = 0;
+    if (!job->Picture) {
+        printf("error: IMG_Load: %s error\n", job->Path.c_str());
+        entry->Failed = 1;
+    } else if (!entry->Picture) {
+        if (job->Scaled) {
+            DiaImageCache_SetPicture(entry, job->Scaled, 0);
+            job->Scaled = 0;
+        } else {
+            DiaImageCache_SetPicture(entry, job->Picture, 0);
+            job->Picture = 0;
+        }
+        entry->Cache->Stat.prefetched++;
+    }
+    if (entry->Users == 0) {
+        DiaImageCache_Delete(entry);
+    }
+}
+
+DiaImageCacheEntry *DiaImageCache_Acquire(DiaImageCache *cache, std::string screen, const char *src, int width, int height) {
+    if (!cache || !src) {
+        return 0;
+    }
+    std::string key = DiaAssetPack_Key(src, width, height);
+    DiaImageCacheEntry *entry;
+    std::map<std::string, DiaImageCacheEntry *>::iterator it = cache->Entries.find(key);
+    if (it == cache->Entries.end()) {
+        entry = new DiaImageCacheEntry(cache, src, width, height);
+        cache->Entries[key] = entry;
+    } else {
+        entry = it->second;
+    }
+    entry->Users++;
+    entry->Screens[screen]++;
+    return entry;
+}
+
+void DiaImageCache_Release(DiaImageCacheEntry *entry, std::string screen) {
+    if (!entry) {
+        return;
+    }
+    std::map<std::string, int>::iterator it = entry->Screens.find(screen);
+    if (it != entry->Screens.end() && --it->second == 0) {
+        entry->Screens.erase(it);
+    }
+    // A queued entry is deleted when the loader is done with it
+    if (--entry->Users == 0 && !entry->Loading) {
+        DiaImageCache_Delete(entry);
+    }
+}
+
+SDL_Surface *DiaImageCache_Get(DiaImageCacheEntry *entry) {
+    if (!entry) {
+        return 0;
+    }
+    DiaImageCache *cache = entry->Cache;
+    if (entry->Picture) {
+        cache->Stat.hits++;
+        if (entry->InLru && entry->LruPos != cache->Lru.begin()) {
+            cache->Lru.splice(cache->Lru.begin(), cache->Lru, entry->LruPos);
+        }
+        return entry->Picture;
+    }
+    if (entry->Failed) {
+        return 0;
+    }
+    cache->Stat.misses++;
+    if (DiaImageCache_Load(entry)) {
+        return 0;
+    }
+    DiaImageCache_Trim(cache);
+    return entry->Picture;
+}
+
+void DiaImageCache_GetSize(DiaImageCacheEntry *entry, int *width, int *height) {
+    if (entry->PictureW >= 0) {
+        *width = entry->PictureW;
+        *height = entry->PictureH;
+    } else {
+        *width = entry->Width;
+        *height = entry->Height;
+    }
+}
+
+void DiaImageCache_Trim(DiaImageCache *cache) {
+    std::list<DiaImageCacheEntry *>::iterator it = cache->Lru.end();
+    while (cache->Resident > cache->Budget && it != cache->Lru.begin()) {
+        --it;
+        DiaImageCacheEntry *entry = *it;
+        if (entry->Screens.count(cache->CurrentScreen) || entry->Screens.count(cache->NextScreen)) {
+            continue;
+        }
+        ++it;
+        DiaImageCache_Unload(entry);
+        cache->Stat.evictions++;
+    }
+}
+
+void DiaImageCache_SetScreen(DiaImageCache *cache, std::string screen) {
+    if (!cache) {
+        return;
+    }
+    cache->CurrentScreen = screen;
+    if (cache->NextScreen == screen) {
+        cache->NextScreen = "";
+    }
+    DiaImageCache_Trim(cache);
+    cache->Stat.switches++;
+    DiaImageCache_PrintStat(cache, cache->Stat.switches % IMAGE_CACHE_REPORT_SWITCHES == 1);
+}
+
+// Size from the PNG header, 0 if the file is something else.
+static size_t DiaImageCache_PngPixels(std::string path) {
+    unsigned char header[24];
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        return 0;
+    }
+    size_t n = fread(header, 1, sizeof(header), f);
+    fclose(f);
+    if (n != sizeof(header) || memcmp(header, "\x89PNG", 4) != 0 || memcmp(header + 12, "IHDR", 4) != 0) {
+        return 0;
+    }
+    size_t w = ((size_t)header[16] << 24) | (header[17] << 16) | (header[18] << 8) | header[19];
+    size_t h = ((size_t)header[20] << 24) | (header[21] << 16) | (header[22] << 8) | header[23];
+    return w * h;
+}
+
+static size_t DiaImageCache_Estimate(DiaImageCacheEntry *entry) {
+    SDL_Surface *video = SDL_GetVideoSurface();
+    size_t bytesPerPixel = video ? video->format->BytesPerPixel : 4;
+    if (entry->PictureW >= 0) {
+        return (size_t)entry->PictureW * entry->PictureH * bytesPerPixel;
+    }
+    if (entry->Width && entry->Height) {
+        return (size_t)entry->Width * entry->Height * bytesPerPixel;
+    }
+    return DiaImageCache_PngPixels(DiaImageCache_Path(entry)) * bytesPerPixel;
+}
+
+long DiaImageCache_Prefetch(DiaImageCache *cache, std::string screen, DiaAssetLoader *loader, size_t limit) {
+    if (!cache) {
+        return -1;
+    }
+    std::vector<DiaImageCacheEntry *> toLoad;
+    size_t estimate = 0;
+    std::map<std::string, DiaImageCacheEntry *>::iterator it;
+    for (it = cache->Entries.begin(); it != cache->Entries.end(); ++it) {
+        DiaImageCacheEntry *entry = it->second;
+        if (entry->Picture || entry->Failed || entry->Loading || !entry->Screens.count(screen)) {
+            continue;
+        }
+        // Packed pictures cost nothing to take right now
+        if (DiaImageCache_LoadPacked(entry) == 0) {
+            continue;
+        }
+        toLoad.push_back(entry);
+        estimate += DiaImageCache_Estimate(entry);
+    }
+    if (estimate > limit) {
+        return -1;
+    }
+    cache->NextScreen = screen;
+
+    for (size_t i = 0; i < toLoad.size(); i++) {
+        DiaImageCacheEntry *entry = toLoad[i];
+        DiaAssetJob *job = new DiaAssetJob(DiaImageCache_Path(entry), entry->Width, entry->Height,
+            DiaImageCache_Apply, entry, 0);
+        if (DiaAssetLoader_Submit(loader, job) == ASSET_LOADER_NO_ERROR) {
+            entry->Loading = 1;
+            continue;
+        }
+        delete job;
+        if (DiaImageCache_Load(entry) == 0) {
+            cache->Stat.prefetched++;
+        }
+    }
+    DiaImageCache_Trim(cache);
+    return estimate;
+}
+
+void DiaImageCache_PrintStat(DiaImageCache *cache, int perScreen) {
+    if (!cache) {
+        return;
+    }
+    uint64_t gets = cache->Stat.hits + cache->Stat.misses;
+    printf("Image cache: %lu of %lu KB, %llu hits, %llu misses (%.1f%% hit rate), %llu prefetched, %llu evicted\n",
+        (unsigned long)(cache->Resident / 1024), (unsigned long)(cache->Budget / 1024),
+        (unsigned long long)cache->Stat.hits, (unsigned long long)cache->Stat.misses,
+        gets ? cache->Stat.hits * 100.0 / gets : 0.0, (unsigned long long)cache->Stat.prefetched,
+        (unsigned long long)cache->Stat.evictions);
+    if (!perScreen) {
+        return;
+    }
+
+    std::set<std::string> screens;
+    std::map<std::string, DiaImageCacheEntry *>::iterator it;
+    for (it = cache->Entries.begin(); it != cache->Entries.end(); ++it) {
+        std::map<std::string, int>::iterator s;
+        for (s = it->second->Screens.begin(); s != it->second->Screens.end(); ++s) {
+            screens.insert(s->first);
+        }
+    }
+    for (std::set<std::string>::iterator s = screens.begin(); s != screens.end(); ++s) {
+        int total = 0, loaded = 0;
+        size_t bytes = 0;
+        for (it = cache->Entries.begin(); it != cache->Entries.end(); ++it) {
+            DiaImageCacheEntry *entry = it->second;
+            if (!entry->Screens.count(*s)) {
+                continue;
+            }
+            total++;
+            if (entry->Picture) {
+                loaded++;
+                bytes += entry->Bytes;
+            }
+        }
+        printf("  %s%s: %d of %d pictures loaded, %lu KB\n", s->c_str(), *s == cache->CurrentScreen ? " (current)" : "",
+            loaded, total, (unsigned long)(bytes / 1024));
+    }
+}
+
+DiaImageCache::~DiaImageCache() {
+    std::map<std::string, DiaImageCacheEntry *>::iterator it;
+    for (it = Entries.begin(); it != Entries.end(); ++it) {
+        DiaImageCache_Unload(it->second);
+        delete it->second;
+    }
+}
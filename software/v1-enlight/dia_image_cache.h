@@ -0,0 +1,131 @@
+#ifndef DIA_IMAGE_CACHE_H
+#define DIA_IMAGE_CACHE_H
+
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <SDL.h>
+
+#include "dia_asset_loader.h"
+#include "dia_asset_pack.h"
+
+// Default budget, "image_cache_mb" in main.json overrides it.
+#define IMAGE_CACHE_DEFAULT_MB 96
+// Residency of every screen is printed after this many screen switches.
+#define IMAGE_CACHE_REPORT_SWITCHES 20
+
+class DiaImageCache;
+
+// A picture the way items show it: src decoded, in the display format and
+// scaled to Width x Height (0x0 keeps its own size).
+class DiaImageCacheEntry {
+   public:
+    DiaImageCache *Cache;
+    std::string Src;
+    int Width;
+    int Height;
+
+    // 0 while the picture is not loaded.
+    SDL_Surface *Picture;
+    // Known once the picture has been loaded, -1 before.
+    int PictureW;
+    int PictureH;
+    // Heap taken by Picture, 0 for pictures mapped from the asset pack.
+    size_t Bytes;
+    // Decoding failed, it is not tried again.
+    int Failed;
+    // Queued to DiaAssetLoader.
+    int Loading;
+
+    // Items using the entry, by screen id.
+    std::map<std::string, int> Screens;
+    int Users;
+    int InLru;
+    std::list<DiaImageCacheEntry *>::iterator LruPos;
+
+    DiaImageCacheEntry(DiaImageCache *cache, std::string src, int width, int height) {
+        Cache = cache;
+        Src = src;
+        Width = width;
+        Height = height;
+        Picture = 0;
+        PictureW = -1;
+        PictureH = -1;
+        Bytes = 0;
+        Failed = 0;
+        Loading = 0;
+        Users = 0;
+        InLru = 0;
+    }
+};
+
+typedef struct image_cache_stat {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t prefetched;
+    uint64_t evictions;
+    uint64_t switches;
+} image_cache_stat_t;
+
+// DiaImageCache loads pictures of image and image_array items when they are
+// first displayed or prefetched, and frees the least recently used ones
+// when the loaded pictures take more than Budget bytes. Pictures of the
+// current and the prefetched screen are never freed, even over budget.
+// Everything runs on the main thread, like the items.
+class DiaImageCache {
+   public:
+    std::string Folder;
+    DiaAssetPack *Pack;
+    size_t Budget;
+    size_t Resident;
+    // By DiaAssetPack_Key of src and size.
+    std::map<std::string, DiaImageCacheEntry *> Entries;
+    // Loaded pictures which take heap, the most recently used first.
+    std::list<DiaImageCacheEntry *> Lru;
+    std::string CurrentScreen;
+    // Prefetched last, kept like the current screen until it is shown or
+    // another one is prefetched.
+    std::string NextScreen;
+    image_cache_stat_t Stat;
+
+    DiaImageCache(std::string folder, DiaAssetPack *pack) {
+        Folder = folder;
+        Pack = pack;
+        Budget = (size_t)IMAGE_CACHE_DEFAULT_MB * 1024 * 1024;
+        Resident = 0;
+        Stat = image_cache_stat_t();
+    }
+
+    ~DiaImageCache();
+};
+
+// Returns the entry of the picture for an item of the screen, nothing is
+// loaded yet. Every Acquire needs a Release.
+DiaImageCacheEntry *DiaImageCache_Acquire(DiaImageCache *cache, std::string screen, const char *src, int width, int height);
+void DiaImageCache_Release(DiaImageCacheEntry *entry, std::string screen);
+
+// Loads the picture if it is not loaded, 0 if it can't be decoded.
+SDL_Surface *DiaImageCache_Get(DiaImageCacheEntry *entry);
+
+// Size of the picture without loading it; the item size if the picture has
+// never been loaded.
+void DiaImageCache_GetSize(DiaImageCacheEntry *entry, int *width, int *height);
+
+// The screen is being shown: its pictures are kept, others may be freed.
+void DiaImageCache_SetScreen(DiaImageCache *cache, std::string screen);
+
+// Loads the pictures of the screen, in place or queued to the loader.
+// Returns the estimated bytes they take, or -1 and loads nothing if that
+// is more than limit.
+long DiaImageCache_Prefetch(DiaImageCache *cache, std::string screen, DiaAssetLoader *loader, size_t limit);
+
+// Frees the least recently used pictures until the budget is met.
+void DiaImageCache_Trim(DiaImageCache *cache);
+
+void DiaImageCache_PrintStat(DiaImageCache *cache, int perScreen);
+
+#endif
@@ -0,0 +1,192 @@
+#include "dia_journal.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "dia_crc.h"
+
+static void DiaJournal_EncodeRecord(std::string *out, uint8_t type, uint64_t id, const std::string &payload) {
+    dia_journal_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.magic = DIA_JOURNAL_MAGIC;
+    record.type = type;
+    record.length = payload.size();
+    record.id = id;
+
+    uint32_t crc = dia_crc32(0, &record, sizeof(record));
+    record.crc = dia_crc32(crc, payload.data(), payload.size());
+
+    out->append((const char *)&record, sizeof(record));
+    out->append(payload);
+}
+
+// Encodes unacknowledged entries for the rewritten file.
+static void DiaJournal_Snapshot(void *arg, std::string *data) {
+    DiaJournal *journal = (DiaJournal *)arg;
+    for (std::map<uint64_t, std::string>::iterator it = journal->Live.begin(); it != journal->Live.end(); ++it) {
+        DiaJournal_EncodeRecord(data, DIA_JOURNAL_RECORD_APPEND, it->first, it->second);
+    }
+    journal->AckedBytes = 0;
+}
+
+// The file is rewritten once acknowledged records take more than
+// DIA_JOURNAL_COMPACT_BYTES and more than live ones. A failed batch is
+// not a loss: the entries are still in the channel and the log file
+// rewrites the journal from Live.
+static int DiaJournal_Committed(void *arg, const std::string &batch, int err) {
+    DiaJournal *journal = (DiaJournal *)arg;
+    return journal->AckedBytes > DIA_JOURNAL_COMPACT_BYTES && journal->AckedBytes > journal->LiveBytes;
+}
+
+// Reads records up to the first broken one, returns the size of the valid
+// ones.
+static size_t DiaJournal_Load(void *arg, const std::string &data) {
+    DiaJournal *journal = (DiaJournal *)arg;
+    size_t offset = 0;
+    uint64_t maxId = 0;
+    while (offset + sizeof(dia_journal_record_t) <= data.size()) {
+        dia_journal_record_t record;
+        memcpy(&record, data.data() + offset, sizeof(record));
+        // Compared with what is left, a corrupt length must not wrap around
+        // on 32-bit size_t.
+        if (record.magic != DIA_JOURNAL_MAGIC || record.length > data.size() - offset - sizeof(record)) {
+            break;
+        }
+        uint32_t expected = record.crc;
+        record.crc = 0;
+        uint32_t crc = dia_crc32(0, &record, sizeof(record));
+        crc = dia_crc32(crc, data.data() + offset + sizeof(record), record.length);
+        if (crc != expected) {
+            break;
+        }
+
+        if (record.type == DIA_JOURNAL_RECORD_APPEND) {
+            std::string payload(data.data() + offset + sizeof(record), record.length);
+            if (journal->Live.find(record.id) == journal->Live.end()) {
+                journal->LiveBytes += sizeof(record) + payload.size();
+            }
+            journal->Live[record.id] = payload;
+        } else if (record.type == DIA_JOURNAL_RECORD_ACK) {
+            std::map<uint64_t, std::string>::iterator it = journal->Live.find(record.id);
+            if (it != journal->Live.end()) {
+                journal->LiveBytes -= sizeof(record) + it->second.size();
+                journal->AckedBytes += sizeof(record) + it->second.size();
+                journal->Live.erase(it);
+            }
+        }
+        if (record.id > maxId) {
+            maxId = record.id;
+        }
+        offset += sizeof(record) + record.length;
+    }
+
+    journal->NextId = maxId + 1;
+    journal->Stat.live_entries = journal->Live.size();
+    return offset;
+}
+
+int DiaJournal_Open(DiaJournal *journal) {
+    if (!journal) {
+        return DIA_JOURNAL_NULL_PARAMETER;
+    }
+
+    journal->Log.Load = DiaJournal_Load;
+    journal->Log.Committed = DiaJournal_Committed;
+    journal->Log.Snapshot = DiaJournal_Snapshot;
+    journal->Log.Owner = journal;
+    if (DiaLogFile_Open(&journal->Log) != DIA_LOG_FILE_NO_ERROR) {
+        return DIA_JOURNAL_OPEN_ERROR;
+    }
+    printf("Journal: %s opened, %d unsent entries\n", journal->Log.Path.c_str(), (int)journal->Live.size());
+    return DIA_JOURNAL_NO_ERROR;
+}
+
+int DiaJournal_Replay(DiaJournal *journal, void *arg, void (*handler)(void *arg, uint64_t id, std::string route, std::string body)) {
+    if (!journal || !handler) {
+        return DIA_JOURNAL_NULL_PARAMETER;
+    }
+
+    pthread_mutex_lock(&journal->Log.Lock);
+    std::map<uint64_t, std::string> live = journal->Live;
+    pthread_mutex_unlock(&journal->Log.Lock);
+
+    for (std::map<uint64_t, std::string>::iterator it = live.begin(); it != live.end(); ++it) {
+        size_t separator = it->second.find('\0');
+        if (separator == std::string::npos) {
+            continue;
+        }
+        handler(arg, it->first, it->second.substr(0, separator), it->second.substr(separator + 1));
+    }
+    return DIA_JOURNAL_NO_ERROR;
+}
+
+uint64_t DiaJournal_Append(DiaJournal *journal, std::string route, std::string body) {
+    if (!journal || !journal->Log.WriterThread) {
+        return 0;
+    }
+
+    std::string payload;
+    payload.reserve(route.size() + 1 + body.size());
+    payload.append(route);
+    payload.push_back('\0');
+    payload.append(body);
+
+    pthread_mutex_lock(&journal->Log.Lock);
+    uint64_t id = journal->NextId++;
+    DiaJournal_EncodeRecord(&journal->Log.Pending, DIA_JOURNAL_RECORD_APPEND, id, payload);
+    journal->LiveBytes += sizeof(dia_journal_record_t) + payload.size();
+    journal->Live[id].swap(payload);
+    DiaLogFile_Queue(&journal->Log);
+    journal->Stat.appended++;
+    journal->Stat.live_entries = journal->Live.size();
+    pthread_mutex_unlock(&journal->Log.Lock);
+    return id;
+}
+
+int DiaJournal_Ack(DiaJournal *journal, uint64_t id) {
+    if (!journal || !journal->Log.WriterThread) {
+        return DIA_JOURNAL_NULL_PARAMETER;
+    }
+
+    static const std::string empty;
+    pthread_mutex_lock(&journal->Log.Lock);
+    std::map<uint64_t, std::string>::iterator it = journal->Live.find(id);
+    if (it != journal->Live.end()) {
+        journal->LiveBytes -= sizeof(dia_journal_record_t) + it->second.size();
+        journal->AckedBytes += sizeof(dia_journal_record_t) + it->second.size();
+        journal->Live.erase(it);
+        DiaJournal_EncodeRecord(&journal->Log.Pending, DIA_JOURNAL_RECORD_ACK, id, empty);
+        DiaLogFile_Queue(&journal->Log);
+        journal->Stat.acked++;
+        journal->Stat.live_entries = journal->Live.size();
+    }
+    pthread_mutex_unlock(&journal->Log.Lock);
+    return DIA_JOURNAL_NO_ERROR;
+}
+
+int DiaJournal_Flush(DiaJournal *journal) {
+    if (!journal || !journal->Log.WriterThread) {
+        return DIA_JOURNAL_NULL_PARAMETER;
+    }
+
+    pthread_mutex_lock(&journal->Log.Lock);
+    // A failed batch is rewritten from Live, so it is not an error here.
+    DiaLogFile_WaitSynced(&journal->Log, journal->Log.SyncedRecords, journal->Log.QueuedRecords);
+    pthread_mutex_unlock(&journal->Log.Lock);
+    return DIA_JOURNAL_NO_ERROR;
+}
+
+void DiaJournal_GetStat(DiaJournal *journal, dia_journal_stat_t *stat) {
+    pthread_mutex_lock(&journal->Log.Lock);
+    *stat = journal->Stat;
+    stat->syncs = journal->Log.Stat.syncs;
+    stat->bytes_written = journal->Log.Stat.bytes_written;
+    stat->compactions = journal->Log.Stat.rewrites;
+    pthread_mutex_unlock(&journal->Log.Lock);
+}
+
+DiaJournal::~DiaJournal() {
+    DiaLogFile_Stop(&Log);
+}
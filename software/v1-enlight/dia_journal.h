@@ -0,0 +1,92 @@
+#ifndef DIA_JOURNAL_H
+#define DIA_JOURNAL_H
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+#include "dia_log_file.h"
+
+#define DIA_JOURNAL_NO_ERROR 0
+#define DIA_JOURNAL_NULL_PARAMETER 1
+#define DIA_JOURNAL_OPEN_ERROR 2
+#define DIA_JOURNAL_WRITE_ERROR 3
+
+#define DIA_JOURNAL_MAGIC 0x4c4e524a
+#define DIA_JOURNAL_RECORD_APPEND 1
+#define DIA_JOURNAL_RECORD_ACK 2
+
+// The writer thread does not fsync more often than this, so bursts of
+// entries share one fsync instead of wearing the SD card.
+#define DIA_JOURNAL_SYNC_INTERVAL_MS 50
+// The file is rewritten when acknowledged records take more than this
+// and more than live ones.
+#define DIA_JOURNAL_COMPACT_BYTES (256 * 1024)
+
+// On-disk record header, followed by length bytes of payload.
+// crc covers the header (with crc set to 0) and the payload.
+typedef struct dia_journal_record {
+    uint32_t magic;
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t length;
+    uint32_t crc;
+    uint64_t id;
+} dia_journal_record_t;
+
+typedef struct dia_journal_stat {
+    uint64_t appended;
+    uint64_t acked;
+    uint64_t syncs;
+    uint64_t bytes_written;
+    uint64_t compactions;
+    uint64_t live_entries;
+} dia_journal_stat_t;
+
+// DiaJournal is an append-only write-ahead log for network messages.
+// Append and Ack only copy the record to memory and wake the writer thread
+// of the log file, which writes everything collected so far with one write
+// and one fdatasync. An entry can therefore be lost only if power fails
+// within one sync interval after it was appended.
+class DiaJournal {
+   public:
+    DiaLogFile Log;
+
+    // Everything below is protected by Log.Lock.
+    uint64_t NextId;
+    // Unacknowledged entries: id -> payload, used for replay and compaction.
+    std::map<uint64_t, std::string> Live;
+    uint64_t LiveBytes;
+    uint64_t AckedBytes;
+
+    dia_journal_stat_t Stat;
+
+    DiaJournal(std::string path) : Log("Journal", path, DIA_JOURNAL_SYNC_INTERVAL_MS) {
+        NextId = 1;
+        LiveBytes = 0;
+        AckedBytes = 0;
+        Stat = dia_journal_stat_t();
+    }
+
+    ~DiaJournal();
+};
+
+// Opens (or creates) the journal, reads all valid records and starts the
+// writer thread. A torn record at the end of the file is cut off.
+int DiaJournal_Open(DiaJournal *journal);
+
+// Calls handler for every entry which was not acknowledged, in append order.
+int DiaJournal_Replay(DiaJournal *journal, void *arg, void (*handler)(void *arg, uint64_t id, std::string route, std::string body));
+
+// Returns id of the new entry, 0 if the journal is not open.
+uint64_t DiaJournal_Append(DiaJournal *journal, std::string route, std::string body);
+
+int DiaJournal_Ack(DiaJournal *journal, uint64_t id);
+
+// Blocks until everything appended so far is on disk.
+int DiaJournal_Flush(DiaJournal *journal);
+
+void DiaJournal_GetStat(DiaJournal *journal, dia_journal_stat_t *stat);
+
+#endif
@@ -0,0 +1,71 @@
+// Journal throughput benchmark.
+// Usage: ./journal_bench.exe [journal path] [entries]
+// Run it with the path on the SD card to get numbers for the real device.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "dia_journal.h"
+
+static uint64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+    std::string path = argc > 1 ? argv[1] : "bench.journal";
+    int count = argc > 2 ? atoi(argv[2]) : 20000;
+    unlink(path.c_str());
+
+    // Typical /save-money body.
+    std::string body = "{\"Hash\":\"A1B2C3D4E5F6A7B8C9D0\",\"CarsTotal\":1,\"Coins\":10,\"Banknotes\":100,"
+                       "\"CarsCashless\":0,\"Service\":0,\"Bonuses\":0,\"SessionId\":\"0f4c2b7e-6d1a-4c7b-9a9e-2f3b1c5d7e8f\"}";
+
+    DiaJournal *journal = new DiaJournal(path);
+    if (DiaJournal_Open(journal) != DIA_JOURNAL_NO_ERROR) {
+        printf("can't open %s\n", path.c_str());
+        return 1;
+    }
+
+    std::vector<uint64_t> latency(count);
+    std::vector<uint64_t> ids(count);
+    uint64_t start = NowNs();
+    for (int i = 0; i < count; i++) {
+        uint64_t t = NowNs();
+        ids[i] = DiaJournal_Append(journal, "/save-money", body);
+        latency[i] = NowNs() - t;
+    }
+    uint64_t enqueued = NowNs();
+    DiaJournal_Flush(journal);
+    uint64_t synced = NowNs();
+
+    for (int i = 0; i < count; i++) {
+        DiaJournal_Ack(journal, ids[i]);
+    }
+    DiaJournal_Flush(journal);
+    uint64_t acked = NowNs();
+
+    std::sort(latency.begin(), latency.end());
+    dia_journal_stat_t stat;
+    DiaJournal_GetStat(journal, &stat);
+
+    printf("entries:          %d x %d bytes\n", count, (int)body.size());
+    printf("enqueue:          %.0f entries/sec\n", count * 1e9 / (enqueued - start));
+    printf("enqueue latency:  p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           latency[count / 2] / 1000.0, latency[count * 99 / 100] / 1000.0, latency[count - 1] / 1000.0);
+    printf("durable:          %.0f entries/sec\n", count * 1e9 / (synced - start));
+    printf("ack + sync:       %.0f entries/sec\n", count * 1e9 / (acked - synced));
+    printf("syncs:            %llu, compactions %llu, written %llu bytes\n",
+           (unsigned long long)stat.syncs, (unsigned long long)stat.compactions, (unsigned long long)stat.bytes_written);
+
+    delete journal;
+    unlink(path.c_str());
+    return 0;
+}
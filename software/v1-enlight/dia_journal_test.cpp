@@ -0,0 +1,103 @@
+// Journal recovery checks: a journal with a broken tail is opened, the
+// entries before it are replayed and the tail is cut off.
+// Usage: ./journal_test.exe [journal path]
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "dia_journal.h"
+
+#define TEST_ENTRIES 3
+
+static int Failed = 0;
+
+static void Check(int ok, const char *what) {
+    if (!ok) {
+        printf("failed %s\n", what);
+        Failed = 1;
+    }
+}
+
+static void CountEntry(void *arg, uint64_t id, std::string route, std::string body) {
+    (*(int *)arg)++;
+}
+
+static off_t FileSize(std::string path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return -1;
+    }
+    return st.st_size;
+}
+
+static void AppendBytes(std::string path, const void *data, size_t size) {
+    int fd = open(path.c_str(), O_WRONLY | O_APPEND);
+    if (fd < 0 || write(fd, data, size) != (ssize_t)size) {
+        printf("can't append to %s\n", path.c_str());
+        Failed = 1;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+// Writes TEST_ENTRIES entries, returns the size of the journal.
+static off_t WriteEntries(std::string path) {
+    unlink(path.c_str());
+    DiaJournal *journal = new DiaJournal(path);
+    Check(DiaJournal_Open(journal) == DIA_JOURNAL_NO_ERROR, "open of a new journal");
+    for (int i = 0; i < TEST_ENTRIES; i++) {
+        DiaJournal_Append(journal, "/save-money", "{\"Coins\":10}");
+    }
+    DiaJournal_Flush(journal);
+    delete journal;
+    return FileSize(path);
+}
+
+// Opens the journal with a broken tail and checks that every entry is
+// replayed and the tail is cut off.
+static void CheckRecovery(std::string path, off_t size, const char *what) {
+    DiaJournal *journal = new DiaJournal(path);
+    int entries = 0;
+    Check(DiaJournal_Open(journal) == DIA_JOURNAL_NO_ERROR, what);
+    DiaJournal_Replay(journal, &entries, CountEntry);
+    delete journal;
+    Check(entries == TEST_ENTRIES, what);
+    Check(FileSize(path) == size, what);
+}
+
+int main(int argc, char **argv) {
+    std::string path = argc > 1 ? argv[1] : "test.journal";
+
+    // Power lost in the middle of a record.
+    off_t size = WriteEntries(path);
+    dia_journal_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.magic = DIA_JOURNAL_MAGIC;
+    AppendBytes(path, &record, sizeof(record) / 2);
+    CheckRecovery(path, size, "short tail");
+
+    // Blocks allocated but never written.
+    char zeroes[256];
+    memset(zeroes, 0, sizeof(zeroes));
+    AppendBytes(path, zeroes, sizeof(zeroes));
+    CheckRecovery(path, size, "zeroed tail");
+
+    // Intact magic with a length near 4 GiB, which wraps around an offset
+    // check on 32-bit size_t.
+    record.type = DIA_JOURNAL_RECORD_APPEND;
+    record.length = 0xfffffff0u;
+    record.id = TEST_ENTRIES + 1;
+    AppendBytes(path, &record, sizeof(record));
+    AppendBytes(path, zeroes, sizeof(zeroes));
+    CheckRecovery(path, size, "corrupt length");
+
+    unlink(path.c_str());
+    printf("%s\n", Failed ? "FAILED" : "OK");
+    return Failed;
+}
@@ -0,0 +1,551 @@
+#include "dia_json.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+static void DiaJson_EncodeString(std::string *out, const char *str, size_t length) {
+    static const char hex[] = "0123456789abcdef";
+    out->push_back('"');
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)str[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out->append(str + start, i - start);
+        start = i + 1;
+        switch (c) {
+            case '"': out->append("\\\""); break;
+            case '\\': out->append("\\\\"); break;
+            case '\n': out->append("\\n"); break;
+            case '\r': out->append("\\r"); break;
+            case '\t': out->append("\\t"); break;
+            case '\b': out->append("\\b"); break;
+            case '\f': out->append("\\f"); break;
+            default: {
+                char buf[7] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf], 0};
+                out->append(buf);
+            }
+        }
+    }
+    out->append(str + start, length - start);
+    out->push_back('"');
+}
+
+static void DiaJson_EncodeInt(std::string *out, int value) {
+    char buf[16];
+    int length = snprintf(buf, sizeof(buf), "%d", value);
+    out->append(buf, length);
+}
+
+static void DiaJson_EncodeObject(std::string *out, const dia_json_schema_t *schema, const char *base) {
+    out->push_back('{');
+    for (int i = 0; i < schema->count; i++) {
+        const dia_json_field_t *field = &schema->fields[i];
+        const char *value = base + field->offset;
+        if (i > 0) {
+            out->push_back(',');
+        }
+        DiaJson_EncodeString(out, field->name, strlen(field->name));
+        out->push_back(':');
+
+        switch (field->type) {
+            case DIA_JSON_INT:
+                DiaJson_EncodeInt(out, *(const int *)value);
+                break;
+            case DIA_JSON_BOOL:
+                out->append(*(const bool *)value ? "true" : "false");
+                break;
+            case DIA_JSON_CSTR: {
+                const char *str = *(const char *const *)value;
+                DiaJson_EncodeString(out, str ? str : "", str ? strlen(str) : 0);
+                break;
+            }
+            case DIA_JSON_STRING: {
+                const std::string *str = (const std::string *)value;
+                DiaJson_EncodeString(out, str->data(), str->size());
+                break;
+            }
+            case DIA_JSON_OBJECT:
+                DiaJson_EncodeObject(out, field->schema, value);
+                break;
+            case DIA_JSON_ARRAY:
+                out->push_back('[');
+                for (int j = 0; j < field->count; j++) {
+                    if (j > 0) {
+                        out->push_back(',');
+                    }
+                    if (field->schema) {
+                        DiaJson_EncodeObject(out, field->schema, value + j * field->stride);
+                    } else {
+                        DiaJson_EncodeInt(out, *(const int *)(value + j * field->stride));
+                    }
+                }
+                out->push_back(']');
+                break;
+            default:
+                out->append("null");
+        }
+    }
+    out->push_back('}');
+}
+
+int DiaJson_Encode(std::string *out, const dia_json_schema_t *schema, const void *data) {
+    if (!out || !schema || !data) {
+        return DIA_JSON_NULL_PARAMETER;
+    }
+    DiaJson_EncodeObject(out, schema, (const char *)data);
+    return DIA_JSON_NO_ERROR;
+}
+
+// Decoder state. Every function returns 0 on success and leaves Pos right
+// after the value it has read.
+typedef struct dia_json_parser {
+    const char *Pos;
+    const char *End;
+    int Depth;
+} dia_json_parser_t;
+
+static void DiaJson_SkipSpace(dia_json_parser_t *p) {
+    while (p->Pos < p->End && (*p->Pos == ' ' || *p->Pos == '\t' || *p->Pos == '\n' || *p->Pos == '\r')) {
+        p->Pos++;
+    }
+}
+
+static int DiaJson_Expect(dia_json_parser_t *p, char c) {
+    DiaJson_SkipSpace(p);
+    if (p->Pos >= p->End || *p->Pos != c) {
+        return 1;
+    }
+    p->Pos++;
+    return 0;
+}
+
+static int DiaJson_Literal(dia_json_parser_t *p, const char *literal) {
+    size_t length = strlen(literal);
+    if ((size_t)(p->End - p->Pos) < length || memcmp(p->Pos, literal, length) != 0) {
+        return 1;
+    }
+    p->Pos += length;
+    return 0;
+}
+
+static int DiaJson_Hex4(dia_json_parser_t *p, uint32_t *value) {
+    if (p->End - p->Pos < 4) {
+        return 1;
+    }
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = *p->Pos++;
+        *value <<= 4;
+        if (c >= '0' && c <= '9') {
+            *value |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            *value |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            *value |= c - 'A' + 10;
+        } else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Decoded characters go to out (std::string) or to buf (at most size - 1
+// bytes plus zero, longer strings are marked by *truncated). Both may be
+// NULL to skip the string.
+static int DiaJson_ParseString(dia_json_parser_t *p, std::string *out, char *buf, size_t size, int *truncated) {
+    if (DiaJson_Expect(p, '"')) {
+        return 1;
+    }
+    size_t used = 0;
+    char utf8[4];
+    for (;;) {
+        const char *start = p->Pos;
+        while (p->Pos < p->End && *p->Pos != '"' && *p->Pos != '\\' && (unsigned char)*p->Pos >= 0x20) {
+            p->Pos++;
+        }
+        const char *chunk = start;
+        size_t length = p->Pos - start;
+
+        if (p->Pos >= p->End || (unsigned char)*p->Pos < 0x20) {
+            return 1;
+        }
+        if (*p->Pos == '\\') {
+            // Flush the plain run first, the escape is appended below.
+            if (out) {
+                out->append(chunk, length);
+            }
+            if (buf) {
+                size_t n = length < size - 1 - used ? length : size - 1 - used;
+                memcpy(buf + used, chunk, n);
+                used += n;
+                if (n < length) {
+                    *truncated = 1;
+                }
+            }
+            p->Pos++;
+            if (p->Pos >= p->End) {
+                return 1;
+            }
+            char c = *p->Pos++;
+            length = 1;
+            chunk = utf8;
+            switch (c) {
+                case '"': utf8[0] = '"'; break;
+                case '\\': utf8[0] = '\\'; break;
+                case '/': utf8[0] = '/'; break;
+                case 'b': utf8[0] = '\b'; break;
+                case 'f': utf8[0] = '\f'; break;
+                case 'n': utf8[0] = '\n'; break;
+                case 'r': utf8[0] = '\r'; break;
+                case 't': utf8[0] = '\t'; break;
+                case 'u': {
+                    uint32_t code;
+                    if (DiaJson_Hex4(p, &code)) {
+                        return 1;
+                    }
+                    if (code >= 0xd800 && code <= 0xdbff) {
+                        uint32_t low;
+                        if (DiaJson_Literal(p, "\\u") || DiaJson_Hex4(p, &low) || low < 0xdc00 || low > 0xdfff) {
+                            return 1;
+                        }
+                        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                    } else if (code >= 0xdc00 && code <= 0xdfff) {
+                        return 1;
+                    }
+                    if (code < 0x80) {
+                        utf8[0] = (char)code;
+                    } else if (code < 0x800) {
+                        utf8[0] = (char)(0xc0 | (code >> 6));
+                        utf8[1] = (char)(0x80 | (code & 0x3f));
+                        length = 2;
+                    } else if (code < 0x10000) {
+                        utf8[0] = (char)(0xe0 | (code >> 12));
+                        utf8[1] = (char)(0x80 | ((code >> 6) & 0x3f));
+                        utf8[2] = (char)(0x80 | (code & 0x3f));
+                        length = 3;
+                    } else {
+                        utf8[0] = (char)(0xf0 | (code >> 18));
+                        utf8[1] = (char)(0x80 | ((code >> 12) & 0x3f));
+                        utf8[2] = (char)(0x80 | ((code >> 6) & 0x3f));
+                        utf8[3] = (char)(0x80 | (code & 0x3f));
+                        length = 4;
+                    }
+                    break;
+                }
+                default:
+                    return 1;
+            }
+        } else {
+            // Closing quote.
+            p->Pos++;
+        }
+
+        if (out) {
+            out->append(chunk, length);
+        }
+        if (buf) {
+            size_t n = length < size - 1 - used ? length : size - 1 - used;
+            memcpy(buf + used, chunk, n);
+            used += n;
+            if (n < length) {
+                *truncated = 1;
+            }
+        }
+        if (chunk == start) {
+            break;
+        }
+    }
+    if (buf) {
+        buf[used] = 0;
+    }
+    return 0;
+}
+
+// Returns 0 and sets *isInteger to 0 for numbers with a fraction or an exponent.
+static int DiaJson_ParseNumber(dia_json_parser_t *p, long long *value, int *isInteger) {
+    const char *start = p->Pos;
+    int negative = 0;
+    unsigned long long result = 0;
+    int overflow = 0;
+
+    if (p->Pos < p->End && *p->Pos == '-') {
+        negative = 1;
+        p->Pos++;
+    }
+    if (p->Pos >= p->End || *p->Pos < '0' || *p->Pos > '9') {
+        return 1;
+    }
+    while (p->Pos < p->End && *p->Pos >= '0' && *p->Pos <= '9') {
+        if (result > (ULLONG_MAX - 9) / 10) {
+            overflow = 1;
+        }
+        result = result * 10 + (*p->Pos - '0');
+        p->Pos++;
+    }
+    *isInteger = 1;
+    if (p->Pos < p->End && *p->Pos == '.') {
+        *isInteger = 0;
+        p->Pos++;
+        if (p->Pos >= p->End || *p->Pos < '0' || *p->Pos > '9') {
+            return 1;
+        }
+        while (p->Pos < p->End && *p->Pos >= '0' && *p->Pos <= '9') {
+            p->Pos++;
+        }
+    }
+    if (p->Pos < p->End && (*p->Pos == 'e' || *p->Pos == 'E')) {
+        *isInteger = 0;
+        p->Pos++;
+        if (p->Pos < p->End && (*p->Pos == '+' || *p->Pos == '-')) {
+            p->Pos++;
+        }
+        if (p->Pos >= p->End || *p->Pos < '0' || *p->Pos > '9') {
+            return 1;
+        }
+        while (p->Pos < p->End && *p->Pos >= '0' && *p->Pos <= '9') {
+            p->Pos++;
+        }
+    }
+    if (overflow || result > (unsigned long long)LLONG_MAX) {
+        // Like jansson, integers which don't fit are an error.
+        p->Pos = start;
+        return 1;
+    }
+    *value = negative ? -(long long)result : (long long)result;
+    return 0;
+}
+
+static int DiaJson_SkipValue(dia_json_parser_t *p);
+
+static int DiaJson_SkipContainer(dia_json_parser_t *p, char open, char close) {
+    if (DiaJson_Expect(p, open) || ++p->Depth > DIA_JSON_MAX_DEPTH) {
+        return 1;
+    }
+    if (DiaJson_Expect(p, close) == 0) {
+        p->Depth--;
+        return 0;
+    }
+    for (;;) {
+        if (open == '{' && (DiaJson_ParseString(p, NULL, NULL, 0, NULL) || DiaJson_Expect(p, ':'))) {
+            return 1;
+        }
+        if (DiaJson_SkipValue(p)) {
+            return 1;
+        }
+        if (DiaJson_Expect(p, ',') == 0) {
+            continue;
+        }
+        if (DiaJson_Expect(p, close)) {
+            return 1;
+        }
+        p->Depth--;
+        return 0;
+    }
+}
+
+static int DiaJson_SkipValue(dia_json_parser_t *p) {
+    DiaJson_SkipSpace(p);
+    if (p->Pos >= p->End) {
+        return 1;
+    }
+    long long number;
+    int isInteger;
+    switch (*p->Pos) {
+        case '{': return DiaJson_SkipContainer(p, '{', '}');
+        case '[': return DiaJson_SkipContainer(p, '[', ']');
+        case '"': return DiaJson_ParseString(p, NULL, NULL, 0, NULL);
+        case 't': return DiaJson_Literal(p, "true");
+        case 'f': return DiaJson_Literal(p, "false");
+        case 'n': return DiaJson_Literal(p, "null");
+        default: return DiaJson_ParseNumber(p, &number, &isInteger);
+    }
+}
+
+static int DiaJson_DecodeObject(dia_json_parser_t *p, const dia_json_schema_t *schema, char *base, unsigned int *found);
+
+// Reads the value of one field. Returns 0 and sets *matched if the value
+// had the type of the field, values of other types are skipped.
+static int DiaJson_DecodeField(dia_json_parser_t *p, const dia_json_field_t *field, char *base, int *matched) {
+    char *value = base + field->offset;
+    *matched = 0;
+    DiaJson_SkipSpace(p);
+    if (p->Pos >= p->End) {
+        return 1;
+    }
+    char c = *p->Pos;
+
+    switch (field->type) {
+        case DIA_JSON_INT:
+            if (c == '-' || (c >= '0' && c <= '9')) {
+                long long number;
+                int isInteger;
+                if (DiaJson_ParseNumber(p, &number, &isInteger)) {
+                    return 1;
+                }
+                if (isInteger) {
+                    *(int *)value = (int)number;
+                    *matched = 1;
+                }
+                return 0;
+            }
+            break;
+        case DIA_JSON_BOOL:
+            if (c == 't' || c == 'f') {
+                if (DiaJson_Literal(p, c == 't' ? "true" : "false")) {
+                    return 1;
+                }
+                *(bool *)value = c == 't';
+                *matched = 1;
+                return 0;
+            }
+            break;
+        case DIA_JSON_STRING:
+            if (c == '"') {
+                std::string *str = (std::string *)value;
+                // clear keeps the capacity, so a reused struct does not allocate.
+                str->clear();
+                if (DiaJson_ParseString(p, str, NULL, 0, NULL)) {
+                    return 1;
+                }
+                *matched = 1;
+                return 0;
+            }
+            break;
+        case DIA_JSON_OBJECT:
+            if (c == '{') {
+                unsigned int nested = 0;
+                if (DiaJson_DecodeObject(p, field->schema, value, &nested)) {
+                    return 1;
+                }
+                *matched = 1;
+                return 0;
+            }
+            break;
+        case DIA_JSON_ARRAY:
+            if (c == '[') {
+                if (DiaJson_Expect(p, '[') || ++p->Depth > DIA_JSON_MAX_DEPTH) {
+                    return 1;
+                }
+                if (DiaJson_Expect(p, ']') == 0) {
+                    p->Depth--;
+                    *matched = 1;
+                    return 0;
+                }
+                for (int i = 0;; i++) {
+                    DiaJson_SkipSpace(p);
+                    char e = p->Pos < p->End ? *p->Pos : 0;
+                    if (i < field->count && field->schema && e == '{') {
+                        unsigned int nested = 0;
+                        if (DiaJson_DecodeObject(p, field->schema, value + i * field->stride, &nested)) {
+                            return 1;
+                        }
+                    } else if (i < field->count && !field->schema && (e == '-' || (e >= '0' && e <= '9'))) {
+                        long long number;
+                        int isInteger;
+                        if (DiaJson_ParseNumber(p, &number, &isInteger)) {
+                            return 1;
+                        }
+                        if (isInteger) {
+                            *(int *)(value + i * field->stride) = (int)number;
+                        }
+                    } else if (DiaJson_SkipValue(p)) {
+                        return 1;
+                    }
+                    if (DiaJson_Expect(p, ',') == 0) {
+                        continue;
+                    }
+                    if (DiaJson_Expect(p, ']')) {
+                        return 1;
+                    }
+                    break;
+                }
+                p->Depth--;
+                *matched = 1;
+                return 0;
+            }
+            break;
+    }
+    return DiaJson_SkipValue(p);
+}
+
+static int DiaJson_DecodeObject(dia_json_parser_t *p, const dia_json_schema_t *schema, char *base, unsigned int *found) {
+    if (DiaJson_Expect(p, '{') || ++p->Depth > DIA_JSON_MAX_DEPTH) {
+        return 1;
+    }
+    if (DiaJson_Expect(p, '}') == 0) {
+        p->Depth--;
+        return 0;
+    }
+    for (;;) {
+        char key[DIA_JSON_MAX_KEY];
+        int truncated = 0;
+        if (DiaJson_ParseString(p, NULL, key, sizeof(key), &truncated) || DiaJson_Expect(p, ':')) {
+            return 1;
+        }
+
+        const dia_json_field_t *field = NULL;
+        int index = 0;
+        for (int i = 0; !truncated && i < schema->count; i++) {
+            if (strcmp(schema->fields[i].name, key) == 0) {
+                field = &schema->fields[i];
+                index = i;
+                break;
+            }
+        }
+
+        if (field) {
+            int matched;
+            if (DiaJson_DecodeField(p, field, base, &matched)) {
+                return 1;
+            }
+            if (matched && index < 32) {
+                *found |= 1u << index;
+            }
+        } else if (DiaJson_SkipValue(p)) {
+            return 1;
+        }
+
+        if (DiaJson_Expect(p, ',') == 0) {
+            continue;
+        }
+        if (DiaJson_Expect(p, '}')) {
+            return 1;
+        }
+        p->Depth--;
+        return 0;
+    }
+}
+
+int DiaJson_Decode(const char *text, size_t length, const dia_json_schema_t *schema, void *data, unsigned int *found) {
+    if (!text || !schema || !data) {
+        return DIA_JSON_NULL_PARAMETER;
+    }
+    dia_json_parser_t parser;
+    parser.Pos = text;
+    parser.End = text + length;
+    parser.Depth = 0;
+
+    unsigned int mask = 0;
+    DiaJson_SkipSpace(&parser);
+    if (parser.Pos < parser.End && *parser.Pos != '{') {
+        // Still report broken text as a parse error.
+        return DiaJson_SkipValue(&parser) ? DIA_JSON_PARSE_ERROR : DIA_JSON_NOT_OBJECT;
+    }
+    if (DiaJson_DecodeObject(&parser, schema, (char *)data, &mask)) {
+        return DIA_JSON_PARSE_ERROR;
+    }
+    DiaJson_SkipSpace(&parser);
+    if (parser.Pos != parser.End) {
+        return DIA_JSON_PARSE_ERROR;
+    }
+    if (found) {
+        *found = mask;
+    }
+    return DIA_JSON_NO_ERROR;
+}
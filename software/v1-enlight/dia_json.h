@@ -0,0 +1,68 @@
+#ifndef DIA_JSON_H
+#define DIA_JSON_H
+
+#include <stddef.h>
+
+#include <string>
+
+#define DIA_JSON_NO_ERROR 0
+#define DIA_JSON_NULL_PARAMETER 1
+#define DIA_JSON_PARSE_ERROR 2
+#define DIA_JSON_NOT_OBJECT 3
+
+// Field types. C strings are only encoded, decoding needs std::string.
+#define DIA_JSON_INT 1
+#define DIA_JSON_BOOL 2
+#define DIA_JSON_CSTR 3
+#define DIA_JSON_STRING 4
+#define DIA_JSON_OBJECT 5
+#define DIA_JSON_ARRAY 6
+
+// Nested objects and arrays deeper than this are rejected.
+#define DIA_JSON_MAX_DEPTH 32
+// Keys longer than this never match a field.
+#define DIA_JSON_MAX_KEY 64
+
+struct dia_json_schema;
+
+// One member of a message struct: JSON key, type and where it is stored.
+// Objects and arrays keep their own schema; an array is a fixed C array of
+// count elements, each stride bytes long. Arrays without a schema hold ints.
+typedef struct dia_json_field {
+    const char *name;
+    int type;
+    size_t offset;
+    const struct dia_json_schema *schema;
+    int count;
+    size_t stride;
+} dia_json_field_t;
+
+// At most 32 fields, so DiaJson_Decode can report them in a bit mask.
+typedef struct dia_json_schema {
+    const dia_json_field_t *fields;
+    int count;
+} dia_json_schema_t;
+
+#define DIA_JSON_FIELD(type, member, name, kind) \
+    { name, kind, offsetof(type, member), 0, 0, 0 }
+#define DIA_JSON_NESTED(type, member, name, schema) \
+    { name, DIA_JSON_OBJECT, offsetof(type, member), &schema, 0, 0 }
+#define DIA_JSON_FIXED_ARRAY(type, member, name, schema) \
+    { name, DIA_JSON_ARRAY, offsetof(type, member), &schema, \
+      (int)(sizeof(((type *)0)->member) / sizeof(((type *)0)->member[0])), sizeof(((type *)0)->member[0]) }
+#define DIA_JSON_INT_ARRAY(type, member, name) \
+    { name, DIA_JSON_ARRAY, offsetof(type, member), 0, \
+      (int)(sizeof(((type *)0)->member) / sizeof(((type *)0)->member[0])), sizeof(int) }
+#define DIA_JSON_SCHEMA(fields) \
+    { fields, (int)(sizeof(fields) / sizeof(fields[0])) }
+
+// Appends the struct as a compact JSON object to out. Clearing out between
+// messages keeps its capacity, so a reused buffer does not allocate.
+int DiaJson_Encode(std::string *out, const dia_json_schema_t *schema, const void *data);
+
+// Reads a JSON object straight into the struct, without building a tree.
+// Unknown keys are skipped; fields missing in the text or having another
+// type keep their values. Bit i of found is set if field i was read.
+int DiaJson_Decode(const char *text, size_t length, const dia_json_schema_t *schema, void *data, unsigned int *found);
+
+#endif
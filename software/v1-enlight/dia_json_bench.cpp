@@ -0,0 +1,251 @@
+// JSON codec benchmark and compatibility check.
+// Usage: ./json_bench.exe [repeats]
+// Compares DiaJson with the jansson code used before for the messages the
+// post sends most: PING, its answer, money and relay reports. Every message
+// is checked to be the same JSON object both ways before it is timed.
+
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <new>
+#include <string>
+
+#include "dia_json.h"
+#include "dia_network_messages.h"
+
+#define BENCH_HASH "B827EB0F1A2C"
+
+static unsigned long long Allocations = 0;
+
+void *operator new(size_t size) {
+    Allocations++;
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
+static void *CountingMalloc(size_t size) {
+    Allocations++;
+    return malloc(size);
+}
+
+static double NowSec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *PingAnswer =
+    "{\"serviceAmount\":0,\"openStation\":false,\"ButtonID\":0,\"lastUpdate\":1718000000,"
+    "\"lastDiscountUpdate\":1718000000,\"bonusSystemActive\":true,\"bonusAmount\":0,"
+    "\"qr_data\":\"https://pay.example/q?s=42\",\"sessionID\":\"a7f3c2\",\"AuthorizedSessionID\":\"\"}";
+
+// The jansson code of DiaNetwork before DiaJson.
+
+static std::string JanssonDump(json_t *object) {
+    char *str = json_dumps(object, 0);
+    std::string res = str;
+    free(str);
+    json_decref(object);
+    return res;
+}
+
+static std::string JanssonPing(int balance, int program) {
+    json_t *object = json_object();
+    json_object_set_new(object, "Hash", json_string(BENCH_HASH));
+    json_object_set_new(object, "CurrentBalance", json_integer(balance));
+    json_object_set_new(object, "CurrentProgram", json_integer(program));
+    return JanssonDump(object);
+}
+
+static std::string JanssonMoneyReport(money_report_t *s) {
+    json_t *object = json_object();
+    json_object_set_new(object, "Hash", json_string(BENCH_HASH));
+    json_object_set_new(object, "Banknotes", json_integer(s->banknotes_total));
+    json_object_set_new(object, "CarsTotal", json_integer(s->cars_total));
+    json_object_set_new(object, "Coins", json_integer(s->coins_total));
+    json_object_set_new(object, "Electronical", json_integer(s->cashless_total));
+    json_object_set_new(object, "Service", json_integer(s->service_total));
+    json_object_set_new(object, "Bonuses", json_integer(s->bonuses_total));
+    json_object_set_new(object, "SessionId", json_string(s->session_id.c_str()));
+    return JanssonDump(object);
+}
+
+static std::string JanssonRelayReport(relay_report_t *s) {
+    json_t *object = json_object();
+    json_t *relayarr = json_array();
+    json_object_set_new(object, "Hash", json_string(BENCH_HASH));
+    for (int i = 0; i < MAX_RELAY_NUM; i++) {
+        json_t *relay = json_object();
+        json_object_set_new(relay, "RelayID", json_integer(i + 1));
+        json_object_set_new(relay, "SwitchedCount", json_integer(s->RelayStats[i].switched_count));
+        json_object_set_new(relay, "TotalTimeOn", json_integer(s->RelayStats[i].total_time_on));
+        json_array_append_new(relayarr, relay);
+    }
+    json_object_set_new(object, "RelayStats", relayarr);
+    return JanssonDump(object);
+}
+
+static int JanssonPingAnswer(const std::string &answer, server_update_t *update) {
+    json_error_t error;
+    json_t *object = json_loads(answer.c_str(), 0, &error);
+    if (!json_is_object(object)) {
+        json_decref(object);
+        return 1;
+    }
+    update->service_money = (int)json_integer_value(json_object_get(object, "serviceAmount"));
+    update->open_station = json_boolean_value(json_object_get(object, "openStation"));
+    update->button_id = (int)json_integer_value(json_object_get(object, "ButtonID"));
+    update->last_update = (int)json_integer_value(json_object_get(object, "lastUpdate"));
+    update->last_discount_update = (int)json_integer_value(json_object_get(object, "lastDiscountUpdate"));
+    update->bonus_system_active = json_boolean_value(json_object_get(object, "bonusSystemActive"));
+    update->bonus_amount = (int)json_integer_value(json_object_get(object, "bonusAmount"));
+    json_t *value = json_object_get(object, "AuthorizedSessionID");
+    update->authorized_session_id = json_is_string(value) ? json_string_value(value) : "";
+    value = json_object_get(object, "sessionID");
+    update->session_id = json_is_string(value) ? json_string_value(value) : "";
+    value = json_object_get(object, "qr_data");
+    if (json_is_string(value)) {
+        update->qr_data = json_string_value(value);
+    }
+    json_decref(object);
+    return 0;
+}
+
+// The same messages through DiaJson.
+
+static std::string CodecPing(std::string *buf, int balance, int program) {
+    ping_message_t message = {BENCH_HASH, balance, program};
+    buf->clear();
+    DiaJson_Encode(buf, &ping_message_schema, &message);
+    return *buf;
+}
+
+static std::string CodecMoneyReport(std::string *buf, money_report_t *s) {
+    money_report_message_t message;
+    message.hash = BENCH_HASH;
+    message.report = *s;
+    buf->clear();
+    DiaJson_Encode(buf, &money_report_message_schema, &message);
+    return *buf;
+}
+
+static std::string CodecRelayReport(std::string *buf, relay_report_t *s) {
+    relay_report_message_t message;
+    message.hash = BENCH_HASH;
+    for (int i = 0; i < MAX_RELAY_NUM; i++) {
+        message.relays[i].relay_id = i + 1;
+        message.relays[i].switched_count = s->RelayStats[i].switched_count;
+        message.relays[i].total_time_on = s->RelayStats[i].total_time_on;
+    }
+    buf->clear();
+    DiaJson_Encode(buf, &relay_report_message_schema, &message);
+    return *buf;
+}
+
+static int CodecPingAnswer(const std::string &answer, server_update_t *update) {
+    return DiaJson_Decode(answer.data(), answer.size(), &server_update_schema, update, NULL);
+}
+
+static int SameJson(const std::string &a, const std::string &b) {
+    json_error_t error;
+    json_t *x = json_loads(a.c_str(), 0, &error);
+    json_t *y = json_loads(b.c_str(), 0, &error);
+    int same = x && y && json_equal(x, y);
+    json_decref(x);
+    json_decref(y);
+    return same;
+}
+
+static int SameUpdate(const server_update_t &a, const server_update_t &b) {
+    return a.service_money == b.service_money && a.open_station == b.open_station && a.button_id == b.button_id &&
+           a.last_update == b.last_update && a.last_discount_update == b.last_discount_update &&
+           a.bonus_system_active == b.bonus_system_active && a.bonus_amount == b.bonus_amount &&
+           a.qr_data == b.qr_data && a.authorized_session_id == b.authorized_session_id && a.session_id == b.session_id;
+}
+
+static void PrintResult(const char *name, double janssonSec, unsigned long long janssonAllocs, double codecSec,
+                        unsigned long long codecAllocs, int repeats) {
+    printf("%-14s %10.0f %8.1f %10.0f %8.1f %7.1fx\n", name, janssonSec * 1e9 / repeats, (double)janssonAllocs / repeats,
+           codecSec * 1e9 / repeats, (double)codecAllocs / repeats, janssonSec / codecSec);
+}
+
+int main(int argc, char **argv) {
+    int repeats = argc > 1 ? atoi(argv[1]) : 200000;
+    if (repeats < 1) {
+        repeats = 1;
+    }
+    json_set_alloc_funcs(CountingMalloc, free);
+
+    money_report_t money = money_report_t();
+    money.cars_total = 1;
+    money.coins_total = 50;
+    money.banknotes_total = 100;
+    money.cashless_total = 0;
+    money.service_total = 0;
+    money.bonuses_total = 0;
+    money.session_id = "a7f3c2-\"quoted\"\\n";
+
+    relay_report_t relays;
+    for (int i = 0; i < MAX_RELAY_NUM; i++) {
+        relays.RelayStats[i].switched_count = 1000 + i;
+        relays.RelayStats[i].total_time_on = 360000 * i;
+    }
+
+    // Compatibility first.
+    std::string buf;
+    buf.reserve(JSON_MESSAGE_RESERVE);
+    std::string answer = PingAnswer;
+    server_update_t janssonUpdate, codecUpdate;
+    int ok = SameJson(JanssonPing(120, 3), CodecPing(&buf, 120, 3)) &&
+             SameJson(JanssonMoneyReport(&money), CodecMoneyReport(&buf, &money)) &&
+             SameJson(JanssonRelayReport(&relays), CodecRelayReport(&buf, &relays)) &&
+             JanssonPingAnswer(answer, &janssonUpdate) == 0 && CodecPingAnswer(answer, &codecUpdate) == 0 &&
+             SameUpdate(janssonUpdate, codecUpdate);
+    if (!ok) {
+        printf("DiaJson and jansson disagree\n");
+        return 1;
+    }
+
+    printf("%-14s %10s %8s %10s %8s %8s\n", "message", "jansson ns", "allocs", "DiaJson ns", "allocs", "speedup");
+    volatile size_t sink = 0;
+    double start, janssonSec, codecSec;
+    unsigned long long janssonAllocs, codecAllocs;
+
+#define BENCH_CASE(name, janssonCall, codecCall)                \
+    Allocations = 0;                                           \
+    start = NowSec();                                          \
+    for (int i = 0; i < repeats; i++) {                        \
+        janssonCall;                                           \
+    }                                                          \
+    janssonSec = NowSec() - start;                             \
+    janssonAllocs = Allocations;                               \
+    Allocations = 0;                                           \
+    start = NowSec();                                          \
+    for (int i = 0; i < repeats; i++) {                        \
+        codecCall;                                             \
+    }                                                          \
+    codecSec = NowSec() - start;                               \
+    codecAllocs = Allocations;                                 \
+    PrintResult(name, janssonSec, janssonAllocs, codecSec, codecAllocs, repeats);
+
+    // The encoders return std::string like the DiaNetwork ones, so each
+    // DiaJson message still allocates the returned copy once.
+    BENCH_CASE("ping", sink += JanssonPing(i, 3).size(), sink += CodecPing(&buf, i, 3).size());
+    BENCH_CASE("money report", sink += JanssonMoneyReport(&money).size(), sink += CodecMoneyReport(&buf, &money).size());
+    BENCH_CASE("relay report", sink += JanssonRelayReport(&relays).size(), sink += CodecRelayReport(&buf, &relays).size());
+    BENCH_CASE("ping answer", sink += JanssonPingAnswer(answer, &janssonUpdate), sink += CodecPingAnswer(answer, &codecUpdate));
+    return 0;
+}
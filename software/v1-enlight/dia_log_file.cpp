@@ -0,0 +1,264 @@
+#include "dia_log_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t DiaLogFile_NowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int DiaLogFile_WriteAll(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return DIA_LOG_FILE_WRITE_ERROR;
+        }
+        data += written;
+        size -= written;
+    }
+    return DIA_LOG_FILE_NO_ERROR;
+}
+
+// Directory entries must be synced too, otherwise a renamed or newly created
+// file can disappear after power loss.
+static void DiaLogFile_SyncDirectory(const std::string &path) {
+    char buf[4096];
+    snprintf(buf, sizeof(buf), "%s", path.c_str());
+    int fd = open(dirname(buf), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+static int DiaLogFile_ReadAll(int fd, std::string *data) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return DIA_LOG_FILE_OPEN_ERROR;
+    }
+
+    data->resize(st.st_size);
+    size_t done = 0;
+    while (done < data->size()) {
+        ssize_t res = pread(fd, &(*data)[done], data->size() - done, done);
+        if (res <= 0) {
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        done += res;
+    }
+    data->resize(done);
+    return DIA_LOG_FILE_NO_ERROR;
+}
+
+// Rewrites the file with what the owner encodes. Called from the writer
+// thread. The records are encoded under Lock and written without it, so
+// the owner is not blocked by the rewrite. Records queued meanwhile stay in
+// Pending and are appended to the new file.
+static int DiaLogFile_Rewrite(DiaLogFile *log) {
+    std::string data;
+    pthread_mutex_lock(&log->Lock);
+    log->Snapshot(log->Owner, &data);
+    pthread_mutex_unlock(&log->Lock);
+
+    int err = DIA_LOG_FILE_NO_ERROR;
+    std::string tmpPath = log->Path + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        printf("%s: can't create %s: %s\n", log->Name.c_str(), tmpPath.c_str(), strerror(errno));
+        err = DIA_LOG_FILE_OPEN_ERROR;
+    } else if (DiaLogFile_WriteAll(fd, data.data(), data.size()) != DIA_LOG_FILE_NO_ERROR || fdatasync(fd) != 0) {
+        printf("%s: can't write %s: %s\n", log->Name.c_str(), tmpPath.c_str(), strerror(errno));
+        err = DIA_LOG_FILE_WRITE_ERROR;
+    } else if (rename(tmpPath.c_str(), log->Path.c_str()) != 0) {
+        printf("%s: can't replace %s: %s\n", log->Name.c_str(), log->Path.c_str(), strerror(errno));
+        err = DIA_LOG_FILE_WRITE_ERROR;
+    }
+    if (err != DIA_LOG_FILE_NO_ERROR) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmpPath.c_str());
+        }
+        // Retried after the next batch or sync interval.
+        pthread_mutex_lock(&log->Lock);
+        log->NeedRewrite = 1;
+        pthread_mutex_unlock(&log->Lock);
+        return err;
+    }
+    DiaLogFile_SyncDirectory(log->Path);
+
+    pthread_mutex_lock(&log->Lock);
+    int oldFd = log->Fd;
+    log->Fd = fd;
+    log->FileBytes = data.size();
+    log->NeedRewrite = 0;
+    log->Stat.rewrites++;
+    log->Stat.syncs++;
+    log->Stat.bytes_written += data.size();
+    pthread_mutex_unlock(&log->Lock);
+    close(oldFd);
+    return DIA_LOG_FILE_NO_ERROR;
+}
+
+// Writer thread: takes everything queued so far, writes it with one write
+// call and syncs once. Records queued meanwhile go to the next batch.
+static void *DiaLogFile_WriterThread(void *arg) {
+    DiaLogFile *log = (DiaLogFile *)arg;
+    std::string batch;
+
+    for (;;) {
+        pthread_mutex_lock(&log->Lock);
+        while (log->Pending.empty() && !log->NeedRewrite && !log->ToBeDeleted) {
+            pthread_cond_wait(&log->DataReady, &log->Lock);
+        }
+        int needRewrite = log->NeedRewrite;
+        if (log->Pending.empty() && log->ToBeDeleted) {
+            pthread_mutex_unlock(&log->Lock);
+            if (needRewrite) {
+                DiaLogFile_Rewrite(log);
+            }
+            break;
+        }
+        batch.swap(log->Pending);
+        uint64_t synced = log->SyncedRecords;
+        uint64_t queued = log->QueuedRecords;
+        pthread_mutex_unlock(&log->Lock);
+
+        uint64_t startTime = DiaLogFile_NowMs();
+        int err = DIA_LOG_FILE_NO_ERROR;
+        if (!batch.empty()) {
+            err = DiaLogFile_WriteAll(log->Fd, batch.data(), batch.size());
+            if (err == DIA_LOG_FILE_NO_ERROR && fdatasync(log->Fd) != 0) {
+                err = DIA_LOG_FILE_WRITE_ERROR;
+            }
+        }
+        if (err != DIA_LOG_FILE_NO_ERROR) {
+            printf("%s: write failed: %s\n", log->Name.c_str(), strerror(errno));
+            if (ftruncate(log->Fd, log->FileBytes) != 0) {
+                printf("%s: can't truncate: %s\n", log->Name.c_str(), strerror(errno));
+            }
+        }
+
+        pthread_mutex_lock(&log->Lock);
+        log->SyncedRecords = queued;
+        if (!batch.empty()) {
+            log->Stat.syncs++;
+        }
+        if (err == DIA_LOG_FILE_NO_ERROR) {
+            log->Stat.bytes_written += batch.size();
+            log->FileBytes += batch.size();
+        } else {
+            log->FailedFrom = synced;
+            log->FailedTo = queued;
+            log->NeedRewrite = 1;
+        }
+        if (log->Committed(log->Owner, batch, err)) {
+            log->NeedRewrite = 1;
+        }
+        needRewrite = log->NeedRewrite;
+        int toBeDeleted = log->ToBeDeleted;
+        pthread_cond_broadcast(&log->DataSynced);
+        pthread_mutex_unlock(&log->Lock);
+        batch.clear();
+
+        if (needRewrite) {
+            DiaLogFile_Rewrite(log);
+        }
+
+        uint64_t spent = DiaLogFile_NowMs() - startTime;
+        if (spent < (uint64_t)log->SyncIntervalMs && !toBeDeleted) {
+            usleep((log->SyncIntervalMs - spent) * 1000);
+        }
+    }
+
+    pthread_exit(NULL);
+    return NULL;
+}
+
+int DiaLogFile_Open(DiaLogFile *log) {
+    if (!log || !log->Load || !log->Committed || !log->Snapshot) {
+        return DIA_LOG_FILE_NULL_PARAMETER;
+    }
+
+    log->Fd = open(log->Path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (log->Fd < 0) {
+        printf("%s: can't open %s: %s\n", log->Name.c_str(), log->Path.c_str(), strerror(errno));
+        return DIA_LOG_FILE_OPEN_ERROR;
+    }
+    DiaLogFile_SyncDirectory(log->Path);
+
+    std::string data;
+    if (DiaLogFile_ReadAll(log->Fd, &data) != DIA_LOG_FILE_NO_ERROR) {
+        close(log->Fd);
+        log->Fd = -1;
+        return DIA_LOG_FILE_OPEN_ERROR;
+    }
+    // Only the last write can be torn, so everything after the first
+    // broken record is cut off.
+    size_t valid = log->Load(log->Owner, data);
+    if (valid < data.size()) {
+        printf("%s: %d broken bytes at the end of %s, cutting\n", log->Name.c_str(), (int)(data.size() - valid), log->Path.c_str());
+        if (ftruncate(log->Fd, valid) != 0) {
+            printf("%s: can't truncate: %s\n", log->Name.c_str(), strerror(errno));
+        }
+    }
+    log->FileBytes = valid;
+
+    if (pthread_create(&log->WriterThread, NULL, DiaLogFile_WriterThread, log) != 0) {
+        log->WriterThread = 0;
+        close(log->Fd);
+        log->Fd = -1;
+        return DIA_LOG_FILE_OPEN_ERROR;
+    }
+    return DIA_LOG_FILE_NO_ERROR;
+}
+
+uint64_t DiaLogFile_Queue(DiaLogFile *log) {
+    pthread_cond_signal(&log->DataReady);
+    return ++log->QueuedRecords;
+}
+
+int DiaLogFile_WaitSynced(DiaLogFile *log, uint64_t from, uint64_t target) {
+    while (log->SyncedRecords < target) {
+        pthread_cond_wait(&log->DataSynced, &log->Lock);
+    }
+    if (log->FailedTo > from && log->FailedFrom < target) {
+        return DIA_LOG_FILE_WRITE_ERROR;
+    }
+    return DIA_LOG_FILE_NO_ERROR;
+}
+
+void DiaLogFile_Stop(DiaLogFile *log) {
+    if (!log->WriterThread) {
+        return;
+    }
+    pthread_mutex_lock(&log->Lock);
+    log->ToBeDeleted = 1;
+    pthread_cond_signal(&log->DataReady);
+    pthread_mutex_unlock(&log->Lock);
+    pthread_join(log->WriterThread, NULL);
+    log->WriterThread = 0;
+}
+
+DiaLogFile::~DiaLogFile() {
+    DiaLogFile_Stop(this);
+    if (Fd >= 0) {
+        close(Fd);
+    }
+    pthread_cond_destroy(&DataSynced);
+    pthread_cond_destroy(&DataReady);
+    pthread_mutex_destroy(&Lock);
+}
@@ -0,0 +1,108 @@
+#ifndef DIA_LOG_FILE_H
+#define DIA_LOG_FILE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#define DIA_LOG_FILE_NO_ERROR 0
+#define DIA_LOG_FILE_NULL_PARAMETER 1
+#define DIA_LOG_FILE_OPEN_ERROR 2
+#define DIA_LOG_FILE_WRITE_ERROR 3
+
+typedef struct dia_log_file_stat {
+    uint64_t syncs;
+    uint64_t bytes_written;
+    uint64_t rewrites;
+} dia_log_file_stat_t;
+
+// DiaLogFile is the append-only file under DiaJournal and DiaStorageFile.
+// The owner encodes its checksummed records into Pending with Lock held and
+// calls DiaLogFile_Queue. The writer thread writes everything queued so far
+// with one write and one fdatasync, then sleeps for SyncIntervalMs, so
+// records queued meanwhile share the next fdatasync.
+// A batch which fails to write is cut off, since a torn record would hide
+// every record appended after it, and the file is rewritten from the owner.
+// A rewrite goes to a temporary file renamed over the log, so a power cut
+// leaves either the old or the new file.
+class DiaLogFile {
+   public:
+    // Prefix of the messages, e.g. "Journal".
+    std::string Name;
+    std::string Path;
+    int SyncIntervalMs;
+    // Written by the writer thread only, swapped under Lock.
+    int Fd;
+
+    // The owner keeps its own state under this lock too.
+    pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t DataReady = PTHREAD_COND_INITIALIZER;
+    pthread_cond_t DataSynced = PTHREAD_COND_INITIALIZER;
+    // Records waiting for the writer thread.
+    std::string Pending;
+    uint64_t QueuedRecords;
+    uint64_t SyncedRecords;
+    // Records (FailedFrom, FailedTo] were in the last batch which failed.
+    uint64_t FailedFrom;
+    uint64_t FailedTo;
+    // Size of the file up to the last record written in full.
+    uint64_t FileBytes;
+    int NeedRewrite;
+    int ToBeDeleted;
+    dia_log_file_stat_t Stat;
+
+    // Called by DiaLogFile_Open with the content of the file, returns the
+    // size of its valid records. The rest is cut off.
+    size_t (*Load)(void *owner, const std::string &data);
+    // Called with Lock held after each batch, err is DIA_LOG_FILE_NO_ERROR
+    // if it is on disk. Returns 1 if the file is to be rewritten.
+    int (*Committed)(void *owner, const std::string &batch, int err);
+    // Called with Lock held, encodes the records of the rewritten file.
+    void (*Snapshot)(void *owner, std::string *data);
+    void *Owner;
+
+    pthread_t WriterThread;
+
+    DiaLogFile(std::string name, std::string path, int syncIntervalMs) {
+        Name = name;
+        Path = path;
+        SyncIntervalMs = syncIntervalMs;
+        Fd = -1;
+        QueuedRecords = 0;
+        SyncedRecords = 0;
+        FailedFrom = 0;
+        FailedTo = 0;
+        FileBytes = 0;
+        NeedRewrite = 0;
+        ToBeDeleted = 0;
+        Stat = dia_log_file_stat_t();
+        Load = 0;
+        Committed = 0;
+        Snapshot = 0;
+        Owner = 0;
+        WriterThread = 0;
+    }
+
+    ~DiaLogFile();
+};
+
+// Opens (or creates) the file, loads it and starts the writer thread.
+// The hooks must be set.
+int DiaLogFile_Open(DiaLogFile *log);
+
+// Counts the record the owner has just put to Pending and wakes the writer
+// thread. Called with Lock held, returns the number of the record.
+uint64_t DiaLogFile_Queue(DiaLogFile *log);
+
+// Waits until records up to target are written, returns
+// DIA_LOG_FILE_WRITE_ERROR if any of (from, target] failed.
+// Called with Lock held.
+int DiaLogFile_WaitSynced(DiaLogFile *log, uint64_t from, uint64_t target);
+
+// Writes what is still queued and stops the writer thread. Owners call it
+// before their state goes away, the hooks are not called afterwards.
+void DiaLogFile_Stop(DiaLogFile *log);
+
+#endif
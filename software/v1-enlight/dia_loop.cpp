@@ -0,0 +1,377 @@
+#include "dia_loop.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t DiaLoop_NowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void DiaLoop_WakeUp(DiaLoop *loop) {
+    uint64_t one = 1;
+    if (write(loop->WakeupFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        printf("Loop: can't wake up: %s\n", strerror(errno));
+    }
+}
+
+static void DiaLoop_Drain(int fd) {
+    uint64_t value;
+    while (read(fd, &value, sizeof(value)) > 0) {
+    }
+}
+
+// Called with Lock held. Keeps the timerfd armed for the nearest timer.
+static void DiaLoop_ArmNearest(DiaLoop *loop) {
+    uint64_t nearest = 0;
+    for (std::map<int, dia_loop_timer_t>::iterator it = loop->Timers.begin(); it != loop->Timers.end(); ++it) {
+        if (it->second.due_us && (!nearest || it->second.due_us < nearest)) {
+            nearest = it->second.due_us;
+        }
+    }
+    if (nearest == loop->ArmedUs) {
+        return;
+    }
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = nearest / 1000000;
+    spec.it_value.tv_nsec = (nearest % 1000000) * 1000;
+    if (timerfd_settime(loop->TimerFd, TFD_TIMER_ABSTIME, &spec, NULL) != 0) {
+        printf("Loop: can't arm timer: %s\n", strerror(errno));
+        return;
+    }
+    loop->ArmedUs = nearest;
+}
+
+// Runs timers which are due, one at a time, so a callback may add, arm or
+// remove timers, itself included.
+static void DiaLoop_RunTimers(DiaLoop *loop) {
+    for (;;) {
+        uint64_t now = DiaLoop_NowUs();
+        pthread_mutex_lock(&loop->Lock);
+        std::map<int, dia_loop_timer_t>::iterator due = loop->Timers.end();
+        for (std::map<int, dia_loop_timer_t>::iterator it = loop->Timers.begin(); it != loop->Timers.end(); ++it) {
+            if (it->second.due_us && it->second.due_us <= now + DIA_LOOP_SLACK_US &&
+                (due == loop->Timers.end() || it->second.due_us < due->second.due_us)) {
+                due = it;
+            }
+        }
+        if (due == loop->Timers.end()) {
+            DiaLoop_ArmNearest(loop);
+            pthread_mutex_unlock(&loop->Lock);
+            return;
+        }
+
+        dia_loop_timer_t *timer = &due->second;
+        uint64_t lateness = now > timer->due_us ? now - timer->due_us : 0;
+        loop->Stat.timers_fired++;
+        loop->Stat.lateness_total_us += lateness;
+        if (lateness > loop->Stat.lateness_max_us) {
+            loop->Stat.lateness_max_us = lateness;
+        }
+        if (timer->period_ms > 0) {
+            // Runs missed while the loop was busy are skipped, not caught up.
+            uint64_t period = (uint64_t)timer->period_ms * 1000;
+            timer->due_us += period;
+            if (timer->due_us <= now) {
+                timer->due_us += ((now - timer->due_us) / period + 1) * period;
+            }
+        } else {
+            timer->due_us = 0;
+        }
+        void *arg = timer->arg;
+        dia_loop_callback_t callback = timer->callback;
+        pthread_mutex_unlock(&loop->Lock);
+
+        callback(arg);
+    }
+}
+
+static void DiaLoop_RunFd(DiaLoop *loop, int fd, uint32_t events) {
+    pthread_mutex_lock(&loop->Lock);
+    std::map<int, dia_loop_fd_t>::iterator it = loop->Fds.find(fd);
+    if (it == loop->Fds.end()) {
+        // Removed by a callback which ran before in this wakeup.
+        pthread_mutex_unlock(&loop->Lock);
+        return;
+    }
+    dia_loop_fd_t handler = it->second;
+    loop->Stat.fd_events++;
+    pthread_mutex_unlock(&loop->Lock);
+
+    handler.callback(handler.arg, fd, events);
+}
+
+static void DiaLoop_RunPosted(DiaLoop *loop) {
+    std::list<dia_loop_posted_t> posted;
+    pthread_mutex_lock(&loop->Lock);
+    posted.swap(loop->Posted);
+    loop->Stat.posted += posted.size();
+    pthread_mutex_unlock(&loop->Lock);
+
+    for (std::list<dia_loop_posted_t>::iterator it = posted.begin(); it != posted.end(); ++it) {
+        it->callback(it->arg);
+    }
+}
+
+static void *DiaLoop_LoopThread(void *arg) {
+    DiaLoop *loop = (DiaLoop *)arg;
+    struct epoll_event events[DIA_LOOP_MAX_EVENTS];
+
+    for (;;) {
+        pthread_mutex_lock(&loop->Lock);
+        int stop = loop->ToBeDeleted;
+        pthread_mutex_unlock(&loop->Lock);
+        if (stop) {
+            break;
+        }
+
+        int n = epoll_wait(loop->EpollFd, events, DIA_LOOP_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno != EINTR) {
+                printf("Loop: epoll_wait failed: %s\n", strerror(errno));
+                usleep(100000);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&loop->Lock);
+        loop->Stat.wakeups++;
+        pthread_mutex_unlock(&loop->Lock);
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == loop->TimerFd) {
+                DiaLoop_Drain(fd);
+                pthread_mutex_lock(&loop->Lock);
+                // Fired, so it is not armed any more.
+                loop->ArmedUs = 0;
+                pthread_mutex_unlock(&loop->Lock);
+            } else if (fd == loop->WakeupFd) {
+                DiaLoop_Drain(fd);
+            } else {
+                DiaLoop_RunFd(loop, fd, events[i].events);
+            }
+        }
+        DiaLoop_RunPosted(loop);
+        DiaLoop_RunTimers(loop);
+    }
+    return NULL;
+}
+
+static int DiaLoop_Watch(DiaLoop *loop, int fd) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    return epoll_ctl(loop->EpollFd, EPOLL_CTL_ADD, fd, &event);
+}
+
+int DiaLoop_Start(DiaLoop *loop) {
+    if (!loop) {
+        return DIA_LOOP_NULL_PARAMETER;
+    }
+    loop->EpollFd = epoll_create1(EPOLL_CLOEXEC);
+    loop->TimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    loop->WakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->EpollFd < 0 || loop->TimerFd < 0 || loop->WakeupFd < 0) {
+        printf("Loop: can't create descriptors: %s\n", strerror(errno));
+        return DIA_LOOP_START_ERROR;
+    }
+    if (DiaLoop_Watch(loop, loop->TimerFd) != 0 || DiaLoop_Watch(loop, loop->WakeupFd) != 0) {
+        printf("Loop: can't watch descriptors: %s\n", strerror(errno));
+        return DIA_LOOP_START_ERROR;
+    }
+
+    pthread_mutex_lock(&loop->Lock);
+    loop->PrintedUs = DiaLoop_NowUs();
+    DiaLoop_ArmNearest(loop);
+    pthread_mutex_unlock(&loop->Lock);
+
+    if (pthread_create(&loop->LoopThread, NULL, DiaLoop_LoopThread, loop) != 0) {
+        loop->LoopThread = 0;
+        return DIA_LOOP_START_ERROR;
+    }
+    return DIA_LOOP_NO_ERROR;
+}
+
+int DiaLoop_Stop(DiaLoop *loop) {
+    if (!loop) {
+        return DIA_LOOP_NULL_PARAMETER;
+    }
+    if (!loop->LoopThread) {
+        return DIA_LOOP_STOPPED;
+    }
+    pthread_mutex_lock(&loop->Lock);
+    loop->ToBeDeleted = 1;
+    pthread_mutex_unlock(&loop->Lock);
+    DiaLoop_WakeUp(loop);
+    pthread_join(loop->LoopThread, NULL);
+    loop->LoopThread = 0;
+    return DIA_LOOP_NO_ERROR;
+}
+
+// The loop thread recomputes the nearest timer after every wakeup.
+static void DiaLoop_Changed(DiaLoop *loop) {
+    if (loop->WakeupFd >= 0 && !pthread_equal(pthread_self(), loop->LoopThread)) {
+        DiaLoop_WakeUp(loop);
+    }
+}
+
+int DiaLoop_AddTimer(DiaLoop *loop, int periodMs, void *arg, dia_loop_callback_t callback, int *id) {
+    if (!loop || !callback || periodMs < 0) {
+        return DIA_LOOP_NULL_PARAMETER;
+    }
+    dia_loop_timer_t timer;
+    timer.due_us = periodMs > 0 ? DiaLoop_NowUs() + (uint64_t)periodMs * 1000 : 0;
+    timer.period_ms = periodMs;
+    timer.arg = arg;
+    timer.callback = callback;
+
+    pthread_mutex_lock(&loop->Lock);
+    int timerId = loop->NextTimerId++;
+    loop->Timers[timerId] = timer;
+    pthread_mutex_unlock(&loop->Lock);
+
+    if (id) {
+        *id = timerId;
+    }
+    DiaLoop_Changed(loop);
+    return DIA_LOOP_NO_ERROR;
+}
+
+int DiaLoop_ArmTimer(DiaLoop *loop, int id, int delayMs) {
+    if (!loop || delayMs < 0) {
+        return DIA_LOOP_NULL_PARAMETER;
+    }
+    int err = DIA_LOOP_NO_ERROR;
+    pthread_mutex_lock(&loop->Lock);
+    std::map<int, dia_loop_timer_t>::iterator it = loop->Timers.find(id);
+    if (it == loop->Timers.end()) {
+        err = DIA_LOOP_NOT_FOUND;
+    } else {
+        it->second.due_us = DiaLoop_NowUs() + (uint64_t)delayMs * 1000;
+    }
+    pthread_mutex_unlock(&loop->Lock);
+
+    DiaLoop_Changed(loop);
+    return err;
+}
+
+int DiaLoop_RemoveTimer(DiaLoop *loop, int id) {
+    if (!loop) {
+        return DIA_LOOP_NULL_PARAMETER;
+    }
+    pthread_mutex_lock(&loop->Lock);
+    int found = loop->Timers.erase(id);
+    pthread_mutex_unlock(&loop->Lock);
+    return found ? DIA_LOOP_NO_ERROR : DIA_LOOP_NOT_FOUND;
+}
+
+int DiaLoop_AddFd(DiaLoop *loop, int fd, uint32_t events, void *arg, dia_loop_fd_callback_t callback) {
+    if (!loop || fd < 0 || !callback || loop->EpollFd < 0) {
+        return DIA_LOOP_NULL_PARAMETER;
+    }
+    dia_loop_fd_t handler;
+    handler.arg = arg;
+    handler.callback = callback;
+    pthread_mutex_lock(&loop->Lock);
+    loop->Fds[fd] = handler;
+    pthread_mutex_unlock(&loop->Lock);
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(loop->EpollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        printf("Loop: can't watch fd %d: %s\n", fd, strerror(errno));
+        pthread_mutex_lock(&loop->Lock);
+        loop->Fds.erase(fd);
+        pthread_mutex_unlock(&loop->Lock);
+        return DIA_LOOP_START_ERROR;
+    }
+    return DIA_LOOP_NO_ERROR;
+}
+
+int DiaLoop_RemoveFd(DiaLoop *loop, int fd) {
+    if (!loop || loop->EpollFd < 0) {
+        return DIA_LOOP_NULL_PARAMETER;
+    }
+    epoll_ctl(loop->EpollFd, EPOLL_CTL_DEL, fd, NULL);
+    pthread_mutex_lock(&loop->Lock);
+    int found = loop->Fds.erase(fd);
+    pthread_mutex_unlock(&loop->Lock);
+    return found ? DIA_LOOP_NO_ERROR : DIA_LOOP_NOT_FOUND;
+}
+
+int DiaLoop_Post(DiaLoop *loop, void *arg, dia_loop_callback_t callback) {
+    if (!loop || !callback) {
+        return DIA_LOOP_NULL_PARAMETER;
+    }
+    dia_loop_posted_t posted;
+    posted.arg = arg;
+    posted.callback = callback;
+    pthread_mutex_lock(&loop->Lock);
+    int stopped = loop->ToBeDeleted || !loop->LoopThread;
+    if (!stopped) {
+        loop->Posted.push_back(posted);
+    }
+    pthread_mutex_unlock(&loop->Lock);
+    if (stopped) {
+        return DIA_LOOP_STOPPED;
+    }
+    DiaLoop_WakeUp(loop);
+    return DIA_LOOP_NO_ERROR;
+}
+
+void DiaLoop_GetStat(DiaLoop *loop, dia_loop_stat_t *stat) {
+    if (!loop || !stat) {
+        return;
+    }
+    pthread_mutex_lock(&loop->Lock);
+    *stat = loop->Stat;
+    pthread_mutex_unlock(&loop->Lock);
+}
+
+void DiaLoop_PrintStat(DiaLoop *loop) {
+    if (!loop) {
+        return;
+    }
+    uint64_t now = DiaLoop_NowUs();
+    pthread_mutex_lock(&loop->Lock);
+    dia_loop_stat_t stat = loop->Stat;
+    dia_loop_stat_t last = loop->PrintedStat;
+    uint64_t elapsed = now - loop->PrintedUs;
+    loop->PrintedStat = stat;
+    loop->PrintedUs = now;
+    int timers = loop->Timers.size();
+    int fds = loop->Fds.size();
+    pthread_mutex_unlock(&loop->Lock);
+
+    uint64_t fired = stat.timers_fired - last.timers_fired;
+    printf("Loop: %d timers, %d fds, %.1f wakeups/s, %llu timers fired, lateness avg %llu us, max %llu us\n", timers,
+           fds, elapsed ? (stat.wakeups - last.wakeups) * 1e6 / elapsed : 0.0, (unsigned long long)fired,
+           (unsigned long long)(fired ? (stat.lateness_total_us - last.lateness_total_us) / fired : 0),
+           (unsigned long long)stat.lateness_max_us);
+}
+
+DiaLoop::~DiaLoop() {
+    DiaLoop_Stop(this);
+    if (EpollFd >= 0) {
+        close(EpollFd);
+    }
+    if (TimerFd >= 0) {
+        close(TimerFd);
+    }
+    if (WakeupFd >= 0) {
+        close(WakeupFd);
+    }
+    pthread_mutex_destroy(&Lock);
+}
@@ -0,0 +1,129 @@
+#ifndef DIA_LOOP_H
+#define DIA_LOOP_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <list>
+#include <map>
+
+#define DIA_LOOP_NO_ERROR 0
+#define DIA_LOOP_NULL_PARAMETER 1
+#define DIA_LOOP_START_ERROR 2
+#define DIA_LOOP_NOT_FOUND 3
+#define DIA_LOOP_STOPPED 4
+
+// Timers due this soon after the one which woke the loop run in the same
+// wakeup, so jobs with equal periods share it.
+#define DIA_LOOP_SLACK_US 2000
+#define DIA_LOOP_MAX_EVENTS 16
+
+// Callbacks run on the loop thread and must not block: every other job
+// waits. Blocking work belongs to its own thread or to DiaNetReactor.
+typedef void (*dia_loop_callback_t)(void *arg);
+typedef void (*dia_loop_fd_callback_t)(void *arg, int fd, uint32_t events);
+
+typedef struct dia_loop_timer {
+    // CLOCK_MONOTONIC, 0 while the timer is not armed.
+    uint64_t due_us;
+    // 0 for one-shot timers, which are armed with DiaLoop_ArmTimer.
+    int period_ms;
+    void *arg;
+    dia_loop_callback_t callback;
+} dia_loop_timer_t;
+
+typedef struct dia_loop_fd {
+    void *arg;
+    dia_loop_fd_callback_t callback;
+} dia_loop_fd_t;
+
+typedef struct dia_loop_posted {
+    void *arg;
+    dia_loop_callback_t callback;
+} dia_loop_posted_t;
+
+typedef struct dia_loop_stat {
+    // Returns from epoll_wait, i.e. times the thread was woken up.
+    uint64_t wakeups;
+    uint64_t timers_fired;
+    uint64_t fd_events;
+    uint64_t posted;
+    // How much later than due the timers ran.
+    uint64_t lateness_total_us;
+    uint64_t lateness_max_us;
+} dia_loop_stat_t;
+
+// DiaLoop runs periodic jobs, file descriptor handlers and callbacks posted
+// by other threads on one thread, sleeping in epoll_wait between them. The
+// nearest timer is kept on a timerfd, an eventfd wakes the loop up when
+// another thread changes something.
+class DiaLoop {
+   public:
+    int ToBeDeleted;
+    int EpollFd;
+    int TimerFd;
+    int WakeupFd;
+    pthread_t LoopThread;
+
+    // Everything below is protected by Lock.
+    pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+    std::map<int, dia_loop_timer_t> Timers;
+    std::map<int, dia_loop_fd_t> Fds;
+    std::list<dia_loop_posted_t> Posted;
+    int NextTimerId;
+    // Due time the timerfd is armed for, 0 if disarmed.
+    uint64_t ArmedUs;
+    dia_loop_stat_t Stat;
+
+    // Stat at the previous DiaLoop_PrintStat.
+    dia_loop_stat_t PrintedStat;
+    uint64_t PrintedUs;
+
+    DiaLoop() {
+        ToBeDeleted = 0;
+        EpollFd = -1;
+        TimerFd = -1;
+        WakeupFd = -1;
+        LoopThread = 0;
+        NextTimerId = 1;
+        ArmedUs = 0;
+        Stat = dia_loop_stat_t();
+        PrintedStat = dia_loop_stat_t();
+        PrintedUs = 0;
+    }
+
+    ~DiaLoop();
+};
+
+// Creates the descriptors and starts the loop thread.
+int DiaLoop_Start(DiaLoop *loop);
+
+// Stops the loop thread. Jobs stay registered but never run again.
+int DiaLoop_Stop(DiaLoop *loop);
+
+// Runs callback every periodMs, first time periodMs from now. A timer with
+// periodMs 0 is one-shot and stays disarmed until DiaLoop_ArmTimer.
+// id gets the timer id.
+int DiaLoop_AddTimer(DiaLoop *loop, int periodMs, void *arg, dia_loop_callback_t callback, int *id);
+
+// Makes the timer run delayMs from now, periodic timers go on from there.
+int DiaLoop_ArmTimer(DiaLoop *loop, int id, int delayMs);
+
+int DiaLoop_RemoveTimer(DiaLoop *loop, int id);
+
+// Calls callback when epoll reports events (EPOLLIN, ...) on fd.
+// The descriptor stays owned by the caller.
+int DiaLoop_AddFd(DiaLoop *loop, int fd, uint32_t events, void *arg, dia_loop_fd_callback_t callback);
+
+int DiaLoop_RemoveFd(DiaLoop *loop, int fd);
+
+// Runs callback once on the loop thread, as soon as possible. Any thread,
+// a DiaNetReactor callback included, can hand its result to the loop so.
+int DiaLoop_Post(DiaLoop *loop, void *arg, dia_loop_callback_t callback);
+
+void DiaLoop_GetStat(DiaLoop *loop, dia_loop_stat_t *stat);
+
+// Prints wakeups per second and timer lateness since the previous call.
+void DiaLoop_PrintStat(DiaLoop *loop);
+
+#endif
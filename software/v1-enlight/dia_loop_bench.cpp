@@ -0,0 +1,131 @@
+// Periodic jobs on threads of their own vs on one DiaLoop.
+// Usage: ./loop_bench.exe [-n jobs] [-p period ms] [-t seconds]
+// Every job only counts its runs, so the numbers are the cost of waking up:
+// context switches of the process and how late the jobs ran.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dia_loop.h"
+
+#define BENCH_MAX_JOBS 64
+
+typedef struct bench_job {
+    int periodMs;
+    volatile int stop;
+    uint64_t runs;
+    uint64_t nextUs;
+    uint64_t latenessTotalUs;
+    uint64_t latenessMaxUs;
+    pthread_t thread;
+} bench_job_t;
+
+static uint64_t NowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static long ContextSwitches() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+// The way the firmware jobs ran before: work, then sleep for the period.
+static void *JobThread(void *arg) {
+    bench_job_t *job = (bench_job_t *)arg;
+    job->nextUs = NowUs() + job->periodMs * 1000;
+    while (!job->stop) {
+        usleep(job->periodMs * 1000);
+        uint64_t now = NowUs();
+        uint64_t lateness = now > job->nextUs ? now - job->nextUs : 0;
+        job->latenessTotalUs += lateness;
+        if (lateness > job->latenessMaxUs) {
+            job->latenessMaxUs = lateness;
+        }
+        job->runs++;
+        job->nextUs = now + job->periodMs * 1000;
+    }
+    return NULL;
+}
+
+static void LoopJob(void *arg) {
+    bench_job_t *job = (bench_job_t *)arg;
+    job->runs++;
+}
+
+int main(int argc, char **argv) {
+    int jobs = 4;
+    int periodMs = 100;
+    int seconds = 5;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:p:t:")) != -1) {
+        switch (opt) {
+            case 'n': jobs = atoi(optarg); break;
+            case 'p': periodMs = atoi(optarg); break;
+            case 't': seconds = atoi(optarg); break;
+            default:
+                printf("usage: %s [-n jobs] [-p period ms] [-t seconds]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (jobs < 1 || jobs > BENCH_MAX_JOBS || periodMs < 1 || seconds < 1) {
+        printf("wrong parameters\n");
+        return 1;
+    }
+
+    static bench_job_t job[BENCH_MAX_JOBS];
+    printf("%d jobs every %d ms for %d sec\n\n", jobs, periodMs, seconds);
+    printf("%-8s %10s %12s %12s %16s %16s\n", "mode", "runs", "wakeups/s", "switches/s", "lateness avg us", "lateness max us");
+
+    long switches = ContextSwitches();
+    for (int i = 0; i < jobs; i++) {
+        job[i] = bench_job_t();
+        job[i].periodMs = periodMs;
+        pthread_create(&job[i].thread, NULL, JobThread, &job[i]);
+    }
+    sleep(seconds);
+    uint64_t runs = 0, latenessTotal = 0, latenessMax = 0;
+    for (int i = 0; i < jobs; i++) {
+        job[i].stop = 1;
+        pthread_join(job[i].thread, NULL);
+        runs += job[i].runs;
+        latenessTotal += job[i].latenessTotalUs;
+        if (job[i].latenessMaxUs > latenessMax) {
+            latenessMax = job[i].latenessMaxUs;
+        }
+    }
+    switches = ContextSwitches() - switches;
+    printf("%-8s %10llu %12.1f %12.1f %16llu %16llu\n", "threads", (unsigned long long)runs, (double)runs / seconds,
+           (double)switches / seconds, (unsigned long long)(runs ? latenessTotal / runs : 0),
+           (unsigned long long)latenessMax);
+
+    DiaLoop *loop = new DiaLoop();
+    if (DiaLoop_Start(loop) != DIA_LOOP_NO_ERROR) {
+        printf("loop is not started\n");
+        return 1;
+    }
+    switches = ContextSwitches();
+    for (int i = 0; i < jobs; i++) {
+        job[i] = bench_job_t();
+        DiaLoop_AddTimer(loop, periodMs, &job[i], LoopJob, NULL);
+    }
+    sleep(seconds);
+    DiaLoop_Stop(loop);
+    switches = ContextSwitches() - switches;
+
+    dia_loop_stat_t stat;
+    DiaLoop_GetStat(loop, &stat);
+    printf("%-8s %10llu %12.1f %12.1f %16llu %16llu\n", "DiaLoop", (unsigned long long)stat.timers_fired,
+           (double)stat.wakeups / seconds, (double)switches / seconds,
+           (unsigned long long)(stat.timers_fired ? stat.lateness_total_us / stat.timers_fired : 0),
+           (unsigned long long)stat.lateness_max_us);
+    delete loop;
+    return 0;
+}
@@ -80,7 +80,7 @@ int DiaMicroCoinSp_GetAnswerRaw(DiaDevice * device)
     return bytes_read;
 }
 
-void DiaMicroCoinSp_StartDriver(DiaMicroCoinSp * coinAcceptor)
+int DiaMicroCoinSp_StartDriver(DiaMicroCoinSp * coinAcceptor)
 {
     assert(coinAcceptor->_Device);
     DiaDevice * device = coinAcceptor->_Device;
@@ -93,10 +93,11 @@ void DiaMicroCoinSp_StartDriver(DiaMicroCoinSp * coinAcceptor)
     int err = pthread_create(&coinAcceptor->WorkingThread, NULL, &DiaMicroCoinSp_WorkingThread, coinAcceptor);
     if (err != 0) {
         printf("\ncan't create thread :[%s]", strerror(err));
-        return;
+        return DIA_MCSP_THREAD_ERROR;
     }
 
     printf("Microcoin SP initialized properly \n");
+    return DIA_MCSP_NO_ERROR;
 }
 
 void DiaMicroCoinSp_PrintBuffer(char *Buf, int bufLength)
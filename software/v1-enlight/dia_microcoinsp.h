@@ -47,7 +47,7 @@ void DiaMicroCoinSp_ProcessIncomingData(void * specificDriver, char * data, int
 void DiaMicroCoinSp_CommandReadingThread(void * driverPtr, int size, char * buf);
 long DiaMicroCoinSp_CheckMonet(DiaMicroCoinSp * coinAcceptor);
 void DiaMicroCoinSp_PrintBuffer(char *Buf, int bufLength);
-void DiaMicroCoinSp_StartDriver(DiaMicroCoinSp * coinAcceptor);
+int DiaMicroCoinSp_StartDriver(DiaMicroCoinSp * coinAcceptor);
 int DiaMicroCoinSp_SendRequest(DiaDevice * device, char * buf , char additionalBytesCount, char cmd);
 void DiaMicroCoinSp_SendRequestRaw(DiaDevice * device, char * buf , char additionalBytesCount, char cmd);
 int DiaMicroCoinSp_GetAnswerRaw(DiaDevice * device);
@@ -0,0 +1,656 @@
+#include "dia_mock_server.h"
+
+#include <event2/buffer.h>
+#include <event2/event.h>
+#include <event2/http.h>
+#include <event2/keyvalq_struct.h>
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <string>
+#include <vector>
+
+// Station id answered by /station-by-hash, registry keys of the station
+// under test are stored under it.
+#define DIA_MOCK_STATION_ID 1
+
+// Answer which is waiting for the injected latency.
+// libevent keeps the request alive even if the client goes away,
+// evhttp_send_reply frees it in that case.
+typedef struct dia_mock_reply {
+    struct evhttp_request *req;
+    int code;
+    int close;
+    std::string body;
+    time_t held_since;
+} dia_mock_reply_t;
+
+typedef struct dia_mock_route {
+    const char *path;
+    int (*handler)(DiaMockServer *server, json_t *request, std::string *answer);
+} dia_mock_route_t;
+
+static std::string DiaMockServer_Dump(json_t *object) {
+    char *str = json_dumps(object, JSON_ENCODE_ANY);
+    std::string res = str ? str : "";
+    free(str);
+    json_decref(object);
+    return res;
+}
+
+static std::string DiaMockServer_GetString(json_t *object, const char *key) {
+    json_t *value = json_object_get(object, key);
+    return json_is_string(value) ? json_string_value(value) : "";
+}
+
+static std::string DiaMockServer_RegistryKey(int stationID, std::string key) {
+    return std::to_string(stationID) + "/" + key;
+}
+
+static int DiaMockServer_Empty(DiaMockServer *server, json_t *request, std::string *answer) {
+    return HTTP_OK;
+}
+
+// Some routes are checked for a non-empty answer by DiaNetwork.
+static int DiaMockServer_EmptyObject(DiaMockServer *server, json_t *request, std::string *answer) {
+    *answer = "{}";
+    return HTTP_OK;
+}
+
+// Station state, the same for PING answers and pushed updates.
+static std::string DiaMockServer_StationState(DiaMockServer *server) {
+    json_t *object = json_object();
+    json_object_set_new(object, "serviceAmount", json_integer(server->PendingServiceMoney));
+    server->PendingServiceMoney = 0;
+    json_object_set_new(object, "openStation", json_false());
+    json_object_set_new(object, "ButtonID", json_integer(0));
+    json_object_set_new(object, "lastUpdate", json_integer(0));
+    json_object_set_new(object, "lastDiscountUpdate", json_integer(0));
+    json_object_set_new(object, "bonusSystemActive", json_false());
+    json_object_set_new(object, "bonusAmount", json_integer(0));
+    json_object_set_new(object, "sessionID", json_string(""));
+    json_object_set_new(object, "AuthorizedSessionID", json_string(""));
+    return DiaMockServer_Dump(object);
+}
+
+static int DiaMockServer_Ping(DiaMockServer *server, json_t *request, std::string *answer) {
+    if (!request) {
+        // GET /ping is used to discover the server.
+        return HTTP_OK;
+    }
+    *answer = DiaMockServer_StationState(server);
+    return HTTP_OK;
+}
+
+// /subscribe is handled by DiaMockServer_CentralRequest, since it is not
+// answered right away. This one is used only without push support.
+static int DiaMockServer_NoPush(DiaMockServer *server, json_t *request, std::string *answer) {
+    return HTTP_NOTFOUND;
+}
+
+static int DiaMockServer_CreateSession(DiaMockServer *server, json_t *request, std::string *answer) {
+    server->Stat.sessions++;
+    std::string id = "mock-session-" + std::to_string(server->Stat.sessions);
+
+    json_t *object = json_object();
+    json_object_set_new(object, "ID", json_string(id.c_str()));
+    json_object_set_new(object, "QR", json_string(("http://localhost/#/?sessionID=" + id).c_str()));
+    *answer = DiaMockServer_Dump(object);
+    return HTTP_OK;
+}
+
+static int DiaMockServer_StationConfig(DiaMockServer *server, json_t *request, std::string *answer) {
+    json_t *object = json_object();
+    json_t *programs = json_array();
+    for (int i = 1; i <= server->Config.programs; i++) {
+        json_t *relay = json_object();
+        json_object_set_new(relay, "id", json_integer(i));
+        json_object_set_new(relay, "timeon", json_integer(1000));
+        json_object_set_new(relay, "timeoff", json_integer(0));
+        json_t *relays = json_array();
+        json_array_append_new(relays, relay);
+
+        json_t *program = json_object();
+        json_object_set_new(program, "id", json_integer(i));
+        json_object_set_new(program, "price", json_integer(10));
+        json_object_set_new(program, "name", json_string(("program " + std::to_string(i)).c_str()));
+        json_object_set_new(program, "relays", relays);
+
+        json_t *button = json_object();
+        json_object_set_new(button, "buttonID", json_integer(i));
+        json_object_set_new(button, "program", program);
+        json_array_append_new(programs, button);
+    }
+    json_object_set_new(object, "programs", programs);
+    json_object_set_new(object, "preflightSec", json_integer(0));
+    json_object_set_new(object, "relayBoard", json_string("localGPIO"));
+    json_object_set_new(object, "lastUpdate", json_integer(0));
+    *answer = DiaMockServer_Dump(object);
+    return HTTP_OK;
+}
+
+static int DiaMockServer_ServerInfo(DiaMockServer *server, json_t *request, std::string *answer) {
+    json_t *object = json_object();
+    json_object_set_new(object, "bonusServiceURL", json_string("http://localhost"));
+    *answer = DiaMockServer_Dump(object);
+    return HTTP_OK;
+}
+
+static int DiaMockServer_Volume(DiaMockServer *server, json_t *request, std::string *answer) {
+    json_t *object = json_object();
+    json_object_set_new(object, "volume", json_integer(0));
+    json_object_set_new(object, "status", json_string("ok"));
+    *answer = DiaMockServer_Dump(object);
+    return HTTP_OK;
+}
+
+static int DiaMockServer_CardReaderConfig(DiaMockServer *server, json_t *request, std::string *answer) {
+    json_t *object = json_object();
+    json_object_set_new(object, "cardReaderType", json_string("NOT_USED"));
+    *answer = DiaMockServer_Dump(object);
+    return HTTP_OK;
+}
+
+static int DiaMockServer_GetQr(DiaMockServer *server, json_t *request, std::string *answer) {
+    json_t *object = json_object();
+    json_object_set_new(object, "qr_data", json_string(""));
+    *answer = DiaMockServer_Dump(object);
+    return HTTP_OK;
+}
+
+static int DiaMockServer_Discounts(DiaMockServer *server, json_t *request, std::string *answer) {
+    *answer = "[]";
+    return HTTP_OK;
+}
+
+static int DiaMockServer_SaveMoney(DiaMockServer *server, json_t *request, std::string *answer) {
+    if (!json_is_object(request)) {
+        return HTTP_BADREQUEST;
+    }
+    static const char *fields[] = {"CarsTotal", "Coins", "Banknotes", "Electronical", "Service", "Bonuses"};
+    for (unsigned int i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        json_t *value = json_object_get(request, fields[i]);
+        if (json_is_integer(value)) {
+            server->MoneyTotals[fields[i]] += json_integer_value(value);
+        }
+    }
+    server->Stat.money_reports++;
+    server->Delivered.push_back(DiaMockServer_GetString(request, "SessionId"));
+    return HTTP_OK;
+}
+
+static int DiaMockServer_LoadMoney(DiaMockServer *server, json_t *request, std::string *answer) {
+    json_t *object = json_object();
+    json_object_set_new(object, "carsTotal", json_integer(server->MoneyTotals["CarsTotal"]));
+    json_object_set_new(object, "coins", json_integer(server->MoneyTotals["Coins"]));
+    json_object_set_new(object, "banknotes", json_integer(server->MoneyTotals["Banknotes"]));
+    json_object_set_new(object, "electronical", json_integer(server->MoneyTotals["Electronical"]));
+    json_object_set_new(object, "service", json_integer(server->MoneyTotals["Service"]));
+    json_object_set_new(object, "bonuses", json_integer(server->MoneyTotals["Bonuses"]));
+    *answer = DiaMockServer_Dump(object);
+    return HTTP_OK;
+}
+
+static int DiaMockServer_SaveRelay(DiaMockServer *server, json_t *request, std::string *answer) {
+    server->Stat.relay_reports++;
+    return HTTP_OK;
+}
+
+static int DiaMockServer_LoadRelay(DiaMockServer *server, json_t *request, std::string *answer) {
+    json_t *object = json_object();
+    json_object_set_new(object, "relayStats", json_array());
+    *answer = DiaMockServer_Dump(object);
+    return HTTP_OK;
+}
+
+// Batch routes take {"Entries": [...]} and store every entry like the
+// single route does, answering which ones were stored.
+static int DiaMockServer_Batch(DiaMockServer *server, json_t *request, std::string *answer,
+                               int (*handler)(DiaMockServer *, json_t *, std::string *)) {
+    if (!server->Config.batch) {
+        return HTTP_NOTFOUND;
+    }
+    json_t *entries = json_object_get(request, "Entries");
+    if (!json_is_array(entries)) {
+        return HTTP_BADREQUEST;
+    }
+    json_t *acked = json_array();
+    for (size_t i = 0; i < json_array_size(entries); i++) {
+        std::string entryAnswer;
+        int code = handler(server, json_array_get(entries, i), &entryAnswer);
+        json_array_append_new(acked, json_integer(code == HTTP_OK ? 1 : 0));
+    }
+    server->Stat.batches++;
+
+    json_t *object = json_object();
+    json_object_set_new(object, "Acked", acked);
+    *answer = DiaMockServer_Dump(object);
+    return HTTP_OK;
+}
+
+static int DiaMockServer_SaveMoneyBatch(DiaMockServer *server, json_t *request, std::string *answer) {
+    return DiaMockServer_Batch(server, request, answer, DiaMockServer_SaveMoney);
+}
+
+static int DiaMockServer_SaveRelayBatch(DiaMockServer *server, json_t *request, std::string *answer) {
+    return DiaMockServer_Batch(server, request, answer, DiaMockServer_SaveRelay);
+}
+
+static int DiaMockServer_SaveValue(DiaMockServer *server, json_t *request, bool overwrite) {
+    json_t *pair = json_object_get(request, "KeyPair");
+    if (!json_is_object(pair)) {
+        return HTTP_BADREQUEST;
+    }
+    std::string key = DiaMockServer_RegistryKey(DIA_MOCK_STATION_ID, DiaMockServer_GetString(pair, "Key"));
+    if (overwrite || server->Registry.find(key) == server->Registry.end()) {
+        server->Registry[key] = DiaMockServer_GetString(pair, "Value");
+    }
+    return HTTP_OK;
+}
+
+static int DiaMockServer_Save(DiaMockServer *server, json_t *request, std::string *answer) {
+    return DiaMockServer_SaveValue(server, request, true);
+}
+
+static int DiaMockServer_SaveIfNotExists(DiaMockServer *server, json_t *request, std::string *answer) {
+    return DiaMockServer_SaveValue(server, request, false);
+}
+
+// The real server answers with a JSON string followed by a new line,
+// DiaNetwork cuts both quotes and the new line.
+static int DiaMockServer_LoadValue(DiaMockServer *server, int stationID, std::string key, std::string *answer) {
+    std::string value = server->Registry[DiaMockServer_RegistryKey(stationID, key)];
+    *answer = DiaMockServer_Dump(json_string(value.c_str())) + "\n";
+    return HTTP_OK;
+}
+
+static int DiaMockServer_Load(DiaMockServer *server, json_t *request, std::string *answer) {
+    return DiaMockServer_LoadValue(server, DIA_MOCK_STATION_ID, DiaMockServer_GetString(request, "Key"), answer);
+}
+
+static int DiaMockServer_LoadFromStation(DiaMockServer *server, json_t *request, std::string *answer) {
+    int stationID = (int)json_integer_value(json_object_get(request, "StationID"));
+    return DiaMockServer_LoadValue(server, stationID, DiaMockServer_GetString(request, "Key"), answer);
+}
+
+static int DiaMockServer_StationByHash(DiaMockServer *server, json_t *request, std::string *answer) {
+    *answer = std::to_string(DIA_MOCK_STATION_ID);
+    return HTTP_OK;
+}
+
+static const dia_mock_route_t DiaMockServer_Routes[] = {
+    {"/ping", DiaMockServer_Ping},
+    {"/create-session", DiaMockServer_CreateSession},
+    {"/end-session", DiaMockServer_Empty},
+    {"/station-program-by-hash", DiaMockServer_StationConfig},
+    {"/server/info", DiaMockServer_ServerInfo},
+    {"/run-program", DiaMockServer_Empty},
+    {"/stop-program", DiaMockServer_Empty},
+    {"/volume-dispenser", DiaMockServer_Volume},
+    {"/run-dispenser", DiaMockServer_Empty},
+    {"/stop-dispenser", DiaMockServer_EmptyObject},
+    {"/card-reader-config-by-hash", DiaMockServer_CardReaderConfig},
+    {"/get-qr", DiaMockServer_GetQr},
+    {"/set-bonuses", DiaMockServer_EmptyObject},
+    {"/get-station-discounts", DiaMockServer_Discounts},
+    {"/save-money", DiaMockServer_SaveMoney},
+    {"/save-money-batch", DiaMockServer_SaveMoneyBatch},
+    {"/load-money", DiaMockServer_LoadMoney},
+    {"/save-relay", DiaMockServer_SaveRelay},
+    {"/save-relay-batch", DiaMockServer_SaveRelayBatch},
+    {"/load-relay", DiaMockServer_LoadRelay},
+    {"/save", DiaMockServer_Save},
+    {"/save-if-not-exists", DiaMockServer_SaveIfNotExists},
+    {"/load", DiaMockServer_Load},
+    {"/load-from-station", DiaMockServer_LoadFromStation},
+    {"/station-by-hash", DiaMockServer_StationByHash},
+    {"/subscribe", DiaMockServer_NoPush},
+};
+
+static void DiaMockServer_SendReply(dia_mock_reply_t *reply) {
+    struct evbuffer *buf = evbuffer_new();
+    evbuffer_add(buf, reply->body.data(), reply->body.size());
+    struct evkeyvalq *headers = evhttp_request_get_output_headers(reply->req);
+    evhttp_add_header(headers, "Content-Type", "application/json");
+    if (reply->close) {
+        evhttp_add_header(headers, "Connection", "close");
+    }
+    evhttp_send_reply(reply->req, reply->code, NULL, buf);
+    evbuffer_free(buf);
+    delete reply;
+}
+
+static void DiaMockServer_DelayedReply(evutil_socket_t fd, short what, void *arg) {
+    DiaMockServer_SendReply((dia_mock_reply_t *)arg);
+}
+
+static void DiaMockServer_Reply(DiaMockServer *server, dia_mock_reply_t *reply) {
+    int delay = server->Config.latency_ms;
+    if (server->Config.jitter_ms > 0) {
+        delay += rand_r(&server->Seed) % (server->Config.jitter_ms + 1);
+    }
+    if (delay <= 0) {
+        DiaMockServer_SendReply(reply);
+        return;
+    }
+    struct timeval tv;
+    tv.tv_sec = delay / 1000;
+    tv.tv_usec = (delay % 1000) * 1000;
+    event_base_once(server->Base, -1, EV_TIMEOUT, DiaMockServer_DelayedReply, reply, &tv);
+}
+
+// Batches come gzipped, NULL is returned if the body can't be inflated.
+static json_t *DiaMockServer_ReadBody(struct evhttp_request *req) {
+    struct evbuffer *input = evhttp_request_get_input_buffer(req);
+    size_t length = evbuffer_get_length(input);
+    if (length == 0) {
+        return NULL;
+    }
+    const char *body = (const char *)evbuffer_pullup(input, length);
+    json_error_t error;
+
+    const char *encoding = evhttp_find_header(evhttp_request_get_input_headers(req), "Content-Encoding");
+    if (!encoding || strcmp(encoding, "gzip") != 0) {
+        return json_loadb(body, length, 0, &error);
+    }
+
+    std::string inflated;
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 15 + 16) != Z_OK) {
+        return NULL;
+    }
+    stream.next_in = (Bytef *)body;
+    stream.avail_in = length;
+    int err;
+    do {
+        char buf[16384];
+        stream.next_out = (Bytef *)buf;
+        stream.avail_out = sizeof(buf);
+        err = inflate(&stream, Z_NO_FLUSH);
+        inflated.append(buf, sizeof(buf) - stream.avail_out);
+    } while (err == Z_OK);
+    inflateEnd(&stream);
+    if (err != Z_STREAM_END) {
+        return NULL;
+    }
+    return json_loadb(inflated.data(), inflated.size(), 0, &error);
+}
+
+// Decides whether the request fails before it reaches its route.
+// Returns 0 if the request should be served.
+static int DiaMockServer_Inject(DiaMockServer *server, dia_mock_reply_t *reply) {
+    server->Stat.requests++;
+    if (server->InOutage) {
+        server->Stat.refused++;
+        reply->code = HTTP_SERVUNAVAIL;
+        reply->close = 1;
+        return 1;
+    }
+    if (server->Config.error_percent > 0 && (int)(rand_r(&server->Seed) % 100) < server->Config.error_percent) {
+        server->Stat.injected_errors++;
+        reply->code = HTTP_INTERNAL;
+        return 1;
+    }
+    return 0;
+}
+
+static void DiaMockServer_CentralRequest(struct evhttp_request *req, void *arg) {
+    DiaMockServer *server = (DiaMockServer *)arg;
+    dia_mock_reply_t *reply = new dia_mock_reply_t();
+    reply->req = req;
+    reply->code = HTTP_OK;
+    reply->close = 0;
+
+    std::vector<std::string> delivered;
+
+    pthread_mutex_lock(&server->Lock);
+    if (!DiaMockServer_Inject(server, reply)) {
+        const char *path = evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req));
+        json_t *request = DiaMockServer_ReadBody(req);
+        const dia_mock_route_t *route = NULL;
+        for (unsigned int i = 0; i < sizeof(DiaMockServer_Routes) / sizeof(DiaMockServer_Routes[0]); i++) {
+            if (path && strcmp(path, DiaMockServer_Routes[i].path) == 0) {
+                route = &DiaMockServer_Routes[i];
+                break;
+            }
+        }
+        if (route && route->handler == DiaMockServer_NoPush && server->Config.push) {
+            if (server->PendingServiceMoney > 0) {
+                server->Stat.pushes++;
+                reply->body = DiaMockServer_StationState(server);
+            } else {
+                reply->held_since = time(NULL);
+                server->Subscribers.push_back(reply);
+                reply = 0;
+            }
+        } else if (route) {
+            reply->code = route->handler(server, request, &reply->body);
+            delivered.swap(server->Delivered);
+        } else {
+            printf("Mock server: unknown route %s\n", path ? path : "");
+            server->Stat.unknown_routes++;
+            reply->code = HTTP_NOTFOUND;
+        }
+        json_decref(request);
+    }
+    pthread_mutex_unlock(&server->Lock);
+
+    // The report counts as delivered when the answer is sent, not when it is
+    // received, so injected latency is included.
+    for (size_t i = 0; i < delivered.size() && server->MoneyHandler; i++) {
+        server->MoneyHandler(server->MoneyArg, delivered[i]);
+    }
+    if (reply) {
+        DiaMockServer_Reply(server, reply);
+    }
+}
+
+// Online Cash Register: POST /V2/<post>/<cash>/<electronical>.
+static void DiaMockServer_ReceiptRequest(struct evhttp_request *req, void *arg) {
+    DiaMockServer *server = (DiaMockServer *)arg;
+    dia_mock_reply_t *reply = new dia_mock_reply_t();
+    reply->req = req;
+    reply->code = HTTP_OK;
+    reply->close = 0;
+
+    pthread_mutex_lock(&server->Lock);
+    if (!DiaMockServer_Inject(server, reply)) {
+        const char *path = evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req));
+        int post, cash, electronical;
+        if (path && sscanf(path, "/V2/%d/%d/%d", &post, &cash, &electronical) == 3) {
+            server->Stat.receipts++;
+        } else {
+            server->Stat.unknown_routes++;
+            reply->code = HTTP_NOTFOUND;
+        }
+    }
+    pthread_mutex_unlock(&server->Lock);
+
+    DiaMockServer_Reply(server, reply);
+}
+
+static int DiaMockServer_Bind(DiaMockServer *server) {
+    server->CentralSocket = evhttp_bind_socket_with_handle(server->Central, "0.0.0.0", server->Config.port);
+    if (!server->CentralSocket) {
+        printf("Mock server: can't bind port %d\n", server->Config.port);
+        return DIA_MOCK_BIND_ERROR;
+    }
+    server->ReceiptsSocket = evhttp_bind_socket_with_handle(server->Receipts, "0.0.0.0", server->Config.receipts_port);
+    if (!server->ReceiptsSocket) {
+        printf("Mock server: can't bind port %d\n", server->Config.receipts_port);
+        return DIA_MOCK_BIND_ERROR;
+    }
+    return DIA_MOCK_NO_ERROR;
+}
+
+static void DiaMockServer_Unbind(DiaMockServer *server) {
+    if (server->CentralSocket) {
+        evhttp_del_accept_socket(server->Central, server->CentralSocket);
+        server->CentralSocket = 0;
+    }
+    if (server->ReceiptsSocket) {
+        evhttp_del_accept_socket(server->Receipts, server->ReceiptsSocket);
+        server->ReceiptsSocket = 0;
+    }
+}
+
+static void DiaMockServer_OutageTick(evutil_socket_t fd, short what, void *arg) {
+    DiaMockServer *server = (DiaMockServer *)arg;
+    struct timeval tv = {0, 0};
+
+    pthread_mutex_lock(&server->Lock);
+    if (server->InOutage) {
+        if (DiaMockServer_Bind(server) != DIA_MOCK_NO_ERROR) {
+            // Somebody took the port, try again a bit later.
+            DiaMockServer_Unbind(server);
+            tv.tv_sec = 1;
+        } else {
+            printf("Mock server: outage is over\n");
+            server->InOutage = 0;
+            tv.tv_sec = server->Config.outage_period_sec;
+        }
+    } else {
+        printf("Mock server: outage for %d sec\n", server->Config.outage_sec);
+        DiaMockServer_Unbind(server);
+        server->InOutage = 1;
+        server->Stat.outages++;
+        tv.tv_sec = server->Config.outage_sec;
+    }
+    pthread_mutex_unlock(&server->Lock);
+
+    evtimer_add(server->OutageTimer, &tv);
+}
+
+// Answers held subscriptions when there is something to push, when they
+// were held long enough or when the server stops.
+static void DiaMockServer_PollTick(evutil_socket_t fd, short what, void *arg) {
+    DiaMockServer *server = (DiaMockServer *)arg;
+    std::list<dia_mock_reply_t *> ready;
+    time_t now = time(NULL);
+    pthread_mutex_lock(&server->Lock);
+    std::list<dia_mock_reply_t *>::iterator it = server->Subscribers.begin();
+    while (it != server->Subscribers.end()) {
+        dia_mock_reply_t *reply = *it;
+        int push = server->PendingServiceMoney > 0;
+        if (push || server->ToBeDeleted || now - reply->held_since >= server->Config.push_hold_sec) {
+            if (push) {
+                server->Stat.pushes++;
+            }
+            reply->body = DiaMockServer_StationState(server);
+            ready.push_back(reply);
+            it = server->Subscribers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    pthread_mutex_unlock(&server->Lock);
+
+    for (it = ready.begin(); it != ready.end(); ++it) {
+        DiaMockServer_SendReply(*it);
+    }
+
+    if (server->ToBeDeleted) {
+        event_base_loopbreak(server->Base);
+    }
+}
+
+static void *DiaMockServer_LoopThread(void *arg) {
+    DiaMockServer *server = (DiaMockServer *)arg;
+    event_base_dispatch(server->Base);
+    return NULL;
+}
+
+int DiaMockServer_Start(DiaMockServer *server) {
+    if (!server) {
+        return DIA_MOCK_NULL_PARAMETER;
+    }
+    server->Seed = (unsigned int)getpid();
+    server->Base = event_base_new();
+    server->Central = evhttp_new(server->Base);
+    server->Receipts = evhttp_new(server->Base);
+    evhttp_set_gencb(server->Central, DiaMockServer_CentralRequest, server);
+    evhttp_set_gencb(server->Receipts, DiaMockServer_ReceiptRequest, server);
+    evhttp_set_allowed_methods(server->Central, EVHTTP_REQ_GET | EVHTTP_REQ_POST);
+    evhttp_set_allowed_methods(server->Receipts, EVHTTP_REQ_POST);
+
+    int err = DiaMockServer_Bind(server);
+    if (err != DIA_MOCK_NO_ERROR) {
+        return err;
+    }
+
+    // libevent is used without locking, so the loop itself checks whether
+    // it has to stop.
+    struct timeval poll = {0, DIA_MOCK_POLL_MS * 1000};
+    server->PollTimer = event_new(server->Base, -1, EV_PERSIST, DiaMockServer_PollTick, server);
+    evtimer_add(server->PollTimer, &poll);
+
+    if (server->Config.outage_period_sec > 0 && server->Config.outage_sec > 0) {
+        struct timeval tv = {server->Config.outage_period_sec, 0};
+        server->OutageTimer = evtimer_new(server->Base, DiaMockServer_OutageTick, server);
+        evtimer_add(server->OutageTimer, &tv);
+    }
+
+    printf("Mock server: central on %d, receipts on %d, latency %d+%d ms, errors %d%%, outage %d sec every %d sec\n",
+           server->Config.port, server->Config.receipts_port, server->Config.latency_ms, server->Config.jitter_ms,
+           server->Config.error_percent, server->Config.outage_sec, server->Config.outage_period_sec);
+
+    pthread_create(&server->LoopThread, NULL, DiaMockServer_LoopThread, server);
+    return DIA_MOCK_NO_ERROR;
+}
+
+int DiaMockServer_Stop(DiaMockServer *server) {
+    if (!server) {
+        return DIA_MOCK_NULL_PARAMETER;
+    }
+    if (server->LoopThread) {
+        server->ToBeDeleted = 1;
+        pthread_join(server->LoopThread, NULL);
+        server->LoopThread = 0;
+    }
+    if (server->OutageTimer) {
+        event_free(server->OutageTimer);
+        server->OutageTimer = 0;
+    }
+    if (server->PollTimer) {
+        event_free(server->PollTimer);
+        server->PollTimer = 0;
+    }
+    // evhttp_free closes the listeners and all connections.
+    if (server->Central) {
+        evhttp_free(server->Central);
+        server->Central = 0;
+        server->CentralSocket = 0;
+    }
+    if (server->Receipts) {
+        evhttp_free(server->Receipts);
+        server->Receipts = 0;
+        server->ReceiptsSocket = 0;
+    }
+    if (server->Base) {
+        event_base_free(server->Base);
+        server->Base = 0;
+    }
+    return DIA_MOCK_NO_ERROR;
+}
+
+void DiaMockServer_AddServiceMoney(DiaMockServer *server, int amount) {
+    pthread_mutex_lock(&server->Lock);
+    server->PendingServiceMoney += amount;
+    pthread_mutex_unlock(&server->Lock);
+}
+
+void DiaMockServer_GetStat(DiaMockServer *server, dia_mock_stat_t *stat) {
+    pthread_mutex_lock(&server->Lock);
+    *stat = server->Stat;
+    pthread_mutex_unlock(&server->Lock);
+}
+
+DiaMockServer::~DiaMockServer() {
+    DiaMockServer_Stop(this);
+}
@@ -0,0 +1,142 @@
+#ifndef DIA_MOCK_SERVER_H
+#define DIA_MOCK_SERVER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#define DIA_MOCK_NO_ERROR 0
+#define DIA_MOCK_NULL_PARAMETER 1
+#define DIA_MOCK_BIND_ERROR 2
+
+// Ports used by the real installation.
+#define DIA_MOCK_CENTRAL_PORT 8020
+#define DIA_MOCK_RECEIPTS_PORT 8443
+
+// The event loop checks ToBeDeleted and held subscriptions this often.
+#define DIA_MOCK_POLL_MS 100
+// /subscribe is answered after this time if nothing happened.
+#define DIA_MOCK_PUSH_HOLD_SEC 25
+
+// Failure injection. All values are zero for a healthy server.
+typedef struct dia_mock_config {
+    int port;
+    // Receipts are plain HTTP here, point DiaNetwork::SetCashRegisterURL at it.
+    int receipts_port;
+    // Every answer is delayed by latency_ms plus random 0..jitter_ms.
+    int latency_ms;
+    int jitter_ms;
+    // Percent of requests answered with 500.
+    int error_percent;
+    // Every outage_period_sec the listening sockets are closed for
+    // outage_sec, so new connections are refused and requests coming
+    // over kept-alive connections get 503.
+    int outage_period_sec;
+    int outage_sec;
+    // Amount of programs returned by /station-program-by-hash.
+    int programs;
+    // 0 makes /subscribe answer 404 like servers without push support.
+    int push;
+    int push_hold_sec;
+    // 0 makes the batch routes answer 404 like older servers.
+    int batch;
+} dia_mock_config_t;
+
+typedef struct dia_mock_stat {
+    uint64_t requests;
+    uint64_t injected_errors;
+    uint64_t refused;
+    uint64_t outages;
+    uint64_t unknown_routes;
+    uint64_t money_reports;
+    uint64_t relay_reports;
+    uint64_t receipts;
+    uint64_t sessions;
+    uint64_t pushes;
+    uint64_t batches;
+} dia_mock_stat_t;
+
+struct dia_mock_reply;
+
+// DiaMockServer is a local stand-in for the Central Server and the Online
+// Cash Register. It answers every route DiaNetwork uses with the smallest
+// valid answer, remembers saved registry keys and money totals, and can be
+// made slow, flaky or unavailable to see how the post behaves.
+class DiaMockServer {
+   public:
+    dia_mock_config_t Config;
+    int ToBeDeleted;
+    int InOutage;
+
+    struct event_base *Base;
+    struct evhttp *Central;
+    struct evhttp *Receipts;
+    struct evhttp_bound_socket *CentralSocket;
+    struct evhttp_bound_socket *ReceiptsSocket;
+    struct event *OutageTimer;
+    struct event *PollTimer;
+    pthread_t LoopThread;
+
+    pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+    dia_mock_stat_t Stat;
+    std::map<std::string, std::string> Registry;
+    // Sums of everything sent to /save-money, returned by /load-money.
+    std::map<std::string, int64_t> MoneyTotals;
+    // Service money waiting for the next PING or pushed update.
+    int PendingServiceMoney;
+    // /subscribe requests waiting for something to happen.
+    std::list<struct dia_mock_reply *> Subscribers;
+    // SessionIds of money reports stored by the request being handled.
+    std::vector<std::string> Delivered;
+    unsigned int Seed;
+
+    // Called from the loop thread for every accepted money report,
+    // single or batched, with its SessionId.
+    void *MoneyArg;
+    void (*MoneyHandler)(void *arg, std::string sessionId);
+
+    DiaMockServer() {
+        Config = dia_mock_config_t();
+        Config.port = DIA_MOCK_CENTRAL_PORT;
+        Config.receipts_port = DIA_MOCK_RECEIPTS_PORT;
+        Config.programs = 6;
+        Config.push = 1;
+        Config.push_hold_sec = DIA_MOCK_PUSH_HOLD_SEC;
+        Config.batch = 1;
+        PendingServiceMoney = 0;
+        ToBeDeleted = 0;
+        InOutage = 0;
+        Base = 0;
+        Central = 0;
+        Receipts = 0;
+        CentralSocket = 0;
+        ReceiptsSocket = 0;
+        OutageTimer = 0;
+        PollTimer = 0;
+        LoopThread = 0;
+        Stat = dia_mock_stat_t();
+        Seed = 1;
+        MoneyArg = 0;
+        MoneyHandler = 0;
+    }
+
+    ~DiaMockServer();
+};
+
+// Binds both ports and starts the event loop thread.
+int DiaMockServer_Start(DiaMockServer *server);
+
+// Stops the loop thread and closes all sockets.
+int DiaMockServer_Stop(DiaMockServer *server);
+
+void DiaMockServer_GetStat(DiaMockServer *server, dia_mock_stat_t *stat);
+
+// Adds service money like an operator does from the server UI. It is given
+// to a waiting subscription at once, otherwise to the next PING.
+void DiaMockServer_AddServiceMoney(DiaMockServer *server, int amount);
+
+#endif
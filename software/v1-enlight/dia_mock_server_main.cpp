@@ -0,0 +1,68 @@
+// Standalone mock Central Server, a post can be pointed at it with
+// the server address in its settings.
+// Usage: ./mock_server.exe [-p port] [-r receipts port] [-l latency ms] [-j jitter ms]
+//                          [-e error percent] [-o outage period sec] [-d outage sec] [-P] [-B]
+// -P answers /subscribe with 404 like servers without push support.
+// -B answers the batch routes with 404 like servers without batch support.
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "dia_mock_server.h"
+
+static volatile sig_atomic_t Interrupted = 0;
+
+static void OnSignal(int sig) {
+    Interrupted = 1;
+}
+
+int main(int argc, char **argv) {
+    DiaMockServer *server = new DiaMockServer();
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:r:l:j:e:o:d:PB")) != -1) {
+        switch (opt) {
+            case 'p': server->Config.port = atoi(optarg); break;
+            case 'r': server->Config.receipts_port = atoi(optarg); break;
+            case 'l': server->Config.latency_ms = atoi(optarg); break;
+            case 'j': server->Config.jitter_ms = atoi(optarg); break;
+            case 'e': server->Config.error_percent = atoi(optarg); break;
+            case 'o': server->Config.outage_period_sec = atoi(optarg); break;
+            case 'd': server->Config.outage_sec = atoi(optarg); break;
+            case 'P': server->Config.push = 0; break;
+            case 'B': server->Config.batch = 0; break;
+            default:
+                printf("usage: %s [-p port] [-r receipts port] [-l latency ms] [-j jitter ms] "
+                       "[-e error percent] [-o outage period sec] [-d outage sec] [-P] [-B]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (DiaMockServer_Start(server) != DIA_MOCK_NO_ERROR) {
+        delete server;
+        return 1;
+    }
+
+    signal(SIGINT, OnSignal);
+    signal(SIGTERM, OnSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    dia_mock_stat_t last = dia_mock_stat_t();
+    while (!Interrupted) {
+        sleep(1);
+        dia_mock_stat_t stat;
+        DiaMockServer_GetStat(server, &stat);
+        if (stat.requests != last.requests) {
+            printf("%llu req/s, money %llu, receipts %llu, errors %llu, refused %llu\n",
+                   (unsigned long long)(stat.requests - last.requests), (unsigned long long)stat.money_reports,
+                   (unsigned long long)stat.receipts, (unsigned long long)stat.injected_errors,
+                   (unsigned long long)stat.refused);
+        }
+        last = stat;
+    }
+
+    delete server;
+    return 0;
+}
@@ -0,0 +1,366 @@
+#include "dia_net_reactor.h"
+
+#include <errno.h>
+#include <event2/event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+static size_t DiaNetReactor_Write(void *ptr, size_t size, size_t nmemb, void *userdata) {
+    DiaNetRequest *request = (DiaNetRequest *)userdata;
+    request->Answer.append((const char *)ptr, size * nmemb);
+    return size * nmemb;
+}
+
+static void DiaNetReactor_WakeUp(DiaNetReactor *reactor) {
+    uint64_t one = 1;
+    if (write(reactor->WakeupFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        printf("Net reactor: can't wake up: %s\n", strerror(errno));
+    }
+}
+
+// Hands the finished request to its owner.
+static void DiaNetReactor_Complete(DiaNetReactor *reactor, DiaNetRequest *request) {
+    if (request->Callback) {
+        request->Callback(request->Arg, request);
+        delete request;
+        return;
+    }
+    pthread_mutex_lock(&reactor->Lock);
+    request->Done = 1;
+    pthread_cond_broadcast(&request->DoneCond);
+    pthread_mutex_unlock(&reactor->Lock);
+}
+
+static void DiaNetReactor_Finish(DiaNetReactor *reactor, DiaNetRequest *request, CURLcode code) {
+    request->CurlCode = code;
+    if (request->Curl) {
+        curl_easy_getinfo(request->Curl, CURLINFO_RESPONSE_CODE, &request->HttpCode);
+        reactor->Pool->UpdateStat(request->Curl, code);
+        curl_multi_remove_handle(reactor->Multi, request->Curl);
+        reactor->Pool->Release(request->Curl);
+        request->Curl = 0;
+    }
+    reactor->Active.remove(request);
+    if (request->Serial) {
+        reactor->SerialRunning = 0;
+    }
+    DiaNetReactor_Complete(reactor, request);
+}
+
+static int DiaNetReactor_TimeoutOf(DiaNetReactor *reactor, DiaNetRequest *request) {
+    if (request->TimeoutMs > 0) {
+        return request->TimeoutMs;
+    }
+    int timeout = reactor->DefaultTimeoutMs;
+    pthread_mutex_lock(&reactor->Lock);
+    std::map<std::string, int>::iterator it = reactor->RouteTimeouts.find(request->Route);
+    if (it != reactor->RouteTimeouts.end()) {
+        timeout = it->second;
+    }
+    pthread_mutex_unlock(&reactor->Lock);
+    return timeout;
+}
+
+static void DiaNetReactor_Begin(DiaNetReactor *reactor, DiaNetRequest *request) {
+    reactor->Active.push_back(request);
+    if (request->Serial) {
+        reactor->SerialRunning = 1;
+    }
+
+    CURL *curl = reactor->Pool->Acquire();
+    if (!curl) {
+        DiaNetReactor_Finish(reactor, request, CURLE_FAILED_INIT);
+        return;
+    }
+    request->Curl = curl;
+
+    curl_easy_setopt(curl, CURLOPT_URL, request->Url.c_str());
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, request);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, DiaNetReactor_Write);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, request);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)DiaNetReactor_TimeoutOf(reactor, request));
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    if (request->Headers) {
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, request->Headers);
+    }
+    if (request->Method == DIA_NET_POST) {
+        curl_easy_setopt(curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request->Body.c_str());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)request->Body.size());
+    } else {
+        curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+    }
+    if (request->Insecure) {
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+    }
+
+    CURLMcode err = curl_multi_add_handle(reactor->Multi, curl);
+    if (err != CURLM_OK) {
+        printf("Net reactor: can't add request %s: %s\n", request->Url.c_str(), curl_multi_strerror(err));
+        DiaNetReactor_Finish(reactor, request, CURLE_FAILED_INIT);
+    }
+}
+
+// Starts waiting requests while there are free slots.
+// The serial queue goes first, but only one of its requests runs at a time.
+static void DiaNetReactor_StartWaiting(DiaNetReactor *reactor) {
+    pthread_mutex_lock(&reactor->Lock);
+    while (!reactor->Submitted.empty()) {
+        DiaNetRequest *request = reactor->Submitted.front();
+        reactor->Submitted.pop_front();
+        if (request->Serial) {
+            reactor->SerialWaiting.push_back(request);
+        } else {
+            reactor->Waiting.push_back(request);
+        }
+    }
+    int maxRunning = reactor->MaxRunning;
+    pthread_mutex_unlock(&reactor->Lock);
+
+    while ((int)reactor->Active.size() < maxRunning) {
+        DiaNetRequest *request = 0;
+        if (!reactor->SerialRunning && !reactor->SerialWaiting.empty()) {
+            request = reactor->SerialWaiting.front();
+            reactor->SerialWaiting.pop_front();
+        } else if (!reactor->Waiting.empty()) {
+            request = reactor->Waiting.front();
+            reactor->Waiting.pop_front();
+        } else {
+            break;
+        }
+        DiaNetReactor_Begin(reactor, request);
+    }
+}
+
+static void DiaNetReactor_CheckDone(DiaNetReactor *reactor) {
+    CURLMsg *msg;
+    int left;
+    int finished = 0;
+    while ((msg = curl_multi_info_read(reactor->Multi, &left))) {
+        if (msg->msg != CURLMSG_DONE) {
+            continue;
+        }
+        DiaNetRequest *request = 0;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&request);
+        DiaNetReactor_Finish(reactor, request, msg->data.result);
+        finished = 1;
+    }
+    if (finished) {
+        DiaNetReactor_StartWaiting(reactor);
+    }
+}
+
+static void DiaNetReactor_SocketEvent(evutil_socket_t fd, short kind, void *arg) {
+    DiaNetReactor *reactor = (DiaNetReactor *)arg;
+    int action = ((kind & EV_READ) ? CURL_CSELECT_IN : 0) | ((kind & EV_WRITE) ? CURL_CSELECT_OUT : 0);
+    int running;
+    curl_multi_socket_action(reactor->Multi, fd, action, &running);
+    DiaNetReactor_CheckDone(reactor);
+}
+
+static void DiaNetReactor_TimerEvent(evutil_socket_t fd, short kind, void *arg) {
+    DiaNetReactor *reactor = (DiaNetReactor *)arg;
+    int running;
+    curl_multi_socket_action(reactor->Multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    DiaNetReactor_CheckDone(reactor);
+}
+
+// curl tells which sockets to watch, the event of a socket is kept
+// as its curl_multi_assign pointer.
+static int DiaNetReactor_SocketCallback(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp) {
+    DiaNetReactor *reactor = (DiaNetReactor *)userp;
+    struct event *ev = (struct event *)socketp;
+
+    if (what == CURL_POLL_REMOVE) {
+        if (ev) {
+            event_free(ev);
+            curl_multi_assign(reactor->Multi, s, NULL);
+        }
+        return 0;
+    }
+
+    short kind = EV_PERSIST;
+    if (what & CURL_POLL_IN) {
+        kind |= EV_READ;
+    }
+    if (what & CURL_POLL_OUT) {
+        kind |= EV_WRITE;
+    }
+    if (ev) {
+        event_del(ev);
+        event_assign(ev, reactor->Base, s, kind, DiaNetReactor_SocketEvent, reactor);
+    } else {
+        ev = event_new(reactor->Base, s, kind, DiaNetReactor_SocketEvent, reactor);
+        curl_multi_assign(reactor->Multi, s, ev);
+    }
+    event_add(ev, NULL);
+    return 0;
+}
+
+static int DiaNetReactor_TimerCallback(CURLM *multi, long timeoutMs, void *userp) {
+    DiaNetReactor *reactor = (DiaNetReactor *)userp;
+    if (timeoutMs < 0) {
+        evtimer_del(reactor->Timer);
+        return 0;
+    }
+    struct timeval tv;
+    tv.tv_sec = timeoutMs / 1000;
+    tv.tv_usec = (timeoutMs % 1000) * 1000;
+    evtimer_add(reactor->Timer, &tv);
+    return 0;
+}
+
+static void DiaNetReactor_WakeupEvent(evutil_socket_t fd, short kind, void *arg) {
+    DiaNetReactor *reactor = (DiaNetReactor *)arg;
+    uint64_t value;
+    if (read(fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        printf("Net reactor: wakeup read failed: %s\n", strerror(errno));
+    }
+    pthread_mutex_lock(&reactor->Lock);
+    int toBeDeleted = reactor->ToBeDeleted;
+    pthread_mutex_unlock(&reactor->Lock);
+    if (toBeDeleted) {
+        event_base_loopbreak(reactor->Base);
+        return;
+    }
+    DiaNetReactor_StartWaiting(reactor);
+}
+
+static void *DiaNetReactor_LoopThread(void *arg) {
+    DiaNetReactor *reactor = (DiaNetReactor *)arg;
+    event_base_dispatch(reactor->Base);
+
+    // Nobody may wait forever for a request which will never be sent.
+    pthread_mutex_lock(&reactor->Lock);
+    reactor->Waiting.splice(reactor->Waiting.end(), reactor->Submitted);
+    pthread_mutex_unlock(&reactor->Lock);
+    reactor->Waiting.splice(reactor->Waiting.end(), reactor->SerialWaiting);
+    while (!reactor->Active.empty()) {
+        DiaNetReactor_Finish(reactor, reactor->Active.front(), CURLE_ABORTED_BY_CALLBACK);
+    }
+    while (!reactor->Waiting.empty()) {
+        DiaNetRequest *request = reactor->Waiting.front();
+        reactor->Waiting.pop_front();
+        request->CurlCode = CURLE_ABORTED_BY_CALLBACK;
+        DiaNetReactor_Complete(reactor, request);
+    }
+    return NULL;
+}
+
+int DiaNetReactor_Start(DiaNetReactor *reactor) {
+    if (!reactor || !reactor->Pool) {
+        return DIA_NET_NULL_PARAMETER;
+    }
+    reactor->WakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor->WakeupFd < 0) {
+        printf("Net reactor: can't create eventfd: %s\n", strerror(errno));
+        return DIA_NET_START_ERROR;
+    }
+    reactor->Base = event_base_new();
+    reactor->Multi = curl_multi_init();
+    if (!reactor->Base || !reactor->Multi) {
+        printf("Net reactor: can't create event base or multi handle\n");
+        return DIA_NET_START_ERROR;
+    }
+    reactor->Timer = evtimer_new(reactor->Base, DiaNetReactor_TimerEvent, reactor);
+    reactor->Wakeup = event_new(reactor->Base, reactor->WakeupFd, EV_READ | EV_PERSIST, DiaNetReactor_WakeupEvent, reactor);
+    event_add(reactor->Wakeup, NULL);
+
+    curl_multi_setopt(reactor->Multi, CURLMOPT_SOCKETFUNCTION, DiaNetReactor_SocketCallback);
+    curl_multi_setopt(reactor->Multi, CURLMOPT_SOCKETDATA, reactor);
+    curl_multi_setopt(reactor->Multi, CURLMOPT_TIMERFUNCTION, DiaNetReactor_TimerCallback);
+    curl_multi_setopt(reactor->Multi, CURLMOPT_TIMERDATA, reactor);
+    curl_multi_setopt(reactor->Multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)DIA_NET_MAX_HOST_CONNECTIONS);
+
+    if (pthread_create(&reactor->LoopThread, NULL, DiaNetReactor_LoopThread, reactor) != 0) {
+        reactor->LoopThread = 0;
+        return DIA_NET_START_ERROR;
+    }
+    return DIA_NET_NO_ERROR;
+}
+
+int DiaNetReactor_Submit(DiaNetReactor *reactor, DiaNetRequest *request) {
+    if (!reactor || !request) {
+        return DIA_NET_NULL_PARAMETER;
+    }
+    pthread_mutex_lock(&reactor->Lock);
+    int stopped = reactor->ToBeDeleted || !reactor->LoopThread;
+    if (!stopped) {
+        reactor->Submitted.push_back(request);
+    }
+    pthread_mutex_unlock(&reactor->Lock);
+
+    if (stopped) {
+        // The callback is never called on the caller's thread.
+        request->CurlCode = CURLE_ABORTED_BY_CALLBACK;
+        if (request->Callback) {
+            delete request;
+        }
+        return DIA_NET_STOPPED;
+    }
+    DiaNetReactor_WakeUp(reactor);
+    return DIA_NET_NO_ERROR;
+}
+
+int DiaNetReactor_Perform(DiaNetReactor *reactor, DiaNetRequest *request) {
+    if (!reactor || !request || request->Callback) {
+        return DIA_NET_NULL_PARAMETER;
+    }
+    request->Done = 0;
+    int err = DiaNetReactor_Submit(reactor, request);
+    if (err != DIA_NET_NO_ERROR) {
+        return err;
+    }
+    pthread_mutex_lock(&reactor->Lock);
+    while (!request->Done) {
+        pthread_cond_wait(&request->DoneCond, &reactor->Lock);
+    }
+    pthread_mutex_unlock(&reactor->Lock);
+    return err;
+}
+
+void DiaNetReactor_SetRouteTimeout(DiaNetReactor *reactor, std::string route, int timeoutMs) {
+    pthread_mutex_lock(&reactor->Lock);
+    if (timeoutMs > 0) {
+        reactor->RouteTimeouts[route] = timeoutMs;
+    } else {
+        reactor->RouteTimeouts.erase(route);
+    }
+    pthread_mutex_unlock(&reactor->Lock);
+}
+
+void DiaNetReactor_SetMaxRunning(DiaNetReactor *reactor, int maxRunning) {
+    pthread_mutex_lock(&reactor->Lock);
+    reactor->MaxRunning = maxRunning > 0 ? maxRunning : 1;
+    pthread_mutex_unlock(&reactor->Lock);
+    DiaNetReactor_WakeUp(reactor);
+}
+
+DiaNetReactor::~DiaNetReactor() {
+    if (LoopThread) {
+        pthread_mutex_lock(&Lock);
+        ToBeDeleted = 1;
+        pthread_mutex_unlock(&Lock);
+        DiaNetReactor_WakeUp(this);
+        pthread_join(LoopThread, NULL);
+    }
+    if (Multi) {
+        curl_multi_cleanup(Multi);
+    }
+    if (Timer) {
+        event_free(Timer);
+    }
+    if (Wakeup) {
+        event_free(Wakeup);
+    }
+    if (Base) {
+        event_base_free(Base);
+    }
+    if (WakeupFd >= 0) {
+        close(WakeupFd);
+    }
+    pthread_mutex_destroy(&Lock);
+}
@@ -0,0 +1,154 @@
+#ifndef DIA_NET_REACTOR_H
+#define DIA_NET_REACTOR_H
+
+#include <curl/curl.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <string>
+
+#include "dia_curl_pool.h"
+
+#define DIA_NET_NO_ERROR 0
+#define DIA_NET_NULL_PARAMETER 1
+#define DIA_NET_START_ERROR 2
+#define DIA_NET_STOPPED 3
+
+#define DIA_NET_GET 0
+#define DIA_NET_POST 1
+
+// Used when neither the request nor its route have a timeout.
+#define DIA_NET_DEFAULT_TIMEOUT_MS 10000
+// Requests running at the same time, others wait in the reactor.
+#define DIA_NET_MAX_RUNNING 8
+// Connections to one host, curl queues transfers above it.
+#define DIA_NET_MAX_HOST_CONNECTIONS 4
+
+class DiaNetRequest;
+
+// Called on the reactor thread when the request is finished, the request is
+// deleted right after it returns. Must not block: every other request waits.
+typedef void (*dia_net_callback_t)(void *arg, DiaNetRequest *request);
+
+class DiaNetRequest {
+   public:
+    std::string Url;
+    // Route is used to look up the timeout, e.g. "/ping".
+    std::string Route;
+    int Method;
+    std::string Body;
+    struct curl_slist *Headers;
+    // 0 means route or default timeout.
+    int TimeoutMs;
+    // Skip TLS verification, the Online Cash Register has a self-signed certificate.
+    int Insecure;
+    // Serial requests are sent one by one in submission order,
+    // so registry writes can't overtake each other.
+    int Serial;
+
+    void *Arg;
+    dia_net_callback_t Callback;
+
+    // Result.
+    CURLcode CurlCode;
+    long HttpCode;
+    std::string Answer;
+
+    // Reactor internals.
+    CURL *Curl;
+    int Done;
+    pthread_cond_t DoneCond = PTHREAD_COND_INITIALIZER;
+
+    DiaNetRequest() {
+        Method = DIA_NET_GET;
+        Headers = 0;
+        TimeoutMs = 0;
+        Insecure = 0;
+        Serial = 0;
+        Arg = 0;
+        Callback = 0;
+        CurlCode = CURLE_OK;
+        HttpCode = 0;
+        Curl = 0;
+        Done = 0;
+    }
+
+    ~DiaNetRequest() {
+        pthread_cond_destroy(&DoneCond);
+    }
+
+    // 0 if the transfer succeeded and the server answered 2xx.
+    int Failed() {
+        return CurlCode != CURLE_OK || HttpCode < 200 || HttpCode > 299;
+    }
+};
+
+// DiaNetReactor runs every HTTP request of the post on one thread:
+// curl_multi_socket_action driven by a libevent loop. Callers either submit
+// a request with a callback and go on, or wait for it with
+// DiaNetReactor_Perform, which blocks only the calling thread, so one slow
+// route does not hold the others.
+class DiaNetReactor {
+   public:
+    DiaCurlPool *Pool;
+    int ToBeDeleted;
+
+    CURLM *Multi;
+    struct event_base *Base;
+    struct event *Timer;
+    struct event *Wakeup;
+    int WakeupFd;
+    pthread_t LoopThread;
+
+    // Everything below is protected by Lock.
+    pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+    int MaxRunning;
+    int DefaultTimeoutMs;
+    std::map<std::string, int> RouteTimeouts;
+    // Submitted by other threads, not yet seen by the reactor thread.
+    std::list<DiaNetRequest *> Submitted;
+
+    // Reactor thread only.
+    std::list<DiaNetRequest *> Waiting;
+    std::list<DiaNetRequest *> SerialWaiting;
+    std::list<DiaNetRequest *> Active;
+    int SerialRunning;
+
+    DiaNetReactor(DiaCurlPool *pool) {
+        Pool = pool;
+        ToBeDeleted = 0;
+        Multi = 0;
+        Base = 0;
+        Timer = 0;
+        Wakeup = 0;
+        WakeupFd = -1;
+        LoopThread = 0;
+        MaxRunning = DIA_NET_MAX_RUNNING;
+        DefaultTimeoutMs = DIA_NET_DEFAULT_TIMEOUT_MS;
+        SerialRunning = 0;
+    }
+
+    ~DiaNetReactor();
+};
+
+// Creates the multi handle and starts the reactor thread.
+int DiaNetReactor_Start(DiaNetReactor *reactor);
+
+// Takes ownership of the request, which is deleted after its callback.
+// Returns DIA_NET_STOPPED if the reactor is not running; the request is
+// deleted then and its callback is not called.
+int DiaNetReactor_Submit(DiaNetReactor *reactor, DiaNetRequest *request);
+
+// Submits the request and waits for it. The request stays owned by the
+// caller and must not have a callback.
+int DiaNetReactor_Perform(DiaNetReactor *reactor, DiaNetRequest *request);
+
+// Timeout of requests to the route, 0 removes the route specific timeout.
+void DiaNetReactor_SetRouteTimeout(DiaNetReactor *reactor, std::string route, int timeoutMs);
+
+// Limits requests running at the same time, the rest wait in the reactor.
+void DiaNetReactor_SetMaxRunning(DiaNetReactor *reactor, int maxRunning);
+
+#endif
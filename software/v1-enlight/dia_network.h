@@ -4,6 +4,7 @@
 #include <arpa/inet.h>
 #include <assert.h>
 #include <curl/curl.h>
+#include <errno.h>
 #include <jansson.h>
 #include <net/if.h>
 #include <netinet/in.h>
@@ -13,7 +14,9 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include <iomanip>
 #include <iostream>
@@ -23,15 +26,56 @@
 #include <queue>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "dia_channel.h"
-
-#define MAX_RELAY_NUM 6
+#include "dia_curl_pool.h"
+#include "dia_discovery.h"
+#include "dia_journal.h"
+#include "dia_json.h"
+#include "dia_net_reactor.h"
+#include "dia_network_messages.h"
+
+// Reports queued beyond this stay in the journal until the next boot.
 #define CHANNEL_SIZE 8192
+#define RECEIPTS_CHANNEL_SIZE 1024
+// Sending threads wait this long for a new entry before they look at
+// interrupted again. A new entry wakes them at once.
+#define CHANNEL_IDLE_WAIT_MS 1000
 #define RETRY_DELAY 5
 
 #define SERVER_UNAVAILABLE 2
 
+// Registry reads are made from the Lua thread, so the screen is frozen
+// while they wait.
+#define REGISTRY_READ_TIMEOUT_MS 3000
+
+// Server push: /subscribe is answered when the station state changes,
+// or after at most PUSH_HOLD_SEC with the current state.
+#define PUSH_HOLD_SEC 25
+#define PUSH_TIMEOUT_MS ((PUSH_HOLD_SEC + 10) * 1000)
+// A failed subscription is retried after this delay.
+#define PUSH_RETRY_SEC 5
+// Servers without /subscribe are asked again after this delay.
+#define PUSH_PROBE_SEC 600
+// While updates are pushed, PING is only sent this often, to report liveness.
+#define PUSH_HEARTBEAT_SEC 10
+
+#define PUSH_OFF 0
+#define PUSH_ACTIVE 1
+#define PUSH_UNSUPPORTED 2
+
+// Queued reports of one route go to <route>-batch in one gzip request,
+// {"Hash": ..., "Entries": [<report>, ...]}, answered with batch_answer_t.
+// Servers without the batch route are asked again after BATCH_PROBE_SEC.
+#define BATCH_ROUTE_SUFFIX "-batch"
+#define BATCH_PROBE_SEC 600
+
+// Unsent reports survive reboots in this file.
+#define NETWORK_JOURNAL_PATH "network.journal"
+// Address of the Central Server which answered last time.
+#define CENTRAL_SERVER_CACHE_PATH "central_server.cache"
+
 // Message for report sending channel.
 class NetworkMessage {
    public:
@@ -56,45 +100,44 @@ class ReceiptToSend {
     }
 };
 
-typedef struct curl_answer {
-    char *data;
-    size_t length;
-} curl_answer_t;
-
-typedef struct money_report {
-    int cars_total;
-    int coins_total;
-    int banknotes_total;
-    int cashless_total;
-    int service_total;
-    int bonuses_total;
-    std::string session_id;
-} money_report_t;
-
-typedef struct RelayStat {
-    int switched_count;
-    int total_time_on;
-} RelayStat_t;
-
-typedef struct relay_report {
-    RelayStat_t RelayStats[MAX_RELAY_NUM];
-} relay_report_t;
-
 class DiaNetwork {
    private:
     // For receipts
 
    public:
-    DiaChannel<ReceiptToSend> *receipts_channel;
+    // Filled by the Lua thread only, emptied by the receipts thread.
+    DiaSpscChannel<ReceiptToSend> *receipts_channel;
 
     DiaNetwork() {
         _Host = "";
         _Port = ":8020";
         curl_global_init(CURL_GLOBAL_ALL);
+        _CurlPool = new DiaCurlPool();
+        _Reactor = new DiaNetReactor(_CurlPool);
+        if (DiaNetReactor_Start(_Reactor) != DIA_NET_NO_ERROR) {
+            printf("Network reactor is not started, all requests will fail\n");
+        }
+        DiaNetReactor_SetRouteTimeout(_Reactor, "/load", REGISTRY_READ_TIMEOUT_MS);
+        DiaNetReactor_SetRouteTimeout(_Reactor, "/load-from-station", REGISTRY_READ_TIMEOUT_MS);
+        DiaNetReactor_SetRouteTimeout(_Reactor, "/subscribe", PUSH_TIMEOUT_MS);
+
+        // Push deadlines are monotonic, like the ones of smart_delay.
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&_PushCond, &attr);
+        pthread_condattr_destroy(&attr);
 
         _OnlineCashRegister = "";
         _PublicKey = "";
-        receipts_channel = new DiaChannel<ReceiptToSend>();
+        receipts_channel = new DiaSpscChannel<ReceiptToSend>(RECEIPTS_CHANNEL_SIZE);
+
+        _Journal = new DiaJournal(NETWORK_JOURNAL_PATH);
+        if (DiaJournal_Open(_Journal) == DIA_JOURNAL_NO_ERROR) {
+            DiaJournal_Replay(_Journal, this, DiaNetwork::RestoreEntry);
+        } else {
+            printf("Reports journal is not available, unsent reports will be lost on reboot\n");
+        }
 
         pthread_create(&entry_processing_thread, NULL, DiaNetwork::process_extract, this);
         pthread_create(&receipts_processing_thread, NULL, DiaNetwork::process_receipts, this);
@@ -102,8 +145,6 @@ class DiaNetwork {
 
     ~DiaNetwork() {
         printf("Destroying DiaNetwork\n");
-        delete receipts_channel;
-        curl_global_cleanup();
         StopTheWorld();
         int status = pthread_join(entry_processing_thread, NULL);
         if (status != 0) {
@@ -113,170 +154,149 @@ class DiaNetwork {
         if (status != 0) {
             printf("Main error: can't join receipts thread, status = %d\n", status);
         }
+        delete receipts_channel;
+        delete _Journal;
+        delete _Reactor;
+        delete _CurlPool;
+        curl_slist_free_all(_JsonHeaders);
+        curl_slist_free_all(_GzipJsonHeaders);
+        pthread_cond_destroy(&_PushCond);
+        curl_global_cleanup();
     }
 
-    // Base function for sending a GET request.
-    // Parameters: gets pre-created HTTP body, modifies answer from server, gets address of host (URL).
-    int SendRequestGet(std::string *answer, std::string host_addr, int timeout) {
-        assert(answer);
+    // Returns connection reuse and latency counters of all requests made so far.
+    void GetRequestStat(curl_pool_stat_t *stat) {
+        _CurlPool->GetStat(stat);
+    }
 
-        CURL *curl;
-        CURLcode res;
-        curl_answer_t raw_answer;
+    void PrintRequestStat() {
+        _CurlPool->PrintStat();
+    }
 
-        InitCurlAnswer(&raw_answer);
+    // Returns amount of reports and receipts waiting to be sent.
+    void GetQueueDepth(int *reports, int *receipts) {
+        *reports = channel.Size();
+        *receipts = receipts_channel->Size();
+    }
 
-        curl = curl_easy_init();
-        if (curl == NULL) {
-            DestructCurlAnswer(&raw_answer);
-            return 1;
-        }
+    // Timeout of requests to the route in milliseconds, 0 returns the default.
+    void SetRouteTimeout(std::string route, int timeoutMs) {
+        DiaNetReactor_SetRouteTimeout(_Reactor, route, timeoutMs);
+    }
 
-        curl_easy_setopt(curl, CURLOPT_URL, host_addr.c_str());
-        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "GET");
-        curl_easy_setopt(curl, CURLOPT_USERAGENT, "diae/0.1");
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, this->_Writefunc);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &raw_answer);
-        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout);
+    // Limits requests running at the same time.
+    void SetMaxRunningRequests(int maxRunning) {
+        DiaNetReactor_SetMaxRunning(_Reactor, maxRunning);
+    }
+
+    // Base function for sending a GET request.
+    // Parameters: modifies answer from server, gets address of host (URL), timeout in ms (0 means route default).
+    int SendRequestGet(std::string *answer, std::string host_addr, int timeout) {
+        assert(answer);
+
+        DiaNetRequest request;
+        request.Url = host_addr;
+        request.Route = RouteOf(host_addr);
+        request.Method = DIA_NET_GET;
+        request.TimeoutMs = timeout;
 
-        res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
-            DestructCurlAnswer(&raw_answer);
-            curl_easy_cleanup(curl);
+        DiaNetReactor_Perform(_Reactor, &request);
+        if (request.CurlCode != CURLE_OK) {
             return 1;
         }
-        *answer = raw_answer.data;
-        DestructCurlAnswer(&raw_answer);
-        curl_easy_cleanup(curl);
+        *answer = request.Answer;
         return 0;
     }
 
     // Base function for sending a POST request.
     // Parameters: gets pre-created HTTP body, modifies answer from server, gets address of host (URL).
-    int SendRequest(std::string *body, std::string *answer, std::string host_addr) {
+    // Blocks only the calling thread, other requests go on meanwhile.
+    int SendRequest(std::string *body, std::string *answer, std::string host_addr, int serial = 0) {
         assert(body);
         assert(answer);
 
-        CURL *curl;
-        CURLcode res;
-        curl_answer_t raw_answer;
-
-        InitCurlAnswer(&raw_answer);
-
-        curl = curl_easy_init();
-        if (curl == NULL) {
-            DestructCurlAnswer(&raw_answer);
-            printf("curl is NULL :( \n");
-            return 1;
-        }
-
-        struct curl_slist *headers = NULL;
-        headers = curl_slist_append(headers, "Accept: application/json");
-        headers = curl_slist_append(headers, "Content-Type: application/json");
-        headers = curl_slist_append(headers, "charsets: utf-8");
+        DiaNetRequest request;
+        PrepareJsonRequest(&request, *body, host_addr);
+        request.Serial = serial;
 
-        curl_easy_setopt(curl, CURLOPT_URL, host_addr.c_str());
-        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "POST");
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body->c_str());
-        curl_easy_setopt(curl, CURLOPT_USERAGENT, "diae/0.1");
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, this->_Writefunc);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &raw_answer);
-        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, 10000);
-
-        res = curl_easy_perform(curl);
-        int http_code = 0;
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-        if ((res != CURLE_OK) || ((http_code != 200) && (http_code != 201) && (http_code != 204))) {
-            printf("CURL code is wrong %d, http code %d\n", res, http_code);
-            DestructCurlAnswer(&raw_answer);
-            curl_easy_cleanup(curl);
-            curl_slist_free_all(headers);
+        DiaNetReactor_Perform(_Reactor, &request);
+        if (request.Failed()) {
+            printf("CURL code is wrong %d, http code %ld\n", request.CurlCode, request.HttpCode);
             return 1;
         }
-        *answer = raw_answer.data;
-        DestructCurlAnswer(&raw_answer);
-        curl_easy_cleanup(curl);
-        curl_slist_free_all(headers);
+        *answer = request.Answer;
         return 0;
     }
 
+    // Sends a POST request to the route and returns at once. The callback is
+    // called on the network thread when the request is finished and must not block.
+    // If the network is stopped, DIA_NET_STOPPED is returned and it is not called.
+    int SendRequestAsync(std::string route, std::string body, void *arg, dia_net_callback_t callback, int serial = 0) {
+        DiaNetRequest *request = new DiaNetRequest();
+        PrepareJsonRequest(request, body, _Host + _Port + route);
+        request->Serial = serial;
+        request->Arg = arg;
+        request->Callback = callback;
+        return DiaNetReactor_Submit(_Reactor, request);
+    }
+
     // Central server searching, if it's IP address is unknown.
-    // Gets local machine's IP and starts pinging every address in block.
+    // Tries the address which answered last time and localhost, then probes
+    // the whole local /24 at once and pings the addresses which accepted.
     // Modifies IP address.
     int SearchCentralServer(std::string &ip, int &stop) {
-        printf("Checking localhost...\n");
-        int err = this->SendPingRequestGet("localhost");
-        if (!err) {
-            ip = "localhost";
-            return 0;
-        }
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
 
-        int sock = socket(PF_INET, SOCK_DGRAM, 0);
-        sockaddr_in loopback;
-
-        if (sock == -1) {
-            printf("Could not socket\n");
-            return SERVER_UNAVAILABLE;
+        std::string cached;
+        std::vector<std::string> candidates;
+        if (DiaDiscovery_LoadCache(CENTRAL_SERVER_CACHE_PATH, &cached) == DIA_DISCOVERY_NO_ERROR) {
+            candidates.push_back(cached);
         }
-
-        memset(&loopback, 0, sizeof(loopback));
-        loopback.sin_family = AF_INET;
-        loopback.sin_addr.s_addr = INADDR_LOOPBACK;
-        loopback.sin_port = htons(9);
-
-        if (connect(sock, reinterpret_cast<sockaddr *>(&loopback), sizeof(loopback)) == -1) {
-            close(sock);
-            printf("Could not connect\n");
-            return SERVER_UNAVAILABLE;
+        if (cached != "localhost") {
+            candidates.push_back("localhost");
         }
+        const char *source = "cache";
+        int found = FindCentralServer(candidates, ip);
 
-        socklen_t addrlen = sizeof(loopback);
-        if (getsockname(sock, reinterpret_cast<sockaddr *>(&loopback), &addrlen) == -1) {
-            close(sock);
-            printf("Could not getsockname\n");
-            return SERVER_UNAVAILABLE;
+        if (found && !stop) {
+            std::string localIP;
+            if (DiaDiscovery_LocalAddress(&localIP) != DIA_DISCOVERY_NO_ERROR) {
+                return SERVER_UNAVAILABLE;
+            }
+            printf("Local ip address: %s\n", localIP.c_str());
+
+            candidates.clear();
+            int port = atoi(_Port.c_str() + 1);
+            DiaDiscovery_Scan(localIP, port, DIA_DISCOVERY_SCAN_MS, &candidates);
+            printf("Scan found %d hosts listening on port %d\n", (int)candidates.size(), port);
+            source = "scan";
+            found = FindCentralServer(candidates, ip);
         }
-
-        close(sock);
-
-        char buf[INET_ADDRSTRLEN];
-        if (inet_ntop(AF_INET, &loopback.sin_addr, buf, INET_ADDRSTRLEN) == 0x0) {
-            printf("Could not inet_ntop\n");
+        if (found) {
             return SERVER_UNAVAILABLE;
-        } else {
-            printf("Local ip address: %s\n", buf);
         }
 
-        std::string baseIP(buf);
-        std::string reqIP;
-
-        printf("Base IP: %s\n", baseIP.c_str());
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        long ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+        printf("Central server %s found by %s in %ld ms\n", ip.c_str(), source, ms);
 
-        // Truncate baseIP to prepare for scan
-        int dotCount = 0;
-        for (int j = 0; j < INET_ADDRSTRLEN; j++) {
-            if (baseIP[j] == '.')
-                dotCount++;
-            reqIP += baseIP[j];
-            if (dotCount == 3)
-                break;
+        if (ip != cached) {
+            DiaDiscovery_SaveCache(CENTRAL_SERVER_CACHE_PATH, ip);
         }
+        return 0;
+    }
 
-        // Scan whole block
-        for (int i = 1; i < 255; i++) {
-            std::string reqUrl = reqIP + std::to_string(i);
-
-            err = this->SendPingRequestGet(reqUrl);
-
-            if (!err) {
-                // We found it!
-                ip = reqIP + std::to_string(i);
+    // Pings the candidates in order, returns 0 and the first one which answered.
+    int FindCentralServer(std::vector<std::string> &candidates, std::string &ip) {
+        for (size_t i = 0; i < candidates.size(); i++) {
+            if (!SendPingRequestGet(candidates[i])) {
+                ip = candidates[i];
                 return 0;
-            }         	
-        }   	
-
-        return SERVER_UNAVAILABLE;
+            }
+        }
+        return 1;
     }
 
     // Returns local machine's MAC address of eth0 interface.
@@ -318,6 +338,13 @@ class DiaNetwork {
         return 0;
     }
 
+    // Overrides the Online Cash Register base URL, e.g. "http://127.0.0.1:8443/".
+    // By default it is https on port 8443 of the Central Server host.
+    int SetCashRegisterURL(std::string url) {
+        _CashRegisterURL = url;
+        return 0;
+    }
+
     // Just host name getter.
     std::string GetHostName() {
         return _Host;
@@ -351,29 +378,13 @@ class DiaNetwork {
 
         if (result || answer == "") return 1;
 
-        json_error_t error;
-        json_t *json = json_loads(answer.c_str(), 0, &error);
-
-        if (!json_is_object(json)) {
-            json_decref(json);
+        station_answer_t session;
+        unsigned int found = 0;
+        if (DiaJson_Decode(answer.data(), answer.size(), &session_answer_schema, &session, &found) || found != 3) {
             return 1;
         }
-
-        json_t *id_json = json_object_get(json, "ID");
-        json_t *qr_json = json_object_get(json, "QR");
-
-        if (!(json_is_string(id_json) && json_is_string(qr_json))) {
-            json_decref(json);
-            json_decref(id_json);
-            json_decref(qr_json);
-            return 1;
-        }
-
-        sessionID = json_string_value(id_json);
-        QR = json_string_value(qr_json);
-        json_decref(json);
-        json_decref(id_json);
-        json_decref(qr_json);
+        sessionID = session.id;
+        QR = session.qr;
         return 0;
     }
 
@@ -412,26 +423,12 @@ class DiaNetwork {
             return 1;
         }
 
-        json_error_t error;
-        json_t *json = json_loads(answer.c_str(), 0, &error);
-
-        if (!json_is_object(json)) {
-            json_decref(json);
+        station_answer_t info;
+        unsigned int found = 0;
+        if (DiaJson_Decode(answer.data(), answer.size(), &server_info_answer_schema, &info, &found) || !found) {
             return 1;
         }
-
-        json_t *url_json = json_object_get(json, "bonusServiceURL");
-
-        if (!(json_is_string(url_json))) {
-            json_decref(json);
-            json_decref(url_json);
-            return 1;
-        }
-
-        serverHost = json_string_value(url_json);
-        json_decref(json);
-        json_decref(url_json);
-
+        serverHost = info.bonus_service_url;
         return 0;
     }
 
@@ -473,33 +470,20 @@ class DiaNetwork {
         int result;
 
         result = SendRequest(&json_get_volue_request, &answer, url);
+        return ParseVolumeAnswer(result, answer, status);
+    }
 
+    // Volume from the /volume-dispenser answer, -1 if the request failed.
+    int ParseVolumeAnswer(int result, const std::string &answer, std::string *status) {
         if (result == 0 && answer != "") {
-            json_error_t error;
-            json_t *json = json_loads(answer.c_str(), 0, &error);
-
-            if (!json_is_object(json)) {
+            station_answer_t volume;
+            unsigned int found = 0;
+            if (DiaJson_Decode(answer.data(), answer.size(), &volume_answer_schema, &volume, &found) || found != 3) {
                 printf("GetVolume answer %s\n", answer.c_str());
-                json_decref(json);
                 return -1;
             }
-
-            json_t *volume_json = json_object_get(json, "volume");
-            json_t *status_json = json_object_get(json, "status");
-
-            if (!(json_is_integer(volume_json) && json_is_string(status_json))) {
-                printf("GetVolume answer %s\n", answer.c_str());
-                json_decref(json);
-                json_decref(volume_json);
-                json_decref(status_json);
-                return -1;
-            }
-            *status = json_string_value(status_json);
-            int v = json_integer_value(volume_json);
-            json_decref(json);
-            json_decref(volume_json);
-            json_decref(status_json);
-            return v;
+            *status = volume.status;
+            return volume.volume;
         }
         printf("GetVolume answer %s\n", answer.c_str());
         return -1;
@@ -520,6 +504,26 @@ class DiaNetwork {
         return 0;
     }
 
+    // Variants of the station commands for jobs of the firmware loop, which
+    // must not block. The callback gets the finished request on the network
+    // thread.
+    int RunProgramOnServerAsync(int programID, int preflight, void *arg, dia_net_callback_t callback) {
+        return SendRequestAsync("/run-program", json_create_run_program(programID, preflight), arg, callback);
+    }
+
+    int StartFluidFlowSensorAsync(int volume, int startProgramID, int stopProgramID, void *arg, dia_net_callback_t callback) {
+        return SendRequestAsync("/run-dispenser", json_create_start_fluid_flow_sensor(volume, startProgramID, stopProgramID), arg, callback);
+    }
+
+    int GetVolumeAsync(void *arg, dia_net_callback_t callback) {
+        return SendRequestAsync("/volume-dispenser", json_create_get_volue(), arg, callback);
+    }
+
+    // /run-program and /run-dispenser answer with an empty body on success.
+    static int StationCommandFailed(DiaNetRequest *request) {
+        return request->Failed() || request->Answer != "";
+    }
+
     // GetCardReaderConig request to specified URL with method POST.
     // Returns 0, if request was OK, other value - in case of failure.
     int GetCardReaderConig(std::string &cardReaderType, std::string &host, std::string &port) {
@@ -534,42 +538,23 @@ class DiaNetwork {
             return 1;
         }
 
-        json_t *object;
-        json_error_t error;
-
-        int err = 0;
-        object = json_loads(answer.c_str(), 0, &error);
         printf("GetCardReaderConig answer %s\n", answer.c_str());
-        do {
-            if (!object) {
-                printf("Error in GetCardReaderConig: %d: %s\n", error.line, error.text);
-                err = 1;
-                break;
-            }
-
-            if (!json_is_object(object)) {
-                printf("Not a JSON\n");
-                break;
-            }
-
-            json_t *obj_card_reader_type;
-            obj_card_reader_type = json_object_get(object, "cardReaderType");
-            cardReaderType = json_string_value(obj_card_reader_type);
-
-            json_t *obj_host;
-            obj_host = json_object_get(object, "host");
-            if (obj_host) {
-                host = json_string_value(obj_host);
-            }
-
-            json_t *obj_port;
-            obj_port = json_object_get(object, "port");
-            if (obj_port) {
-                port = json_string_value(obj_port);
-            }
-        } while (0);
-        json_decref(object);
-        return err;
+        station_answer_t config;
+        config.host = host;
+        config.port = port;
+        int err = DiaJson_Decode(answer.data(), answer.size(), &card_reader_answer_schema, &config, NULL);
+        if (err == DIA_JSON_PARSE_ERROR) {
+            printf("Error in GetCardReaderConig\n");
+            return 1;
+        }
+        if (err == DIA_JSON_NOT_OBJECT) {
+            printf("Not a JSON\n");
+            return 0;
+        }
+        cardReaderType = config.card_reader_type;
+        host = config.host;
+        port = config.port;
+        return 0;
     }
 
     // PING request to specified URL with method GET.
@@ -583,103 +568,95 @@ class DiaNetwork {
 
     // PING request to specified URL with method POST.
     // Returns 0, if request was OK, other value - in case of failure.
-    // Modifies service money, if server returned that kind of data.
-    int SendPingRequest(int &service_money, bool &open_station, int &button_id, int balance, int program, int &lastUpdate, int &lastDiscountUpdate, bool &bonus_system_active, std::string &qrData, std::string &authorizedSessionID, std::string &sessionID, int &bonusAmount) {
+    // Fills update with the station state returned by the server.
+    int SendPingRequest(server_update_t *update, int balance, int program) {
         std::string answer;
         std::string url = _Host + _Port + "/ping";
-
         int result;
         std::string json_ping_request = json_create_ping_report(balance, program);
         result = SendRequest(&json_ping_request, &answer, url);
         // printf("Server answer on PING:\n%s\n", answer.c_str());
-
         if (result == 2) {
             return 3;
         }
         if (result) {
             return 1;
         }
+        return ParseServerUpdate(answer, update, "PING");
+    }
 
-        json_t *object;
-        json_error_t error;
-
-        int err = 0;
-        object = json_loads(answer.c_str(), 0, &error);
-        do {
-            if (!object) {
-                printf("Error in PING: %d: %s\n", error.line, error.text);
-                err = 1;
-                break;
-            }
-
-            if (!json_is_object(object)) {
-                printf("Not a JSON\n");
-                break;
-            }
-
-            json_t *obj_service_amount;
-            obj_service_amount = json_object_get(object, "serviceAmount");
-            service_money = (int)json_integer_value(obj_service_amount);
-
-            json_t *obj_open_station;
-            obj_open_station = json_object_get(object, "openStation");
-            open_station = (bool)json_boolean_value(obj_open_station);
-
-            json_t *obj_button_id;
-            obj_button_id = json_object_get(object, "ButtonID");
-            button_id = (int)json_integer_value(obj_button_id);
+    int SendPingRequest(int &service_money, bool &open_station, int &button_id, int balance, int program, int &lastUpdate, int &lastDiscountUpdate, bool &bonus_system_active, std::string &qrData, std::string &authorizedSessionID, std::string &sessionID, int &bonusAmount) {
+        server_update_t update;
+        update.qr_data = qrData;
+        int err = SendPingRequest(&update, balance, program);
+        if (err) {
+            return err;
+        }
+        service_money = update.service_money;
+        open_station = update.open_station;
+        button_id = update.button_id;
+        lastUpdate = update.last_update;
+        lastDiscountUpdate = update.last_discount_update;
+        bonus_system_active = update.bonus_system_active;
+        bonusAmount = update.bonus_amount;
+        authorizedSessionID = update.authorized_session_id;
+        sessionID = update.session_id;
+        qrData = update.qr_data;
+        return 0;
+    }
 
-            json_t *obj_last_update;
-            obj_last_update = json_object_get(object, "lastUpdate");
-            lastUpdate = (int)json_integer_value(obj_last_update);
+    // Keeps a subscription to station updates open while the server supports it.
+    // Called from the pinging thread on every iteration, balance and program are
+    // reported the same way PING does.
+    void PushTick(int balance, int program) {
+        time_t now = time(NULL);
+        pthread_mutex_lock(&_PushLock);
+        _PushBalance = balance;
+        _PushProgram = program;
+        int start = !_PushInFlight && !interrupted && now >= _PushNextTry;
+        if (start) {
+            _PushInFlight = 1;
+        }
+        pthread_mutex_unlock(&_PushLock);
 
-            json_t *obj_last_discount_update;
-            obj_last_discount_update = json_object_get(object, "lastDiscountUpdate");
-            lastDiscountUpdate = (int)json_integer_value(obj_last_discount_update);
+        if (start) {
+            Subscribe();
+        }
+    }
 
-            json_t *obj_bonus_system;
-            obj_bonus_system = json_object_get(object, "bonusSystemActive");
-            bonus_system_active = (bool)json_boolean_value(obj_bonus_system);
+    // Returns 1 while updates are pushed by the server, so polling is not needed.
+    int PushIsActive() {
+        pthread_mutex_lock(&_PushLock);
+        int active = _PushState == PUSH_ACTIVE;
+        pthread_mutex_unlock(&_PushLock);
+        return active;
+    }
 
-            json_t *obj_bonus_amount;
-            obj_bonus_amount = json_object_get(object, "bonusAmount");
-            bonusAmount = (int)json_integer_value(obj_bonus_amount);
+    // Waits up to timeoutMs for an update pushed by the server.
+    // Returns 0 and fills update if there was one.
+    int WaitServerUpdate(server_update_t *update, int timeoutMs) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeoutMs / 1000;
+        deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
 
-            json_t *obj_authorized_session_ID;
-            obj_authorized_session_ID = json_object_get(object, "AuthorizedSessionID");
-            
-            if (json_is_string(obj_authorized_session_ID)) {
-                authorizedSessionID = (std::string)json_string_value(obj_authorized_session_ID);
-            }
-            else{
-                authorizedSessionID = "";
-            }
-            json_t *obj_session_ID;
-            obj_session_ID = json_object_get(object, "sessionID");
-            
-            if (json_is_string(obj_session_ID)) {
-                sessionID = (std::string)json_string_value(obj_session_ID);
-            }
-            else{
-                sessionID = "";
-            }
-            json_t *obj_qr_data;
-            obj_qr_data = json_object_get(object, "qr_data");
-            if (json_is_string(obj_qr_data)) {
-                qrData = (std::string)json_string_value(obj_qr_data);
+        int err = 1;
+        pthread_mutex_lock(&_PushLock);
+        while (_PushUpdates.empty() && _PushState == PUSH_ACTIVE && !interrupted) {
+            if (pthread_cond_timedwait(&_PushCond, &_PushLock, &deadline) == ETIMEDOUT) {
+                break;
             }
-            json_decref(obj_service_amount);
-            json_decref(obj_open_station);
-            json_decref(obj_button_id);
-            json_decref(obj_last_update);
-            json_decref(obj_last_discount_update);
-            json_decref(obj_bonus_system);
-            json_decref(obj_bonus_amount);
-            json_decref(obj_authorized_session_ID);
-            json_decref(obj_session_ID);
-            json_decref(obj_qr_data);
-        } while (0);
-        json_decref(object);
+        }
+        if (!_PushUpdates.empty()) {
+            *update = _PushUpdates.front();
+            _PushUpdates.pop_front();
+            err = 0;
+        }
+        pthread_mutex_unlock(&_PushLock);
         return err;
     }
 
@@ -692,30 +669,16 @@ class DiaNetwork {
         result = SendRequest(&json_get_qr_request, &answer, url);
 
         if (result == 0 && answer != "") {
-            json_error_t error;
-            json_t *json = json_loads(answer.c_str(), 0, &error);
-
-            if (!json_is_object(json)) {
+            station_answer_t qr;
+            unsigned int found = 0;
+            if (DiaJson_Decode(answer.data(), answer.size(), &qr_answer_schema, &qr, &found) || !found) {
                 printf("GetQr answer %s\n", answer.c_str());
-                json_decref(json);
-                return 1;
-            }
-
-            json_t *qr_data_json = json_object_get(json, "qr_data");
-
-            if (!json_is_string(qr_data_json)) {
-                printf("GetVolume answer %s\n", answer.c_str());
-                json_decref(json);
                 return 1;
             }
-
-            qrData = (std::string)json_string_value(qr_data_json);
-
-            json_decref(json);
-            json_decref(qr_data_json);
+            qrData = qr.qr_data;
             return 0;
         }
-        printf("GetVolume answer %s\n", answer.c_str());
+        printf("GetQr answer %s\n", answer.c_str());
         return 1;
     }
 
@@ -765,41 +728,33 @@ class DiaNetwork {
     int ReceiptRequest(int postPosition, int cash, int electronical) {
         if ((cash + electronical) > 0) {
             ReceiptToSend *incomingReceipt = new ReceiptToSend(postPosition, cash, electronical);
-            receipts_channel->Push(incomingReceipt);
+            if (receipts_channel->Push(incomingReceipt) != CHANNEL_NOERROR) {
+                printf("RECEIPTS CHANNEL OVERFLOW\n");
+                delete incomingReceipt;
+                return 1;
+            }
         }
         return 0;
     }
 
     // Base function for receipt sending to Online Cash Register.
     int SendReceiptRequest(int postPosition, int cash, int electronical) {
-        CURL *curl;
-        CURLcode res;
-
-        curl = curl_easy_init();
-        if (curl == NULL) {
-            return 1;
-        }
-
         std::string reqUrl;
-        reqUrl = "https://" + _OnlineCashRegister + ":8443/";
+        reqUrl = _CashRegisterURL != "" ? _CashRegisterURL : "https://" + _OnlineCashRegister + ":8443/";
         reqUrl += "V2/" + std::to_string(postPosition) + "/" + std::to_string(cash) + "/" + std::to_string(electronical);
 
-        curl_easy_setopt(curl, CURLOPT_URL, reqUrl.c_str());
-        curl_easy_setopt(curl, CURLOPT_USERAGENT, "diae/0.1");
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0);
-        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "POST");
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        DiaNetRequest request;
+        request.Url = reqUrl;
+        request.Route = "/V2";
+        request.Method = DIA_NET_POST;
+        request.Insecure = 1;
 
-        res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
-            printf("%s", curl_easy_strerror(res));
+        DiaNetReactor_Perform(_Reactor, &request);
+        if (request.CurlCode != CURLE_OK) {
+            printf("%s", curl_easy_strerror(request.CurlCode));
             printf("\n");
-            curl_easy_cleanup(curl);
             return SERVER_UNAVAILABLE;
         }
-
-        curl_easy_cleanup(curl);
         return 0;
     }
 
@@ -840,63 +795,21 @@ class DiaNetwork {
             return 1;
         }
 
-        json_t *object;
-        json_error_t error;
-        object = json_loads(answer.c_str(), 0, &error);
-        int err = 0;
-
         printf("Server returned for Get Last Money: \n%s\n", answer.c_str());
-        do {
-            if (!object) {
-                printf("Error in get_last_money_report on line %d: %s\n", error.line, error.text);
-                err = 1;
-                break;
-            }
-
-            if (!json_is_object(object)) {
-                err = 1;
-                break;
-            }
-
-            json_t *obj_var = json_object_get(object, "carsTotal");
-            if (!json_is_integer(obj_var)) {
-                money_report_data->cars_total = 0;
-            } else
-                money_report_data->cars_total = (int)json_integer_value(obj_var);
-
-            obj_var = json_object_get(object, "coins");
-            if (!json_is_integer(obj_var)) {
-                money_report_data->coins_total = 0;
-            } else
-                money_report_data->coins_total = (int)json_integer_value(obj_var);
-
-            obj_var = json_object_get(object, "banknotes");
-            if (!json_is_integer(obj_var)) {
-                money_report_data->banknotes_total = 0;
-            } else
-                money_report_data->banknotes_total = (int)json_integer_value(obj_var);
-
-            obj_var = json_object_get(object, "electronical");
-            if (!json_is_integer(obj_var)) {
-                money_report_data->cashless_total = 0;
-            } else
-                money_report_data->cashless_total = (int)json_integer_value(obj_var);
-
-            obj_var = json_object_get(object, "service");
-            if (!json_is_integer(obj_var)) {
-                money_report_data->service_total = 0;
-            } else
-                money_report_data->service_total = (int)json_integer_value(obj_var);
-            obj_var = json_object_get(object, "bonuses");
-            if (!json_is_integer(obj_var)) {
-                money_report_data->bonuses_total = 0;
-            } else
-                money_report_data->bonuses_total = (int)json_integer_value(obj_var);
-
-            json_decref(obj_var);
-        } while (0);
-        json_decref(object);
-        return err;
+        // Missing totals are zero.
+        money_report_t report = money_report_t();
+        int err = DiaJson_Decode(answer.data(), answer.size(), &money_report_answer_schema, &report, NULL);
+        if (err) {
+            printf("Error in get_last_money_report: %d\n", err);
+            return 1;
+        }
+        money_report_data->cars_total = report.cars_total;
+        money_report_data->coins_total = report.coins_total;
+        money_report_data->banknotes_total = report.banknotes_total;
+        money_report_data->cashless_total = report.cashless_total;
+        money_report_data->service_total = report.service_total;
+        money_report_data->bonuses_total = report.bonuses_total;
+        return 0;
     }
 
     // Sends LOAD request to Central Server and decodes JSON result to relay report.
@@ -917,107 +830,44 @@ class DiaNetwork {
 
         fprintf(stderr, "%s\n", answer.c_str());
 
-        json_t *object;
-        json_error_t error;
-        object = json_loads(answer.c_str(), 0, &error);
-        int err = 0;
-
-        do {
-            if (!object) {
-                printf("Error in get_last_relay_report on line %d: %s\n", error.line, error.text);
-                err = 1;
-                break;
-            }
-
-            if (!json_is_object(object)) {
-                printf("JSON is not an object\n");
-                err = 1;
-                break;
-            }
+        relay_report_message_t report = relay_report_message_t();
+        unsigned int found = 0;
+        int err = DiaJson_Decode(answer.data(), answer.size(), &relay_report_answer_schema, &report, &found);
+        if (err) {
+            printf("Error in get_last_relay_report: %d\n", err);
+            return 1;
+        }
+        if (!found) {
+            return 1;
+        }
 
-            json_t *obj_array;
-            obj_array = json_object_get(object, "relayStats");
-            if (!json_is_array(obj_array)) {
-                err = 1;
-                break;
+        // Relays come in any order, each one is stored by its relayID.
+        for (int i = 0; i < MAX_RELAY_NUM; i++) {
+            int relay_id = report.relays[i].relay_id;
+            if (relay_id == 0) {
+                continue;
             }
-
-            json_t *element = new json_t();
-            json_t *obj_var = new json_t();
-            int i, relay_id, switched_count, total_time_on;
-
-            json_array_foreach(obj_array, i, element) {
-                obj_var = json_object_get(element, "relayID");
-                if (!json_is_integer(obj_var)) {
-                    printf("relayId problem\n");
-                    err = 1;
-                    break;
-                }
-                relay_id = (int)json_integer_value(obj_var);
-
-                obj_var = json_object_get(element, "switchedCount");
-                if (!json_is_integer(obj_var)) {
-                    switched_count = 0;
-                } else
-                    switched_count = (int)json_integer_value(obj_var);
-
-                obj_var = json_object_get(element, "totalTimeOn");
-                if (!json_is_integer(obj_var)) {
-                    total_time_on = 0;
-                } else
-                    total_time_on = (int)json_integer_value(obj_var);
-                relay_report_data->RelayStats[relay_id - 1].switched_count = switched_count;
-                relay_report_data->RelayStats[relay_id - 1].total_time_on = total_time_on;
+            if (relay_id < 1 || relay_id > MAX_RELAY_NUM) {
+                printf("relayId problem\n");
+                return 1;
             }
-            json_decref(element);
-            json_decref(obj_var);
-        } while (0);
-
-        json_decref(object);
-        return err;
-    }
-
-    // Sends SAVE IF NOT EXISTS request to Central Server and decodes JSON result to value string.
-    // Gets key and value strings.
-    std::string SetRegistryValueByKeyIfNotExists(std::string key, std::string value) {
-        std::string answer;
-        std::string result = "";
-
-        // Encode SAVE request to JSON with key string
-        std::string set_registry_value = json_set_registry_value(key, value);
-        printf("JSON:\n%s\n", set_registry_value.c_str());
-
-        // Send request to Central Server
-        std::string url = _Host + _Port + "/save-if-not-exists";
-        int res = SendRequest(&set_registry_value, &answer, url);
-
-        printf("Server answer: \n%s\n", answer.c_str());
-
-        if (res > 0) {
-            printf("No connection to server\n");
+            relay_report_data->RelayStats[relay_id - 1].switched_count = report.relays[i].switched_count;
+            relay_report_data->RelayStats[relay_id - 1].total_time_on = report.relays[i].total_time_on;
         }
-        return result;
+        return 0;
     }
 
     // Sends SAVE request to Central Server and decodes JSON result to value string.
     // Gets key and value strings.
     std::string SetRegistryValueByKey(std::string key, std::string value) {
-        std::string answer;
         std::string result = "";
 
         // Encode SAVE request to JSON with key string
         std::string set_registry_value = json_set_registry_value(key, value);
         printf("JSON:\n%s\n", set_registry_value.c_str());
 
-        // Send request to Central Server
-        std::string url = _Host + _Port + "/save";
-        int res = SendRequest(&set_registry_value, &answer, url);
-
-        printf("Server answer: \n%s\n", answer.c_str());
-
-        if (res > 0) {
-            printf("No connection to server\n");
-        }
+        // Send request to Central Server, the answer is not waited for.
+        SendRequestAsync("/save", set_registry_value, NULL, DiaNetwork::RegistryWriteDone, 1);
         return result;
     }
 
@@ -1033,7 +883,7 @@ class DiaNetwork {
 
         // Send request to Central Server
         std::string url = _Host + _Port + "/load";
-        int res = SendRequest(&get_registry_value, &answer, url);
+        int res = SendRequest(&get_registry_value, &answer, url, 1);
 
         printf("Server answer: %s\n", answer.c_str());
 
@@ -1055,7 +905,7 @@ class DiaNetwork {
 
         // Send request to Central Server
         std::string url = _Host + _Port + "/load-from-station";
-        int res = SendRequest(&get_registry_value_from_station, &answer, url);
+        int res = SendRequest(&get_registry_value_from_station, &answer, url, 1);
 
         printf("Server answer: %s\n", answer.c_str());
 
@@ -1094,14 +944,36 @@ class DiaNetwork {
     int interrupted = 0;
     std::string _PublicKey;
     std::string _OnlineCashRegister;
+    std::string _CashRegisterURL;
     std::string _Host;
     std::string _Port;
 
-    DiaChannel<NetworkMessage> channel;
+    DiaCurlPool *_CurlPool;
+    DiaNetReactor *_Reactor;
+    DiaJournal *_Journal;
+    struct curl_slist *_JsonHeaders = JsonHeaders();
+    struct curl_slist *_GzipJsonHeaders = curl_slist_append(JsonHeaders(), "Content-Encoding: gzip");
+
+    // Report thread only. Route -> time the batch route is tried again,
+    // routes which are not in the map are sent in batches.
+    std::map<std::string, time_t> _BatchNextProbe;
+    // Cleared if the server does not accept gzip bodies.
+    int _BatchGzip = 1;
+
+    DiaChannel<NetworkMessage> channel{CHANNEL_SIZE, CHANNEL_REJECT_NEW};
     pthread_t entry_processing_thread;
     pthread_t receipts_processing_thread;
     pthread_mutex_t nfct_entries_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+    pthread_mutex_t _PushLock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t _PushCond;
+    int _PushState = PUSH_OFF;
+    int _PushInFlight = 0;
+    time_t _PushNextTry = 0;
+    int _PushBalance = 0;
+    int _PushProgram = 0;
+    std::list<server_update_t> _PushUpdates;
+
     // Thread, which tries to send reports to Central Server.
     static void *process_extract(void *arg) {
         DiaNetwork *Dia = (DiaNetwork *)arg;
@@ -1134,11 +1006,10 @@ class DiaNetwork {
 
     int PopAndSendReceipt() {
         ReceiptToSend *extractedReceipt;
-        int err = receipts_channel->Peek(&extractedReceipt);
+        int err = receipts_channel->Peek(&extractedReceipt, CHANNEL_IDLE_WAIT_MS);
 
         if (err) {
-            // CHANNEL_BUFFER_EMPTY IS THE ONLY ERR
-            sleep(1);
+            // Empty or closed.
             return 0;
         }
 
@@ -1156,21 +1027,119 @@ class DiaNetwork {
 
     // Interrupt the report processing thread.
     int StopTheWorld() {
+        pthread_mutex_lock(&_PushLock);
         interrupted = 1;
+        pthread_cond_broadcast(&_PushCond);
+        pthread_mutex_unlock(&_PushLock);
+        channel.Close();
+        receipts_channel->Close();
         return 0;
     }
 
+    // Decodes PING answer or pushed update. Fields missing in the answer get
+    // zero values, so the server must always send the whole state.
+    int ParseServerUpdate(const std::string &answer, server_update_t *update, const char *source) {
+        // qr_data is kept if the server does not send it.
+        std::string qrData;
+        qrData.swap(update->qr_data);
+        *update = server_update_t();
+        update->qr_data.swap(qrData);
+
+        int err = DiaJson_Decode(answer.data(), answer.size(), &server_update_schema, update, NULL);
+        if (err == DIA_JSON_PARSE_ERROR) {
+            printf("Error in %s: %s\n", source, answer.c_str());
+            return 1;
+        }
+        if (err == DIA_JSON_NOT_OBJECT) {
+            printf("Not a JSON\n");
+        }
+        return 0;
+    }
+
+    // Called on the network thread when /subscribe is answered.
+    // A successful answer is queued for the pinging thread and the next
+    // subscription is sent right away.
+    static void SubscribeDone(void *arg, DiaNetRequest *request) {
+        DiaNetwork *Dia = (DiaNetwork *)arg;
+        server_update_t update;
+        int resubscribe = 0;
+
+        int err = request->Failed() || Dia->ParseServerUpdate(request->Answer, &update, "SUBSCRIBE");
+
+        pthread_mutex_lock(&Dia->_PushLock);
+        Dia->_PushInFlight = 0;
+        if (!err) {
+            if (Dia->_PushState != PUSH_ACTIVE) {
+                printf("Server push is active\n");
+            }
+            Dia->_PushState = PUSH_ACTIVE;
+            Dia->_PushUpdates.push_back(update);
+            resubscribe = !Dia->interrupted;
+            Dia->_PushInFlight = resubscribe;
+        } else if (request->HttpCode == 404 || request->HttpCode == 405 || request->HttpCode == 501) {
+            if (Dia->_PushState != PUSH_UNSUPPORTED) {
+                printf("Server does not support push, polling\n");
+            }
+            Dia->_PushState = PUSH_UNSUPPORTED;
+            Dia->_PushNextTry = time(NULL) + PUSH_PROBE_SEC;
+        } else {
+            if (Dia->_PushState == PUSH_ACTIVE && !Dia->interrupted) {
+                printf("Server push failed: curl %d, http %ld, polling\n", request->CurlCode, request->HttpCode);
+            }
+            Dia->_PushState = PUSH_OFF;
+            Dia->_PushNextTry = time(NULL) + PUSH_RETRY_SEC;
+        }
+        pthread_cond_broadcast(&Dia->_PushCond);
+        pthread_mutex_unlock(&Dia->_PushLock);
+
+        if (resubscribe) {
+            Dia->Subscribe();
+        }
+    }
+
+    void Subscribe() {
+        pthread_mutex_lock(&_PushLock);
+        int balance = _PushBalance;
+        int program = _PushProgram;
+        pthread_mutex_unlock(&_PushLock);
+
+        std::string json_subscribe_request = json_create_ping_report(balance, program);
+        if (SendRequestAsync("/subscribe", json_subscribe_request, this, DiaNetwork::SubscribeDone) != DIA_NET_NO_ERROR) {
+            // SubscribeDone is not called then.
+            pthread_mutex_lock(&_PushLock);
+            _PushInFlight = 0;
+            pthread_cond_broadcast(&_PushCond);
+            pthread_mutex_unlock(&_PushLock);
+        }
+    }
+
     // Pop message from channel (queue) and send it to the Central Server.
+    // Several queued reports of the same route are sent in one batch request.
     int PopAndSend() {
-        NetworkMessage *message;
-        int err = channel.Peek(&message);
+        NetworkMessage *messages[BATCH_MAX_ENTRIES];
+        int count = channel.PeekSome(messages, BATCH_MAX_ENTRIES, CHANNEL_IDLE_WAIT_MS);
 
-        if (err) {
-            // CHANNEL_BUFFER_EMPTY IS THE ONLY ERR
-            sleep(1);
+        if (count == 0) {
+            // Empty or closed.
             return 0;
         }
 
+        // Entries acknowledged by an earlier batch, while an entry before
+        // them was not.
+        if (messages[0]->resolved) {
+            channel.DropOne();
+            return 0;
+        }
+
+        int batch = 1;
+        while (batch < count && !messages[batch]->resolved && messages[batch]->route == messages[0]->route) {
+            batch++;
+        }
+        if (batch > 1 && BatchAllowed(messages[0]->route)) {
+            return SendBatch(messages, batch);
+        }
+
+        NetworkMessage *message = messages[0];
         std::string answer;
         std::string url = _Host + _Port + message->route;
 
@@ -1180,12 +1149,133 @@ class DiaNetwork {
             printf("No connection to server\n");
             return SERVER_UNAVAILABLE;
         } else {
+            DiaJournal_Ack(_Journal, message->entry_id);
             channel.DropOne();
         }
 
         return 0;
     }
 
+    int BatchAllowed(const std::string &route) {
+        std::map<std::string, time_t>::iterator it = _BatchNextProbe.find(route);
+        if (it == _BatchNextProbe.end()) {
+            return 1;
+        }
+        if (time(NULL) < it->second) {
+            return 0;
+        }
+        _BatchNextProbe.erase(it);
+        return 1;
+    }
+
+    // Sends count entries of one route in one request. Acknowledged entries
+    // are marked resolved and dropped once they reach the front of the channel.
+    int SendBatch(NetworkMessage **messages, int count) {
+        std::string route = messages[0]->route;
+
+        hash_message_t hash = {_PublicKey.c_str()};
+        std::string body;
+        DiaJson_Encode(&body, &hash_message_schema, &hash);
+        body.erase(body.size() - 1);
+        body += ",\"Entries\":[";
+        for (int i = 0; i < count; i++) {
+            if (i > 0) {
+                body += ',';
+            }
+            body += messages[i]->json_request;
+        }
+        body += "]}";
+
+        DiaNetRequest request;
+        PrepareJsonRequest(&request, body, _Host + _Port + route + BATCH_ROUTE_SUFFIX);
+        if (_BatchGzip && GzipBody(body, &request.Body) == 0) {
+            request.Headers = _GzipJsonHeaders;
+        }
+        DiaNetReactor_Perform(_Reactor, &request);
+
+        long code = request.HttpCode;
+        if (request.CurlCode == CURLE_OK && (code == 404 || code == 405 || code == 501)) {
+            printf("Server does not support %s%s, sending one by one\n", route.c_str(), BATCH_ROUTE_SUFFIX);
+            _BatchNextProbe[route] = time(NULL) + BATCH_PROBE_SEC;
+            return 0;
+        }
+        if (request.CurlCode == CURLE_OK && code == 415 && request.Headers == _GzipJsonHeaders) {
+            printf("Server does not accept gzip, sending batches uncompressed\n");
+            _BatchGzip = 0;
+            return 0;
+        }
+        if (request.Failed()) {
+            printf("Batch of %d failed: curl %d, http %ld\n", count, request.CurlCode, code);
+            return SERVER_UNAVAILABLE;
+        }
+
+        batch_answer_t answer = batch_answer_t();
+        if (DiaJson_Decode(request.Answer.data(), request.Answer.size(), &batch_answer_schema, &answer, NULL)) {
+            printf("Wrong batch answer: %s\n", request.Answer.c_str());
+            return SERVER_UNAVAILABLE;
+        }
+
+        int acked = 0;
+        for (int i = 0; i < count; i++) {
+            if (answer.acked[i] == 1) {
+                DiaJournal_Ack(_Journal, messages[i]->entry_id);
+                messages[i]->resolved = 1;
+                acked++;
+            }
+        }
+        printf("Batch of %d %s: %d acknowledged, %zu -> %zu bytes\n", count, route.c_str(), acked, body.size(), request.Body.size());
+
+        for (int i = 0; i < count && messages[i]->resolved; i++) {
+            channel.DropOne();
+        }
+        return acked ? 0 : SERVER_UNAVAILABLE;
+    }
+
+    // gzip framing, so the server can take it with Content-Encoding: gzip.
+    static int GzipBody(const std::string &body, std::string *out) {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return 1;
+        }
+        out->resize(deflateBound(&stream, body.size()) + 32);
+        stream.next_in = (Bytef *)body.data();
+        stream.avail_in = body.size();
+        stream.next_out = (Bytef *)&(*out)[0];
+        stream.avail_out = out->size();
+        int err = deflate(&stream, Z_FINISH);
+        out->resize(stream.total_out);
+        deflateEnd(&stream);
+        if (err != Z_STREAM_END) {
+            *out = body;
+            return 1;
+        }
+        return 0;
+    }
+
+    static void RegistryWriteDone(void *arg, DiaNetRequest *request) {
+        if (request->Failed()) {
+            printf("Registry write %s failed: curl %d, http %ld\n", request->Route.c_str(), request->CurlCode, request->HttpCode);
+        }
+    }
+
+    // Puts an entry which was not sent before reboot back to the channel.
+    static void RestoreEntry(void *arg, uint64_t id, std::string route, std::string body) {
+        DiaNetwork *Dia = (DiaNetwork *)arg;
+        NetworkMessage *entry = new NetworkMessage();
+
+        entry->stime = time(NULL);
+        entry->entry_id = id;
+        entry->json_request = body;
+        entry->route = route;
+
+        printf("Restored unsent entry %llu %s\n", (unsigned long long)id, route.c_str());
+        if (Dia->channel.Push(entry) != CHANNEL_NOERROR) {
+            printf("CHANNEL BUFFER OVERFLOW, entry %llu waits for the next boot\n", (unsigned long long)id);
+            delete entry;
+        }
+    }
+
     // Add new message (report) to the channel. Thread will pop it in the future.
     int CreateAndPushEntry(std::string json_string, std::string route) {
         NetworkMessage *entry = new NetworkMessage();
@@ -1196,85 +1286,58 @@ class DiaNetwork {
         entry->stime = time(NULL);
         entry->json_request = json_string;
         entry->route = route;
+        // The journal only queues the record for its writer thread,
+        // so the money path does not wait for the disk.
+        entry->entry_id = DiaJournal_Append(_Journal, route, json_string);
 
-        if (channel.Push(entry) == CHANNEL_BUFFER_OVERFLOW) {
+        if (channel.Push(entry) != CHANNEL_NOERROR) {
+            // Still in the journal, it is sent after the next boot.
             printf("CHANNEL BUFFER OVERFLOW\n");
+            delete entry;
             return 1;
         } else {
             return 0;
         }
     }
 
+    // Encodes the message into one buffer, which fits every message we send
+    // without growing.
+    static std::string EncodeMessage(const dia_json_schema_t *schema, const void *message) {
+        std::string res;
+        res.reserve(JSON_MESSAGE_RESERVE);
+        DiaJson_Encode(&res, schema, message);
+        return res;
+    }
+
     // Encodes _PublicKey to JSON string.
     std::string json_create_ping_report(int balance, int program) {
-        json_t *object = json_object();
-
-        json_object_set_new(object, "Hash", json_string(_PublicKey.c_str()));
-        json_object_set_new(object, "CurrentBalance", json_integer(balance));
-        json_object_set_new(object, "CurrentProgram", json_integer(program));
-        char *str = json_dumps(object, 0);
-        std::string res = str;
-
-        free(str);
-        str = 0;
-        json_decref(object);
-        return res;
+        ping_message_t message = {_PublicKey.c_str(), balance, program};
+        return EncodeMessage(&ping_message_schema, &message);
     }
 
     std::string json_create_card_reader_config() {
-        json_t *object = json_object();
-
-        json_object_set_new(object, "Hash", json_string(_PublicKey.c_str()));
-        char *str = json_dumps(object, 0);
-        std::string res = str;
-
-        free(str);
-        str = 0;
-        json_decref(object);
-        return res;
+        hash_message_t message = {_PublicKey.c_str()};
+        return EncodeMessage(&hash_message_schema, &message);
     }
 
     std::string json_create_run_program(int programID, int preflight) {
-        json_t *object = json_object();
-
-        json_object_set_new(object, "hash", json_string(_PublicKey.c_str()));
-        json_object_set_new(object, "programID", json_integer(programID));
-        json_object_set_new(object, "preflight", json_boolean(preflight));
-        char *str = json_dumps(object, 0);
-        std::string res = str;
-
-        free(str);
-        str = 0;
-        json_decref(object);
-        return res;
+        station_message_t message = station_message_t();
+        message.hash = _PublicKey.c_str();
+        message.program_id = programID;
+        message.preflight = preflight;
+        return EncodeMessage(&run_program_message_schema, &message);
     }
 
     std::string json_create_get_volue() {
-        json_t *object = json_object();
-
-        json_object_set_new(object, "hash", json_string(_PublicKey.c_str()));
-        char *str = json_dumps(object, 0);
-        std::string res = str;
-
-        free(str);
-        str = 0;
-        json_decref(object);
-        return res;
+        hash_message_t message = {_PublicKey.c_str()};
+        return EncodeMessage(&hash_lower_message_schema, &message);
     }
 
     std::string json_create_end_session(std::string sessionID) {
-        json_t *object = json_object();
-
-        json_object_set_new(object, "hash", json_string(_PublicKey.c_str()));
-        json_object_set_new(object, "sessionID", json_string(sessionID.c_str()));
-
-        char *str = json_dumps(object, 0);
-        std::string res = str;
-
-        free(str);
-        str = 0;
-        json_decref(object);
-        return res;
+        station_message_t message = station_message_t();
+        message.hash = _PublicKey.c_str();
+        message.session_id = sessionID.c_str();
+        return EncodeMessage(&end_session_message_schema, &message);
     }
 
     std::string json_create_get_qr() {
@@ -1282,237 +1345,131 @@ class DiaNetwork {
     }
 
     std::string json_create_stop_dispenser(int stopProgramID) {
-        json_t *object = json_object();
-
-        json_object_set_new(object, "hash", json_string(_PublicKey.c_str()));
-        json_object_set_new(object, "stopProgramID", json_integer(stopProgramID));
-
-        char *str = json_dumps(object, 0);
-        std::string res = str;
-        free(str);
-        str = 0;
-        json_decref(object);
-        return res;
+        station_message_t message = station_message_t();
+        message.hash = _PublicKey.c_str();
+        message.stop_program_id = stopProgramID;
+        return EncodeMessage(&stop_dispenser_message_schema, &message);
     }
 
     std::string json_create_set_bonuses(int bonuses) {
-        json_t *object = json_object();
-
-        json_object_set_new(object, "hash", json_string(_PublicKey.c_str()));
-        json_object_set_new(object, "bonuses", json_integer(bonuses));
-
-        char *str = json_dumps(object, 0);
-        std::string res = str;
-        free(str);
-        str = 0;
-        json_decref(object);
-        return res;
+        station_message_t message = station_message_t();
+        message.hash = _PublicKey.c_str();
+        message.bonuses = bonuses;
+        return EncodeMessage(&set_bonuses_message_schema, &message);
     }
 
     std::string json_create_start_fluid_flow_sensor(int volume, int startProgramID, int stopProgramID) {
-        json_t *object = json_object();
-
-        json_object_set_new(object, "hash", json_string(_PublicKey.c_str()));
-        json_object_set_new(object, "volume", json_integer(volume));
-        json_object_set_new(object, "startProgramID", json_integer(startProgramID));
-        json_object_set_new(object, "stopProgramID", json_integer(stopProgramID));
-        char *str = json_dumps(object, 0);
-        std::string res = str;
-
-        free(str);
-        str = 0;
-        json_decref(object);
-        return res;
+        station_message_t message = station_message_t();
+        message.hash = _PublicKey.c_str();
+        message.volume = volume;
+        message.start_program_id = startProgramID;
+        message.stop_program_id = stopProgramID;
+        return EncodeMessage(&run_dispenser_message_schema, &message);
     }
 
     // Encodes money report struct to JSON string.
     std::string json_create_money_report(struct money_report *s) {
-        json_t *object = json_object();
-
-        json_object_set_new(object, "Hash", json_string(_PublicKey.c_str()));
-        json_object_set_new(object, "Banknotes", json_integer(s->banknotes_total));
-        json_object_set_new(object, "CarsTotal", json_integer(s->cars_total));
-        json_object_set_new(object, "Coins", json_integer(s->coins_total));
-        json_object_set_new(object, "Electronical", json_integer(s->cashless_total));
-        json_object_set_new(object, "Service", json_integer(s->service_total));
-        json_object_set_new(object, "Bonuses", json_integer(s->bonuses_total));
-        json_object_set_new(object, "SessionId", json_string(s->session_id.c_str()));
-
-        char *str = json_dumps(object, 0);
-        std::string res = str;
-        free(str);
-        str = 0;
-        json_decref(object);
-        return res;
+        money_report_message_t message;
+        message.hash = _PublicKey.c_str();
+        message.report = *s;
+        return EncodeMessage(&money_report_message_schema, &message);
     }
 
     // Encodes relay report struct to JSON string.
     std::string json_create_relay_report(struct relay_report *s) {
-        json_t *object = json_object();
-        json_t *relayarr = json_array();
-        json_t *relayobj[MAX_RELAY_NUM];
-
-        json_object_set_new(object, "Hash", json_string(_PublicKey.c_str()));
-
+        relay_report_message_t message;
+        message.hash = _PublicKey.c_str();
         for (int i = 0; i < MAX_RELAY_NUM; i++) {
-            relayobj[i] = json_object();
-            json_object_set_new(relayobj[i], "RelayID", json_integer(i + 1));
-            json_object_set_new(relayobj[i], "SwitchedCount", json_integer(s->RelayStats[i].switched_count));
-            json_object_set_new(relayobj[i], "TotalTimeOn", json_integer(s->RelayStats[i].total_time_on));
-            json_array_append_new(relayarr, relayobj[i]);
-        }
-
-        json_object_set_new(object, "RelayStats", relayarr);
-        char *str = json_dumps(object, 0);
-        std::string res = str;
-        free(str);
-        str = 0;
-        json_decref(object);
-        return res;
+            message.relays[i].relay_id = i + 1;
+            message.relays[i].switched_count = s->RelayStats[i].switched_count;
+            message.relays[i].total_time_on = s->RelayStats[i].total_time_on;
+        }
+        return EncodeMessage(&relay_report_message_schema, &message);
     }
 
     // Encodes key and value to JSON string.
     std::string json_set_registry_value(std::string key, std::string value) {
-        json_t *object = json_object();
-        json_t *keypair = json_object();
-
-        json_object_set_new(object, "Hash", json_string(_PublicKey.c_str()));
-        json_object_set_new(keypair, "Key", json_string(key.c_str()));
-        json_object_set_new(keypair, "Value", json_string(value.c_str()));
-        json_object_set_new(object, "KeyPair", keypair);
-
-        char *str = json_dumps(object, 0);
-        std::string res = str;
-
-        free(str);
-        str = 0;
-        json_decref(object);
-        return res;
+        registry_message_t message = registry_message_t();
+        message.hash = _PublicKey.c_str();
+        message.key_pair.key = key.c_str();
+        message.key_pair.value = value.c_str();
+        return EncodeMessage(&set_registry_message_schema, &message);
     }
 
     // Encodes key to JSON string.
     std::string json_get_registry_value(std::string key) {
-        json_t *object = json_object();
-
-        json_object_set_new(object, "Hash", json_string(_PublicKey.c_str()));
-        json_object_set_new(object, "Key", json_string(key.c_str()));
-
-        char *str = json_dumps(object, 0);
-        std::string res = str;
-
-        free(str);
-        str = 0;
-        json_decref(object);
-        return res;
+        registry_message_t message = registry_message_t();
+        message.hash = _PublicKey.c_str();
+        message.key = key.c_str();
+        return EncodeMessage(&get_registry_message_schema, &message);
     }
 
     std::string json_get_registry_value_from_station(int stationID, std::string key) {
-        json_t *object = json_object();
-
-        json_object_set_new(object, "Hash", json_string(_PublicKey.c_str()));
-        json_object_set_new(object, "StationID", json_integer(stationID));
-        json_object_set_new(object, "Key", json_string(key.c_str()));
-
-        char *str = json_dumps(object, 0);
-        std::string res = str;
-
-        free(str);
-        str = 0;
-        json_decref(object);
-        return res;
+        registry_message_t message = registry_message_t();
+        message.hash = _PublicKey.c_str();
+        message.station_id = stationID;
+        message.key = key.c_str();
+        return EncodeMessage(&get_station_registry_message_schema, &message);
     }
 
     // Encode PublicKey to JSON string.
     std::string json_get_public_key() {
-        json_t *object = json_object();
-
-        json_object_set_new(object, "Hash", json_string(_PublicKey.c_str()));
-
-        char *str = json_dumps(object, 0);
-        std::string res = str;
-
-        free(str);
-        str = 0;
-        json_decref(object);
-        return res;
+        hash_message_t message = {_PublicKey.c_str()};
+        return EncodeMessage(&hash_message_schema, &message);
     }
 
     // Encodes empty money report to JSON string.
     std::string json_get_last_money_report() {
-        json_t *object = json_object();
-
-        json_object_set_new(object, "Hash", json_string(_PublicKey.c_str()));
-        json_object_set_new(object, "Banknotes", json_integer(1));
-        json_object_set_new(object, "CarsTotal", json_integer(1));
-        json_object_set_new(object, "Coins", json_integer(1));
-        json_object_set_new(object, "Electronical", json_integer(1));
-        json_object_set_new(object, "Service", json_integer(1));
-
-        char *str = json_dumps(object, 0);
-        std::string res = str;
-        free(str);
-        str = 0;
-        json_decref(object);
-        return res;
+        money_report_message_t message;
+        message.hash = _PublicKey.c_str();
+        message.report.banknotes_total = 1;
+        message.report.cars_total = 1;
+        message.report.coins_total = 1;
+        message.report.cashless_total = 1;
+        message.report.service_total = 1;
+        return EncodeMessage(&load_money_message_schema, &message);
     }
 
     // Encodes empty relay report to JSON string.
     std::string json_get_last_relay_report() {
-        json_t *object = json_object();
-        json_t *relayarr = json_array();
-        json_t *relayobj[MAX_RELAY_NUM];
-
-        json_object_set_new(object, "Hash", json_string(_PublicKey.c_str()));
-
+        relay_report_message_t message;
+        message.hash = _PublicKey.c_str();
         for (int i = 0; i < MAX_RELAY_NUM; i++) {
-            relayobj[i] = json_object();
-            json_object_set_new(relayobj[i], "RelayID", json_integer(1));
-            json_object_set_new(relayobj[i], "SwitchedCount", json_integer(1));
-            json_object_set_new(relayobj[i], "TotalTimeOn", json_integer(1));
-            json_array_append_new(relayarr, relayobj[i]);
-        }
-
-        json_object_set_new(object, "RelayStats", relayarr);
-        char *str = json_dumps(object, 0);
-        std::string res = str;
-        free(str);
-        str = 0;
-        json_decref(object);
-        return res;
+            message.relays[i].relay_id = 1;
+            message.relays[i].switched_count = 1;
+            message.relays[i].total_time_on = 1;
+        }
+        return EncodeMessage(&relay_report_message_schema, &message);
     }
 
     std::string json_get_station_discounts() {
-        json_t *object = json_object();
-
-        json_object_set_new(object, "Hash", json_string(_PublicKey.c_str()));
-
-        char *str = json_dumps(object, 0);
-        std::string res = str;
-        free(str);
-        str = 0;
-        json_decref(object);
-        return res;
+        hash_message_t message = {_PublicKey.c_str()};
+        return EncodeMessage(&hash_message_schema, &message);
     }
-    static size_t _Writefunc(void *ptr, size_t size, size_t nmemb, curl_answer_t *answer) {
-        assert(answer);
-        size_t new_len = answer->length + size * nmemb;
-        answer->data = (char *)realloc(answer->data, new_len + 1);
-        assert(answer->data);
-        memcpy(answer->data + answer->length, ptr, size * nmemb);
-        answer->data[new_len] = '\0';
-        answer->length = new_len;
 
-        return size * nmemb;
+    // Path of the URL without host and port, e.g. "/ping".
+    static std::string RouteOf(const std::string &url) {
+        size_t start = url.find("://");
+        start = (start == std::string::npos) ? 0 : start + 3;
+        size_t path = url.find('/', start);
+        return path == std::string::npos ? "/" : url.substr(path);
     }
 
-    void InitCurlAnswer(curl_answer_t *raw_answer) {
-        raw_answer->data = (char *)malloc(1);
-        raw_answer->length = 0;
-        raw_answer->data[0] = 0;
+    void PrepareJsonRequest(DiaNetRequest *request, const std::string &body, const std::string &url) {
+        request->Url = url;
+        request->Route = RouteOf(url);
+        request->Method = DIA_NET_POST;
+        request->Body = body;
+        request->Headers = _JsonHeaders;
     }
 
-    void DestructCurlAnswer(curl_answer_t *raw_answer) {
-        free(raw_answer->data);
+    // Headers of every JSON request, created once and shared by all requests.
+    static struct curl_slist *JsonHeaders() {
+        struct curl_slist *headers = NULL;
+        headers = curl_slist_append(headers, "Accept: application/json");
+        headers = curl_slist_append(headers, "Content-Type: application/json");
+        headers = curl_slist_append(headers, "charsets: utf-8");
+        return headers;
     }
 };
 
@@ -0,0 +1,234 @@
+// Drives DiaNetwork against the local mock Central Server.
+// Usage: ./network_bench.exe [-t seconds] [-r money reports per sec] [-l latency ms] [-j jitter ms]
+//                            [-e error percent] [-o outage period sec] [-d outage sec]
+//                            [-s service money period sec] [-P] [-B]
+// Prints request rate, depth of the report and receipt queues and
+// end-to-end delivery latency of money reports once a second and in total.
+// Service money is added on the server every few seconds to measure how long
+// it takes to reach the post, -P turns server push off to compare with polling.
+// -B turns batch routes off to compare how fast the queue drains after outages.
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "dia_mock_server.h"
+#include "dia_network.h"
+
+// After the load stops the bench waits this long for the queues to drain.
+#define BENCH_DRAIN_SEC 60
+#define BENCH_PING_MS 1000
+
+typedef struct bench_state {
+    pthread_mutex_t Lock;
+    // SessionId -> time the report was queued.
+    std::map<std::string, uint64_t> Sent;
+    std::vector<uint64_t> Latency;
+    uint64_t Duplicates;
+    // Time service money was added on the server, 0 if it was received.
+    uint64_t ServiceAdded;
+    std::vector<uint64_t> ServiceLatency;
+} bench_state_t;
+
+static uint64_t NowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void OnMoneyDelivered(void *arg, std::string sessionId) {
+    bench_state_t *state = (bench_state_t *)arg;
+    uint64_t now = NowUs();
+    pthread_mutex_lock(&state->Lock);
+    std::map<std::string, uint64_t>::iterator it = state->Sent.find(sessionId);
+    if (it != state->Sent.end()) {
+        state->Latency.push_back(now - it->second);
+        state->Sent.erase(it);
+    } else {
+        // The answer was lost and the report was sent once more.
+        state->Duplicates++;
+    }
+    pthread_mutex_unlock(&state->Lock);
+}
+
+// Called with every PING answer and pushed update.
+static void OnServerUpdate(bench_state_t *state, server_update_t *update) {
+    if (update->service_money > 0 && state->ServiceAdded) {
+        state->ServiceLatency.push_back(NowUs() - state->ServiceAdded);
+        state->ServiceAdded = 0;
+    }
+}
+
+static void PrintLatency(const char *title, const char *unit, std::vector<uint64_t> latency) {
+    if (latency.empty()) {
+        printf("%s: no %s delivered\n", title, unit);
+        return;
+    }
+    std::sort(latency.begin(), latency.end());
+    size_t n = latency.size();
+    printf("%s: %d %s, p50 %.1f ms, p99 %.1f ms, max %.1f ms\n", title, (int)n, unit,
+           latency[n / 2] / 1000.0, latency[n * 99 / 100] / 1000.0, latency[n - 1] / 1000.0);
+}
+
+int main(int argc, char **argv) {
+    int seconds = 30;
+    int rate = 5;
+    int servicePeriod = 5;
+    DiaMockServer *server = new DiaMockServer();
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:r:l:j:e:o:d:s:PB")) != -1) {
+        switch (opt) {
+            case 't': seconds = atoi(optarg); break;
+            case 'r': rate = atoi(optarg); break;
+            case 'l': server->Config.latency_ms = atoi(optarg); break;
+            case 'j': server->Config.jitter_ms = atoi(optarg); break;
+            case 'e': server->Config.error_percent = atoi(optarg); break;
+            case 'o': server->Config.outage_period_sec = atoi(optarg); break;
+            case 'd': server->Config.outage_sec = atoi(optarg); break;
+            case 's': servicePeriod = atoi(optarg); break;
+            case 'P': server->Config.push = 0; break;
+            case 'B': server->Config.batch = 0; break;
+            default:
+                printf("usage: %s [-t seconds] [-r reports per sec] [-l latency ms] [-j jitter ms] "
+                       "[-e error percent] [-o outage period sec] [-d outage sec] "
+                       "[-s service money period sec] [-P] [-B]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (rate < 1) {
+        rate = 1;
+    }
+    if (servicePeriod < 1) {
+        servicePeriod = 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    bench_state_t *state = new bench_state_t();
+    pthread_mutex_init(&state->Lock, 0);
+    state->Duplicates = 0;
+    state->ServiceAdded = 0;
+    server->MoneyArg = state;
+    server->MoneyHandler = OnMoneyDelivered;
+    if (DiaMockServer_Start(server) != DIA_MOCK_NO_ERROR) {
+        return 1;
+    }
+
+    // Reports left by a previous run must not be replayed.
+    unlink(NETWORK_JOURNAL_PATH);
+    DiaNetwork *network = new DiaNetwork();
+    network->SetHostAddress("127.0.0.1");
+    network->SetCashRegisterURL("http://127.0.0.1:" + std::to_string(server->Config.receipts_port) + "/");
+    network->SetPublicKey("BENCH0000000000000000");
+
+    uint64_t start = NowUs();
+    uint64_t nextReport = start;
+    uint64_t nextPing = start;
+    // Off the PING schedule, so polling is not measured at its best case.
+    uint64_t nextService = start + (uint64_t)servicePeriod * 1000000 + BENCH_PING_MS * 1000 / 2;
+    int serviceAdded = 0;
+    uint64_t nextPrint = start + 1000000;
+    uint64_t end = start + (uint64_t)seconds * 1000000;
+    uint64_t drainEnd = end + BENCH_DRAIN_SEC * 1000000ULL;
+    int queued = 0;
+    dia_mock_stat_t last = dia_mock_stat_t();
+
+    printf("  sec   req/s  reports  receipts  delivered\n");
+    for (;;) {
+        uint64_t now = NowUs();
+        int reports, receipts;
+        network->GetQueueDepth(&reports, &receipts);
+        if (now >= end && ((reports == 0 && receipts == 0) || now >= drainEnd)) {
+            break;
+        }
+
+        if (now < end && now >= nextReport) {
+            std::string sessionId = "bench-" + std::to_string(queued++);
+            pthread_mutex_lock(&state->Lock);
+            state->Sent[sessionId] = NowUs();
+            pthread_mutex_unlock(&state->Lock);
+            network->SendMoneyReport(0, 10, 0, 0, 0, 0, sessionId);
+            network->ReceiptRequest(1, 10, 0);
+            nextReport += 1000000 / rate;
+        }
+
+        // The next money is added only after the previous one arrived.
+        if (now < end && now >= nextService && !state->ServiceAdded) {
+            state->ServiceAdded = NowUs();
+            DiaMockServer_AddServiceMoney(server, 10);
+            serviceAdded++;
+            nextService += (uint64_t)servicePeriod * 1000000;
+        }
+
+        // The pinging thread of the firmware does the same in the meantime.
+        network->PushTick(0, 0);
+        if (now >= nextPing) {
+            server_update_t update;
+            if (!network->SendPingRequest(&update, 0, 0)) {
+                OnServerUpdate(state, &update);
+            }
+            int pingMs = network->PushIsActive() ? PUSH_HEARTBEAT_SEC * 1000 : BENCH_PING_MS;
+            nextPing = NowUs() + pingMs * 1000;
+        }
+
+        if (now >= nextPrint) {
+            dia_mock_stat_t stat;
+            DiaMockServer_GetStat(server, &stat);
+            printf("%5d %7llu %8d %9d %10llu\n", (int)((now - start) / 1000000),
+                   (unsigned long long)(stat.requests - last.requests), reports, receipts,
+                   (unsigned long long)stat.money_reports);
+            last = stat;
+            nextPrint += 1000000;
+        }
+
+        uint64_t wake = std::min(std::min(nextReport, nextPing), nextPrint);
+        now = NowUs();
+        if (wake > now) {
+            uint64_t sleepUs = std::min(wake - now, (uint64_t)100000);
+            server_update_t update;
+            if (!network->WaitServerUpdate(&update, sleepUs / 1000)) {
+                OnServerUpdate(state, &update);
+            } else if (!network->PushIsActive()) {
+                usleep(sleepUs);
+            }
+        }
+    }
+    uint64_t finished = NowUs();
+
+    dia_mock_stat_t stat;
+    DiaMockServer_GetStat(server, &stat);
+    curl_pool_stat_t curlStat;
+    network->GetRequestStat(&curlStat);
+    int reports, receipts;
+    network->GetQueueDepth(&reports, &receipts);
+
+    printf("\n");
+    printf("requests:        %llu in %.1f sec, %.1f req/s\n", (unsigned long long)stat.requests,
+           (finished - start) / 1e6, stat.requests * 1e6 / (finished - start));
+    printf("injected:        %llu errors, %llu refused, %llu outages\n", (unsigned long long)stat.injected_errors,
+           (unsigned long long)stat.refused, (unsigned long long)stat.outages);
+    printf("money reports:   %d queued, %llu delivered, %llu duplicates, %d left\n", queued,
+           (unsigned long long)stat.money_reports, (unsigned long long)state->Duplicates, reports);
+    printf("batches:         %llu\n", (unsigned long long)stat.batches);
+    printf("receipts:        %d queued, %llu delivered, %d left\n", queued, (unsigned long long)stat.receipts, receipts);
+    pthread_mutex_lock(&state->Lock);
+    PrintLatency("delivery", "reports", state->Latency);
+    printf("service money:   %d added, %d received, %llu pushes\n", serviceAdded,
+           (int)state->ServiceLatency.size(), (unsigned long long)stat.pushes);
+    PrintLatency("service money", "updates", state->ServiceLatency);
+    pthread_mutex_unlock(&state->Lock);
+    network->PrintRequestStat();
+
+    delete network;
+    DiaMockServer_Stop(server);
+    delete server;
+    unlink(NETWORK_JOURNAL_PATH);
+    return 0;
+}
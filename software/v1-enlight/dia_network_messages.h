@@ -0,0 +1,284 @@
+#ifndef DIA_NETWORK_MESSAGES_H
+#define DIA_NETWORK_MESSAGES_H
+
+#include <string>
+
+#include "dia_json.h"
+
+#define MAX_RELAY_NUM 6
+
+// Every request body fits in this, so encoding does not grow the buffer.
+#define JSON_MESSAGE_RESERVE 512
+// Queued reports sent in one batch request at most.
+#define BATCH_MAX_ENTRIES 32
+
+typedef struct money_report {
+    int cars_total;
+    int coins_total;
+    int banknotes_total;
+    int cashless_total;
+    int service_total;
+    int bonuses_total;
+    std::string session_id;
+} money_report_t;
+
+// Station state sent by the server in PING answers and pushed updates.
+typedef struct server_update {
+    int service_money = 0;
+    bool open_station = false;
+    int button_id = 0;
+    int last_update = 0;
+    int last_discount_update = 0;
+    bool bonus_system_active = false;
+    int bonus_amount = 0;
+    std::string qr_data;
+    std::string authorized_session_id;
+    std::string session_id;
+} server_update_t;
+
+typedef struct RelayStat {
+    int switched_count;
+    int total_time_on;
+} RelayStat_t;
+
+typedef struct relay_report {
+    RelayStat_t RelayStats[MAX_RELAY_NUM];
+} relay_report_t;
+
+// Messages sent to and received from the Central Server, with the schemas
+// DiaJson encodes and decodes them by. Hash points to _PublicKey.
+
+typedef struct hash_message {
+    const char *hash;
+} hash_message_t;
+
+// Most routes want "Hash", the dispenser and session ones want "hash".
+static const dia_json_field_t hash_message_fields[] = {
+    DIA_JSON_FIELD(hash_message_t, hash, "Hash", DIA_JSON_CSTR),
+};
+static const dia_json_field_t hash_lower_message_fields[] = {
+    DIA_JSON_FIELD(hash_message_t, hash, "hash", DIA_JSON_CSTR),
+};
+static const dia_json_schema_t hash_message_schema = DIA_JSON_SCHEMA(hash_message_fields);
+static const dia_json_schema_t hash_lower_message_schema = DIA_JSON_SCHEMA(hash_lower_message_fields);
+
+typedef struct ping_message {
+    const char *hash;
+    int balance;
+    int program;
+} ping_message_t;
+
+static const dia_json_field_t ping_message_fields[] = {
+    DIA_JSON_FIELD(ping_message_t, hash, "Hash", DIA_JSON_CSTR),
+    DIA_JSON_FIELD(ping_message_t, balance, "CurrentBalance", DIA_JSON_INT),
+    DIA_JSON_FIELD(ping_message_t, program, "CurrentProgram", DIA_JSON_INT),
+};
+static const dia_json_schema_t ping_message_schema = DIA_JSON_SCHEMA(ping_message_fields);
+
+// Used by the dispenser, program, session and bonus routes.
+typedef struct station_message {
+    const char *hash;
+    const char *session_id;
+    int program_id;
+    bool preflight;
+    int volume;
+    int start_program_id;
+    int stop_program_id;
+    int bonuses;
+} station_message_t;
+
+static const dia_json_field_t run_program_message_fields[] = {
+    DIA_JSON_FIELD(station_message_t, hash, "hash", DIA_JSON_CSTR),
+    DIA_JSON_FIELD(station_message_t, program_id, "programID", DIA_JSON_INT),
+    DIA_JSON_FIELD(station_message_t, preflight, "preflight", DIA_JSON_BOOL),
+};
+static const dia_json_field_t end_session_message_fields[] = {
+    DIA_JSON_FIELD(station_message_t, hash, "hash", DIA_JSON_CSTR),
+    DIA_JSON_FIELD(station_message_t, session_id, "sessionID", DIA_JSON_CSTR),
+};
+static const dia_json_field_t stop_dispenser_message_fields[] = {
+    DIA_JSON_FIELD(station_message_t, hash, "hash", DIA_JSON_CSTR),
+    DIA_JSON_FIELD(station_message_t, stop_program_id, "stopProgramID", DIA_JSON_INT),
+};
+static const dia_json_field_t set_bonuses_message_fields[] = {
+    DIA_JSON_FIELD(station_message_t, hash, "hash", DIA_JSON_CSTR),
+    DIA_JSON_FIELD(station_message_t, bonuses, "bonuses", DIA_JSON_INT),
+};
+static const dia_json_field_t run_dispenser_message_fields[] = {
+    DIA_JSON_FIELD(station_message_t, hash, "hash", DIA_JSON_CSTR),
+    DIA_JSON_FIELD(station_message_t, volume, "volume", DIA_JSON_INT),
+    DIA_JSON_FIELD(station_message_t, start_program_id, "startProgramID", DIA_JSON_INT),
+    DIA_JSON_FIELD(station_message_t, stop_program_id, "stopProgramID", DIA_JSON_INT),
+};
+static const dia_json_schema_t run_program_message_schema = DIA_JSON_SCHEMA(run_program_message_fields);
+static const dia_json_schema_t end_session_message_schema = DIA_JSON_SCHEMA(end_session_message_fields);
+static const dia_json_schema_t stop_dispenser_message_schema = DIA_JSON_SCHEMA(stop_dispenser_message_fields);
+static const dia_json_schema_t set_bonuses_message_schema = DIA_JSON_SCHEMA(set_bonuses_message_fields);
+static const dia_json_schema_t run_dispenser_message_schema = DIA_JSON_SCHEMA(run_dispenser_message_fields);
+
+typedef struct money_report_message {
+    const char *hash;
+    money_report_t report;
+} money_report_message_t;
+
+static const dia_json_field_t money_report_message_fields[] = {
+    DIA_JSON_FIELD(money_report_message_t, hash, "Hash", DIA_JSON_CSTR),
+    DIA_JSON_FIELD(money_report_message_t, report.banknotes_total, "Banknotes", DIA_JSON_INT),
+    DIA_JSON_FIELD(money_report_message_t, report.cars_total, "CarsTotal", DIA_JSON_INT),
+    DIA_JSON_FIELD(money_report_message_t, report.coins_total, "Coins", DIA_JSON_INT),
+    DIA_JSON_FIELD(money_report_message_t, report.cashless_total, "Electronical", DIA_JSON_INT),
+    DIA_JSON_FIELD(money_report_message_t, report.service_total, "Service", DIA_JSON_INT),
+    DIA_JSON_FIELD(money_report_message_t, report.bonuses_total, "Bonuses", DIA_JSON_INT),
+    DIA_JSON_FIELD(money_report_message_t, report.session_id, "SessionId", DIA_JSON_STRING),
+};
+static const dia_json_schema_t money_report_message_schema = DIA_JSON_SCHEMA(money_report_message_fields);
+// /load-money only looks at the hash, the first five fields are kept
+// for compatibility with the old request.
+static const dia_json_schema_t load_money_message_schema = {money_report_message_fields, 6};
+
+// /load-money answer.
+static const dia_json_field_t money_report_answer_fields[] = {
+    DIA_JSON_FIELD(money_report_t, cars_total, "carsTotal", DIA_JSON_INT),
+    DIA_JSON_FIELD(money_report_t, coins_total, "coins", DIA_JSON_INT),
+    DIA_JSON_FIELD(money_report_t, banknotes_total, "banknotes", DIA_JSON_INT),
+    DIA_JSON_FIELD(money_report_t, cashless_total, "electronical", DIA_JSON_INT),
+    DIA_JSON_FIELD(money_report_t, service_total, "service", DIA_JSON_INT),
+    DIA_JSON_FIELD(money_report_t, bonuses_total, "bonuses", DIA_JSON_INT),
+};
+static const dia_json_schema_t money_report_answer_schema = DIA_JSON_SCHEMA(money_report_answer_fields);
+
+typedef struct relay_stat_message {
+    int relay_id;
+    int switched_count;
+    int total_time_on;
+} relay_stat_message_t;
+
+typedef struct relay_report_message {
+    const char *hash;
+    relay_stat_message_t relays[MAX_RELAY_NUM];
+} relay_report_message_t;
+
+static const dia_json_field_t relay_stat_message_fields[] = {
+    DIA_JSON_FIELD(relay_stat_message_t, relay_id, "RelayID", DIA_JSON_INT),
+    DIA_JSON_FIELD(relay_stat_message_t, switched_count, "SwitchedCount", DIA_JSON_INT),
+    DIA_JSON_FIELD(relay_stat_message_t, total_time_on, "TotalTimeOn", DIA_JSON_INT),
+};
+static const dia_json_schema_t relay_stat_message_schema = DIA_JSON_SCHEMA(relay_stat_message_fields);
+static const dia_json_field_t relay_report_message_fields[] = {
+    DIA_JSON_FIELD(relay_report_message_t, hash, "Hash", DIA_JSON_CSTR),
+    DIA_JSON_FIXED_ARRAY(relay_report_message_t, relays, "RelayStats", relay_stat_message_schema),
+};
+static const dia_json_schema_t relay_report_message_schema = DIA_JSON_SCHEMA(relay_report_message_fields);
+
+// /load-relay answer, relays are stored by relayID.
+static const dia_json_field_t relay_stat_answer_fields[] = {
+    DIA_JSON_FIELD(relay_stat_message_t, relay_id, "relayID", DIA_JSON_INT),
+    DIA_JSON_FIELD(relay_stat_message_t, switched_count, "switchedCount", DIA_JSON_INT),
+    DIA_JSON_FIELD(relay_stat_message_t, total_time_on, "totalTimeOn", DIA_JSON_INT),
+};
+static const dia_json_schema_t relay_stat_answer_schema = DIA_JSON_SCHEMA(relay_stat_answer_fields);
+static const dia_json_field_t relay_report_answer_fields[] = {
+    DIA_JSON_FIXED_ARRAY(relay_report_message_t, relays, "relayStats", relay_stat_answer_schema),
+};
+static const dia_json_schema_t relay_report_answer_schema = DIA_JSON_SCHEMA(relay_report_answer_fields);
+
+typedef struct registry_key_pair {
+    const char *key;
+    const char *value;
+} registry_key_pair_t;
+
+typedef struct registry_message {
+    const char *hash;
+    int station_id;
+    const char *key;
+    registry_key_pair_t key_pair;
+} registry_message_t;
+
+static const dia_json_field_t registry_key_pair_fields[] = {
+    DIA_JSON_FIELD(registry_key_pair_t, key, "Key", DIA_JSON_CSTR),
+    DIA_JSON_FIELD(registry_key_pair_t, value, "Value", DIA_JSON_CSTR),
+};
+static const dia_json_schema_t registry_key_pair_schema = DIA_JSON_SCHEMA(registry_key_pair_fields);
+static const dia_json_field_t set_registry_message_fields[] = {
+    DIA_JSON_FIELD(registry_message_t, hash, "Hash", DIA_JSON_CSTR),
+    DIA_JSON_NESTED(registry_message_t, key_pair, "KeyPair", registry_key_pair_schema),
+};
+static const dia_json_field_t get_registry_message_fields[] = {
+    DIA_JSON_FIELD(registry_message_t, hash, "Hash", DIA_JSON_CSTR),
+    DIA_JSON_FIELD(registry_message_t, key, "Key", DIA_JSON_CSTR),
+};
+static const dia_json_field_t get_station_registry_message_fields[] = {
+    DIA_JSON_FIELD(registry_message_t, hash, "Hash", DIA_JSON_CSTR),
+    DIA_JSON_FIELD(registry_message_t, station_id, "StationID", DIA_JSON_INT),
+    DIA_JSON_FIELD(registry_message_t, key, "Key", DIA_JSON_CSTR),
+};
+static const dia_json_schema_t set_registry_message_schema = DIA_JSON_SCHEMA(set_registry_message_fields);
+static const dia_json_schema_t get_registry_message_schema = DIA_JSON_SCHEMA(get_registry_message_fields);
+static const dia_json_schema_t get_station_registry_message_schema = DIA_JSON_SCHEMA(get_station_registry_message_fields);
+
+// PING answer and pushed update.
+static const dia_json_field_t server_update_fields[] = {
+    DIA_JSON_FIELD(server_update_t, service_money, "serviceAmount", DIA_JSON_INT),
+    DIA_JSON_FIELD(server_update_t, open_station, "openStation", DIA_JSON_BOOL),
+    DIA_JSON_FIELD(server_update_t, button_id, "ButtonID", DIA_JSON_INT),
+    DIA_JSON_FIELD(server_update_t, last_update, "lastUpdate", DIA_JSON_INT),
+    DIA_JSON_FIELD(server_update_t, last_discount_update, "lastDiscountUpdate", DIA_JSON_INT),
+    DIA_JSON_FIELD(server_update_t, bonus_system_active, "bonusSystemActive", DIA_JSON_BOOL),
+    DIA_JSON_FIELD(server_update_t, bonus_amount, "bonusAmount", DIA_JSON_INT),
+    DIA_JSON_FIELD(server_update_t, qr_data, "qr_data", DIA_JSON_STRING),
+    DIA_JSON_FIELD(server_update_t, authorized_session_id, "AuthorizedSessionID", DIA_JSON_STRING),
+    DIA_JSON_FIELD(server_update_t, session_id, "sessionID", DIA_JSON_STRING),
+};
+static const dia_json_schema_t server_update_schema = DIA_JSON_SCHEMA(server_update_fields);
+
+// Answers of /create-session, /server/info, /volume-dispenser,
+// /card-reader-config-by-hash and /get-qr.
+typedef struct station_answer {
+    std::string id;
+    std::string qr;
+    std::string bonus_service_url;
+    int volume = 0;
+    std::string status;
+    std::string card_reader_type;
+    std::string host;
+    std::string port;
+    std::string qr_data;
+} station_answer_t;
+
+static const dia_json_field_t session_answer_fields[] = {
+    DIA_JSON_FIELD(station_answer_t, id, "ID", DIA_JSON_STRING),
+    DIA_JSON_FIELD(station_answer_t, qr, "QR", DIA_JSON_STRING),
+};
+static const dia_json_field_t server_info_answer_fields[] = {
+    DIA_JSON_FIELD(station_answer_t, bonus_service_url, "bonusServiceURL", DIA_JSON_STRING),
+};
+static const dia_json_field_t volume_answer_fields[] = {
+    DIA_JSON_FIELD(station_answer_t, volume, "volume", DIA_JSON_INT),
+    DIA_JSON_FIELD(station_answer_t, status, "status", DIA_JSON_STRING),
+};
+static const dia_json_field_t card_reader_answer_fields[] = {
+    DIA_JSON_FIELD(station_answer_t, card_reader_type, "cardReaderType", DIA_JSON_STRING),
+    DIA_JSON_FIELD(station_answer_t, host, "host", DIA_JSON_STRING),
+    DIA_JSON_FIELD(station_answer_t, port, "port", DIA_JSON_STRING),
+};
+static const dia_json_field_t qr_answer_fields[] = {
+    DIA_JSON_FIELD(station_answer_t, qr_data, "qr_data", DIA_JSON_STRING),
+};
+static const dia_json_schema_t session_answer_schema = DIA_JSON_SCHEMA(session_answer_fields);
+static const dia_json_schema_t server_info_answer_schema = DIA_JSON_SCHEMA(server_info_answer_fields);
+static const dia_json_schema_t volume_answer_schema = DIA_JSON_SCHEMA(volume_answer_fields);
+static const dia_json_schema_t card_reader_answer_schema = DIA_JSON_SCHEMA(card_reader_answer_fields);
+static const dia_json_schema_t qr_answer_schema = DIA_JSON_SCHEMA(qr_answer_fields);
+
+// Answer of a batch route: 1 for every entry the server has stored, in the
+// order they were sent. Entries without a 1 are sent again.
+typedef struct batch_answer {
+    int acked[BATCH_MAX_ENTRIES];
+} batch_answer_t;
+
+static const dia_json_field_t batch_answer_fields[] = {
+    DIA_JSON_INT_ARRAY(batch_answer_t, acked, "Acked"),
+};
+static const dia_json_schema_t batch_answer_schema = DIA_JSON_SCHEMA(batch_answer_fields);
+
+#endif
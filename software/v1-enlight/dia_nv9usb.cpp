@@ -22,7 +22,7 @@ void DiaNv9Usb_CleanBalance(void * specificDriver, int balanceToClean) {
 void * DiaNv9Usb_CommandReadingThread(void * driverPtr) {
     printf("nv9 thread...\n");
     DiaNv9Usb * driver = (DiaNv9Usb *)driverPtr;
-    while(!driver->ToBeDeleted) {
+    while(!driver->ToBeDeleted && driver->_Device->NeedWorking) {
         driver->_Device->ReadPortBytes();
         int size  = driver->_Device->_Bytes_Read;
 
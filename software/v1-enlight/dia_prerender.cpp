@@ -0,0 +1,160 @@
+#include "dia_prerender.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include "dia_screen.h"
+#include "dia_screen_config.h"
+
+static double DiaPrerender_NowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static void DiaPrerender_Prepare(DiaPrerender *prerender, DiaScreenConfig *screenConfig) {
+    if (!prerender->Loader) {
+        prerender->Loader = new DiaAssetLoader();
+        if (DiaAssetLoader_Start(prerender->Loader) != ASSET_LOADER_NO_ERROR) {
+            printf("Prerender: pictures are decoded in place, the video mode is not set\n");
+        }
+    }
+    prerender->Target = screenConfig;
+    DiaImageCache_Prefetch(prerender->Cache, screenConfig->id, prerender->Loader, (size_t)-1);
+}
+
+int DiaPrerender_Request(DiaPrerender *prerender, DiaScreenConfig *screenConfig) {
+    if (!prerender || !screenConfig) {
+        return 1;
+    }
+    if (prerender->Target == screenConfig || prerender->FrameScreen == screenConfig) {
+        return 0;
+    }
+    prerender->Stat.hinted++;
+    DiaPrerender_Prepare(prerender, screenConfig);
+    return 0;
+}
+
+static int DiaPrerender_Compose(DiaPrerender *prerender, DiaScreen *screen) {
+    DiaScreenConfig *target = prerender->Target;
+    SDL_Surface *canvas = screen->Canvas;
+    if (prerender->Frame && (prerender->Frame->w != canvas->w || prerender->Frame->h != canvas->h)) {
+        SDL_FreeSurface(prerender->Frame);
+        prerender->Frame = 0;
+    }
+    if (!prerender->Frame) {
+        prerender->Frame = SDL_CreateRGBSurface(SDL_SWSURFACE, canvas->w, canvas->h, canvas->format->BitsPerPixel,
+            canvas->format->Rmask, canvas->format->Gmask, canvas->format->Bmask, 0);
+        if (!prerender->Frame) {
+            printf("error: can't create the prerender frame\n");
+            return 1;
+        }
+    }
+    if (prerender->FrameScreen) {
+        prerender->Stat.wasted++;
+        prerender->FrameScreen = 0;
+    }
+
+    double start = DiaPrerender_NowMs();
+    SDL_FillRect(prerender->Frame, NULL, 0);
+    // Items draw on the canvas of the screen
+    screen->Canvas = prerender->Frame;
+    int err = target->DisplayItems(screen, NULL);
+    screen->Canvas = canvas;
+    if (err) {
+        return err;
+    }
+    // Changes from now on are damage to draw over the frame
+    target->FullRedraw = 0;
+    target->DamagedRects.clear();
+    prerender->FrameScreen = target;
+
+    double composed = DiaPrerender_NowMs() - start;
+    prerender->Stat.composed++;
+    prerender->Stat.compose_ms += composed;
+    printf("Prerendered screen '%s' in %.1f ms\n", target->id.c_str(), composed);
+    return 0;
+}
+
+void DiaPrerender_Poll(DiaPrerender *prerender, DiaScreen *screen) {
+    if (!prerender || !prerender->Target || !screen) {
+        return;
+    }
+    if (DiaAssetLoader_Poll(prerender->Loader) > 0) {
+        return;
+    }
+    if (prerender->Target->id != screen->LastDisplayed) {
+        DiaPrerender_Compose(prerender, screen);
+    }
+    prerender->Target = 0;
+}
+
+int DiaPrerender_Take(DiaPrerender *prerender, DiaScreenConfig *screenConfig, DiaScreen *screen) {
+    if (!prerender) {
+        return 0;
+    }
+    if (prerender->Target == screenConfig) {
+        prerender->Target = 0;
+    }
+    if (prerender->FrameScreen != screenConfig) {
+        return 0;
+    }
+    prerender->FrameScreen = 0;
+    if (screenConfig->FullRedraw) {
+        prerender->Stat.wasted++;
+        return 0;
+    }
+    SDL_BlitSurface(prerender->Frame, NULL, screen->Canvas, NULL);
+    prerender->Stat.used++;
+    return 1;
+}
+
+void DiaPrerender_Learn(DiaPrerender *prerender, std::string from, DiaScreenConfig *screenConfig) {
+    if (!prerender) {
+        return;
+    }
+    if (!from.empty()) {
+        prerender->Transitions[from][screenConfig]++;
+    }
+
+    std::map<DiaScreenConfig *, int> &next = prerender->Transitions[screenConfig->id];
+    DiaScreenConfig *likely = 0;
+    int likelyCount = 0;
+    int total = 0;
+    std::map<DiaScreenConfig *, int>::iterator it;
+    for (it = next.begin(); it != next.end(); ++it) {
+        total += it->second;
+        if (it->second > likelyCount) {
+            likely = it->first;
+            likelyCount = it->second;
+        }
+    }
+    if (!likely || likelyCount < PRERENDER_MIN_TRANSITIONS || likelyCount * 100 < total * PRERENDER_MIN_SHARE_PERCENT) {
+        return;
+    }
+    if (prerender->Target || prerender->FrameScreen == likely) {
+        return;
+    }
+    prerender->Stat.learned++;
+    DiaPrerender_Prepare(prerender, likely);
+}
+
+void DiaPrerender_PrintStat(DiaPrerender *prerender) {
+    if (!prerender) {
+        return;
+    }
+    printf("Prerender: %llu hinted, %llu learned, %llu composed (%.1f ms on average), %llu used, %llu wasted\n",
+        (unsigned long long)prerender->Stat.hinted, (unsigned long long)prerender->Stat.learned,
+        (unsigned long long)prerender->Stat.composed,
+        prerender->Stat.composed ? prerender->Stat.compose_ms / prerender->Stat.composed : 0.0,
+        (unsigned long long)prerender->Stat.used, (unsigned long long)prerender->Stat.wasted);
+}
+
+DiaPrerender::~DiaPrerender() {
+    if (Loader) {
+        delete Loader;
+    }
+    if (Frame) {
+        SDL_FreeSurface(Frame);
+    }
+}
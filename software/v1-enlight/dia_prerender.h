@@ -0,0 +1,83 @@
+#ifndef DIA_PRERENDER_H
+#define DIA_PRERENDER_H
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+#include <SDL.h>
+
+#include "dia_asset_loader.h"
+#include "dia_image_cache.h"
+
+// A screen is prepared without a hint once it has followed the shown screen
+// at least this many times...
+#define PRERENDER_MIN_TRANSITIONS 3
+// ...and in at least this share of the switches away from it.
+#define PRERENDER_MIN_SHARE_PERCENT 50
+
+class DiaScreen;
+class DiaScreenConfig;
+
+typedef struct prerender_stat {
+    uint64_t hinted;
+    uint64_t learned;
+    uint64_t composed;
+    uint64_t used;
+    // Composed, but another screen was shown or the damage was too big.
+    uint64_t wasted;
+    double compose_ms;
+} prerender_stat_t;
+
+// DiaPrerender prepares the screen which is likely to be shown next, told
+// by screen:Prefetch() in Lua or learned from the switches seen so far.
+// Its pictures are decoded by the loader workers, then the frame is composed
+// off-screen while the main loop waits in smart_delay. Switching to the
+// screen is then one blit of the frame, and the items changed since are
+// drawn over it like damage on a shown screen.
+// Items are only touched on the main thread.
+class DiaPrerender {
+   public:
+    DiaImageCache *Cache;
+    // Started on the first request.
+    DiaAssetLoader *Loader;
+    // How many times a screen was shown right after another one, by the id
+    // of the first one.
+    std::map<std::string, std::map<DiaScreenConfig *, int> > Transitions;
+    // Screen whose pictures are being decoded, 0 if none.
+    DiaScreenConfig *Target;
+    // Composed frame of FrameScreen, kept to be reused.
+    SDL_Surface *Frame;
+    DiaScreenConfig *FrameScreen;
+    prerender_stat_t Stat;
+
+    DiaPrerender(DiaImageCache *cache) {
+        Cache = cache;
+        Loader = 0;
+        Target = 0;
+        Frame = 0;
+        FrameScreen = 0;
+        Stat = prerender_stat_t();
+    }
+
+    ~DiaPrerender();
+};
+
+// Starts preparing the screen, does nothing if it is prepared already.
+int DiaPrerender_Request(DiaPrerender *prerender, DiaScreenConfig *screenConfig);
+
+// Applies decoded pictures and composes the frame once all of them are in.
+// Called on the main thread when it has time to spare.
+void DiaPrerender_Poll(DiaPrerender *prerender, DiaScreen *screen);
+
+// Puts the prepared frame of the screen being switched to on the canvas.
+// Returns 1 if it did, then only the damage of the screen is to be drawn.
+int DiaPrerender_Take(DiaPrerender *prerender, DiaScreenConfig *screenConfig, DiaScreen *screen);
+
+// Counts the switch and prepares the screen which usually follows.
+void DiaPrerender_Learn(DiaPrerender *prerender, std::string from, DiaScreenConfig *screenConfig);
+
+void DiaPrerender_PrintStat(DiaPrerender *prerender);
+
+#endif
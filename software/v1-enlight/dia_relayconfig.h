@@ -9,13 +9,11 @@ public:
     int RelayNum[PIN_COUNT_CONFIG];
     long OnTime[PIN_COUNT_CONFIG];
     long OffTime[PIN_COUNT_CONFIG];
-    long NextSwitchTime[PIN_COUNT_CONFIG];
     DiaRelayConfig() {
         for(int i=0;i<PIN_COUNT_CONFIG;i++) {
             RelayNum[i] = -1;
             OnTime[i]=0;
             OffTime[i]=0;
-            NextSwitchTime[i]=0;
         }
     }
     int InitRelay(int id, int ontime, int offtime) {
@@ -41,7 +39,6 @@ public:
         this->RelayNum[id] = -1;
         OnTime[id]=0;
         OffTime[id]=0;
-        NextSwitchTime[id]=0;
         return 0;
     }
 };
@@ -78,6 +78,7 @@ int DiaRuntime::InitStr(std::string folder, std::string src_str, std::string inc
         .addConstructor<void (*)()>()
         .addFunction("Display", &DiaRuntimeScreen::Display)
         .addFunction("Set", &DiaRuntimeScreen::SetValue)
+        .addFunction("Prefetch", &DiaRuntimeScreen::Prefetch)
         .endClass();
 
     getGlobalNamespace(Lua)
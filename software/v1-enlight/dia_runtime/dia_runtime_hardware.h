@@ -451,6 +451,9 @@ class DiaRuntimeHardware {
 
     void* delay_object;
     int (*smart_delay_function)(void* object, int milliseconds);
+    // Waits up to milliseconds since the previous call. Delays shorter than a
+    // second end early on a button press, money or a server reply.
+    // Returns milliseconds really passed.
     int SmartDelay(int milliseconds) {
         if (delay_object && smart_delay_function) {
             return smart_delay_function(delay_object, milliseconds);
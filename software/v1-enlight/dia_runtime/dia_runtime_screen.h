@@ -63,11 +63,22 @@ public:
         return 0;
     }
 
+    // Prepares the screen which is going to be shown soon, Display is then
+    // one blit of the prepared frame and the items changed since.
+    int (*prefetch_screen) (void * screen_config);
+    int Prefetch() {
+        if(prefetch_screen) {
+            prefetch_screen(object);
+        }
+        return 0;
+    }
+
     DiaRuntimeScreen() {
         object = 0;
         screen_object = 0;
         set_value_function = 0;
         display_screen = 0;
+        prefetch_screen = 0;
     }
 };
 
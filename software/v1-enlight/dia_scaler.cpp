@@ -0,0 +1,236 @@
+#include "dia_scaler.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DIA_SCALER_NEON
+#endif
+
+// Source pixels and their weights for every destination pixel of one axis.
+class DiaScaleTable {
+    public:
+    int MaxTaps;
+    std::vector<int> Start;
+    std::vector<int> Count;
+    // Offset of the first weight of every destination pixel in Weights.
+    std::vector<int> Offset;
+    std::vector<uint16_t> Weights;
+};
+
+static pthread_mutex_t dia_scaler_tables_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::pair<int, int>, std::shared_ptr<DiaScaleTable> > dia_scaler_tables;
+
+// Pixel parts are calculated exactly like the old double scaler did,
+// then normalized and converted to fixed point.
+static std::shared_ptr<DiaScaleTable> dia_scaler_build_table(int srcSize, int dstSize) {
+    std::shared_ptr<DiaScaleTable> table(new DiaScaleTable());
+    table->MaxTaps = 1;
+    table->Start.resize(dstSize);
+    table->Count.resize(dstSize);
+    table->Offset.resize(dstSize);
+
+    const int one = 1 << DIA_SCALER_WEIGHT_BITS;
+    double scale = static_cast<double>(srcSize) / static_cast<double>(dstSize);
+    std::vector<double> parts;
+    std::vector<int> weights;
+
+    for (int i = 0; i < dstSize; i++) {
+        double startCoordinate = i * scale;
+        double endCoordinate = (i + 1) * scale;
+        double startPixel = floor(startCoordinate);
+        double endPixel = floor(endCoordinate);
+        if (endPixel >= srcSize) {
+            endPixel = srcSize - 1;
+        }
+        double startPixelPart = 1 + startPixel - startCoordinate;
+        double endPixelPart = endCoordinate - endPixel;
+
+        int first = (int)startPixel;
+        int last = (int)endPixel;
+        parts.clear();
+        double partsSum = 0;
+        for (int coord = first; coord <= last; coord++) {
+            double part = 1;
+            if (coord == first) {
+                part = startPixelPart;
+            } else if (coord == last) {
+                part = endPixelPart;
+            }
+            parts.push_back(part);
+            partsSum += part;
+        }
+
+        weights.resize(parts.size());
+        int weightsSum = 0;
+        int biggest = 0;
+        for (size_t k = 0; k < parts.size(); k++) {
+            weights[k] = (int)floor(parts[k] / partsSum * one + 0.5);
+            weightsSum += weights[k];
+            if (weights[k] > weights[biggest]) {
+                biggest = k;
+            }
+        }
+        weights[biggest] += one - weightsSum;
+
+        // Pixels with zero weight at the edges are not worth reading
+        int from = 0;
+        int to = (int)weights.size() - 1;
+        while (from < to && weights[from] == 0) from++;
+        while (to > from && weights[to] == 0) to--;
+
+        table->Start[i] = first + from;
+        table->Count[i] = to - from + 1;
+        table->Offset[i] = table->Weights.size();
+        for (int k = from; k <= to; k++) {
+            table->Weights.push_back((uint16_t)weights[k]);
+        }
+        if (table->Count[i] > table->MaxTaps) {
+            table->MaxTaps = table->Count[i];
+        }
+    }
+    return table;
+}
+
+static std::shared_ptr<DiaScaleTable> dia_scaler_get_table(int srcSize, int dstSize) {
+    std::pair<int, int> key(srcSize, dstSize);
+
+    pthread_mutex_lock(&dia_scaler_tables_lock);
+    auto it = dia_scaler_tables.find(key);
+    if (it != dia_scaler_tables.end()) {
+        std::shared_ptr<DiaScaleTable> table = it->second;
+        pthread_mutex_unlock(&dia_scaler_tables_lock);
+        return table;
+    }
+    pthread_mutex_unlock(&dia_scaler_tables_lock);
+
+    std::shared_ptr<DiaScaleTable> table = dia_scaler_build_table(srcSize, dstSize);
+
+    pthread_mutex_lock(&dia_scaler_tables_lock);
+    if (dia_scaler_tables.size() >= DIA_SCALER_MAX_TABLES) {
+        dia_scaler_tables.clear();
+    }
+    dia_scaler_tables[key] = table;
+    pthread_mutex_unlock(&dia_scaler_tables_lock);
+    return table;
+}
+
+// Horizontal pass: one source row to dstWidth pixels of four 8.8 fixed point
+// channels each.
+static void dia_scaler_row(const uint32_t * src, const DiaScaleTable * table, int dstWidth, uint16_t * out) {
+    const int * starts = table->Start.data();
+    const int * counts = table->Count.data();
+    const int * offsets = table->Offset.data();
+    const uint16_t * weights = table->Weights.data();
+
+    for (int x = 0; x < dstWidth; x++) {
+        const uint32_t * pixel = src + starts[x];
+        const uint16_t * weight = weights + offsets[x];
+        int count = counts[x];
+#ifdef DIA_SCALER_NEON
+        uint32x4_t acc = vdupq_n_u32(0);
+        for (int t = 0; t < count; t++) {
+            uint8x8_t bytes = vreinterpret_u8_u32(vld1_dup_u32(pixel + t));
+            acc = vmlal_n_u16(acc, vget_low_u16(vmovl_u8(bytes)), weight[t]);
+        }
+        vst1_u16(out + x * 4, vrshrn_n_u32(acc, DIA_SCALER_WEIGHT_BITS - 8));
+#else
+        uint32_t acc0 = 0, acc1 = 0, acc2 = 0, acc3 = 0;
+        for (int t = 0; t < count; t++) {
+            const uint8_t * bytes = (const uint8_t *)(pixel + t);
+            uint32_t w = weight[t];
+            acc0 += bytes[0] * w;
+            acc1 += bytes[1] * w;
+            acc2 += bytes[2] * w;
+            acc3 += bytes[3] * w;
+        }
+        const uint32_t round = 1 << (DIA_SCALER_WEIGHT_BITS - 9);
+        out[x * 4 + 0] = (acc0 + round) >> (DIA_SCALER_WEIGHT_BITS - 8);
+        out[x * 4 + 1] = (acc1 + round) >> (DIA_SCALER_WEIGHT_BITS - 8);
+        out[x * 4 + 2] = (acc2 + round) >> (DIA_SCALER_WEIGHT_BITS - 8);
+        out[x * 4 + 3] = (acc3 + round) >> (DIA_SCALER_WEIGHT_BITS - 8);
+#endif
+    }
+}
+
+// Vertical pass: combines horizontally scaled rows into one destination row.
+// acc is a scratch buffer of values elements.
+static void dia_scaler_column(const uint16_t ** rows, const uint16_t * weights, int count, int values, uint32_t * acc, uint8_t * out) {
+    const int shift = DIA_SCALER_WEIGHT_BITS + 8;
+    int i = 0;
+#ifdef DIA_SCALER_NEON
+    for (; i + 8 <= values; i += 8) {
+        uint32x4_t lo = vdupq_n_u32(0);
+        uint32x4_t hi = vdupq_n_u32(0);
+        for (int t = 0; t < count; t++) {
+            uint16x8_t v = vld1q_u16(rows[t] + i);
+            lo = vmlal_n_u16(lo, vget_low_u16(v), weights[t]);
+            hi = vmlal_n_u16(hi, vget_high_u16(v), weights[t]);
+        }
+        uint16x8_t res = vcombine_u16(vshrn_n_u32(lo, 16), vshrn_n_u32(hi, 16));
+        res = vshrq_n_u16(res, shift - 16);
+        vst1_u8(out + i, vmovn_u16(res));
+    }
+#endif
+    // Row by row, so the compiler can vectorize the inner loops
+    const uint16_t * row = rows[0] + i;
+    uint32_t weight = weights[0];
+    for (int k = 0; k < values - i; k++) {
+        acc[k] = row[k] * weight;
+    }
+    for (int t = 1; t < count; t++) {
+        row = rows[t] + i;
+        weight = weights[t];
+        for (int k = 0; k < values - i; k++) {
+            acc[k] += row[k] * weight;
+        }
+    }
+    for (int k = 0; k < values - i; k++) {
+        out[i + k] = acc[k] >> shift;
+    }
+}
+
+void dia_scale_rgba32(const uint32_t * src, int srcWidth, int srcHeight, int srcPitch,
+    uint32_t * dst, int dstWidth, int dstHeight, int dstPitch) {
+    if (!src || !dst || srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0) {
+        return;
+    }
+
+    std::shared_ptr<DiaScaleTable> xTable = dia_scaler_get_table(srcWidth, dstWidth);
+    std::shared_ptr<DiaScaleTable> yTable = dia_scaler_get_table(srcHeight, dstHeight);
+
+    // Horizontally scaled source rows. Rows needed by neighbouring
+    // destination rows overlap, so a ring of MaxTaps rows is enough.
+    int ringSize = yTable->MaxTaps;
+    int rowValues = dstWidth * 4;
+    std::vector<uint16_t> ring((size_t)ringSize * rowValues);
+    std::vector<int> ringRow(ringSize, -1);
+    std::vector<const uint16_t *> rows(ringSize);
+    std::vector<uint32_t> acc(rowValues);
+
+    for (int y = 0; y < dstHeight; y++) {
+        int start = yTable->Start[y];
+        int count = yTable->Count[y];
+        for (int t = 0; t < count; t++) {
+            int srcRow = start + t;
+            int slot = srcRow % ringSize;
+            uint16_t * hrow = &ring[(size_t)slot * rowValues];
+            if (ringRow[slot] != srcRow) {
+                const uint32_t * srcLine = (const uint32_t *)((const uint8_t *)src + (size_t)srcRow * srcPitch);
+                dia_scaler_row(srcLine, xTable.get(), dstWidth, hrow);
+                ringRow[slot] = srcRow;
+            }
+            rows[t] = hrow;
+        }
+
+        uint8_t * dstLine = (uint8_t *)dst + (size_t)y * dstPitch;
+        dia_scaler_column(rows.data(), &yTable->Weights[yTable->Offset[y]], count, rowValues, acc.data(), dstLine);
+    }
+}
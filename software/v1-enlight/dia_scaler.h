@@ -0,0 +1,18 @@
+#ifndef _DIA_SCALER_H
+#define _DIA_SCALER_H
+
+#include <stdint.h>
+
+// Weights of every destination pixel sum up to 1 << DIA_SCALER_WEIGHT_BITS.
+#define DIA_SCALER_WEIGHT_BITS 14
+// Coefficient tables cached for this many (source, destination) size pairs.
+#define DIA_SCALER_MAX_TABLES 64
+
+// Area-averaging scaler for 32 bits per pixel images.
+// All four bytes of a pixel are averaged independently, so any channel order
+// works. Pitches are in bytes. The result differs from the old floating point
+// dia_ScaleSurface by at most 1 per channel.
+void dia_scale_rgba32(const uint32_t * src, int srcWidth, int srcHeight, int srcPitch,
+    uint32_t * dst, int dstWidth, int dstHeight, int dstPitch);
+
+#endif
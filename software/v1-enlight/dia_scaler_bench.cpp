@@ -0,0 +1,128 @@
+// Scaler benchmark and compatibility check.
+// Usage: ./scaler_bench.exe [repeats]
+// Compares dia_scale_rgba32 with the floating point area-averaging scaler
+// dia_ScaleSurface used before, on the size pairs of samples/wash.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <vector>
+
+#include "dia_scaler.h"
+
+typedef struct scale_case {
+    int src_w;
+    int src_h;
+    int dst_w;
+    int dst_h;
+    const char * name;
+} scale_case_t;
+
+// Source picture and item sizes from samples/wash/screens
+static scale_case_t cases[] = {
+    {2650, 1500, 1920, 1080, "background 2650x1500"},
+    {1280, 720, 1920, 1080, "background 1280x720"},
+    {954, 527, 955, 524, "balance"},
+    {494, 493, 249, 249, "program icon"},
+    {499, 339, 264, 180, "non-cash"},
+    {416, 336, 260, 210, "cash"},
+    {501, 57, 440, 40, "bonus"},
+    {472, 105, 543, 112, "return background"},
+    {30, 17, 520, 420, "arrow"},
+    {33, 33, 460, 460, "qr"},
+};
+
+static double NowSec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The algorithm of the old dia_ScaleSurface on a plain buffer.
+static void reference_scale(const uint32_t * src, int srcW, int srcH, uint32_t * dst, int dstW, int dstH) {
+    double scaleX = (double)srcW / (double)dstW;
+    double scaleY = (double)srcH / (double)dstH;
+    for (int x = 0; x < dstW; x++) {
+        double xs = x * scaleX, xe = (x + 1) * scaleX;
+        double xsp = floor(xs), xep = floor(xe);
+        if (xep >= srcW) xep = srcW - 1;
+        for (int y = 0; y < dstH; y++) {
+            double ys = y * scaleY, ye = (y + 1) * scaleY;
+            double ysp = floor(ys), yep = floor(ye);
+            if (yep >= srcH) yep = srcH - 1;
+            double sum[4] = {0, 0, 0, 0};
+            double partsSum = 0;
+            for (int xo = (int)xsp; xo <= (int)xep; xo++) {
+                double xPart = xo == (int)xsp ? 1 + xsp - xs : (xo == (int)xep ? xe - xep : 1);
+                for (int yo = (int)ysp; yo <= (int)yep; yo++) {
+                    double yPart = yo == (int)ysp ? 1 + ysp - ys : (yo == (int)yep ? ye - yep : 1);
+                    double part = xPart * yPart;
+                    uint32_t pixel = src[yo * srcW + xo];
+                    for (int c = 0; c < 4; c++) {
+                        sum[c] += ((pixel >> (c * 8)) & 0xff) * part;
+                    }
+                    partsSum += part;
+                }
+            }
+            uint32_t out = 0;
+            for (int c = 0; c < 4; c++) {
+                int v = (int)(sum[c] / partsSum);
+                if (v > 255) v = 255;
+                out |= (uint32_t)v << (c * 8);
+            }
+            dst[y * dstW + x] = out;
+        }
+    }
+}
+
+int main(int argc, char ** argv) {
+    int repeats = argc > 1 ? atoi(argv[1]) : 5;
+    if (repeats < 1) repeats = 1;
+    srand(1);
+
+    int failed = 0;
+    printf("%-22s %12s %12s %10s %8s\n", "case", "new MP/s", "old MP/s", "speedup", "max diff");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        scale_case_t c = cases[i];
+        std::vector<uint32_t> src((size_t)c.src_w * c.src_h);
+        // Smooth gradients with noise, like real pictures
+        for (int y = 0; y < c.src_h; y++) {
+            for (int x = 0; x < c.src_w; x++) {
+                uint32_t r = (x * 255 / c.src_w + rand() % 16) & 0xff;
+                uint32_t g = (y * 255 / c.src_h + rand() % 16) & 0xff;
+                uint32_t b = rand() & 0xff;
+                uint32_t a = (x + y) % 7 ? 0xff : rand() & 0xff;
+                src[(size_t)y * c.src_w + x] = r | g << 8 | b << 16 | a << 24;
+            }
+        }
+        std::vector<uint32_t> fast((size_t)c.dst_w * c.dst_h);
+        std::vector<uint32_t> slow((size_t)c.dst_w * c.dst_h);
+
+        double t0 = NowSec();
+        for (int r = 0; r < repeats; r++) {
+            dia_scale_rgba32(src.data(), c.src_w, c.src_h, c.src_w * 4, fast.data(), c.dst_w, c.dst_h, c.dst_w * 4);
+        }
+        double t1 = NowSec();
+        reference_scale(src.data(), c.src_w, c.src_h, slow.data(), c.dst_w, c.dst_h);
+        double t2 = NowSec();
+
+        int maxDiff = 0;
+        for (size_t p = 0; p < fast.size(); p++) {
+            for (int ch = 0; ch < 4; ch++) {
+                int d = abs((int)((fast[p] >> (ch * 8)) & 0xff) - (int)((slow[p] >> (ch * 8)) & 0xff));
+                if (d > maxDiff) maxDiff = d;
+            }
+        }
+        if (maxDiff > 1) failed = 1;
+
+        double megapixels = (double)c.dst_w * c.dst_h / 1e6;
+        double fastRate = megapixels * repeats / (t1 - t0);
+        double slowRate = megapixels / (t2 - t1);
+        printf("%-22s %12.1f %12.1f %9.1fx %8d\n", c.name, fastRate, slowRate, fastRate / slowRate, maxDiff);
+    }
+
+    printf(failed ? "FAILED: difference is more than 1\n" : "OK\n");
+    return failed;
+}
@@ -12,6 +12,7 @@
 #include "dia_screen.h"
 
 DiaScreen::DiaScreen(int resX, int resY, int hideCursor, int fullScreen) {
+    StaticLayer = 0;
     
     if (hideCursor) {
         SDL_Cursor* cursor;
@@ -49,11 +50,19 @@ void DiaScreen::FlipFrame() {
     SDL_Flip(Canvas);
     printf(" ... flipped \n");
 }
+// Pushes only the given parts of the frame to the display.
+void DiaScreen::UpdateRects(int count, SDL_Rect * rects) {
+    SDL_UpdateRects(Canvas, count, rects);
+}
+
 void DiaScreen::FillBackground(Uint8 r, Uint8 g, Uint8 b) {
 	SDL_FillRect(Canvas, NULL, SDL_MapRGB(Canvas->format, r, g, b));
 }
 
 DiaScreen::~DiaScreen() {
+    if (StaticLayer) {
+        SDL_FreeSurface(StaticLayer);
+    }
     SDL_Quit();
 }
 
@@ -17,8 +17,13 @@ class DiaScreen
     int Number;
     std::string LastDisplayed;
 	SDL_Surface * Canvas;
+	// Static items of StaticLayerScreen flattened, shared by all screens
+	// as only the shown one uses it.
+	SDL_Surface * StaticLayer;
+	std::string StaticLayerScreen;
 	void FillBackground(Uint8 r, Uint8 g, Uint8 b);
 	void FlipFrame();
+	void UpdateRects(int count, SDL_Rect * rects);
 };
 
 #endif
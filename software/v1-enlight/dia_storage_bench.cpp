@@ -0,0 +1,272 @@
+// Storage write amplification benchmark.
+// Usage: ./storage_bench.exe [directory] [saves] [other keys] [registry operations]
+// Saves relay counters again and again into a file which also keeps a few
+// other keys: with DiaStorageFile, by rewriting the whole file atomically
+// (temporary file, fsync, rename) and by fopen/fwrite without any sync.
+// Run it with the directory on the SD card: "device" is what the kernel sent
+// to the block device (/proc/self/io), which is what wears the card.
+// Then compares the local registry in DiaStorageFile with the file per key
+// (registry_<key>.reg) it replaced, in operations per second.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+
+#include "dia_storage_file.h"
+
+// Same as relay_stat in dia_gpio.h, which needs wiringPi.
+#define BENCH_PIN_COUNT 18
+typedef struct relay_stat {
+    long relay_time[BENCH_PIN_COUNT];
+    int relay_switch[BENCH_PIN_COUNT];
+} relay_stat;
+
+typedef struct bench_result {
+    double seconds;
+    uint64_t fileBytes;
+    uint64_t deviceBytes;
+} bench_result_t;
+
+static double NowSec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t DeviceWriteBytes() {
+    FILE *f = fopen("/proc/self/io", "r");
+    if (!f) {
+        return 0;
+    }
+    char line[128];
+    unsigned long long res = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "write_bytes: %llu", &res) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+    return res;
+}
+
+static void FillOtherKeys(std::map<std::string, std::string> *values, int keys) {
+    for (int i = 0; i < keys; i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "key%d", i);
+        (*values)[key] = std::string(32, 'a' + i % 26);
+    }
+}
+
+static void NextStat(relay_stat *stat, int i) {
+    stat->relay_switch[1 + i % 6]++;
+    stat->relay_time[1 + i % 6] += 1500;
+}
+
+static bench_result_t BenchStorageFile(std::string path, int saves, int keys) {
+    bench_result_t res = bench_result_t();
+    unlink(path.c_str());
+    DiaStorageFile *storage = new DiaStorageFile(path);
+    DiaStorageFile_Open(storage);
+    std::map<std::string, std::string> values;
+    FillOtherKeys(&values, keys);
+    for (std::map<std::string, std::string>::iterator it = values.begin(); it != values.end(); ++it) {
+        DiaStorageFile_Save(storage, it->first.c_str(), it->second.data(), it->second.size());
+    }
+    storage_file_stat_t before;
+    DiaStorageFile_GetStat(storage, &before);
+
+    relay_stat stat = relay_stat();
+    uint64_t device = DeviceWriteBytes();
+    double start = NowSec();
+    for (int i = 0; i < saves; i++) {
+        NextStat(&stat, i);
+        DiaStorageFile_Save(storage, "relays", &stat, sizeof(stat));
+    }
+    res.seconds = NowSec() - start;
+    res.deviceBytes = DeviceWriteBytes() - device;
+
+    storage_file_stat_t after;
+    DiaStorageFile_GetStat(storage, &after);
+    res.fileBytes = after.bytes_written - before.bytes_written;
+    printf("DiaStorageFile compactions: %llu\n", (unsigned long long)(after.compactions - before.compactions));
+
+    relay_stat loaded;
+    delete storage;
+    storage = new DiaStorageFile(path);
+    DiaStorageFile_Open(storage);
+    if (DiaStorageFile_Load(storage, "relays", &loaded, sizeof(loaded)) != STORAGE_FILE_NO_ERROR ||
+        memcmp(&loaded, &stat, sizeof(stat)) != 0) {
+        printf("DiaStorageFile: the last value is not loaded back\n");
+    }
+    delete storage;
+    unlink(path.c_str());
+    return res;
+}
+
+static bench_result_t BenchRewrite(std::string path, int saves, int keys, int sync) {
+    bench_result_t res = bench_result_t();
+    std::map<std::string, std::string> values;
+    FillOtherKeys(&values, keys);
+    std::string tmpPath = path + ".tmp";
+
+    relay_stat stat = relay_stat();
+    uint64_t device = DeviceWriteBytes();
+    double start = NowSec();
+    for (int i = 0; i < saves; i++) {
+        NextStat(&stat, i);
+        values["relays"] = std::string((const char *)&stat, sizeof(stat));
+        std::string data;
+        for (std::map<std::string, std::string>::iterator it = values.begin(); it != values.end(); ++it) {
+            data += it->first + "=" + it->second + "\n";
+        }
+        if (sync) {
+            int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (write(fd, data.data(), data.size()) != (ssize_t)data.size()) {
+                printf("write failed\n");
+            }
+            fdatasync(fd);
+            close(fd);
+            rename(tmpPath.c_str(), path.c_str());
+            int dir = open(".", O_RDONLY | O_DIRECTORY);
+            fsync(dir);
+            close(dir);
+        } else {
+            FILE *f = fopen(path.c_str(), "w");
+            fwrite(data.data(), 1, data.size(), f);
+            fclose(f);
+        }
+        res.fileBytes += data.size();
+    }
+    res.seconds = NowSec() - start;
+    if (!sync) {
+        // Whatever the page cache writes back later is still caused by us.
+        ::sync();
+    }
+    res.deviceBytes = DeviceWriteBytes() - device;
+    unlink(path.c_str());
+    return res;
+}
+
+#define BENCH_REGISTRY_KEYS 16
+
+// What dia_security_write_file and dia_security_read_file do.
+static void WriteKeyFile(const char *fileName, const char *value) {
+    FILE *fp = fopen(fileName, "w");
+    if (fp == NULL) {
+        return;
+    }
+    fprintf(fp, "%s", value);
+    fflush(fp);
+    fclose(fp);
+}
+
+static int ReadKeyFile(const char *fileName, char *out, int maxSize) {
+    FILE *fp = fopen(fileName, "r");
+    if (fp == 0) {
+        return 1;
+    }
+    int nread = fread(out, 1, maxSize, fp);
+    out[nread >= maxSize ? maxSize - 1 : nread] = 0;
+    fclose(fp);
+    return nread;
+}
+
+static void PrintOps(const char *what, int ops, double seconds) {
+    printf("%-32s %12.0f ops/s\n", what, ops / seconds);
+}
+
+static void BenchRegistry(int ops) {
+    char fileName[BENCH_REGISTRY_KEYS][64 + 16];
+    char key[BENCH_REGISTRY_KEYS][32];
+    for (int i = 0; i < BENCH_REGISTRY_KEYS; i++) {
+        snprintf(key[i], sizeof(key[i]), "price%d", i);
+        snprintf(fileName[i], sizeof(fileName[i]), "registry_%s.reg", key[i]);
+    }
+    char value[32];
+
+    printf("\nlocal registry, %d keys, %d operations\n", BENCH_REGISTRY_KEYS, ops);
+    double start = NowSec();
+    for (int i = 0; i < ops; i++) {
+        snprintf(value, sizeof(value), "%d", i);
+        WriteKeyFile(fileName[i % BENCH_REGISTRY_KEYS], value);
+    }
+    PrintOps("file per key, write (no sync)", ops, NowSec() - start);
+    start = NowSec();
+    int checksum = 0;
+    for (int i = 0; i < ops; i++) {
+        checksum += ReadKeyFile(fileName[i % BENCH_REGISTRY_KEYS], value, sizeof(value));
+    }
+    PrintOps("file per key, read", ops, NowSec() - start);
+    for (int i = 0; i < BENCH_REGISTRY_KEYS; i++) {
+        unlink(fileName[i]);
+    }
+
+    unlink("bench.registry");
+    DiaStorageFile *registry = new DiaStorageFile("bench.registry");
+    DiaStorageFile_Open(registry);
+    start = NowSec();
+    for (int i = 0; i < ops; i++) {
+        snprintf(value, sizeof(value), "%d", i);
+        DiaStorageFile_SaveAsync(registry, key[i % BENCH_REGISTRY_KEYS], value, strlen(value));
+    }
+    DiaStorageFile_Flush(registry);
+    PrintOps("DiaStorageFile, group commit", ops, NowSec() - start);
+    start = NowSec();
+    std::string res;
+    for (int i = 0; i < ops; i++) {
+        DiaStorageFile_Get(registry, key[i % BENCH_REGISTRY_KEYS], &res);
+        checksum += res.size();
+    }
+    PrintOps("DiaStorageFile, read", ops, NowSec() - start);
+    int syncOps = ops < 100 ? ops : 100;
+    start = NowSec();
+    for (int i = 0; i < syncOps; i++) {
+        snprintf(value, sizeof(value), "s%d", i);
+        DiaStorageFile_Save(registry, key[i % BENCH_REGISTRY_KEYS], value, strlen(value));
+    }
+    PrintOps("DiaStorageFile, write and wait", syncOps, NowSec() - start);
+
+    storage_file_stat_t stat;
+    DiaStorageFile_GetStat(registry, &stat);
+    printf("DiaStorageFile: %llu syncs, %llu bytes written, %llu compactions (checksum %d)\n",
+           (unsigned long long)stat.syncs, (unsigned long long)stat.bytes_written,
+           (unsigned long long)stat.compactions, checksum);
+    delete registry;
+    unlink("bench.registry");
+}
+
+static void Print(const char *what, bench_result_t res, int saves) {
+    printf("%-24s %10.0f %14.1f %14.1f %8.1fx\n", what, saves / res.seconds, (double)res.fileBytes / saves,
+           (double)res.deviceBytes / saves, (double)res.deviceBytes / saves / sizeof(relay_stat));
+}
+
+int main(int argc, char **argv) {
+    std::string dir = argc > 1 ? argv[1] : ".";
+    // Every save waits for its own fsync, up to STORAGE_FILE_SYNC_INTERVAL_MS.
+    int saves = argc > 2 ? atoi(argv[2]) : 200;
+    int keys = argc > 3 ? atoi(argv[3]) : 20;
+    int ops = argc > 4 ? atoi(argv[4]) : 20000;
+    if (chdir(dir.c_str()) != 0 || saves < 1 || keys < 0 || ops < 1) {
+        printf("usage: %s [directory] [saves] [other keys] [registry operations]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%d saves of %d bytes of relay counters, %d other keys\n\n", saves, (int)sizeof(relay_stat), keys);
+    bench_result_t storageFile = BenchStorageFile("bench.storage", saves, keys);
+    bench_result_t rewrite = BenchRewrite("bench.rewrite", saves, keys, 1);
+    bench_result_t plain = BenchRewrite("bench.plain", saves, keys, 0);
+
+    printf("%-24s %10s %14s %14s %9s\n", "", "saves/s", "file B/save", "device B/save", "amplif.");
+    Print("DiaStorageFile", storageFile, saves);
+    Print("rewrite + rename", rewrite, saves);
+    Print("fopen, no sync", plain, saves);
+
+    BenchRegistry(ops);
+    return 0;
+}
@@ -225,8 +225,7 @@ wait_mode = function()
         return mode_choose       
 	end
 
-    smart_delay(100)
-    waiting_loops = waiting_loops - 1
+    waiting_loops = waiting_loops - smart_delay(100) / 100
    
     return mode_wait
 end
@@ -327,7 +326,7 @@ thanks_mode = function()
             increment_cars() 
             return mode_fundraising
         end
-        waiting_loops = waiting_loops - 1
+        waiting_loops = waiting_loops - real_ms_per_loop / 100
     
     else
         send_receipt(post_position, cash_balance, electronical_balance)
@@ -345,7 +344,7 @@ apology_mode = function()
     check_open_lid()
 
     if waiting_loops <= 0 then waiting_loops = apology_mode_seconds * 10 end
-    waiting_loops = waiting_loops - 1
+    waiting_loops = waiting_loops - real_ms_per_loop / 100
 
     if waiting_loops <= 0 then return mode_choose end
     return mode_apology
@@ -17,6 +17,7 @@ setup = function()
 
     -- constants
     welcome_mode_seconds = 3
+    real_ms_per_loop = 100
     thanks_mode_seconds = 120
     free_pause_seconds = 120
     wait_card_mode_seconds = 40
@@ -60,7 +61,7 @@ end
 -- loop is being executed
 loop = function()
     currentMode = run_mode(currentMode)
-    smart_delay(100)
+    real_ms_per_loop = smart_delay(100)
     return 0
 end
 
@@ -213,8 +214,7 @@ wait_for_card_mode = function()
         return mode_choose_method        
 	end
 
-    smart_delay(100)
-    waiting_loops = waiting_loops - 1
+    waiting_loops = waiting_loops - smart_delay(100) / 100
    
     return mode_wait_for_card
 end
@@ -308,7 +308,7 @@ thanks_mode = function()
             increment_cars() 
             return mode_work 
         end
-        waiting_loops = waiting_loops - 1
+        waiting_loops = waiting_loops - real_ms_per_loop / 100
     else
         send_receipt(post_position, cash_balance, electronical_balance)
         cash_balance = 0
@@ -205,8 +205,7 @@ wait_for_card_mode = function()
         return mode_choose_method        
 	end
 
-    smart_delay(100)
-    waiting_loops = waiting_loops - 1
+    waiting_loops = waiting_loops - smart_delay(100) / 100
    
     return mode_wait_for_card
 end
@@ -300,7 +299,7 @@ thanks_mode = function()
             increment_cars() 
             return mode_work 
         end
-        waiting_loops = waiting_loops - 1
+        waiting_loops = waiting_loops - real_ms_per_loop / 100
     else
         send_receipt(post_position, cash_balance, electronical_balance)
         cash_balance = 0
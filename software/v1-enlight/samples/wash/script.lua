@@ -99,7 +99,8 @@ end
 loop = function()
     update_post()
     if balance < 0.1 and money_wait_seconds > 0 then
-        money_wait_seconds = money_wait_seconds - 1
+        -- counted in tenths of a second, a loop ends early on events
+        money_wait_seconds = money_wait_seconds - real_ms_per_loop / 100
     end
     if is_money_added and money_wait_seconds <= 0 and get_is_finishing_programm(last_program_id) then
         increment_cars()
@@ -213,7 +214,7 @@ connected_to_bonus_system_mode = function()
         if pressed_key > 0 and pressed_key < 7 then
             waiting_seconds = 0
         end
-        waiting_seconds = waiting_seconds - 1
+        waiting_seconds = waiting_seconds - real_ms_per_loop / 100
     else
         is_connected_to_bonus_system = false
         set_is_connected_to_bonus_system(false)
@@ -305,8 +306,7 @@ wait_for_card_mode = function()
         return mode_choose_method        
 	end
 
-    smart_delay(100)
-    waiting_loops = waiting_loops - 1
+    waiting_loops = waiting_loops - smart_delay(100) / 100
    
     return mode_wait_for_card
 end
@@ -442,7 +442,7 @@ thanks_mode = function()
             is_waiting_receipt = false
             return mode_work 
         end
-        waiting_loops = waiting_loops - 1
+        waiting_loops = waiting_loops - real_ms_per_loop / 100
     else
         send_receipt(post_position, cash_balance, electronical_balance)
         cash_balance = 0
@@ -474,6 +474,8 @@ show_ask_for_money = function()
         ask_for_money:Set("return_background.visible", "true")
     end
     ask_for_money:Display()
+    -- money brings the working screen
+    working:Prefetch()
 end
 
 show_choose_method = function()
@@ -76,7 +76,8 @@ loop = function()
     update_post()
 
     if balance < 0.1 and money_wait_seconds > 0 then
-        money_wait_seconds = money_wait_seconds - 1
+        -- counted in tenths of a second, a loop ends early on events
+        money_wait_seconds = money_wait_seconds - real_ms_per_loop / 100
     end
     if is_money_added and money_wait_seconds <= 0 and get_is_finishing_programm(last_program_id) then
         increment_cars()
@@ -236,8 +237,7 @@ wait_for_card_mode = function()
         return mode_choose_method        
 	end
 
-    smart_delay(100)
-    waiting_loops = waiting_loops - 1
+    waiting_loops = waiting_loops - smart_delay(100) / 100
    
     return mode_wait_for_card
 end
@@ -338,7 +338,7 @@ thanks_mode = function()
             is_waiting_receipt = false
             return mode_work 
         end
-        waiting_loops = waiting_loops - 1
+        waiting_loops = waiting_loops - real_ms_per_loop / 100
     else
         send_receipt(post_position, cash_balance, electronical_balance)
         cash_balance = 0